@@ -0,0 +1,448 @@
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "matrix.h"
+#include "check.h"
+#include "thread_pool.h"
+
+// Number of coefficients processed by one task, whatever the size of the matrices
+#define BATCH_CHUNK_SIZE 16384
+
+extern thread_pool_t thread_pool;
+
+// Kernels operate on one row-major contiguous matrix. They are written for a generic
+// size and always inlined, so that the size-specialised instances below get their
+// loops fully unrolled and vectorized by the compiler.
+
+static inline __attribute__((always_inline)) void _gemm_kernel(const TYPE *restrict a, const TYPE *restrict b, TYPE *restrict c, const size_t m, const size_t p, const size_t n)
+{
+    for (size_t i = 0; i < m; i++){
+        TYPE *restrict ci = c + i*n;
+        #pragma GCC ivdep
+        for (size_t j = 0; j < n; j++)
+            ci[j] = 0;
+        for (size_t k = 0; k < p; k++){
+            TYPE aik = a[i*p+k];
+            const TYPE *restrict bk = b + k*n;
+            #pragma GCC ivdep
+            for (size_t j = 0; j < n; j++)
+                ci[j] += aik * bk[j];
+        }
+    }
+}
+
+// In place PLU with partial pivoting, L has a unit diagonal. Return 0 if singular.
+static inline __attribute__((always_inline)) int _lu_kernel(TYPE *restrict a, int *restrict piv, const size_t n)
+{
+    int ret = 1;
+    for (size_t k = 0; k < n; k++){
+        size_t p = k;
+        TYPE max = fabs(a[k*n+k]);
+        for (size_t i = k+1; i < n; i++){
+            if(fabs(a[i*n+k]) > max){
+                max = fabs(a[i*n+k]);
+                p = i;
+            }
+        }
+        piv[k] = p;
+        if(p != k){
+            #pragma GCC ivdep
+            for (size_t j = 0; j < n; j++){
+                TYPE tmp = a[k*n+j];
+                a[k*n+j] = a[p*n+j];
+                a[p*n+j] = tmp;
+            }
+        }
+        if(a[k*n+k] == 0){
+            ret = 0;
+            continue;
+        }
+        TYPE inv = 1 / a[k*n+k];
+        for (size_t i = k+1; i < n; i++){
+            TYPE lik = a[i*n+k] *= inv;
+            #pragma GCC ivdep
+            for (size_t j = k+1; j < n; j++)
+                a[i*n+j] -= lik * a[k*n+j];
+        }
+    }
+    return ret;
+}
+
+// Solve A X = B in place in b (n*m) from the factors of _lu_kernel
+static inline __attribute__((always_inline)) void _lu_solve_kernel(const TYPE *restrict lu, const int *restrict piv, TYPE *restrict b, const size_t n, const size_t m)
+{
+    for (size_t k = 0; k < n; k++){
+        size_t p = piv[k];
+        if(p != k){
+            #pragma GCC ivdep
+            for (size_t j = 0; j < m; j++){
+                TYPE tmp = b[k*m+j];
+                b[k*m+j] = b[p*m+j];
+                b[p*m+j] = tmp;
+            }
+        }
+    }
+    for (size_t i = 1; i < n; i++){
+        for (size_t k = 0; k < i; k++){
+            TYPE lik = lu[i*n+k];
+            #pragma GCC ivdep
+            for (size_t j = 0; j < m; j++)
+                b[i*m+j] -= lik * b[k*m+j];
+        }
+    }
+    for (size_t i = n; i-- > 0;){
+        for (size_t k = i+1; k < n; k++){
+            TYPE uik = lu[i*n+k];
+            #pragma GCC ivdep
+            for (size_t j = 0; j < m; j++)
+                b[i*m+j] -= uik * b[k*m+j];
+        }
+        TYPE inv = 1 / lu[i*n+i];
+        #pragma GCC ivdep
+        for (size_t j = 0; j < m; j++)
+            b[i*m+j] *= inv;
+    }
+}
+
+// In place lower Cholesky factor, upper part is zeroed. Return 0 if not positive definite.
+static inline __attribute__((always_inline)) int _cholesky_kernel(TYPE *restrict a, const size_t n)
+{
+    for (size_t j = 0; j < n; j++){
+        TYPE d = a[j*n+j];
+        for (size_t k = 0; k < j; k++)
+            d -= a[j*n+k] * a[j*n+k];
+        if(d <= 0)return 0;
+        d = sqrt(d);
+        a[j*n+j] = d;
+        for (size_t i = j+1; i < n; i++){
+            TYPE sum = a[i*n+j];
+            for (size_t k = 0; k < j; k++)
+                sum -= a[i*n+k] * a[j*n+k];
+            a[i*n+j] = sum / d;
+        }
+        for (size_t k = j+1; k < n; k++)
+            a[j*n+k] = 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    size_t n;
+    void (*gemm)(const TYPE *, const TYPE *, TYPE *, size_t, size_t, size_t);
+    int (*lu)(TYPE *, int *, size_t);
+    void (*lu_solve)(const TYPE *, const int *, TYPE *, size_t, size_t);
+    int (*cholesky)(TYPE *, size_t);
+} batch_kernels_t;
+
+#define BATCH_KERNELS(N)                                                                                \
+static void _gemm_##N(const TYPE *a, const TYPE *b, TYPE *c, size_t m, size_t p, size_t n)               \
+{                                                                                                       \
+    (void)m; (void)p; (void)n;                                                                          \
+    _gemm_kernel(a, b, c, N, N, N);                                                                     \
+}                                                                                                       \
+static int _lu_##N(TYPE *a, int *piv, size_t n)                                                         \
+{                                                                                                       \
+    (void)n;                                                                                            \
+    return _lu_kernel(a, piv, N);                                                                       \
+}                                                                                                       \
+static void _lu_solve_##N(const TYPE *lu, const int *piv, TYPE *b, size_t n, size_t m)                  \
+{                                                                                                       \
+    (void)n;                                                                                            \
+    if(m == 1)_lu_solve_kernel(lu, piv, b, N, 1);                                                       \
+    else if(m == N)_lu_solve_kernel(lu, piv, b, N, N);                                                  \
+    else _lu_solve_kernel(lu, piv, b, N, m);                                                            \
+}                                                                                                       \
+static int _cholesky_##N(TYPE *a, size_t n)                                                             \
+{                                                                                                       \
+    (void)n;                                                                                            \
+    return _cholesky_kernel(a, N);                                                                      \
+}
+
+BATCH_KERNELS(2)
+BATCH_KERNELS(3)
+BATCH_KERNELS(4)
+BATCH_KERNELS(8)
+BATCH_KERNELS(16)
+BATCH_KERNELS(32)
+
+static void _gemm_generic(const TYPE *a, const TYPE *b, TYPE *c, size_t m, size_t p, size_t n)
+{
+    _gemm_kernel(a, b, c, m, p, n);
+}
+
+static int _lu_generic(TYPE *a, int *piv, size_t n)
+{
+    return _lu_kernel(a, piv, n);
+}
+
+static void _lu_solve_generic(const TYPE *lu, const int *piv, TYPE *b, size_t n, size_t m)
+{
+    _lu_solve_kernel(lu, piv, b, n, m);
+}
+
+static int _cholesky_generic(TYPE *a, size_t n)
+{
+    return _cholesky_kernel(a, n);
+}
+
+#define BATCH_KERNELS_ENTRY(N) {N, _gemm_##N, _lu_##N, _lu_solve_##N, _cholesky_##N}
+static const batch_kernels_t batch_kernels[] = {
+    BATCH_KERNELS_ENTRY(2),
+    BATCH_KERNELS_ENTRY(3),
+    BATCH_KERNELS_ENTRY(4),
+    BATCH_KERNELS_ENTRY(8),
+    BATCH_KERNELS_ENTRY(16),
+    BATCH_KERNELS_ENTRY(32),
+};
+static const batch_kernels_t batch_kernels_generic = {0, _gemm_generic, _lu_generic, _lu_solve_generic, _cholesky_generic};
+
+static const batch_kernels_t * _kernels_select(size_t n)
+{
+    for (size_t i = 0; i < sizeof(batch_kernels)/sizeof(batch_kernels[0]); i++)
+        if(batch_kernels[i].n == n)
+            return &batch_kernels[i];
+    return &batch_kernels_generic;
+}
+
+// Batch creation functions
+
+matrix_batch_t * matrix_batch_create(size_t count, size_t rows, size_t columns)
+{
+    matrix_batch_t *batch = malloc(sizeof(matrix_batch_t));
+    if(!batch)
+        goto failed_batch;
+    batch->count = count;
+    batch->rows = rows;
+    batch->columns = columns;
+    // Each matrix starts on an ALIGN boundary
+    size_t per_align = ALIGN / sizeof(TYPE);
+    batch->stride = (rows*columns + per_align - 1) / per_align * per_align;
+    size_t size = (count > 0 ? count*batch->stride : per_align) * sizeof(TYPE);
+    batch->data = aligned_alloc(ALIGN, size);
+    if(!batch->data)
+        goto failed_data;
+    memset(batch->data, 0, size);
+    return batch;
+failed_data:
+    free(batch);
+failed_batch:
+    perror(__func__);
+    return NULL;
+}
+
+void matrix_batch_free(matrix_batch_t *batch)
+{
+    if(!sanity_check(batch, __func__))return;
+    free(batch->data);
+    free(batch);
+}
+
+TYPE * matrix_batch_get(const matrix_batch_t *batch, size_t i)
+{
+    if(!sanity_check((void *)batch, __func__))return NULL;
+    if(i >= batch->count){
+        fprintf(stderr, "%s: index %zu out of batch of %zu matrices\n", __func__, i, batch->count);
+        return NULL;
+    }
+    return batch->data + i*batch->stride;
+}
+
+// Batch computation functions
+
+enum batch_op {
+    BATCH_MULT,
+    BATCH_LU,
+    BATCH_CHOLESKY,
+    BATCH_SOLVE,
+    BATCH_INVERSE,
+    BATCH_DET
+};
+
+typedef struct {
+    int op;
+    size_t chunk;
+    const batch_kernels_t *kernels;
+    const matrix_batch_t *A;
+    const matrix_batch_t *B;
+    matrix_batch_t *C;
+    int *piv;
+    TYPE *det;
+    size_t *failures;
+} batch_arg_t;
+
+static void _batch_task(void *args, int index)
+{
+    batch_arg_t *arg = args;
+    const matrix_batch_t *A = arg->A;
+    const batch_kernels_t *kernels = arg->kernels;
+    size_t n = A->rows;
+    size_t start = index*arg->chunk;
+    size_t end = A->count < start+arg->chunk ? A->count : start+arg->chunk;
+    size_t failures = 0;
+    TYPE *lu = NULL;
+    int *piv = NULL;
+    if(arg->op == BATCH_SOLVE || arg->op == BATCH_INVERSE || arg->op == BATCH_DET){
+        // One workspace per task, shared by all the matrices of the chunk
+        lu = aligned_alloc(ALIGN, (n*n + 4-(n*n)%4) * sizeof(TYPE));
+        piv = malloc(n*sizeof(int));
+        if(!lu || !piv){
+            perror(__func__);
+            arg->failures[index] = end - start;
+            free(lu);
+            free(piv);
+            return;
+        }
+    }
+    for (size_t i = start; i < end; i++){
+        const TYPE *a = A->data + i*A->stride;
+        switch(arg->op){
+        case BATCH_MULT:
+            kernels->gemm(a, arg->B->data + i*arg->B->stride, arg->C->data + i*arg->C->stride, n, A->columns, arg->B->columns);
+            break;
+        case BATCH_LU:
+            failures += !kernels->lu((TYPE *)a, arg->piv + i*n, n);
+            break;
+        case BATCH_CHOLESKY:
+            failures += !kernels->cholesky((TYPE *)a, n);
+            break;
+        case BATCH_SOLVE:
+        case BATCH_INVERSE:{
+            TYPE *b = arg->C->data + i*arg->C->stride;
+            memcpy(lu, a, n*n*sizeof(TYPE));
+            if(arg->op == BATCH_INVERSE){
+                memset(b, 0, n*n*sizeof(TYPE));
+                for (size_t k = 0; k < n; k++)
+                    b[k*n+k] = 1;
+            }
+            if(!kernels->lu(lu, piv, n)){
+                failures++;
+                for (size_t k = 0; k < n*arg->C->columns; k++)
+                    b[k] = NAN;
+                break;
+            }
+            kernels->lu_solve(lu, piv, b, n, arg->C->columns);
+            break;
+        }
+        case BATCH_DET:{
+            memcpy(lu, a, n*n*sizeof(TYPE));
+            kernels->lu(lu, piv, n);
+            TYPE det = 1;
+            for (size_t k = 0; k < n; k++)
+                det *= piv[k] != (int)k ? -lu[k*n+k] : lu[k*n+k];
+            arg->det[i] = det;
+            break;
+        }
+        }
+    }
+    arg->failures[index] = failures;
+    free(lu);
+    free(piv);
+}
+
+static int _batch_run(batch_arg_t *arg, const char *function_name)
+{
+    const matrix_batch_t *A = arg->A;
+    size_t size = A->rows*A->columns > 0 ? A->rows*A->columns : 1;
+    arg->chunk = BATCH_CHUNK_SIZE / size > 0 ? BATCH_CHUNK_SIZE / size : 1;
+    if(arg->op == BATCH_MULT && (A->columns != A->rows || arg->B->columns != A->rows))
+        arg->kernels = &batch_kernels_generic;
+    else
+        arg->kernels = _kernels_select(A->rows);
+    size_t nb_chunks = (A->count + arg->chunk - 1) / arg->chunk;
+    if(!nb_chunks)return 1;
+    arg->failures = calloc(nb_chunks, sizeof(size_t));
+    if(!arg->failures){
+        perror(function_name);
+        return 0;
+    }
+    if(nb_chunks == 1){
+        _batch_task(arg, 0);
+    } else {
+        thread_pool_work_t work = {0, NULL, _batch_task, (void *)arg};
+        for (size_t i = 0; i < nb_chunks; i++)
+            thread_pool_queue_work(&thread_pool, &work, i);
+        if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+            printf("\x1b[31mproblem\x1b[0m\n");
+        }
+    }
+    size_t failures = 0;
+    for (size_t i = 0; i < nb_chunks; i++)
+        failures += arg->failures[i];
+    free(arg->failures);
+    if(failures){
+        fprintf(stderr, "%s: %zu singular matri%s in batch\n", function_name, failures, failures > 1 ? "ces":"x");
+        return 0;
+    }
+    return 1;
+}
+
+static int _batch_square_check(const matrix_batch_t *batch, const char *function_name)
+{
+    if(!sanity_check((void *)batch, function_name))return 0;
+    if(batch->rows != batch->columns){
+        fprintf(stderr, "%s: not square matrix\n", function_name);
+        return 0;
+    }
+    return 1;
+}
+
+int matrix_batch_mult(const matrix_batch_t *A, const matrix_batch_t *B, matrix_batch_t *C)
+{
+    if(!sanity_check((void *)A, __func__))return 0;
+    if(!sanity_check((void *)B, __func__))return 0;
+    if(!sanity_check((void *)C, __func__))return 0;
+    if(A->columns != B->rows || C->rows != A->rows || C->columns != B->columns || A->count != B->count || A->count != C->count){
+        fprintf(stderr, "%s: not multiplicable batches\n", __func__);
+        return 0;
+    }
+    batch_arg_t arg = {BATCH_MULT, 0, NULL, A, B, C, NULL, NULL, NULL};
+    return _batch_run(&arg, __func__);
+}
+
+int matrix_batch_lu(matrix_batch_t *A, int *piv)
+{
+    if(!_batch_square_check(A, __func__))return 0;
+    if(!sanity_check((void *)piv, __func__))return 0;
+    batch_arg_t arg = {BATCH_LU, 0, NULL, A, NULL, NULL, piv, NULL, NULL};
+    return _batch_run(&arg, __func__);
+}
+
+int matrix_batch_cholesky(matrix_batch_t *A)
+{
+    if(!_batch_square_check(A, __func__))return 0;
+    batch_arg_t arg = {BATCH_CHOLESKY, 0, NULL, A, NULL, NULL, NULL, NULL, NULL};
+    return _batch_run(&arg, __func__);
+}
+
+int matrix_batch_solve(const matrix_batch_t *A, matrix_batch_t *B)
+{
+    if(!_batch_square_check(A, __func__))return 0;
+    if(!sanity_check((void *)B, __func__))return 0;
+    if(B->rows != A->rows || B->count != A->count){
+        fprintf(stderr, "%s: not solvable batches\n", __func__);
+        return 0;
+    }
+    batch_arg_t arg = {BATCH_SOLVE, 0, NULL, A, NULL, B, NULL, NULL, NULL};
+    return _batch_run(&arg, __func__);
+}
+
+int matrix_batch_inverse(const matrix_batch_t *A, matrix_batch_t *inv)
+{
+    if(!_batch_square_check(A, __func__))return 0;
+    if(!_batch_square_check(inv, __func__))return 0;
+    if(inv->rows != A->rows || inv->count != A->count){
+        fprintf(stderr, "%s: batches size mismatch\n", __func__);
+        return 0;
+    }
+    batch_arg_t arg = {BATCH_INVERSE, 0, NULL, A, NULL, inv, NULL, NULL, NULL};
+    return _batch_run(&arg, __func__);
+}
+
+int matrix_batch_det(const matrix_batch_t *A, TYPE *det)
+{
+    if(!_batch_square_check(A, __func__))return 0;
+    if(!sanity_check((void *)det, __func__))return 0;
+    batch_arg_t arg = {BATCH_DET, 0, NULL, A, NULL, NULL, NULL, det, NULL};
+    return _batch_run(&arg, __func__);
+}
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "matrix.h"
+#include "check.h"
+#include "blas.h"
+#include "kernels.h"
+#include "thread_pool.h"
+
+// Vectors shorter than 2 chunks are processed by the calling thread only
+#define BLAS_CHUNK 8192
+// Rows handled by one gemv task, columns handled by one gevm task, and minimal matrix size to go parallel
+#define GEMV_ROWS 64
+#define GEVM_COLUMNS 1024
+#define GEMV_PARALLEL_SIZE (1 << 16)
+
+extern thread_pool_t thread_pool;
+
+typedef struct {
+    size_t n;
+    TYPE alpha, beta;
+    const TYPE *x;
+    TYPE *y;
+    TYPE *partial;
+} vector_arg_t;
+
+typedef void (*chunk_task_t)(void *, int);
+
+static inline size_t _nb_chunks(size_t n)
+{
+    return (n + BLAS_CHUNK - 1) / BLAS_CHUNK;
+}
+
+typedef void (*range_task_t)(void *, size_t, size_t);
+
+// Chunks of BLAS_CHUNK elements, the calling thread takes its share of them
+static void _run_chunks(size_t n, range_task_t task, void *arg)
+{
+    if(_nb_chunks(n) < 2){
+        if(n)task(arg, 0, n);
+        return;
+    }
+    if(thread_pool_parallel_for(&thread_pool, 0, n, BLAS_CHUNK, task, arg) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+}
+
+TYPE * blas_vector_create(size_t n)
+{
+    size_t size = (n + 4-n%4) * sizeof(TYPE);
+    TYPE *x = aligned_alloc(ALIGN, size);
+    if(!x){
+        perror(__func__);
+        return NULL;
+    }
+    memset(x, 0, size);
+    return x;
+}
+
+void blas_vector_free(TYPE *x)
+{
+    free(x);
+}
+
+static void _copy_task(void *args, size_t start, size_t end)
+{
+    vector_arg_t *arg = args;
+    memcpy(arg->y + start, arg->x + start, (end - start)*sizeof(TYPE));
+}
+
+void blas_copy(size_t n, const TYPE *x, TYPE *y)
+{
+    vector_arg_t arg = {n, 0, 0, x, y, NULL};
+    _run_chunks(n, _copy_task, &arg);
+}
+
+static void _scal_task(void *args, size_t start, size_t end)
+{
+    vector_arg_t *arg = args;
+    kernels->scal(end - start, arg->alpha, arg->y + start, arg->y + start);
+}
+
+void blas_scal(size_t n, TYPE alpha, TYPE *x)
+{
+    vector_arg_t arg = {n, alpha, 0, NULL, x, NULL};
+    _run_chunks(n, _scal_task, &arg);
+}
+
+static void _axpy_task(void *args, size_t start, size_t end)
+{
+    vector_arg_t *arg = args;
+    kernels->axpy(end - start, arg->alpha, arg->x + start, arg->y + start);
+}
+
+void blas_axpy(size_t n, TYPE alpha, const TYPE *x, TYPE *y)
+{
+    vector_arg_t arg = {n, alpha, 0, x, y, NULL};
+    _run_chunks(n, _axpy_task, &arg);
+}
+
+static void _axpby_task(void *args, size_t start, size_t end)
+{
+    vector_arg_t *arg = args;
+    kernels->axpby(end - start, arg->alpha, arg->x + start, arg->beta, arg->y + start);
+}
+
+void blas_axpby(size_t n, TYPE alpha, const TYPE *x, TYPE beta, TYPE *y)
+{
+    vector_arg_t arg = {n, alpha, beta, x, y, NULL};
+    _run_chunks(n, _axpby_task, &arg);
+}
+
+static void _dot_task(void *args, size_t start, size_t end)
+{
+    vector_arg_t *arg = args;
+    arg->partial[start/BLAS_CHUNK] = kernels->dot(end - start, arg->x + start, arg->y + start);
+}
+
+TYPE blas_dot(size_t n, const TYPE *x, const TYPE *y)
+{
+    if(!n)return 0;
+    size_t nb_chunks = _nb_chunks(n);
+    TYPE *partial = malloc(nb_chunks*sizeof(TYPE));
+    if(!partial){
+        perror(__func__);
+        return NAN;
+    }
+    vector_arg_t arg = {n, 0, 0, x, (TYPE *)y, partial};
+    _run_chunks(n, _dot_task, &arg);
+    // Partial sums are reduced in chunk order so that the result does not depend on scheduling
+    TYPE sum = 0;
+    for (size_t i = 0; i < nb_chunks; i++)
+        sum += partial[i];
+    free(partial);
+    return sum;
+}
+
+TYPE blas_nrm2(size_t n, const TYPE *x)
+{
+    return sqrt(blas_dot(n, x, x));
+}
+
+typedef struct {
+    TYPE alpha, beta;
+    const matrix_t *A;
+    const TYPE *x;
+    TYPE *y;
+} gemv_arg_t;
+
+static void _gemv_task(void *args, int i)
+{
+    gemv_arg_t *arg = args;
+    const matrix_t *A = arg->A;
+    size_t m = A->columns;
+    size_t start = i*GEMV_ROWS;
+    size_t end = A->rows < start+GEMV_ROWS ? A->rows : start+GEMV_ROWS;
+    const TYPE *x = arg->x;
+    TYPE alpha = arg->alpha, beta = arg->beta;
+    TYPE *y = arg->y;
+    size_t ii = start;
+    // 4 rows at a time so that each load of x feeds 4 multiply-adds
+    for (; ii + 4 <= end; ii += 4){
+        const TYPE *r0 = __builtin_assume_aligned(A->coeff[ii], ALIGN);
+        const TYPE *r1 = __builtin_assume_aligned(A->coeff[ii+1], ALIGN);
+        const TYPE *r2 = __builtin_assume_aligned(A->coeff[ii+2], ALIGN);
+        const TYPE *r3 = __builtin_assume_aligned(A->coeff[ii+3], ALIGN);
+        TYPE s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        for (size_t k = 0; k < m; k++){
+            TYPE xk = x[k];
+            s0 += r0[k] * xk;
+            s1 += r1[k] * xk;
+            s2 += r2[k] * xk;
+            s3 += r3[k] * xk;
+        }
+        y[ii]   = alpha * s0 + (beta != 0 ? beta * y[ii]   : 0);
+        y[ii+1] = alpha * s1 + (beta != 0 ? beta * y[ii+1] : 0);
+        y[ii+2] = alpha * s2 + (beta != 0 ? beta * y[ii+2] : 0);
+        y[ii+3] = alpha * s3 + (beta != 0 ? beta * y[ii+3] : 0);
+    }
+    for (; ii < end; ii++){
+        const TYPE *row = __builtin_assume_aligned(A->coeff[ii], ALIGN);
+        TYPE sum = 0;
+        for (size_t k = 0; k < m; k++)
+            sum += row[k] * x[k];
+        y[ii] = alpha * sum + (beta != 0 ? beta * y[ii] : 0);
+    }
+}
+
+void blas_gemv(TYPE alpha, const matrix_t *A, const TYPE *x, TYPE beta, TYPE *y)
+{
+    if(!sanity_check((void *)A, __func__))return;
+    gemv_arg_t arg = {alpha, beta, A, x, y};
+    size_t nb_blocks = (A->rows + GEMV_ROWS - 1) / GEMV_ROWS;
+    if(nb_blocks < 2 || A->rows * A->columns < GEMV_PARALLEL_SIZE){
+        for (size_t i = 0; i < nb_blocks; i++)
+            _gemv_task(&arg, i);
+        return;
+    }
+    thread_pool_work_t work = {0, NULL, _gemv_task, (void *)&arg};
+    for (size_t i = 0; i < nb_blocks; i++)
+        thread_pool_queue_work(&thread_pool, &work, i);
+    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+}
+
+typedef struct {
+    TYPE alpha, beta;
+    const matrix_t *A;
+    const TYPE *x;
+    TYPE *y;
+    size_t row_chunk;
+    TYPE **partial;
+} gevm_arg_t;
+
+// Accumulates x[rows] * A[rows][columns] in y[columns], one row at a time so that A is streamed
+static inline void _gevm_kernel(const matrix_t *A, const TYPE *x, TYPE *y, size_t row_start, size_t row_end, size_t col_start, size_t col_end)
+{
+    for (size_t i = row_start; i < row_end; i++){
+        const TYPE *row = A->coeff[i];
+        TYPE xi = x[i];
+        if(xi == 0)continue;
+        #pragma GCC ivdep
+        for (size_t j = col_start; j < col_end; j++)
+            y[j] += xi * row[j];
+    }
+}
+
+static void _gevm_columns_task(void *args, int i)
+{
+    gevm_arg_t *arg = args;
+    size_t start = i*GEVM_COLUMNS;
+    size_t end = arg->A->columns < start+GEVM_COLUMNS ? arg->A->columns : start+GEVM_COLUMNS;
+    TYPE *y = arg->y;
+    TYPE *acc = arg->partial[i];
+    memset(acc + start, 0, (end - start)*sizeof(TYPE));
+    _gevm_kernel(arg->A, arg->x, acc, 0, arg->A->rows, start, end);
+    #pragma GCC ivdep
+    for (size_t j = start; j < end; j++)
+        y[j] = arg->alpha * acc[j] + (arg->beta != 0 ? arg->beta * y[j] : 0);
+}
+
+static void _gevm_rows_task(void *args, int i)
+{
+    gevm_arg_t *arg = args;
+    size_t start = i*arg->row_chunk;
+    size_t end = arg->A->rows < start+arg->row_chunk ? arg->A->rows : start+arg->row_chunk;
+    memset(arg->partial[i], 0, arg->A->columns*sizeof(TYPE));
+    _gevm_kernel(arg->A, arg->x, arg->partial[i], start, end, 0, arg->A->columns);
+}
+
+int blas_gevm(TYPE alpha, const TYPE *x, const matrix_t *A, TYPE beta, TYPE *y)
+{
+    if(!sanity_check((void *)A, __func__))return 0;
+    size_t n = A->rows, m = A->columns;
+    size_t nb_col_blocks = (m + GEVM_COLUMNS - 1) / GEVM_COLUMNS;
+    size_t nb_tasks;
+    chunk_task_t task;
+    gevm_arg_t arg = {alpha, beta, A, x, y, 0, NULL};
+    TYPE *acc = blas_vector_create(m);
+    if(!acc){
+        perror(__func__);
+        return 0;
+    }
+    if(n * m < GEMV_PARALLEL_SIZE || (nb_col_blocks < 2 && n < 2*GEMV_ROWS)){
+        _gevm_kernel(A, x, acc, 0, n, 0, m);
+        for (size_t j = 0; j < m; j++)
+            y[j] = alpha * acc[j] + (beta != 0 ? beta * y[j] : 0);
+        blas_vector_free(acc);
+        return 1;
+    }
+    if(nb_col_blocks >= 2){
+        // Column blocks write disjoint parts of a single accumulator
+        nb_tasks = nb_col_blocks;
+        task = _gevm_columns_task;
+        arg.partial = malloc(nb_tasks*sizeof(TYPE *));
+        if(!arg.partial)goto failed;
+        for (size_t i = 0; i < nb_tasks; i++)
+            arg.partial[i] = acc;
+    } else {
+        // Few columns: row blocks accumulate in private vectors, reduced in block order
+        nb_tasks = (n + GEMV_ROWS - 1) / GEMV_ROWS;
+        arg.row_chunk = GEMV_ROWS;
+        task = _gevm_rows_task;
+        arg.partial = calloc(nb_tasks, sizeof(TYPE *));
+        if(!arg.partial)goto failed;
+        for (size_t i = 0; i < nb_tasks; i++){
+            arg.partial[i] = blas_vector_create(m);
+            if(!arg.partial[i])goto failed_partial;
+        }
+    }
+    thread_pool_work_t work = {0, NULL, task, (void *)&arg};
+    for (size_t i = 0; i < nb_tasks; i++)
+        thread_pool_queue_work(&thread_pool, &work, i);
+    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+    if(task == _gevm_rows_task){
+        for (size_t i = 0; i < nb_tasks; i++)
+            for (size_t j = 0; j < m; j++)
+                acc[j] += arg.partial[i][j];
+        for (size_t j = 0; j < m; j++)
+            y[j] = alpha * acc[j] + (beta != 0 ? beta * y[j] : 0);
+    }
+    if(task == _gevm_rows_task)
+        for (size_t i = 0; i < nb_tasks; i++)
+            blas_vector_free(arg.partial[i]);
+    free(arg.partial);
+    blas_vector_free(acc);
+    return 1;
+failed_partial:
+    for (size_t i = 0; i < nb_tasks; i++)
+        blas_vector_free(arg.partial[i]);
+    free(arg.partial);
+failed:
+    perror(__func__);
+    blas_vector_free(acc);
+    return 0;
+}
+
+void blas_gemm_kernel(size_t m, size_t k, size_t n, const TYPE *A, size_t lda, const TYPE *B, size_t ldb, TYPE *C, size_t ldc)
+{
+    kernels->gemm(m, k, n, A, lda, B, ldb, C, ldc);
+}
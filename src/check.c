@@ -22,6 +22,7 @@ int square_check(const matrix_t *matrix, const char *function_name)
 
 int symetry_check(const matrix_t *matrix, const char *function_name)
 {
+    if(matrix->flags & MATRIX_SYMETRIC)return 1;
     for (size_t i = 0; i < matrix->rows; i++) {
         for (size_t j = 0; j < i; j++) {
             if(matrix->coeff[i][j] != matrix->coeff[j][i]){
@@ -0,0 +1,187 @@
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "matrix.h"
+#include "check.h"
+#include "factor.h"
+#include "blas.h"
+
+// Maximal number of A^-1 and A^-T products of the 1-norm estimator
+#define RCOND_ITERATIONS 5
+
+typedef struct {
+    const matrix_t *F;
+    const size_t *piv;                                                  // NULL for a Cholesky factor
+} factors_t;
+
+static void _factors_solve(const factors_t *f, TYPE *x, int trans)
+{
+    if(f->piv)
+        factor_lu_solve_vector(f->F, f->piv, x, trans);
+    else
+        factor_cholesky_solve_vector(f->F, x);
+}
+
+static TYPE _norm1(const matrix_t *A)
+{
+    TYPE *sums = blas_vector_create(A->columns);
+    TYPE norm = 0;
+    if(!sums)return NAN;
+    for (size_t i = 0; i < A->rows; i++){
+        #pragma GCC ivdep
+        for (size_t j = 0; j < A->columns; j++)
+            sums[j] += fabs(A->coeff[i][j]);
+    }
+    for (size_t j = 0; j < A->columns; j++)
+        norm = fmax(norm, sums[j]);
+    blas_vector_free(sums);
+    return norm;
+}
+
+static TYPE _vector_norm1(size_t n, const TYPE *x)
+{
+    TYPE norm = 0;
+    for (size_t i = 0; i < n; i++)
+        norm += fabs(x[i]);
+    return norm;
+}
+
+// Hager's estimate of ||A^-1||1 with Higham's refinements (LAPACK xLACN2): a few solves with A and AT
+// climbing towards the column of A^-1 with the largest 1-norm, then an alternating sign vector
+// guarding against the cases where that climb stalls.
+static TYPE _inverse_norm1(const factors_t *f, size_t n)
+{
+    TYPE *x = blas_vector_create(n), *y = blas_vector_create(n);
+    TYPE est = 0;
+    if(!x || !y)goto end;
+    for (size_t i = 0; i < n; i++)
+        x[i] = 1.0 / n;
+    size_t last = n;
+    for (int iter = 0; iter < RCOND_ITERATIONS; iter++){
+        _factors_solve(f, x, 0);
+        TYPE norm = _vector_norm1(n, x);
+        if(iter > 0 && norm <= est)break;
+        est = norm;
+        for (size_t i = 0; i < n; i++)
+            y[i] = x[i] >= 0 ? 1 : -1;
+        _factors_solve(f, y, 1);
+        size_t j = 0;
+        for (size_t i = 1; i < n; i++)
+            if(fabs(y[i]) > fabs(y[j]))j = i;
+        if(j == last)break;
+        last = j;
+        memset(x, 0, n*sizeof(TYPE));
+        x[j] = 1;
+    }
+    for (size_t i = 0; i < n; i++)
+        x[i] = (i % 2 ? -1 : 1) * (1 + (TYPE)i / (n > 1 ? n-1 : 1));
+    _factors_solve(f, x, 0);
+    est = fmax(est, 2 * _vector_norm1(n, x) / (3 * n));
+end:
+    if(x)blas_vector_free(x);
+    if(y)blas_vector_free(y);
+    return est;
+}
+
+static TYPE _rcond(const factors_t *f, TYPE normA)
+{
+    size_t n = f->F->rows;
+    if(n == 0)return 1;
+    TYPE inv_norm = _inverse_norm1(f, n);
+    return normA > 0 && inv_norm > 0 ? 1 / (normA * inv_norm) : 0;
+}
+
+// R = B - A*X, then backward error max_j ||r_j||1 / (||A||1 ||x_j||1 + ||b_j||1) (Rigal and Gaches)
+static void _residual(const matrix_t *A, const matrix_t *B, const matrix_t *X, TYPE normA, solve_info_t *info)
+{
+    size_t n = A->rows, m = B->columns;
+    TYPE *r = blas_vector_create(m), *x = blas_vector_create(m), *b = blas_vector_create(m), *ri = blas_vector_create(m);
+    info->residual = info->backward_error = 0;
+    if(!r || !x || !b || !ri)goto end;
+    for (size_t i = 0; i < n; i++){
+        memcpy(ri, B->coeff[i], m*sizeof(TYPE));
+        for (size_t k = 0; k < n; k++){
+            TYPE a = A->coeff[i][k];
+            const TYPE *xk = X->coeff[k];
+            #pragma GCC ivdep
+            for (size_t c = 0; c < m; c++)
+                ri[c] -= a * xk[c];
+        }
+        #pragma GCC ivdep
+        for (size_t c = 0; c < m; c++){
+            r[c] += fabs(ri[c]);
+            x[c] += fabs(X->coeff[i][c]);
+            b[c] += fabs(B->coeff[i][c]);
+        }
+    }
+    for (size_t c = 0; c < m; c++){
+        info->residual = fmax(info->residual, r[c]);
+        TYPE scale = normA * x[c] + b[c];
+        info->backward_error = fmax(info->backward_error, scale > 0 ? r[c] / scale : 0);
+    }
+end:
+    if(r)blas_vector_free(r);
+    if(x)blas_vector_free(x);
+    if(b)blas_vector_free(b);
+    if(ri)blas_vector_free(ri);
+}
+
+static matrix_t * _solve_x(const matrix_t *A, const matrix_t *B, solve_info_t *info, int cholesky, const char *function_name)
+{
+    if(!sanity_check((void *)A, function_name))return NULL;
+    if(!square_check(A, function_name))return NULL;
+    if(B && B->rows != A->rows){
+        fprintf(stderr, "%s: not solvable system (B->rows != A->rows)\n", function_name);
+        return NULL;
+    }
+    if(cholesky && !symetry_check(A, function_name))return NULL;
+    size_t n = A->rows;
+    matrix_t *F = matrix_copy(A), *X = NULL;
+    size_t *piv = cholesky ? NULL : malloc((n+1)*sizeof(size_t));
+    if(!F || (!cholesky && !piv)){
+        perror(function_name);
+        goto end;
+    }
+    int sign, regular = cholesky ? factor_cholesky(F) : factor_lu(F, piv, &sign);
+    if(info)info->rcond = 0;
+    if(!regular){
+        fprintf(stderr, cholesky ? "%s: not positive definite matrix\n" : "%s: not inversible matrix\n", function_name);
+        goto end;
+    }
+    factors_t f = {F, piv};
+    TYPE normA = _norm1(A);
+    if(info)info->rcond = _rcond(&f, normA);
+    if(!B)goto end;
+    X = matrix_copy(B);
+    if(!X)goto end;
+    if(cholesky)
+        factor_cholesky_solve(F, X);
+    else
+        factor_lu_solve(F, piv, X);
+    if(info && info->compute_residual)
+        _residual(A, B, X, normA, info);
+end:
+    if(F)matrix_free(F);
+    free(piv);
+    return X;
+}
+
+matrix_t * matrix_solve_plu_x_f(const matrix_t *A, const matrix_t *B, solve_info_t *info)
+{
+    if(!sanity_check((void *)B, __func__))return NULL;
+    return _solve_x(A, B, info, 0, __func__);
+}
+
+matrix_t * matrix_solve_cholesky_x_f(const matrix_t *A, const matrix_t *B, solve_info_t *info)
+{
+    if(!sanity_check((void *)B, __func__))return NULL;
+    return _solve_x(A, B, info, 1, __func__);
+}
+
+TYPE matrix_rcond_f(const matrix_t *matrix)
+{
+    solve_info_t info = {0};
+    _solve_x(matrix, NULL, &info, 0, __func__);
+    return info.rcond;
+}
@@ -0,0 +1,596 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "matrix.h"
+#include "check.h"
+#include "factor.h"
+#include "kernels.h"
+#include "dist.h"
+#include "thread_pool.h"
+
+// Messages carry int counts: a local matrix, or a panel of it, holds less than 2^31 coefficients.
+#define DIST_BLOCK 64
+// MPI datatypes of TYPE and of the (TYPE, int) pairs of the pivot search: TYPE is a typedef, hence no #if
+_Static_assert(sizeof(TYPE) == sizeof(float) || sizeof(TYPE) == sizeof(double), "TYPE must be float or double");
+#define DIST_TYPE (sizeof(TYPE) == sizeof(float) ? MPI_FLOAT : MPI_DOUBLE)
+#define DIST_TYPE_INT (sizeof(TYPE) == sizeof(float) ? MPI_FLOAT_INT : MPI_DOUBLE_INT)
+// Rows of a local product per task
+#define DIST_ROWS 32
+
+extern thread_pool_t thread_pool;
+
+static inline size_t _extent(size_t total, size_t block, size_t i)
+{
+    return total - i*block < block ? total - i*block : block;
+}
+
+// Blocks of index below K dealt to process i of np
+static inline size_t _blocks_before(size_t K, int i, int np)
+{
+    return (K + np - 1 - i) / np;
+}
+
+// Rows (or columns) dealt to process i of np
+static size_t _local_size(size_t n, size_t block, int i, int np)
+{
+    size_t blocks = (n + block - 1) / block, size = _blocks_before(blocks, i, np) * block;
+    if(blocks && (int)((blocks - 1) % np) == i)size -= blocks*block - n;
+    return size;
+}
+
+// Global index of local row (or column) l of process i
+static inline size_t _global(size_t l, size_t block, int i, int np)
+{
+    return ((l / block) * np + i) * block + l % block;
+}
+
+// Local index of global row (or column) g, on the process owning it
+static inline size_t _local(size_t g, size_t block, int np)
+{
+    return (g / block / np) * block + g % block;
+}
+
+static inline TYPE * _data(const matrix_dist_t *A)
+{
+    return A->local->coeff[0];
+}
+
+// Same result on every rank of the grid from the ok of each of them
+static int _agree(const matrix_grid_t *grid, int ok)
+{
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, grid->comm);
+    return ok;
+}
+
+typedef struct {
+    size_t k, n, lda, ldb, ldc;
+    const TYPE *a, *b;
+    TYPE *c;
+} gemm_arg_t;
+
+static void _gemm_task(void *args, size_t start, size_t end)
+{
+    gemm_arg_t *arg = args;
+    kernels->gemm(end - start, arg->k, arg->n, arg->a + start*arg->lda, arg->lda, arg->b, arg->ldb, arg->c + start*arg->ldc, arg->ldc);
+}
+
+// C += A * B on the rows of the pool
+static void _gemm(size_t m, size_t k, size_t n, const TYPE *a, size_t lda, const TYPE *b, size_t ldb, TYPE *c, size_t ldc)
+{
+    if(!m || !k || !n)return;
+    gemm_arg_t arg = {k, n, lda, ldb, ldc, a, b, c};
+    if(m <= DIST_ROWS){
+        _gemm_task(&arg, 0, m);
+        return;
+    }
+    if(thread_pool_parallel_for(&thread_pool, 0, m, DIST_ROWS, _gemm_task, &arg) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+}
+
+matrix_grid_t * matrix_grid_create(MPI_Comm comm, int p, int q)
+{
+    int size, rank;
+    MPI_Comm_size(comm, &size);
+    MPI_Comm_rank(comm, &rank);
+    if(!p && !q){
+        for (p = (int)sqrt(size); size % p; p--);
+        q = size / p;
+    }
+    if(p <= 0 || q <= 0 || p*q != size){
+        if(!rank)fprintf(stderr, "%s: %d*%d grid for %d ranks\n", __func__, p, q, size);
+        return NULL;
+    }
+    matrix_grid_t *grid = malloc(sizeof(matrix_grid_t));
+    if(!_agree(&(matrix_grid_t){.comm = comm}, grid != NULL)){
+        perror(__func__);
+        free(grid);
+        return NULL;
+    }
+    MPI_Comm_dup(comm, &grid->comm);
+    MPI_Comm_rank(grid->comm, &grid->rank);
+    grid->p = p;
+    grid->q = q;
+    grid->prow = grid->rank / q;
+    grid->pcol = grid->rank % q;
+    MPI_Comm_split(grid->comm, grid->prow, grid->pcol, &grid->row);
+    MPI_Comm_split(grid->comm, grid->pcol, grid->prow, &grid->column);
+    return grid;
+}
+
+void matrix_grid_free(matrix_grid_t *grid)
+{
+    if(!grid)return;
+    MPI_Comm_free(&grid->row);
+    MPI_Comm_free(&grid->column);
+    MPI_Comm_free(&grid->comm);
+    free(grid);
+}
+
+matrix_dist_t * matrix_dist_create(matrix_grid_t *grid, size_t rows, size_t columns, size_t block)
+{
+    if(!sanity_check((void *)grid, __func__))return NULL;
+    if(!block)block = DIST_BLOCK;
+    size_t m = _local_size(rows, block, grid->prow, grid->p), n = _local_size(columns, block, grid->pcol, grid->q);
+    matrix_dist_t *A = malloc(sizeof(matrix_dist_t));
+    matrix_t *local = malloc(sizeof(matrix_t));
+    TYPE **coeff = malloc((m ? m : 1) * sizeof(TYPE *));
+    TYPE *data = calloc(m && n ? m*n : 1, sizeof(TYPE));
+    if(!_agree(grid, A && local && coeff && data)){
+        perror(__func__);
+        free(A); free(local); free(coeff); free(data);
+        return NULL;
+    }
+    coeff[0] = data;
+    for (size_t i = 1; i < m; i++)
+        coeff[i] = data + i*n;
+    *local = (matrix_t){m, n, coeff, 0};
+    *A = (matrix_dist_t){grid, rows, columns, block, local};
+    return A;
+}
+
+void matrix_dist_free(matrix_dist_t *A)
+{
+    if(!A)return;
+    free(A->local->coeff[0]);
+    free(A->local->coeff);
+    free(A->local);
+    free(A);
+}
+
+// Copy between the local matrix of process (prow, pcol) and the coefficients of M it holds
+static void _pack(const matrix_dist_t *A, int prow, int pcol, TYPE *local, matrix_t *M, int to_local)
+{
+    const matrix_grid_t *grid = A->grid;
+    size_t m = _local_size(A->rows, A->block, prow, grid->p), n = _local_size(A->columns, A->block, pcol, grid->q);
+    for (size_t i = 0; i < m; i++){
+        TYPE *row = M->coeff[_global(i, A->block, prow, grid->p)];
+        // Local columns by runs of one block
+        for (size_t j = 0; j < n; j += A->block){
+            size_t width = n - j < A->block ? n - j : A->block;
+            TYPE *x = row + _global(j, A->block, pcol, grid->q);
+            memcpy(to_local ? local + i*n + j : x, to_local ? x : local + i*n + j, width * sizeof(TYPE));
+        }
+    }
+}
+
+// Coefficients of the largest local matrix of the grid
+static size_t _max_local(const matrix_dist_t *A)
+{
+    const matrix_grid_t *grid = A->grid;
+    return _local_size(A->rows, A->block, 0, grid->p) * _local_size(A->columns, A->block, 0, grid->q);
+}
+
+int matrix_dist_scatter(matrix_dist_t *A, const matrix_t *M, int root)
+{
+    if(!sanity_check((void *)A, __func__))return 0;
+    const matrix_grid_t *grid = A->grid;
+    int ok = 1;
+    TYPE *buffer = NULL;
+    if(grid->rank == root){
+        ok = M && M->rows == A->rows && M->columns == A->columns;
+        if(!ok)fprintf(stderr, "%s: no %zux%zu matrix on the root\n", __func__, A->rows, A->columns);
+        else if(!(buffer = malloc((_max_local(A) + 1) * sizeof(TYPE)))){
+            perror(__func__);
+            ok = 0;
+        }
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, root, grid->comm);
+    if(!ok)return 0;
+    if(grid->rank != root){
+        MPI_Recv(_data(A), A->local->rows * A->local->columns, DIST_TYPE, root, 0, grid->comm, MPI_STATUS_IGNORE);
+        return 1;
+    }
+    for (int r = 0; r < grid->p * grid->q; r++){
+        int prow = r / grid->q, pcol = r % grid->q;
+        size_t size = _local_size(A->rows, A->block, prow, grid->p) * _local_size(A->columns, A->block, pcol, grid->q);
+        if(r == root){
+            _pack(A, prow, pcol, _data(A), (matrix_t *)M, 1);
+            continue;
+        }
+        _pack(A, prow, pcol, buffer, (matrix_t *)M, 1);
+        MPI_Send(buffer, size, DIST_TYPE, r, 0, grid->comm);
+    }
+    free(buffer);
+    return 1;
+}
+
+matrix_t * matrix_dist_gather(const matrix_dist_t *A, int root)
+{
+    if(!sanity_check((void *)A, __func__))return NULL;
+    const matrix_grid_t *grid = A->grid;
+    matrix_t *M = NULL;
+    TYPE *buffer = NULL;
+    int ok = 1;
+    if(grid->rank == root){
+        M = matrix_create(A->rows, A->columns);
+        buffer = malloc((_max_local(A) + 1) * sizeof(TYPE));
+        ok = M && buffer;
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, root, grid->comm);
+    if(!ok){
+        if(M)matrix_free(M);
+        free(buffer);
+        return NULL;
+    }
+    if(grid->rank != root){
+        MPI_Send(_data(A), A->local->rows * A->local->columns, DIST_TYPE, root, 0, grid->comm);
+        return NULL;
+    }
+    for (int r = 0; r < grid->p * grid->q; r++){
+        int prow = r / grid->q, pcol = r % grid->q;
+        size_t size = _local_size(A->rows, A->block, prow, grid->p) * _local_size(A->columns, A->block, pcol, grid->q);
+        if(r == root){
+            _pack(A, prow, pcol, _data(A), M, 0);
+            continue;
+        }
+        MPI_Recv(buffer, size, DIST_TYPE, r, 0, grid->comm, MPI_STATUS_IGNORE);
+        _pack(A, prow, pcol, buffer, M, 0);
+    }
+    free(buffer);
+    return M;
+}
+
+static int _same_grid(const matrix_dist_t *A, const matrix_dist_t *B, const char *function_name)
+{
+    if(A->grid == B->grid && A->block == B->block)return 1;
+    if(!A->grid->rank)fprintf(stderr, "%s: matrices of different grids or blocks\n", function_name);
+    return 0;
+}
+
+// Panels of block k of SUMMA: the local rows of A in its block column k and the local columns of B in its block row k
+static void _summa_panels(const matrix_dist_t *A, const matrix_dist_t *B, size_t k, TYPE *a, TYPE *b, MPI_Request *requests)
+{
+    const matrix_grid_t *grid = A->grid;
+    size_t block = A->block, kb = _extent(A->columns, block, k), m = A->local->rows, n = B->local->columns;
+    int qk = k % grid->q, pk = k % grid->p;
+    if(grid->pcol == qk){
+        const TYPE *x = _data(A) + _local(k*block, block, grid->q);
+        for (size_t i = 0; i < m; i++)
+            memcpy(a + i*kb, x + i*A->local->columns, kb * sizeof(TYPE));
+    }
+    MPI_Ibcast(a, m*kb, DIST_TYPE, qk, grid->row, &requests[0]);
+    // The block row of B is contiguous: its owner sends it in place
+    if(grid->prow == pk)b = _data(B) + _local(k*block, block, grid->p) * n;
+    MPI_Ibcast(b, kb*n, DIST_TYPE, pk, grid->column, &requests[1]);
+}
+
+int matrix_dist_gemm(matrix_dist_t *C, const matrix_dist_t *A, const matrix_dist_t *B)
+{
+    if(!sanity_check((void *)A, __func__) || !sanity_check((void *)B, __func__) || !sanity_check((void *)C, __func__))return 0;
+    if(A->columns != B->rows || C->rows != A->rows || C->columns != B->columns){
+        if(!A->grid->rank)fprintf(stderr, "%s: not multipliable matrix\n", __func__);
+        return 0;
+    }
+    if(!_same_grid(A, B, __func__) || !_same_grid(A, C, __func__))return 0;
+    if(C == A || C == B){
+        if(!A->grid->rank)fprintf(stderr, "%s: C is an operand\n", __func__);
+        return 0;
+    }
+    const matrix_grid_t *grid = A->grid;
+    size_t block = A->block, K = (A->columns + block - 1) / block, m = C->local->rows, n = C->local->columns;
+    // Two panels of A and of B: the next ones are on their way during the product of the current ones
+    TYPE *a[2] = {malloc((m*block + 1) * sizeof(TYPE)), malloc((m*block + 1) * sizeof(TYPE))};
+    TYPE *b[2] = {malloc((block*n + 1) * sizeof(TYPE)), malloc((block*n + 1) * sizeof(TYPE))};
+    if(!_agree(grid, a[0] && a[1] && b[0] && b[1])){
+        perror(__func__);
+        free(a[0]); free(a[1]); free(b[0]); free(b[1]);
+        return 0;
+    }
+    memset(_data(C), 0, m*n * sizeof(TYPE));
+    MPI_Request requests[2][2];
+    if(K)_summa_panels(A, B, 0, a[0], b[0], requests[0]);
+    for (size_t k = 0; k < K; k++){
+        int s = k % 2, pk = k % grid->p;
+        MPI_Waitall(2, requests[s], MPI_STATUSES_IGNORE);
+        if(k+1 < K)_summa_panels(A, B, k+1, a[1-s], b[1-s], requests[1-s]);
+        const TYPE *bk = grid->prow == pk ? _data(B) + _local(k*block, block, grid->p) * n : b[s];
+        _gemm(m, _extent(A->columns, block, k), n, a[s], _extent(A->columns, block, k), bk, n, _data(C), n);
+    }
+    free(a[0]); free(a[1]); free(b[0]); free(b[1]);
+    return 1;
+}
+
+typedef struct {
+    size_t block, kb, first;                                            // first: global row of the panel row 0
+    const matrix_dist_t *A;
+    const TYPE *diagonal, *panel, *trans;
+    size_t lck;
+    size_t below;                                                       // Rows of the panel
+} dist_arg_t;
+
+// Local rows of block column k below the diagonal block: x = x * L_kk^-T
+static void _cholesky_trsm_task(void *args, size_t start, size_t end)
+{
+    dist_arg_t *arg = args;
+    size_t kb = arg->kb, n = arg->A->local->columns;
+    for (size_t r = start; r < end; r++){
+        TYPE *x = _data(arg->A) + r*n + arg->lck;
+        for (size_t c = 0; c < kb; c++)
+            x[c] = (x[c] - kernels->dot(c, x, arg->diagonal + c*kb)) / arg->diagonal[c*kb + c];
+    }
+}
+
+// Local block rows of the trailing lower triangle: A_IJ -= L_Ik * L_Jk^T, for k < J <= I
+static void _cholesky_update_task(void *args, size_t start, size_t end)
+{
+    dist_arg_t *arg = args;
+    const matrix_dist_t *A = arg->A;
+    const matrix_grid_t *grid = A->grid;
+    size_t block = arg->block, n = A->local->columns, first = arg->first;
+    for (size_t lb = start; lb < end; lb++){
+        size_t I = lb * grid->p + grid->prow, m = _extent(A->rows, block, I);
+        for (size_t lj = _blocks_before(first / block, grid->pcol, grid->q); lj * block < n; lj++){
+            size_t J = lj * grid->q + grid->pcol;
+            if(J > I)break;
+            _gemm_task(&(gemm_arg_t){arg->kb, _extent(A->columns, block, J), arg->kb, arg->below, n,
+                                     arg->panel + (I*block - first) * arg->kb, arg->trans + (J*block - first), _data(A) + lb*block*n + lj*block}, 0, m);
+        }
+    }
+}
+
+int matrix_dist_cholesky(matrix_dist_t *A)
+{
+    if(!sanity_check((void *)A, __func__))return 0;
+    if(A->rows != A->columns){
+        if(!A->grid->rank)fprintf(stderr, "%s: not square matrix\n", __func__);
+        return 0;
+    }
+    const matrix_grid_t *grid = A->grid;
+    size_t block = A->block, N = (A->rows + block - 1) / block, m = A->local->rows, n = A->local->columns;
+    TYPE *diagonal = malloc(block*block * sizeof(TYPE)), **rows = malloc(block * sizeof(TYPE *));
+    // The panel below the diagonal block is replicated on every rank, then negated and transposed
+    TYPE *panel = malloc((A->rows*block + 1) * sizeof(TYPE)), *trans = malloc((A->rows*block + 1) * sizeof(TYPE));
+    int ok = _agree(grid, diagonal && rows && panel && trans);
+    if(!ok)perror(__func__);
+    for (size_t k = 0; ok && k < N; k++){
+        size_t kb = _extent(A->rows, block, k), first = k*block + kb, below = A->rows - first;
+        int pk = k % grid->p, qk = k % grid->q;
+        size_t lrk = _local(k*block, block, grid->p), lck = _local(k*block, block, grid->q);
+        int status = 1;
+        if(grid->prow == pk && grid->pcol == qk){
+            for (size_t r = 0; r < kb; r++)
+                rows[r] = _data(A) + (lrk + r)*n + lck;
+            status = factor_cholesky(&(matrix_t){kb, kb, rows, 0});
+        }
+        MPI_Bcast(&status, 1, MPI_INT, pk * grid->q + qk, grid->comm);
+        if(!status){
+            ok = 0;
+            break;
+        }
+        if(grid->pcol == qk){
+            if(grid->prow == pk)
+                for (size_t r = 0; r < kb; r++)
+                    memcpy(diagonal + r*kb, _data(A) + (lrk + r)*n + lck, kb * sizeof(TYPE));
+            MPI_Bcast(diagonal, kb*kb, DIST_TYPE, pk, grid->column);
+            size_t r0 = _blocks_before(k+1, grid->prow, grid->p) * block;
+            r0 = r0 < m ? r0 : m;
+            dist_arg_t arg = {block, kb, 0, A, diagonal, NULL, NULL, lck, 0};
+            if(m - r0 <= DIST_ROWS)
+                _cholesky_trsm_task(&arg, r0, m);
+            else if(thread_pool_parallel_for(&thread_pool, r0, m, DIST_ROWS, _cholesky_trsm_task, &arg) != THREAD_POOL_OK)
+                printf("\x1b[31mproblem\x1b[0m\n");
+            memset(panel, 0, below*kb * sizeof(TYPE));
+            for (size_t r = r0; r < m; r++)
+                memcpy(panel + (_global(r, block, grid->prow, grid->p) - first)*kb, _data(A) + r*n + lck, kb * sizeof(TYPE));
+            MPI_Allreduce(MPI_IN_PLACE, panel, below*kb, DIST_TYPE, MPI_SUM, grid->column);
+        }
+        if(!below)continue;
+        MPI_Bcast(panel, below*kb, DIST_TYPE, qk, grid->row);
+        for (size_t c = 0; c < kb; c++)
+            for (size_t r = 0; r < below; r++)
+                trans[c*below + r] = -panel[r*kb + c];
+        dist_arg_t arg = {block, kb, first, A, NULL, panel, trans, lck, below};
+        size_t lb0 = _blocks_before(k+1, grid->prow, grid->p), lb1 = (m + block - 1) / block;
+        if(lb1 <= lb0)continue;
+        if(thread_pool_parallel_for(&thread_pool, lb0, lb1, 1, _cholesky_update_task, &arg) != THREAD_POOL_OK)
+            printf("\x1b[31mproblem\x1b[0m\n");
+    }
+    free(diagonal);
+    free(rows);
+    free(panel);
+    free(trans);
+    return ok;
+}
+
+// Swap the global rows g1 and g2 on the local columns [c0, c1), between the two ranks of the grid column holding them
+static void _swap_rows(matrix_dist_t *A, size_t g1, size_t g2, size_t c0, size_t c1)
+{
+    const matrix_grid_t *grid = A->grid;
+    size_t block = A->block, n = A->local->columns;
+    int o1 = g1 / block % grid->p, o2 = g2 / block % grid->p;
+    if(g1 == g2 || c0 == c1)return;
+    TYPE *x1 = _data(A) + _local(g1, block, grid->p)*n + c0, *x2 = _data(A) + _local(g2, block, grid->p)*n + c0;
+    if(o1 == o2){
+        if(grid->prow != o1)return;
+        for (size_t j = 0; j < c1 - c0; j++){
+            TYPE tmp = x1[j];
+            x1[j] = x2[j];
+            x2[j] = tmp;
+        }
+    } else if(grid->prow == o1){
+        MPI_Sendrecv_replace(x1, c1 - c0, DIST_TYPE, o2, 1, o2, 1, grid->column, MPI_STATUS_IGNORE);
+    } else if(grid->prow == o2){
+        MPI_Sendrecv_replace(x2, c1 - c0, DIST_TYPE, o1, 1, o1, 1, grid->column, MPI_STATUS_IGNORE);
+    }
+}
+
+// Layout of DIST_TYPE_INT for the MPI_MAXLOC pivot search
+typedef struct {
+    TYPE value;
+    int row;
+} pivot_t;
+
+typedef struct {
+    TYPE *data;
+    size_t n, column, kb;
+    const TYPE *pivot;                                                  // Pivot row from the pivot column
+} lu_arg_t;
+
+static void _lu_panel_task(void *args, size_t start, size_t end)
+{
+    lu_arg_t *arg = args;
+    for (size_t r = start; r < end; r++){
+        TYPE *x = arg->data + r*arg->n + arg->column;
+        x[0] /= arg->pivot[0];
+        kernels->axpy(arg->kb - 1, -x[0], arg->pivot + 1, x + 1);
+    }
+}
+
+// Block step k of a blocked triangular solve with the diagonal block column k of A, on the local columns from c0
+// of B: its block row k = T_kk^-1 * itself, T_kk unit lower or upper, then the blocks of the rows below the
+// diagonal (above it if upper) -= T_Ik * block row k. The trailing update of the LU when B is A.
+static int _trailing(const matrix_dist_t *A, size_t k, matrix_dist_t *B, size_t c0, int upper)
+{
+    const matrix_grid_t *grid = A->grid;
+    size_t block = A->block, kb = _extent(A->rows, block, k), n = B->local->columns, width = n - c0, m = B->local->rows;
+    int pk = k % grid->p, qk = k % grid->q;
+    size_t lrk = _local(k*block, block, grid->p), lck = _local(k*block, block, grid->q), r0, r1;
+    if(upper){
+        r0 = 0;
+        r1 = _blocks_before(k, grid->prow, grid->p) * block;
+    } else {
+        r0 = _blocks_before(k+1, grid->prow, grid->p) * block;
+        r0 = r0 < m ? r0 : m;
+        r1 = m;
+    }
+    TYPE *diagonal = malloc(kb*kb * sizeof(TYPE)), *x = malloc((kb*width + 1) * sizeof(TYPE)), *panel = malloc(((r1 - r0)*kb + 1) * sizeof(TYPE));
+    if(!_agree(grid, diagonal && x && panel)){
+        perror(__func__);
+        free(diagonal); free(x); free(panel);
+        return 0;
+    }
+    const TYPE *a = _data(A);
+    size_t na = A->local->columns;
+    if(grid->prow == pk){
+        if(grid->pcol == qk)
+            for (size_t r = 0; r < kb; r++)
+                memcpy(diagonal + r*kb, a + (lrk + r)*na + lck, kb * sizeof(TYPE));
+        MPI_Bcast(diagonal, kb*kb, DIST_TYPE, qk, grid->row);
+        TYPE *rows = _data(B) + lrk*n + c0;
+        if(upper){
+            for (size_t r = kb; r-- > 0;){
+                for (size_t p = r+1; p < kb; p++)
+                    kernels->axpy(width, -diagonal[r*kb + p], rows + p*n, rows + r*n);
+                kernels->scal(width, 1 / diagonal[r*kb + r], rows + r*n, rows + r*n);
+            }
+        } else {
+            for (size_t r = 1; r < kb; r++)
+                for (size_t p = 0; p < r; p++)
+                    kernels->axpy(width, -diagonal[r*kb + p], rows + p*n, rows + r*n);
+        }
+        for (size_t r = 0; r < kb; r++)
+            memcpy(x + r*width, rows + r*n, width * sizeof(TYPE));
+    }
+    MPI_Bcast(x, kb*width, DIST_TYPE, pk, grid->column);
+    if(grid->pcol == qk)
+        for (size_t r = r0; r < r1; r++)
+            for (size_t c = 0; c < kb; c++)
+                panel[(r - r0)*kb + c] = -a[r*na + lck + c];
+    MPI_Bcast(panel, (r1 - r0)*kb, DIST_TYPE, qk, grid->row);
+    _gemm(r1 - r0, kb, width, panel, kb, x, width, _data(B) + r0*n + c0, n);
+    free(diagonal);
+    free(x);
+    free(panel);
+    return 1;
+}
+
+int matrix_dist_lu(matrix_dist_t *A, size_t *piv)
+{
+    if(!sanity_check((void *)A, __func__) || !sanity_check((void *)piv, __func__))return 0;
+    if(A->rows != A->columns){
+        if(!A->grid->rank)fprintf(stderr, "%s: not square matrix\n", __func__);
+        return 0;
+    }
+    const matrix_grid_t *grid = A->grid;
+    size_t block = A->block, N = (A->rows + block - 1) / block, m = A->local->rows, n = A->local->columns;
+    TYPE *pivot = malloc(block * sizeof(TYPE));
+    long long *pivots = malloc(block * sizeof(long long));
+    int ok = _agree(grid, pivot && pivots);
+    if(!ok)perror(__func__);
+    for (size_t k = 0; ok && k < N; k++){
+        size_t kb = _extent(A->rows, block, k), lck = _local(k*block, block, grid->q);
+        int qk = k % grid->q;
+        // Panel on its grid column, the rows swapped whole there
+        if(grid->pcol == qk){
+            for (size_t c = 0; c < kb; c++){
+                size_t g = k*block + c;
+                size_t l = _blocks_before(g / block, grid->prow, grid->p) * block + (g / block % grid->p == (size_t)grid->prow ? g % block : 0);
+                pivot_t best = {-1, 0};
+                for (size_t r = l; r < m; r++){
+                    TYPE value = fabs(_data(A)[r*n + lck + c]);
+                    if(value > best.value)best = (pivot_t){value, _global(r, block, grid->prow, grid->p)};
+                }
+                MPI_Allreduce(MPI_IN_PLACE, &best, 1, DIST_TYPE_INT, MPI_MAXLOC, grid->column);
+                if(best.value == 0){
+                    for (; c < kb; c++)pivots[c] = -1;
+                    break;
+                }
+                pivots[c] = best.row;
+                _swap_rows(A, g, best.row, 0, n);
+                int owner = g / block % grid->p;
+                if(grid->prow == owner)memcpy(pivot, _data(A) + _local(g, block, grid->p)*n + lck + c, (kb - c) * sizeof(TYPE));
+                MPI_Bcast(pivot, kb - c, DIST_TYPE, owner, grid->column);
+                l += grid->prow == owner;
+                lu_arg_t arg = {_data(A), n, lck + c, kb - c, pivot};
+                if(m - l <= DIST_ROWS)
+                    _lu_panel_task(&arg, l, m);
+                else if(thread_pool_parallel_for(&thread_pool, l, m, DIST_ROWS, _lu_panel_task, &arg) != THREAD_POOL_OK)
+                    printf("\x1b[31mproblem\x1b[0m\n");
+            }
+        }
+        MPI_Bcast(pivots, kb, MPI_LONG_LONG, qk, grid->row);
+        for (size_t c = 0; c < kb; c++){
+            if(pivots[c] < 0){
+                ok = 0;
+                break;
+            }
+            piv[k*block + c] = pivots[c];
+            if(grid->pcol != qk)_swap_rows(A, k*block + c, pivots[c], 0, n);
+        }
+        if(ok)ok = _trailing(A, k, A, _blocks_before(k+1, grid->pcol, grid->q) * block < n ? _blocks_before(k+1, grid->pcol, grid->q) * block : n, 0);
+    }
+    free(pivot);
+    free(pivots);
+    return ok;
+}
+
+int matrix_dist_lu_solve(const matrix_dist_t *LU, const size_t *piv, matrix_dist_t *B)
+{
+    if(!sanity_check((void *)LU, __func__) || !sanity_check((void *)piv, __func__) || !sanity_check((void *)B, __func__))return 0;
+    if(LU->rows != LU->columns || B->rows != LU->rows){
+        if(!LU->grid->rank)fprintf(stderr, "%s: not solvable system\n", __func__);
+        return 0;
+    }
+    if(!_same_grid(LU, B, __func__))return 0;
+    size_t N = (LU->rows + LU->block - 1) / LU->block;
+    for (size_t i = 0; i < B->rows; i++)
+        _swap_rows(B, i, piv[i], 0, B->local->columns);
+    int ok = 1;
+    for (size_t k = 0; ok && k < N; k++)
+        ok = _trailing(LU, k, B, 0, 0);
+    for (size_t k = N; ok && k-- > 0;)
+        ok = _trailing(LU, k, B, 0, 1);
+    return ok;
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "matrix.h"
+#include "tools.h"
+#include "dist.h"
+
+// Regression of the distributed layer, run on local ranks by make distcheck: the matrices are drawn on
+// rank 0, scattered, and the gathered results compared there with the local functions.
+static int rank;
+static int failures;
+
+typedef struct {
+    char *test_name;
+    int result;
+    long long mstime;
+}result_t;
+
+static void process_result(result_t res)
+{
+    MPI_Allreduce(MPI_IN_PLACE, &res.result, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    failures += !res.result;
+    if(rank)return;
+    char *formatted_time = format_time(res.mstime, "ms");
+    if (res.result){
+        printf("\033[0;32m[OK]%s (%s)\033[0m\n", res.test_name, formatted_time);
+    }else
+        printf("\033[0;31m[NOK]%s (%s)\033[0m\n", res.test_name, formatted_time);
+    free(formatted_time);
+}
+
+static TYPE max_abs_diff(const matrix_t *A, const matrix_t *B)
+{
+    TYPE diff = 0;
+    for (size_t i = 0; i < A->rows; i++)
+        for (size_t j = 0; j < A->columns; j++)
+            diff = fmax(diff, fabs(A->coeff[i][j] - B->coeff[i][j]));
+    return diff;
+}
+
+// Matrix of rank 0 scattered on a new distributed matrix
+static matrix_dist_t * distribute(matrix_grid_t *grid, const matrix_t *M, size_t rows, size_t columns, size_t block)
+{
+    matrix_dist_t *A = matrix_dist_create(grid, rows, columns, block);
+    if(A && !matrix_dist_scatter(A, M, 0)){
+        matrix_dist_free(A);
+        return NULL;
+    }
+    return A;
+}
+
+static void test_grid(int p, int q, size_t block)
+{
+    char name[128];
+    size_t n = 150, piv[150];
+    matrix_grid_t *grid = matrix_grid_create(MPI_COMM_WORLD, p, q);
+    if(!grid){
+        process_result((result_t){"matrix_grid_create", 0, 0});
+        return;
+    }
+    matrix_t *X = NULL, *Y = NULL, *S = NULL, *B = NULL;
+    if(!rank){
+        X = matrix_random_normal(n, n, 0, 1);
+        Y = matrix_random_normal(n, 97, 0, 1);
+        B = matrix_random_normal(n, 5, 0, 1);
+        matrix_t *XT = matrix_transp_f(X);
+        S = matrix_mult_f(X, XT);
+        for (size_t i = 0; i < n; i++)S->coeff[i][i] += n;
+        matrix_free(XT);
+    }
+    // Gather of scatter, then SUMMA against matrix_mult_f
+    matrix_dist_t *A = distribute(grid, X, n, n, block), *DY = distribute(grid, Y, n, 97, block), *C = matrix_dist_create(grid, n, 97, block);
+    matrix_t *R = A ? matrix_dist_gather(A, 0) : NULL;
+    snprintf(name, sizeof(name), "matrix_dist_scatter/gather %dx%d", grid->p, grid->q);
+    process_result((result_t){name, rank || (R && max_abs_diff(R, X) == 0), 0});
+    if(R)matrix_free(R);
+    long long time = mstime();
+    int ok = A && DY && C && matrix_dist_gemm(C, A, DY);
+    long long time2 = mstime();
+    R = ok ? matrix_dist_gather(C, 0) : NULL;
+    if(!rank){
+        matrix_t *P = matrix_mult_f(X, Y);
+        ok = R && max_abs_diff(R, P) < 1e-10;
+        matrix_free(P);
+    }
+    snprintf(name, sizeof(name), "matrix_dist_gemm %dx%d", grid->p, grid->q);
+    process_result((result_t){name, ok, time2 - time});
+    if(R)matrix_free(R);
+    // Cholesky: L*LT of the lower triangle gathered
+    matrix_dist_t *DS = distribute(grid, S, n, n, block);
+    time = mstime();
+    ok = DS && matrix_dist_cholesky(DS);
+    time2 = mstime();
+    R = ok ? matrix_dist_gather(DS, 0) : NULL;
+    if(!rank && R){
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = i+1; j < n; j++)
+                R->coeff[i][j] = 0;
+        matrix_t *RT = matrix_transp_f(R), *LLT = matrix_mult_f(R, RT);
+        ok = max_abs_diff(LLT, S) < 1e-9;
+        matrix_free(RT); matrix_free(LLT);
+    }
+    snprintf(name, sizeof(name), "matrix_dist_cholesky %dx%d", grid->p, grid->q);
+    process_result((result_t){name, ok, time2 - time});
+    if(R)matrix_free(R);
+    // LU then solve against the residual of the solution
+    matrix_dist_t *DB = distribute(grid, B, n, 5, block);
+    time = mstime();
+    ok = A && DB && matrix_dist_lu(A, piv) && matrix_dist_lu_solve(A, piv, DB);
+    time2 = mstime();
+    R = ok ? matrix_dist_gather(DB, 0) : NULL;
+    if(!rank && R){
+        matrix_t *AX = matrix_mult_f(X, R);
+        ok = max_abs_diff(AX, B) < 1e-9;
+        matrix_free(AX);
+    }
+    snprintf(name, sizeof(name), "matrix_dist_lu/lu_solve %dx%d", grid->p, grid->q);
+    process_result((result_t){name, ok, time2 - time});
+    if(R)matrix_free(R);
+    // A zero column makes the LU singular, a negative diagonal coefficient the Cholesky not positive definite
+    matrix_t *Z = NULL, *N = NULL;
+    if(!rank){
+        Z = matrix_copy(X);
+        N = matrix_copy(S);
+        for (size_t i = 0; i < n; i++)
+            Z->coeff[i][100] = 0;
+        N->coeff[100][100] = -1;
+    }
+    matrix_dist_t *DZ = distribute(grid, Z, n, n, block), *DN = distribute(grid, N, n, n, block);
+    ok = DZ && DN && !matrix_dist_lu(DZ, piv) && !matrix_dist_cholesky(DN);
+    snprintf(name, sizeof(name), "matrix_dist_lu/cholesky failures %dx%d", grid->p, grid->q);
+    process_result((result_t){name, ok, 0});
+    matrix_dist_free(DZ); matrix_dist_free(DN);
+    if(!rank){
+        matrix_free(Z); matrix_free(N);
+    }
+    ok = !matrix_dist_gemm(C, DY, A) && !matrix_dist_cholesky(DY) && !matrix_dist_lu_solve(DY, piv, A);
+    snprintf(name, sizeof(name), "matrix_dist errors %dx%d", grid->p, grid->q);
+    process_result((result_t){name, ok, 0});
+    matrix_dist_free(A); matrix_dist_free(DY); matrix_dist_free(C); matrix_dist_free(DS); matrix_dist_free(DB);
+    if(!rank){
+        matrix_free(X); matrix_free(Y); matrix_free(S); matrix_free(B);
+    }
+    matrix_grid_free(grid);
+}
+
+int main(int argc, char **argv)
+{
+    int provided, size;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    libmatrix_init();
+    // Square grid, then one row and one column of ranks, blocks not dividing the sizes
+    test_grid(0, 0, 16);
+    test_grid(1, size, 7);
+    test_grid(size, 1, 64);
+    libmatrix_end();
+    MPI_Finalize();
+    return failures != 0;
+}
@@ -0,0 +1,618 @@
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "matrix.h"
+#include "check.h"
+#include "factor.h"
+#include "thread_pool.h"
+
+// Rows of one tridiagonal reduction task, and minimal trailing size to go parallel
+#define EIGEN_ROWS 32
+#define EIGEN_PARALLEL_SIZE (1 << 14)
+// Columns of one rotation replay task
+#define EIGEN_COLUMNS 256
+#define EIGEN_MAX_ITER 60
+#define INVERSE_ITER 3
+#define JACOBI_MAX_SWEEPS 60
+
+extern thread_pool_t thread_pool;
+
+typedef struct {
+    TYPE **A;
+    size_t j, r;
+    const TYPE *v;
+    TYPE *p, *w;
+    TYPE tau;
+} tridiag_arg_t;
+
+typedef struct {
+    TYPE **Z;
+    size_t l, m, columns;
+    const TYPE *c, *s;
+} rotation_arg_t;
+
+typedef struct {
+    const TYPE *d, *e;
+    size_t n;
+    TYPE lo, hi, norm;
+    size_t *clusters;                                                   // First index of each cluster, then k
+    TYPE *values;
+    TYPE **vectors;
+    int failed;                                                         // Set by a cluster that could not allocate its workspace, atomic
+} topk_arg_t;
+
+typedef struct {
+    TYPE **G, **V;
+    size_t n;
+    const size_t (*pairs)[2];
+    size_t count;
+    int rotated;
+} jacobi_arg_t;
+
+static void _run_blocks(size_t n, size_t block, void (*task)(void *, int), void *arg, int parallel)
+{
+    if(!parallel || n <= block){
+        for (size_t i = 0; i < n; i += block)
+            task(arg, i);
+        return;
+    }
+    thread_pool_work_t work = {0, NULL, task, arg};
+    for (size_t i = 0; i < n; i += block)
+        thread_pool_queue_work(&thread_pool, &work, i);
+    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+}
+
+// Trailing matrix S = A[j+1:][j+1:], r x r, its row i is A[j+1+i] + j+1
+
+// p = tau * S * v
+static void _tridiag_matvec_task(void *args, int index)
+{
+    tridiag_arg_t *arg = args;
+    size_t start = index, end = start + EIGEN_ROWS < arg->r ? start + EIGEN_ROWS : arg->r;
+    for (size_t i = start; i < end; i++){
+        const TYPE *s = arg->A[arg->j+1+i] + arg->j+1;
+        TYPE sum = 0;
+        for (size_t k = 0; k < arg->r; k++)
+            sum += s[k] * arg->v[k];
+        arg->p[i] = arg->tau * sum;
+    }
+}
+
+// S -= v*wT + w*vT
+static void _tridiag_update_task(void *args, int index)
+{
+    tridiag_arg_t *arg = args;
+    size_t start = index, end = start + EIGEN_ROWS < arg->r ? start + EIGEN_ROWS : arg->r;
+    for (size_t i = start; i < end; i++){
+        TYPE *s = arg->A[arg->j+1+i] + arg->j+1;
+        TYPE vi = arg->v[i], wi = arg->w[i];
+        #pragma GCC ivdep
+        for (size_t k = 0; k < arg->r; k++)
+            s[k] -= vi * arg->w[k] + wi * arg->v[k];
+    }
+}
+
+// Householder reduction of the symetric A to tridiagonal T = QT*A*Q, in place: d and e receive the diagonal
+// and the subdiagonal of T, reflector j is stored below A[j+1][j] (LAPACK xSYTRD layout).
+static int _tridiagonalize(matrix_t *A, TYPE *d, TYPE *e, TYPE *tau)
+{
+    size_t n = A->rows;
+    TYPE **a = A->coeff;
+    TYPE *v = malloc(3*n*sizeof(TYPE)), *p = v + n, *w = p + n;
+    if(!v){
+        perror(__func__);
+        return 0;
+    }
+    for (size_t j = 0; j + 2 < n; j++){
+        size_t r = n - j - 1;
+        TYPE alpha = a[j+1][j], xnorm = 0;
+        for (size_t i = j+2; i < n; i++)
+            xnorm += a[i][j] * a[i][j];
+        tau[j] = 0;
+        if(xnorm == 0)continue;
+        TYPE beta = -copysign(sqrt(alpha * alpha + xnorm), alpha);
+        tau[j] = (beta - alpha) / beta;
+        TYPE scale = 1 / (alpha - beta);
+        v[0] = 1;
+        for (size_t i = j+2; i < n; i++)
+            v[i-j-1] = a[i][j] *= scale;
+        a[j+1][j] = beta;
+        tridiag_arg_t arg = {a, j, r, v, p, w, tau[j]};
+        int parallel = r*r > EIGEN_PARALLEL_SIZE;
+        _run_blocks(r, EIGEN_ROWS, _tridiag_matvec_task, &arg, parallel);
+        TYPE K = 0;
+        for (size_t i = 0; i < r; i++)
+            K += v[i] * p[i];
+        K *= tau[j] / 2;
+        for (size_t i = 0; i < r; i++)
+            w[i] = p[i] - K * v[i];
+        _run_blocks(r, EIGEN_ROWS, _tridiag_update_task, &arg, parallel);
+    }
+    for (size_t i = 0; i < n; i++){
+        d[i] = a[i][i];
+        e[i] = i+1 < n ? a[i+1][i] : 0;
+    }
+    free(v);
+    return 1;
+}
+
+static void _rotation_task(void *args, int index)
+{
+    rotation_arg_t *arg = args;
+    size_t c0 = index, c1 = c0 + EIGEN_COLUMNS < arg->columns ? c0 + EIGEN_COLUMNS : arg->columns;
+    for (size_t i = arg->m; i-- > arg->l;){
+        TYPE c = arg->c[i], s = arg->s[i];
+        TYPE *zi = arg->Z[i], *zj = arg->Z[i+1];
+        #pragma GCC ivdep
+        for (size_t k = c0; k < c1; k++){
+            TYPE f = zj[k];
+            zj[k] = s * zi[k] + c * f;
+            zi[k] = c * zi[k] - s * f;
+        }
+    }
+}
+
+// Implicit QL with Wilkinson shifts on the tridiagonal (d, e), e[i] coupling i and i+1. The rotations of
+// each sweep are recorded, then replayed on the rows of Z (eigenvectors stored as rows) by column slabs.
+static int _tridiagonal_ql(size_t n, TYPE *d, TYPE *e, TYPE **Z)
+{
+    TYPE *rc = malloc(2*n*sizeof(TYPE)), *rs = rc + n;
+    if(!rc){
+        perror(__func__);
+        return 0;
+    }
+    for (size_t l = 0; l < n; l++){
+        int iter = 0;
+        size_t m;
+        do {
+            for (m = l; m + 1 < n; m++){
+                TYPE dd = fabs(d[m]) + fabs(d[m+1]);
+                if(fabs(e[m]) <= DBL_EPSILON * dd)break;
+            }
+            if(m == l)break;
+            if(iter++ == EIGEN_MAX_ITER){
+                free(rc);
+                return 0;
+            }
+            TYPE g = (d[l+1] - d[l]) / (2 * e[l]);
+            TYPE r = hypot(g, 1);
+            g = d[m] - d[l] + e[l] / (g + copysign(r, g));
+            TYPE s = 1, c = 1, p = 0;
+            size_t i, stop = l;
+            int underflow = 0;
+            for (i = m; i-- > l;){
+                TYPE f = s * e[i], b = c * e[i];
+                e[i+1] = r = hypot(f, g);
+                if(r == 0){
+                    d[i+1] -= p;
+                    e[m] = 0;
+                    underflow = 1;
+                    stop = i+1;
+                    break;
+                }
+                s = f / r;
+                c = g / r;
+                g = d[i+1] - p;
+                r = (d[i] - g) * s + 2 * c * b;
+                p = s * r;
+                d[i+1] = g + p;
+                g = c * r - b;
+                rc[i] = c;
+                rs[i] = s;
+            }
+            if(Z){
+                rotation_arg_t arg = {Z, stop, m, n, rc, rs};
+                _run_blocks(n, EIGEN_COLUMNS, _rotation_task, &arg, n*(m-stop) > EIGEN_PARALLEL_SIZE);
+            }
+            if(underflow)continue;
+            d[l] -= p;
+            e[l] = g;
+            e[m] = 0;
+        } while(m != l);
+    }
+    free(rc);
+    return 1;
+}
+
+static int _compare_values(const void *a, const void *b, void *values)
+{
+    TYPE x = ((TYPE *)values)[*(size_t *)a], y = ((TYPE *)values)[*(size_t *)b];
+    return (x > y) - (x < y);
+}
+
+static void _sort_indexes(size_t *index, size_t n, TYPE *values)
+{
+    // Insertion sort: eigenvalues come out of QL nearly sorted
+    for (size_t i = 0; i < n; i++)
+        index[i] = i;
+    for (size_t i = 1; i < n; i++){
+        size_t t = index[i], j = i;
+        while(j > 0 && _compare_values(&index[j-1], &t, values) > 0){
+            index[j] = index[j-1];
+            j--;
+        }
+        index[j] = t;
+    }
+}
+
+// Shifted views: Q of the tridiagonal reduction acts on rows 1..n-1
+static void _back_transform(matrix_t *A, const TYPE *tau, matrix_t *X)
+{
+    size_t n = A->rows;
+    if(n > 2)
+        factor_reflect(A->coeff + 1, n-1, n-2, tau, X->coeff + 1, X->columns, 0);
+}
+
+static matrix_t * _sym_copy(const matrix_t *A, const char *function_name)
+{
+    if(!sanity_check((void *)A, function_name))return NULL;
+    if(!square_check(A, function_name))return NULL;
+    if(!symetry_check(A, function_name))return NULL;
+    return matrix_copy(A);
+}
+
+int matrix_eigen_sym_f(const matrix_t *A, matrix_t **values, matrix_t **vectors)
+{
+    if(!sanity_check((void *)values, __func__))return 0;
+    matrix_t *T = _sym_copy(A, __func__);
+    if(!T)return 0;
+    size_t n = T->rows;
+    int ret = 0;
+    TYPE *d = malloc(3*n*sizeof(TYPE)), *e = d + n, *tau = e + n;
+    size_t *index = malloc(n*sizeof(size_t));
+    matrix_t *Z = vectors ? matrix_identity(n) : NULL;
+    if(!d || !index || (vectors && !Z)){
+        perror(__func__);
+        goto end;
+    }
+    if(!_tridiagonalize(T, d, e, tau))goto end;
+    if(!_tridiagonal_ql(n, d, e, Z ? Z->coeff : NULL)){
+        fprintf(stderr, "%s: no convergence\n", __func__);
+        goto end;
+    }
+    _sort_indexes(index, n, d);
+    *values = matrix_create(n, 1);
+    if(!*values)goto end;
+    for (size_t i = 0; i < n; i++)
+        (*values)->coeff[i][0] = d[index[i]];
+    if(vectors){
+        // Rows of Z are the eigenvectors of the tridiagonal matrix
+        *vectors = matrix_create(n, n);
+        if(!*vectors){
+            matrix_free(*values);
+            goto end;
+        }
+        for (size_t i = 0; i < n; i++)
+            for (size_t c = 0; c < n; c++)
+                (*vectors)->coeff[i][c] = Z->coeff[index[c]][i];
+        _back_transform(T, tau, *vectors);
+    }
+    ret = 1;
+end:
+    free(d);
+    free(index);
+    if(Z)matrix_free(Z);
+    matrix_free(T);
+    return ret;
+}
+
+// Number of eigenvalues of the tridiagonal (d, e) lower than x
+static size_t _sturm_count(const TYPE *d, const TYPE *e, size_t n, TYPE x)
+{
+    size_t count = 0;
+    TYPE q = 1;
+    for (size_t i = 0; i < n; i++){
+        q = d[i] - x - (i > 0 ? e[i-1] * e[i-1] / q : 0);
+        if(q == 0)q = -DBL_EPSILON * (fabs(x) + DBL_MIN);
+        count += q < 0;
+    }
+    return count;
+}
+
+static TYPE _bisection(const topk_arg_t *arg, size_t index)
+{
+    TYPE lo = arg->lo, hi = arg->hi;
+    // Absolute accuracy eps*||T|| as LAPACK's default, tighter for eigenvalues away from 0
+    while(hi - lo > 2 * DBL_EPSILON * fmax(fabs(lo), fabs(hi)) + DBL_EPSILON * arg->norm){
+        TYPE mid = (lo + hi) / 2;
+        if(mid <= lo || mid >= hi)break;
+        if(_sturm_count(arg->d, arg->e, arg->n, mid) > index)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    return (lo + hi) / 2;
+}
+
+// x = (T - λI)^-1 * x by Gaussian elimination with partial pivoting on the tridiagonal
+static void _tridiagonal_solve(const TYPE *d, const TYPE *e, size_t n, TYPE lambda, TYPE tiny, TYPE *x, TYPE *work)
+{
+    TYPE *u0 = work, *u1 = u0 + n, *u2 = u1 + n, *l = u2 + n;
+    int *swap = (int *)(l + n);
+    // Row i: [.. e[i-1], d[i]-λ, e[i] ..], u0 diagonal, u1 and u2 the two superdiagonals after pivoting
+    TYPE diag = d[0] - lambda, up = n > 1 ? e[0] : 0;
+    for (size_t i = 0; i + 1 < n; i++){
+        TYPE below = e[i], next_diag = d[i+1] - lambda, next_up = i + 2 < n ? e[i+1] : 0;
+        if(fabs(diag) >= fabs(below)){
+            swap[i] = 0;
+            if(fabs(diag) < tiny)diag = copysign(tiny, diag);
+            l[i] = below / diag;
+            u0[i] = diag; u1[i] = up; u2[i] = 0;
+            diag = next_diag - l[i] * up;
+            up = next_up;
+        } else {
+            swap[i] = 1;
+            l[i] = diag / below;
+            u0[i] = below; u1[i] = next_diag; u2[i] = next_up;
+            diag = up - l[i] * next_diag;
+            up = -l[i] * next_up;
+        }
+    }
+    u0[n-1] = fabs(diag) < tiny ? copysign(tiny, diag) : diag;
+    for (size_t i = 0; i + 1 < n; i++){
+        if(swap[i]){
+            TYPE tmp = x[i]; x[i] = x[i+1]; x[i+1] = tmp;
+        }
+        x[i+1] -= l[i] * x[i];
+    }
+    for (size_t i = n; i-- > 0;){
+        TYPE sum = x[i];
+        if(i + 1 < n)sum -= u1[i] * x[i+1];
+        if(i + 2 < n)sum -= u2[i] * x[i+2];
+        x[i] = sum / u0[i];
+    }
+}
+
+static void _normalize(size_t n, TYPE *x)
+{
+    TYPE norm = 0;
+    for (size_t i = 0; i < n; i++)
+        norm += x[i] * x[i];
+    norm = sqrt(norm);
+    for (size_t i = 0; i < n; i++)
+        x[i] /= norm;
+}
+
+// Bisection then inverse iteration for the eigenpairs of one cluster. Vectors of a cluster of close
+// eigenvalues are orthogonalized against the previous ones of the cluster at each iteration.
+static void _topk_task(void *args, int cluster)
+{
+    topk_arg_t *arg = args;
+    size_t n = arg->n, first = arg->clusters[cluster], last = arg->clusters[cluster+1];
+    TYPE *work = malloc(4*n*sizeof(TYPE) + n*sizeof(int));
+    if(!work){
+        perror(__func__);
+        __atomic_store_n(&arg->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    for (size_t t = first; t < last; t++){
+        TYPE lambda = arg->values[t];
+        TYPE *x = arg->vectors[t];
+        // Different deterministic starting vectors for each index
+        unsigned int seed = 2654435761u * (t + 1);
+        for (size_t i = 0; i < n; i++){
+            seed = seed * 1103515245u + 12345u;
+            x[i] = 0.5 + (TYPE)(seed >> 16 & 0x7fff) / 0x7fff;
+        }
+        for (int iter = 0; iter < INVERSE_ITER; iter++){
+            _tridiagonal_solve(arg->d, arg->e, n, lambda, DBL_EPSILON * arg->norm, x, work);
+            for (size_t s = first; s < t; s++){
+                const TYPE *y = arg->vectors[s];
+                TYPE dot = 0;
+                for (size_t i = 0; i < n; i++)
+                    dot += x[i] * y[i];
+                for (size_t i = 0; i < n; i++)
+                    x[i] -= dot * y[i];
+            }
+            _normalize(n, x);
+        }
+    }
+    free(work);
+}
+
+int matrix_eigen_sym_topk_f(const matrix_t *A, size_t k, matrix_t **values, matrix_t **vectors)
+{
+    if(!sanity_check((void *)values, __func__))return 0;
+    matrix_t *T = _sym_copy(A, __func__);
+    if(!T)return 0;
+    size_t n = T->rows;
+    if(k > n)k = n;
+    int ret = 0;
+    TYPE *d = malloc(3*n*sizeof(TYPE)), *e = d + n, *tau = e + n;
+    TYPE *lambda = malloc((k+1)*sizeof(TYPE));
+    size_t *clusters = malloc((k+1)*sizeof(size_t));
+    matrix_t *X = vectors ? matrix_create(k, n) : NULL;
+    if(!d || !lambda || !clusters || (vectors && !X)){
+        perror(__func__);
+        goto end;
+    }
+    if(!_tridiagonalize(T, d, e, tau))goto end;
+    // Gershgorin interval
+    TYPE lo = d[0], hi = d[0], norm = 0;
+    for (size_t i = 0; i < n; i++){
+        TYPE radius = fabs(e[i]) + (i > 0 ? fabs(e[i-1]) : 0);
+        lo = fmin(lo, d[i] - radius);
+        hi = fmax(hi, d[i] + radius);
+    }
+    norm = fmax(fabs(lo), fabs(hi));
+    topk_arg_t arg = {d, e, n, lo - DBL_EPSILON * norm, hi + DBL_EPSILON * norm, norm, clusters, lambda, X ? X->coeff : NULL, 0};
+    // Largest first: the t-th one has n-1-t eigenvalues below it
+    for (size_t t = 0; t < k; t++)
+        lambda[t] = _bisection(&arg, n-1-t);
+    *values = matrix_create(k, 1);
+    if(!*values)goto end;
+    for (size_t t = 0; t < k; t++)
+        (*values)->coeff[t][0] = lambda[t];
+    if(vectors){
+        size_t nb = 0;
+        for (size_t t = 0; t < k; t++)
+            if(t == 0 || lambda[t-1] - lambda[t] > 1e-3 * norm)
+                clusters[nb++] = t;
+        clusters[nb] = k;
+        _run_blocks(nb, 1, _topk_task, &arg, 1);
+        *vectors = arg.failed ? NULL : matrix_transp_f(X);
+        if(!*vectors){
+            matrix_free(*values);
+            goto end;
+        }
+        _back_transform(T, tau, *vectors);
+    }
+    ret = 1;
+end:
+    free(d);
+    free(lambda);
+    free(clusters);
+    if(X)matrix_free(X);
+    matrix_free(T);
+    return ret;
+}
+
+// One-sided Jacobi rotation of the rows p and q of G (columns of R) and V
+static void _jacobi_task(void *args, int index)
+{
+    jacobi_arg_t *arg = args;
+    size_t p = arg->pairs[index][0], q = arg->pairs[index][1], n = arg->n;
+    if(p >= n || q >= n)return;
+    TYPE *gp = arg->G[p], *gq = arg->G[q];
+    TYPE alpha = 0, beta = 0, gamma = 0;
+    for (size_t i = 0; i < n; i++){
+        alpha += gp[i] * gp[i];
+        beta += gq[i] * gq[i];
+        gamma += gp[i] * gq[i];
+    }
+    if(fabs(gamma) <= DBL_EPSILON * sqrt(alpha * beta))return;
+    TYPE zeta = (beta - alpha) / (2 * gamma);
+    TYPE t = copysign(1, zeta) / (fabs(zeta) + sqrt(1 + zeta * zeta));
+    TYPE c = 1 / sqrt(1 + t * t), s = c * t;
+    TYPE *vp = arg->V[p], *vq = arg->V[q];
+    #pragma GCC ivdep
+    for (size_t i = 0; i < n; i++){
+        TYPE x = gp[i], y = gq[i];
+        gp[i] = c * x - s * y;
+        gq[i] = s * x + c * y;
+        x = vp[i]; y = vq[i];
+        vp[i] = c * x - s * y;
+        vq[i] = s * x + c * y;
+    }
+    __atomic_store_n(&arg->rotated, 1, __ATOMIC_RELAXED);
+}
+
+// One-sided Jacobi on the rows of G: on return they are orthogonal, G_in = G_out * V with orthogonal V.
+// Round robin ordering: each round is a set of n/2 disjoint pairs rotated in parallel.
+static int _jacobi(size_t n, TYPE **G, TYPE **V)
+{
+    size_t players = n + n % 2;
+    size_t (*pairs)[2] = malloc(players/2 * sizeof(*pairs) + 1);
+    size_t *ring = malloc(players * sizeof(size_t));
+    if(!pairs || !ring){
+        perror(__func__);
+        free(pairs);
+        free(ring);
+        return 0;
+    }
+    for (size_t i = 0; i < players; i++)
+        ring[i] = i;
+    jacobi_arg_t arg = {G, V, n, (const size_t (*)[2])pairs, players/2, 0};
+    int converged = 0;
+    for (int sweep = 0; sweep < JACOBI_MAX_SWEEPS && !converged; sweep++){
+        arg.rotated = 0;
+        for (size_t round = 0; round + 1 < players; round++){
+            for (size_t i = 0; i < players/2; i++){
+                pairs[i][0] = ring[i];
+                pairs[i][1] = ring[players-1-i];
+            }
+            _run_blocks(players/2, 1, _jacobi_task, &arg, n > 64);
+            // Rotate every player but the first one
+            size_t last = ring[players-1];
+            memmove(ring + 2, ring + 1, (players-2)*sizeof(size_t));
+            ring[1] = last;
+        }
+        converged = !arg.rotated;
+    }
+    free(pairs);
+    free(ring);
+    return converged;
+}
+
+int matrix_svd_f(const matrix_t *A, matrix_t **U, matrix_t **S, matrix_t **V)
+{
+    if(!sanity_check((void *)A, __func__))return 0;
+    // Wide matrices: AT = V*S*UT
+    int wide = A->rows < A->columns;
+    matrix_t *B = wide ? matrix_transp_f(A) : (matrix_t *)A;
+    matrix_t *Q = NULL, *R = NULL, *G = NULL, *W = NULL, *UR = NULL;
+    size_t *index = NULL;
+    int ret = 0;
+    if(!B)return 0;
+    // B = Q*R, then one-sided Jacobi on the small square R: RT = W*G -> R = GT*WT
+    if(!matrix_qr_f(B, &Q, &R))goto end;
+    size_t n = R->rows;
+    G = matrix_transp_f(R);
+    W = matrix_identity(n);
+    index = malloc(n*sizeof(size_t));
+    TYPE *sigma = malloc(n*sizeof(TYPE));
+    if(!G || !W || !index || !sigma){
+        free(sigma);
+        goto end;
+    }
+    if(!_jacobi(n, G->coeff, W->coeff)){
+        fprintf(stderr, "%s: no convergence\n", __func__);
+        free(sigma);
+        goto end;
+    }
+    for (size_t i = 0; i < n; i++){
+        TYPE norm = 0;
+        for (size_t j = 0; j < n; j++)
+            norm += G->coeff[i][j] * G->coeff[i][j];
+        sigma[i] = -sqrt(norm);
+    }
+    // Descending singular values
+    _sort_indexes(index, n, sigma);
+    // Rows of G are sigma_i * u_i of R, rows of W are the v_i
+    UR = matrix_create(n, n);
+    matrix_t *Vm = matrix_create(B->columns, n), *Sm = matrix_create(n, 1);
+    if(!UR || !Vm || !Sm){
+        if(Vm)matrix_free(Vm);
+        if(Sm)matrix_free(Sm);
+        free(sigma);
+        goto end;
+    }
+    for (size_t c = 0; c < n; c++){
+        size_t t = index[c];
+        TYPE s = -sigma[t];
+        Sm->coeff[c][0] = s;
+        for (size_t i = 0; i < n; i++){
+            UR->coeff[i][c] = s > 0 ? G->coeff[t][i] / s : 0;
+            Vm->coeff[i][c] = W->coeff[t][i];
+        }
+    }
+    free(sigma);
+    matrix_t *Um = matrix_mult_f(Q, UR);
+    if(!Um){
+        matrix_free(Vm);
+        matrix_free(Sm);
+        goto end;
+    }
+    if(wide){
+        matrix_t *tmp = Um;
+        Um = Vm;
+        Vm = tmp;
+    }
+    if(U)*U = Um; else matrix_free(Um);
+    if(V)*V = Vm; else matrix_free(Vm);
+    if(S)*S = Sm; else matrix_free(Sm);
+    ret = 1;
+end:
+    if(wide)matrix_free(B);
+    if(Q)matrix_free(Q);
+    if(R)matrix_free(R);
+    if(G)matrix_free(G);
+    if(W)matrix_free(W);
+    if(UR)matrix_free(UR);
+    free(index);
+    return ret;
+}
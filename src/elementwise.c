@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "matrix.h"
+#include "check.h"
+#include "kernels.h"
+#include "thread_pool.h"
+
+// Elementwise engine: rows go through the kernel of the operation, in parallel chunks of about
+// ELEMENTWISE_CHUNK coefficients once the matrix has ELEMENTWISE_PARALLEL_SIZE of them. Results larger
+// than tuning.stream_size would only evict the operands from the caches: they are computed by blocks
+// of ELEMENTWISE_BLOCK into a buffer that stays in L1, then streamed to memory.
+#define ELEMENTWISE_CHUNK 16384
+#define ELEMENTWISE_PARALLEL_SIZE (1 << 16)
+#define ELEMENTWISE_BLOCK 512
+#define ELEMENTWISE_MAP -1                                              // f applied to x, beside the ELEMENTWISE_* of the kernel
+
+extern thread_pool_t thread_pool;
+extern matrix_tuning_t tuning;
+
+typedef struct {
+    int op;
+    TYPE alpha;
+    const matrix_t *X, *Y;
+    TYPE (*f)(TYPE);
+    matrix_t *Z;
+    int stream;
+} elementwise_arg_t;
+
+static inline void _block(const elementwise_arg_t *arg, size_t n, const TYPE *x, const TYPE *y, TYPE *z)
+{
+    if(arg->op == ELEMENTWISE_MAP){
+        for (size_t j = 0; j < n; j++)
+            z[j] = arg->f(x[j]);
+    } else {
+        kernels->elementwise(arg->op, n, arg->alpha, x, y, z);
+    }
+}
+
+static void _elementwise_task(void *args, size_t start, size_t end)
+{
+    elementwise_arg_t *arg = args;
+    size_t n = arg->Z->columns;
+    TYPE buffer[ELEMENTWISE_BLOCK] __attribute__((aligned(64)));
+    for (size_t i = start; i < end; i++){
+        const TYPE *x = arg->X->coeff[i], *y = arg->Y ? arg->Y->coeff[i] : NULL;
+        TYPE *z = arg->Z->coeff[i];
+        if(!arg->stream){
+            _block(arg, n, x, y, z);
+            continue;
+        }
+        for (size_t j = 0; j < n; j += ELEMENTWISE_BLOCK){
+            size_t m = n - j < ELEMENTWISE_BLOCK ? n - j : ELEMENTWISE_BLOCK;
+            _block(arg, m, x + j, y ? y + j : NULL, buffer);
+            kernels->stream(m, buffer, z + j);
+        }
+    }
+}
+
+static matrix_t * _elementwise(int op, TYPE alpha, const matrix_t *X, const matrix_t *Y, TYPE (*f)(TYPE), const char *function_name)
+{
+    if(!sanity_check((void *)X, function_name))return NULL;
+    if(op != ELEMENTWISE_SCALE && op != ELEMENTWISE_MAP){
+        if(!sanity_check((void *)Y, function_name))return NULL;
+        if((X->rows != Y->rows) || (X->columns != Y->columns)){
+            fprintf(stderr, "%s: not addable matrix ((matrix1->rows != matrix2->rows) || (matrix1->columns != matrix2->columns))\n", function_name);
+            return NULL;
+        }
+    }
+    matrix_t *Z = matrix_create(X->rows, X->columns);
+    if(!Z)return NULL;
+    size_t size = Z->rows * Z->columns;
+    elementwise_arg_t arg = {op, alpha, X, Y, f, Z, size * sizeof(TYPE) > tuning.stream_size};
+    if(size < ELEMENTWISE_PARALLEL_SIZE){
+        _elementwise_task(&arg, 0, Z->rows);
+        return Z;
+    }
+    size_t rows = Z->columns ? ELEMENTWISE_CHUNK / Z->columns : 0;
+    if(thread_pool_parallel_for(&thread_pool, 0, Z->rows, rows ? rows : 1, _elementwise_task, &arg) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+    return Z;
+}
+
+matrix_t * matrix_add_f(const matrix_t *matrix1, const matrix_t *matrix2)
+{
+    return _elementwise(ELEMENTWISE_ADD, 0, matrix1, matrix2, NULL, __func__);
+}
+
+matrix_t * matrix_sub_f(const matrix_t *matrix1, const matrix_t *matrix2)
+{
+    return _elementwise(ELEMENTWISE_SUB, 0, matrix1, matrix2, NULL, __func__);
+}
+
+matrix_t * matrix_hadamard_f(const matrix_t *matrix1, const matrix_t *matrix2)
+{
+    return _elementwise(ELEMENTWISE_MUL, 0, matrix1, matrix2, NULL, __func__);
+}
+
+matrix_t * matrix_mult_scalar_f(const matrix_t *matrix, TYPE lambda)
+{
+    return _elementwise(ELEMENTWISE_SCALE, lambda, matrix, NULL, NULL, __func__);
+}
+
+matrix_t * matrix_axpy_f(TYPE alpha, const matrix_t *X, const matrix_t *Y)
+{
+    return _elementwise(ELEMENTWISE_AXPY, alpha, X, Y, NULL, __func__);
+}
+
+matrix_t * matrix_map_f(const matrix_t *matrix, TYPE (*f)(TYPE))
+{
+    if(!sanity_check((void *)f, __func__))return NULL;
+    return _elementwise(ELEMENTWISE_MAP, 0, matrix, NULL, f, __func__);
+}
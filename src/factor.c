@@ -0,0 +1,435 @@
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "matrix.h"
+#include "check.h"
+#include "factor.h"
+#include "kernels.h"
+#include "thread_pool.h"
+
+// Columns of a panel, and rows of the trailing matrix updated by one task
+#define FACTOR_BLOCK tuning.factor_block
+#define FACTOR_ROWS tuning.factor_rows
+
+extern thread_pool_t thread_pool;
+extern matrix_tuning_t tuning;
+
+typedef struct {
+    matrix_t *A;
+    size_t k0, k1;
+} factor_arg_t;
+
+static void _run_rows(factor_arg_t *arg, void (*task)(void *, size_t, size_t))
+{
+    size_t n = arg->A->rows;
+    if(n - arg->k1 <= FACTOR_ROWS){
+        if(n > arg->k1)
+            task(arg, arg->k1, n);
+        return;
+    }
+    if(thread_pool_parallel_for(&thread_pool, arg->k1, n, FACTOR_ROWS, task, arg) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+}
+
+// A22 -= L21 * U12 for the rows of one task
+static void _lu_update_task(void *args, size_t start, size_t end)
+{
+    factor_arg_t *arg = args;
+    TYPE **A = arg->A->coeff;
+    size_t n = arg->A->rows;
+    for (size_t i = start; i < end; i++){
+        TYPE *a = A[i];
+        for (size_t p = arg->k0; p < arg->k1; p++)
+            kernels->axpy(n - arg->k1, -a[p], A[p] + arg->k1, a + arg->k1);
+    }
+}
+
+int factor_lu(matrix_t *A, size_t *piv, int *sign)
+{
+    TYPE **a = A->coeff;
+    size_t n = A->rows;
+    int regular = 1;
+    *sign = 1;
+    for (size_t k0 = 0; k0 < n; k0 += FACTOR_BLOCK){
+        size_t k1 = k0 + FACTOR_BLOCK < n ? k0 + FACTOR_BLOCK : n;
+        // Panel: unblocked partial pivoting on columns k0..k1. Swapping row pointers
+        // moves the already computed part of L and the not yet updated part of A at once.
+        for (size_t j = k0; j < k1; j++){
+            size_t p = j;
+            for (size_t i = j+1; i < n; i++)
+                if(fabs(a[i][j]) > fabs(a[p][j]))p = i;
+            piv[j] = p;
+            if(p != j){
+                TYPE *row = a[p];
+                a[p] = a[j];
+                a[j] = row;
+                *sign = -*sign;
+            }
+            if(a[j][j] == 0){
+                regular = 0;
+                continue;
+            }
+            for (size_t i = j+1; i < n; i++){
+                TYPE l = a[i][j] /= a[j][j];
+                #pragma GCC ivdep
+                for (size_t c = j+1; c < k1; c++)
+                    a[i][c] -= l * a[j][c];
+            }
+        }
+        // U12 = L11^-1 * A12
+        for (size_t j = k0; j < k1; j++)
+            for (size_t p = k0; p < j; p++){
+                TYPE l = a[j][p];
+                #pragma GCC ivdep
+                for (size_t c = k1; c < n; c++)
+                    a[j][c] -= l * a[p][c];
+            }
+        factor_arg_t arg = {A, k0, k1};
+        _run_rows(&arg, _lu_update_task);
+    }
+    return regular;
+}
+
+// Tile algorithms: one task per operation on FACTOR_BLOCK*FACTOR_BLOCK tiles, run on the thread pool as a
+// dependency graph in the style of PLASMA. Each task depends on the last writers of the tiles it touches,
+// so the panel of a step starts as soon as its own tiles are updated and the steps overlap.
+enum {
+    TILE_POTRF,                                                         // L_kk of A_kk
+    TILE_TRSM,                                                          // L_ik = A_ik * L_kk^-T
+    TILE_UPDATE                                                         // A_ij -= L_ik * L_jk^T, lower half only if i == j
+};
+
+typedef struct {
+    TYPE **a;
+    size_t n, nb;
+    int failed;                                                         // Set by a diagonal tile not positive definite, atomic
+} cholesky_arg_t;
+
+typedef struct {
+    cholesky_arg_t *arg;
+    int kind;
+    size_t i, j, k;
+} cholesky_task_t;
+
+static inline size_t _tile_end(size_t t, size_t nb, size_t n)
+{
+    return (t+1)*nb < n ? (t+1)*nb : n;
+}
+
+// Run the graph, or if it could not be built, the tasks in the order they were added, which respects the dependencies
+static void _tile_run(thread_pool_graph_t *graph, int built, void (*func)(void *, int), void *tasks, size_t count)
+{
+    if(built && thread_pool_graph_run(&thread_pool, graph) == THREAD_POOL_OK)return;
+    for (size_t t = 0; t < count; t++)
+        func(tasks, t);
+}
+
+// Add task index depending on the last writers of its tiles (-1 for none), it becomes the last writer of *written
+static int _tile_add(thread_pool_graph_t *graph, void (*func)(void *, int), void *tasks, size_t index, int *written, int read1, int read2)
+{
+    int deps[3], nb_deps = 0;
+    if(*written >= 0)deps[nb_deps++] = *written;
+    if(read1 >= 0)deps[nb_deps++] = read1;
+    if(read2 >= 0)deps[nb_deps++] = read2;
+    int id = graph ? thread_pool_graph_add(graph, func, tasks, index, nb_deps, deps) : -1;
+    if(id >= 0)*written = id;
+    return id >= 0;
+}
+
+static void _cholesky_tile_task(void *args, int index)
+{
+    cholesky_task_t *task = (cholesky_task_t *)args + index;
+    cholesky_arg_t *arg = task->arg;
+    if(__atomic_load_n(&arg->failed, __ATOMIC_RELAXED))return;
+    TYPE **a = arg->a;
+    size_t nb = arg->nb, n = arg->n;
+    size_t i0 = task->i*nb, i1 = _tile_end(task->i, nb, n);
+    size_t j0 = task->j*nb, j1 = _tile_end(task->j, nb, n);
+    size_t k0 = task->k*nb, k1 = _tile_end(task->k, nb, n);
+    switch(task->kind){
+    case TILE_POTRF:
+        for (size_t j = k0; j < k1; j++){
+            TYPE d = a[j][j];
+            for (size_t p = k0; p < j; p++)
+                d -= a[j][p] * a[j][p];
+            if(!(d > 0)){
+                __atomic_store_n(&arg->failed, 1, __ATOMIC_RELAXED);
+                return;
+            }
+            a[j][j] = sqrt(d);
+            for (size_t i = j+1; i < k1; i++){
+                TYPE sum = a[i][j];
+                for (size_t p = k0; p < j; p++)
+                    sum -= a[i][p] * a[j][p];
+                a[i][j] = sum / a[j][j];
+            }
+        }
+        break;
+    case TILE_TRSM:
+        for (size_t i = i0; i < i1; i++){
+            TYPE *r = a[i];
+            for (size_t j = k0; j < k1; j++){
+                TYPE sum = r[j];
+                for (size_t p = k0; p < j; p++)
+                    sum -= r[p] * a[j][p];
+                r[j] = sum / a[j][j];
+            }
+        }
+        break;
+    default:
+        for (size_t i = i0; i < i1; i++){
+            size_t end = task->i == task->j ? i+1 : j1;
+            for (size_t j = j0; j < end; j++)
+                a[i][j] -= kernels->dot(k1 - k0, a[i] + k0, a[j] + k0);
+        }
+    }
+}
+
+int factor_cholesky(matrix_t *A)
+{
+    size_t n = A->rows, nb = FACTOR_BLOCK, tiles = (n + nb - 1) / nb, count = 0;
+    if(!n)return 1;
+    cholesky_arg_t arg = {A->coeff, n, nb, 0};
+    cholesky_task_t *tasks = malloc(tiles*(tiles+1)*(tiles+2)/6 * sizeof(cholesky_task_t) + tiles*tiles * sizeof(int));
+    if(!tasks){
+        perror(__func__);
+        return 0;
+    }
+    // Last writer of the lower tile (i, j) in last[i*tiles+j]
+    int *last = (int *)(tasks + tiles*(tiles+1)*(tiles+2)/6);
+    for (size_t t = 0; t < tiles*tiles; t++)
+        last[t] = -1;
+    thread_pool_graph_t *graph = thread_pool_graph_create();
+    int built = graph != NULL;
+    for (size_t k = 0; k < tiles; k++){
+        tasks[count] = (cholesky_task_t){&arg, TILE_POTRF, k, k, k};
+        built &= _tile_add(graph, _cholesky_tile_task, tasks, count++, &last[k*tiles+k], -1, -1);
+        for (size_t i = k+1; i < tiles; i++){
+            tasks[count] = (cholesky_task_t){&arg, TILE_TRSM, i, k, k};
+            built &= _tile_add(graph, _cholesky_tile_task, tasks, count++, &last[i*tiles+k], last[k*tiles+k], -1);
+        }
+        for (size_t i = k+1; i < tiles; i++)
+            for (size_t j = k+1; j <= i; j++){
+                tasks[count] = (cholesky_task_t){&arg, TILE_UPDATE, i, j, k};
+                built &= _tile_add(graph, _cholesky_tile_task, tasks, count++, &last[i*tiles+j], last[i*tiles+k], last[j*tiles+k]);
+            }
+    }
+    _tile_run(graph, built, _cholesky_tile_task, tasks, count);
+    thread_pool_graph_destroy(graph);
+    free(tasks);
+    return !arg.failed;
+}
+
+// Triangular solves on row tiles of X times blocks of SOLVE_COLUMNS columns, the same graph chaining
+// the forward and the backward substitutions of each block of columns without a barrier in between
+#define SOLVE_COLUMNS 256
+
+typedef struct {
+    const matrix_t *F;
+    matrix_t *X;
+    size_t nb;
+} solve_arg_t;
+
+typedef struct {
+    solve_arg_t *arg;
+    int backward, trans, unit;                                          // Coefficient (i, p) read in F[p][i] if trans
+    size_t i, p;                                                        // X_i -= F_ip * X_p, or solve of X_i if p == i
+    size_t c0, c1;
+} solve_task_t;
+
+static void _solve_tile_task(void *args, int index)
+{
+    solve_task_t *task = (solve_task_t *)args + index;
+    solve_arg_t *arg = task->arg;
+    TYPE **f = arg->F->coeff, **x = arg->X->coeff;
+    size_t n = arg->F->rows, nb = arg->nb, c0 = task->c0, c1 = task->c1;
+    size_t i0 = task->i*nb, i1 = _tile_end(task->i, nb, n);
+    size_t p0 = task->p*nb, p1 = _tile_end(task->p, nb, n);
+    if(task->i != task->p){
+        for (size_t i = i0; i < i1; i++)
+            for (size_t p = p0; p < p1; p++)
+                kernels->axpy(c1 - c0, -(task->trans ? f[p][i] : f[i][p]), x[p] + c0, x[i] + c0);
+        return;
+    }
+    for (size_t s = 0; s < i1 - i0; s++){
+        size_t i = task->backward ? i1-1-s : i0+s;
+        size_t b = task->backward ? i+1 : i0, e = task->backward ? i1 : i;
+        for (size_t p = b; p < e; p++)
+            kernels->axpy(c1 - c0, -(task->trans ? f[p][i] : f[i][p]), x[p] + c0, x[i] + c0);
+        if(!task->unit)
+            for (size_t c = c0; c < c1; c++)
+                x[i][c] /= f[i][i];
+    }
+}
+
+// Forward (lower) then backward (upper, or lower transposed if trans) substitutions
+static void _solve(const matrix_t *F, matrix_t *X, int unit, int trans)
+{
+    size_t n = F->rows, nb = FACTOR_BLOCK, tiles = (n + nb - 1) / nb, count = 0;
+    size_t blocks = (X->columns + SOLVE_COLUMNS - 1) / SOLVE_COLUMNS;
+    if(!n || !blocks)return;
+    solve_arg_t arg = {F, X, nb};
+    solve_task_t *tasks = malloc(blocks*tiles*(tiles+1) * sizeof(solve_task_t) + tiles * sizeof(int));
+    if(!tasks){
+        perror(__func__);
+        return;
+    }
+    int *last = (int *)(tasks + blocks*tiles*(tiles+1));
+    thread_pool_graph_t *graph = thread_pool_graph_create();
+    int built = graph != NULL;
+    for (size_t block = 0; block < blocks; block++){
+        size_t c0 = block*SOLVE_COLUMNS, c1 = c0 + SOLVE_COLUMNS < X->columns ? c0 + SOLVE_COLUMNS : X->columns;
+        for (size_t t = 0; t < tiles; t++)
+            last[t] = -1;
+        for (int backward = 0; backward < 2; backward++)
+            for (size_t s = 0; s < tiles; s++){
+                size_t i = backward ? tiles-1-s : s;
+                // Updates by the tiles already solved, then the diagonal tile
+                for (size_t t = 0; t <= s; t++){
+                    size_t p = backward ? tiles-1-t : t;
+                    tasks[count] = (solve_task_t){&arg, backward, backward && trans, !backward && unit, i, p, c0, c1};
+                    built &= _tile_add(graph, _solve_tile_task, tasks, count++, &last[i], p != i ? last[p] : -1, -1);
+                }
+            }
+    }
+    _tile_run(graph, built, _solve_tile_task, tasks, count);
+    thread_pool_graph_destroy(graph);
+    free(tasks);
+}
+
+void factor_lu_solve(const matrix_t *LU, const size_t *piv, matrix_t *X)
+{
+    for (size_t i = 0; i < LU->rows; i++){
+        if(piv[i] != i){
+            TYPE *row = X->coeff[i];
+            X->coeff[i] = X->coeff[piv[i]];
+            X->coeff[piv[i]] = row;
+        }
+    }
+    _solve(LU, X, 1, 0);
+}
+
+void factor_cholesky_solve(const matrix_t *L, matrix_t *X)
+{
+    _solve(L, X, 0, 1);
+}
+
+void factor_lu_solve_vector(const matrix_t *LU, const size_t *piv, TYPE *x, int trans)
+{
+    TYPE **a = LU->coeff;
+    size_t n = LU->rows;
+    if(!trans){
+        for (size_t i = 0; i < n; i++){
+            TYPE tmp = x[i]; x[i] = x[piv[i]]; x[piv[i]] = tmp;
+        }
+        for (size_t i = 0; i < n; i++){
+            TYPE sum = x[i];
+            for (size_t p = 0; p < i; p++)
+                sum -= a[i][p] * x[p];
+            x[i] = sum;
+        }
+        for (size_t i = n; i-- > 0;){
+            TYPE sum = x[i];
+            for (size_t p = i+1; p < n; p++)
+                sum -= a[i][p] * x[p];
+            x[i] = sum / a[i][i];
+        }
+        return;
+    }
+    // AT = UT * LT * P: rows of U and L are read in order, updating the remaining unknowns
+    for (size_t i = 0; i < n; i++){
+        x[i] /= a[i][i];
+        TYPE xi = x[i];
+        #pragma GCC ivdep
+        for (size_t p = i+1; p < n; p++)
+            x[p] -= a[i][p] * xi;
+    }
+    for (size_t i = n; i-- > 0;){
+        TYPE xi = x[i];
+        #pragma GCC ivdep
+        for (size_t p = 0; p < i; p++)
+            x[p] -= a[i][p] * xi;
+    }
+    for (size_t i = n; i-- > 0;){
+        TYPE tmp = x[i]; x[i] = x[piv[i]]; x[piv[i]] = tmp;
+    }
+}
+
+void factor_cholesky_solve_vector(const matrix_t *L, TYPE *x)
+{
+    TYPE **a = L->coeff;
+    size_t n = L->rows;
+    for (size_t i = 0; i < n; i++){
+        TYPE sum = x[i];
+        for (size_t p = 0; p < i; p++)
+            sum -= a[i][p] * x[p];
+        x[i] = sum / a[i][i];
+    }
+    for (size_t i = n; i-- > 0;){
+        x[i] /= a[i][i];
+        TYPE xi = x[i];
+        #pragma GCC ivdep
+        for (size_t p = 0; p < i; p++)
+            x[p] -= a[i][p] * xi;
+    }
+}
+
+static int _is_symetric(const matrix_t *matrix)
+{
+    if(matrix->flags & MATRIX_SYMETRIC)return 1;
+    for (size_t i = 0; i < matrix->rows; i++)
+        for (size_t j = 0; j < i; j++)
+            if(matrix->coeff[i][j] != matrix->coeff[j][i])return 0;
+    return 1;
+}
+
+TYPE matrix_slogdet(const matrix_t *matrix, TYPE *sign)
+{
+    *sign = 0;
+    if(!sanity_check((void *)matrix, __func__))return NAN;
+    if(!square_check(matrix, __func__))return NAN;
+    size_t n = matrix->rows;
+    TYPE logdet = 0;
+    matrix_t *A = matrix_copy(matrix);
+    if(!A)return NAN;
+    // Positive definite matrices take the Cholesky path, the others fall back to LU
+    if(_is_symetric(matrix) && factor_cholesky(A)){
+        for (size_t i = 0; i < n; i++)
+            logdet += log(A->coeff[i][i]);
+        matrix_free(A);
+        *sign = 1;
+        return 2 * logdet;
+    }
+    matrix_free(A);
+    A = matrix_copy(matrix);
+    size_t *piv = malloc((n+1)*sizeof(size_t));
+    if(!A || !piv){
+        perror(__func__);
+        free(piv);
+        if(A)matrix_free(A);
+        return NAN;
+    }
+    int s;
+    if(!factor_lu(A, piv, &s)){
+        free(piv);
+        matrix_free(A);
+        return -INFINITY;
+    }
+    for (size_t i = 0; i < n; i++){
+        TYPE u = A->coeff[i][i];
+        if(u < 0)s = -s;
+        logdet += log(fabs(u));
+    }
+    free(piv);
+    matrix_free(A);
+    *sign = s;
+    return logdet;
+}
+
+TYPE matrix_logdet(const matrix_t *matrix)
+{
+    TYPE sign;
+    TYPE logdet = matrix_slogdet(matrix, &sign);
+    return sign < 0 ? NAN : logdet;
+}
@@ -0,0 +1,264 @@
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "matrix.h"
+#include "check.h"
+#include "factor.h"
+
+// Matrix functions from a handful of products and LU solves.
+// expm: scaling and squaring with the Padé approximants of Higham, SIAM J. Matrix Anal. Appl. 26(4), 2005.
+// sqrtm: scaled Denman-Beavers iteration. logm: inverse scaling and squaring, then the [8/8] Padé
+// approximant of log(I+X) in partial fractions, i.e. 8 points Gauss-Legendre quadrature.
+#define SQRTM_MAX_ITER 50
+#define LOGM_MAX_ROOTS 40
+// ||X||1 under which the [8/8] Padé approximant of log(I+X) reaches double precision (Higham's θ8 = 0.367)
+#define LOGM_THETA 0.25
+
+static const TYPE theta[] = {1.495585217958292e-2, 2.539398330063230e-1, 9.504178996162932e-1, 2.097847961257068e0, 5.371920351148152e0};
+static const TYPE pade3[] = {120, 60, 12, 1};
+static const TYPE pade5[] = {30240, 15120, 3360, 420, 30, 1};
+static const TYPE pade7[] = {17297280, 8648640, 1995840, 277200, 25200, 1512, 56, 1};
+static const TYPE pade9[] = {17643225600., 8821612800., 2075673600., 302702400., 30270240., 2162160., 110880., 3960., 90., 1.};
+static const TYPE pade13[] = {64764752532480000., 32382376266240000., 7771770303897600., 1187353796428800., 129060195264000.,
+                              10559470521600., 670442572800., 33522128640., 1323241920., 40840800., 960960., 16380., 182., 1.};
+static const TYPE gauss_nodes[] = {0.1834346424956498, 0.5255324099163290, 0.7966664774136267, 0.9602898564975363};
+static const TYPE gauss_weights[] = {0.3626837833783620, 0.3137066458778873, 0.2223810344533745, 0.1012285362903763};
+
+static TYPE _norm1(const matrix_t *A)
+{
+    TYPE norm = 0;
+    for (size_t j = 0; j < A->columns; j++){
+        TYPE sum = 0;
+        for (size_t i = 0; i < A->rows; i++)
+            sum += fabs(A->coeff[i][j]);
+        norm = fmax(norm, sum);
+    }
+    return norm;
+}
+
+// Return identity * c + sum of coefs[i] * M[i], NULL matrices are skipped
+static matrix_t * _lincomb(size_t n, TYPE c, size_t count, const TYPE *coefs, matrix_t **M)
+{
+    matrix_t *C = matrix_create(n, n);
+    if(!C)return NULL;
+    for (size_t i = 0; i < n; i++){
+        TYPE *row = C->coeff[i];
+        row[i] = c;
+        for (size_t k = 0; k < count; k++){
+            if(!M[k])continue;
+            const TYPE *m = M[k]->coeff[i];
+            TYPE alpha = coefs[k];
+            #pragma GCC ivdep
+            for (size_t j = 0; j < n; j++)
+                row[j] += alpha * m[j];
+        }
+    }
+    return C;
+}
+
+// Return A^-1 * B, B = NULL for A^-1
+static matrix_t * _solve(const matrix_t *A, const matrix_t *B, const char *function_name)
+{
+    size_t n = A->rows;
+    matrix_t *F = matrix_copy(A), *X = B ? matrix_copy(B) : matrix_identity(n);
+    size_t *piv = malloc((n+1)*sizeof(size_t));
+    int sign;
+    if(!F || !X || !piv){
+        perror(function_name);
+    } else if(factor_lu(F, piv, &sign)){
+        factor_lu_solve(F, piv, X);
+        matrix_free(F);
+        free(piv);
+        return X;
+    } else {
+        fprintf(stderr, "%s: not inversible matrix\n", function_name);
+    }
+    if(F)matrix_free(F);
+    if(X)matrix_free(X);
+    free(piv);
+    return NULL;
+}
+
+static void _free_all(size_t count, matrix_t **M)
+{
+    for (size_t i = 0; i < count; i++)
+        if(M[i])matrix_free(M[i]);
+}
+
+// (V - U)^-1 * (V + U)
+static matrix_t * _pade_quotient(matrix_t *U, matrix_t *V)
+{
+    if(!U || !V)return NULL;
+    size_t n = U->rows;
+    TYPE minus[] = {1, -1}, plus[] = {1, 1};
+    matrix_t *M[] = {V, U};
+    matrix_t *P = _lincomb(n, 0, 2, minus, M), *Q = _lincomb(n, 0, 2, plus, M), *R = NULL;
+    if(P && Q)
+        R = _solve(P, Q, "matrix_expm_f");
+    if(P)matrix_free(P);
+    if(Q)matrix_free(Q);
+    return R;
+}
+
+matrix_t * matrix_expm_f(const matrix_t *A)
+{
+    if(!sanity_check((void *)A, __func__))return NULL;
+    if(!square_check(A, __func__))return NULL;
+    size_t n = A->rows;
+    TYPE norm = _norm1(A);
+    matrix_t *P[4] = {NULL}, *U = NULL, *V = NULL, *R = NULL;
+    // Degrees 3 to 9 evaluated on A itself, with the even powers shared between U and V
+    static const TYPE *low[] = {pade3, pade5, pade7, pade9};
+    for (int d = 0; d < 4; d++){
+        if(norm > theta[d])continue;
+        size_t m = 2*d + 3;
+        P[0] = matrix_mult_f(A, A);
+        for (size_t k = 1; k < m/2; k++)
+            P[k] = P[k-1] ? matrix_mult_f(P[k-1], P[0]) : NULL;
+        const TYPE *b = low[d];
+        TYPE odd[4], even[4];
+        for (size_t k = 0; k < m/2; k++){
+            odd[k] = b[2*k+3];
+            even[k] = b[2*k+2];
+        }
+        matrix_t *W = _lincomb(n, b[1], m/2, odd, P);
+        U = W ? matrix_mult_f(A, W) : NULL;
+        V = _lincomb(n, b[0], m/2, even, P);
+        R = _pade_quotient(U, V);
+        if(W)matrix_free(W);
+        goto end;
+    }
+    {
+        // Degree 13 on A / 2^s, then s squarings
+        int s = norm > theta[4] ? (int)ceil(log2(norm / theta[4])) : 0;
+        matrix_t *As = matrix_mult_scalar_f(A, ldexp(1, -s));
+        const TYPE *b = pade13;
+        if(!As)return NULL;
+        matrix_t *A2 = matrix_mult_f(As, As);
+        matrix_t *A4 = A2 ? matrix_mult_f(A2, A2) : NULL;
+        matrix_t *A6 = A4 ? matrix_mult_f(A4, A2) : NULL;
+        P[0] = A2; P[1] = A4; P[2] = A6;
+        if(!A6){
+            matrix_free(As);
+            goto end;
+        }
+        TYPE c1[] = {b[13], b[11], b[9]}, c2[] = {b[7], b[5], b[3]};
+        TYPE c3[] = {b[12], b[10], b[8]}, c4[] = {b[6], b[4], b[2]};
+        matrix_t *M[] = {A6, A4, A2};
+        matrix_t *W1 = _lincomb(n, 0, 3, c1, M);
+        matrix_t *W2 = W1 ? matrix_mult_f(A6, W1) : NULL;
+        matrix_t *W3 = _lincomb(n, b[1], 3, c2, M);
+        TYPE one[] = {1, 1};
+        matrix_t *W23[] = {W2, W3};
+        matrix_t *W = W2 && W3 ? _lincomb(n, 0, 2, one, W23) : NULL;
+        U = W ? matrix_mult_f(As, W) : NULL;
+        matrix_t *Z1 = _lincomb(n, 0, 3, c3, M);
+        matrix_t *Z2 = Z1 ? matrix_mult_f(A6, Z1) : NULL;
+        matrix_t *Z3 = _lincomb(n, b[0], 3, c4, M);
+        matrix_t *Z23[] = {Z2, Z3};
+        V = Z2 && Z3 ? _lincomb(n, 0, 2, one, Z23) : NULL;
+        R = _pade_quotient(U, V);
+        matrix_t *tmp[] = {As, W1, W2, W3, W, Z1, Z2, Z3};
+        _free_all(8, tmp);
+        for (int i = 0; R && i < s; i++){
+            matrix_t *R2 = matrix_mult_f(R, R);
+            matrix_free(R);
+            R = R2;
+        }
+    }
+end:
+    _free_all(4, P);
+    if(U)matrix_free(U);
+    if(V)matrix_free(V);
+    return R;
+}
+
+matrix_t * matrix_sqrtm_f(const matrix_t *A)
+{
+    if(!sanity_check((void *)A, __func__))return NULL;
+    if(!square_check(A, __func__))return NULL;
+    size_t n = A->rows;
+    matrix_t *Y = matrix_copy(A), *Z = matrix_identity(n);
+    for (int iter = 0; Y && Z && iter < SQRTM_MAX_ITER; iter++){
+        matrix_t *Yi = _solve(Y, NULL, __func__), *Zi = _solve(Z, NULL, __func__);
+        if(!Yi || !Zi){
+            if(Yi)matrix_free(Yi);
+            if(Zi)matrix_free(Zi);
+            break;
+        }
+        // Determinantal scaling |det(Y)*det(Z)|^(-1/2n) speeds up the first iterations
+        TYPE sign, mu = exp(-(matrix_slogdet(Y, &sign) + matrix_slogdet(Z, &sign)) / (2*n));
+        TYPE cy[] = {mu / 2, 1 / (2 * mu)};
+        matrix_t *MY[] = {Y, Zi}, *MZ[] = {Z, Yi};
+        matrix_t *Y1 = _lincomb(n, 0, 2, cy, MY), *Z1 = _lincomb(n, 0, 2, cy, MZ);
+        matrix_free(Yi);
+        matrix_free(Zi);
+        TYPE diff[] = {1, -1};
+        matrix_t *D[] = {Y1, Y};
+        matrix_t *delta = Y1 ? _lincomb(n, 0, 2, diff, D) : NULL;
+        int converged = delta && _norm1(delta) <= sqrt(n) * DBL_EPSILON * _norm1(Y1);
+        if(delta)matrix_free(delta);
+        matrix_free(Y);
+        matrix_free(Z);
+        Y = Y1;
+        Z = Z1;
+        if(converged){
+            matrix_free(Z);
+            return Y;
+        }
+    }
+    fprintf(stderr, "%s: no convergence\n", __func__);
+    if(Y)matrix_free(Y);
+    if(Z)matrix_free(Z);
+    return NULL;
+}
+
+matrix_t * matrix_logm_f(const matrix_t *A)
+{
+    if(!sanity_check((void *)A, __func__))return NULL;
+    if(!square_check(A, __func__))return NULL;
+    size_t n = A->rows;
+    matrix_t *X = matrix_copy(A), *L = NULL;
+    TYPE minus[] = {1};
+    int roots = 0;
+    // A^(1/2^k) = I + X with ||X||1 <= LOGM_THETA
+    while(X){
+        matrix_t *M[] = {X};
+        matrix_t *D = _lincomb(n, -1, 1, minus, M);
+        TYPE norm = D ? _norm1(D) : 0;
+        if(D && norm <= LOGM_THETA){
+            matrix_free(X);
+            X = D;
+            break;
+        }
+        if(D)matrix_free(D);
+        matrix_t *R = roots < LOGM_MAX_ROOTS ? matrix_sqrtm_f(X) : NULL;
+        matrix_free(X);
+        X = R;
+        roots++;
+    }
+    if(!X)return NULL;
+    // log(I+X) = sum of w_j * X * (I + x_j*X)^-1 on the Gauss-Legendre points of [0, 1]
+    L = matrix_create(n, n);
+    for (int j = 0; L && j < 8; j++){
+        TYPE node = (1 + (j < 4 ? -1 : 1) * gauss_nodes[j % 4]) / 2, weight = gauss_weights[j % 4] / 2;
+        TYPE c[] = {node};
+        matrix_t *M[] = {X};
+        matrix_t *B = _lincomb(n, 1, 1, c, M);
+        matrix_t *T = B ? _solve(B, X, __func__) : NULL;
+        if(B)matrix_free(B);
+        if(!T){
+            matrix_free(L);
+            L = NULL;
+            break;
+        }
+        TYPE scale = weight * ldexp(1, roots);
+        for (size_t i = 0; i < n; i++)
+            for (size_t k = 0; k < n; k++)
+                L->coeff[i][k] += scale * T->coeff[i][k];
+        matrix_free(T);
+    }
+    matrix_free(X);
+    return L;
+}
@@ -0,0 +1,15 @@
+#ifndef BLAS
+#define BLAS
+// Level 1 and 2 kernels on contiguous vectors, dispatched on the library thread pool for large sizes
+TYPE *  blas_vector_create(size_t n);                                                       // Creates a 0-filled aligned vector of size n
+void    blas_vector_free(TYPE *x);                                                          // Destroys a vector
+void    blas_copy(size_t n, const TYPE *x, TYPE *y);                                        // y = x
+void    blas_scal(size_t n, TYPE alpha, TYPE *x);                                           // x = α * x
+void    blas_axpy(size_t n, TYPE alpha, const TYPE *x, TYPE *y);                            // y = α * x + y
+void    blas_axpby(size_t n, TYPE alpha, const TYPE *x, TYPE beta, TYPE *y);                // y = α * x + β * y
+TYPE    blas_dot(size_t n, const TYPE *x, const TYPE *y);                                   // Return x.y
+TYPE    blas_nrm2(size_t n, const TYPE *x);                                                 // Return ||x||2
+void    blas_gemv(TYPE alpha, const matrix_t *A, const TYPE *x, TYPE beta, TYPE *y);        // y = α * A * x + β * y
+int     blas_gevm(TYPE alpha, const TYPE *x, const matrix_t *A, TYPE beta, TYPE *y);        // y = α * xT * A + β * y. Return 0 on error, y unchanged
+void    blas_gemm_kernel(size_t m, size_t k, size_t n, const TYPE *A, size_t lda, const TYPE *B, size_t ldb, TYPE *C, size_t ldc); // C += A * B, serial, on row-major strided blocks
+#endif
@@ -0,0 +1,30 @@
+#ifndef MATRIX_DIST
+#define MATRIX_DIST
+#include <mpi.h>
+// Distributed matrices, built apart as libmatrix_dist with mpicc (make dist). Blocks of block*block coefficients
+// are dealt 2D block-cyclic on a p*q grid of ranks: block (I, J) lives on the rank of grid coordinates (I%p, J%q),
+// each rank keeping its blocks in their order in one local matrix. Every function is collective over the grid
+// and computes on its local blocks with the library kernels and thread pool. MPI must be initialised, with at
+// least MPI_THREAD_FUNNELED: only the calling thread communicates.
+typedef struct {
+    MPI_Comm comm;                                                                          // Duplicate of the communicator of the grid
+    MPI_Comm row, column;                                                                   // Ranks of the same grid row, indexed by column, and of the same grid column
+    int rank, p, q;
+    int prow, pcol;                                                                         // Coordinates of this rank, rank = prow*q + pcol
+} matrix_grid_t;
+typedef struct {
+    matrix_grid_t *grid;
+    size_t rows, columns, block;                                                            // Global sizes
+    matrix_t *local;                                                                        // Blocks of this rank, rows contiguous: coeff[i] = coeff[0] + i*columns. Freed by matrix_dist_free
+} matrix_dist_t;
+matrix_grid_t * matrix_grid_create(MPI_Comm comm, int p, int q);                            // p*q grid of the ranks of comm, 0, 0 for the squarest one. Return NULL on error
+void            matrix_grid_free(matrix_grid_t *grid);
+matrix_dist_t * matrix_dist_create(matrix_grid_t *grid, size_t rows, size_t columns, size_t block); // 0-filled rows*columns matrix of block*block blocks (0 for 64)
+void            matrix_dist_free(matrix_dist_t *A);
+int             matrix_dist_scatter(matrix_dist_t *A, const matrix_t *M, int root);         // A = M of rank root, M unused elsewhere. Return 0 on error
+matrix_t *      matrix_dist_gather(const matrix_dist_t *A, int root);                       // Return A on rank root, NULL on the other ranks and on error
+int             matrix_dist_gemm(matrix_dist_t *C, const matrix_dist_t *A, const matrix_dist_t *B); // C = A * B by SUMMA, same grid and block. Return 0 on error
+int             matrix_dist_cholesky(matrix_dist_t *A);                                     // A = L*LT in the lower triangle of A. Return 0 if not positive definite or on error
+int             matrix_dist_lu(matrix_dist_t *A, size_t *piv);                              // P*A = L*U in A as factor_lu, piv of A rows entries on every rank. Return 0 if singular or on error
+int             matrix_dist_lu_solve(const matrix_dist_t *LU, const size_t *piv, matrix_dist_t *B); // B = A^-1 * B from the factors of matrix_dist_lu. Return 0 on error
+#endif
@@ -0,0 +1,11 @@
+#ifndef FACTOR
+#define FACTOR
+// Blocked in place factorisations, trailing updates dispatched on the library thread pool
+int     factor_lu(matrix_t *A, size_t *piv, int *sign);         // P*A = L*U in A (L unit lower), row i was swapped with piv[i]. Return 0 if singular
+int     factor_cholesky(matrix_t *A);                           // A = L*LT in the lower triangle of A. Return 0 if A is not positive definite
+void    factor_lu_solve(const matrix_t *LU, const size_t *piv, matrix_t *X);            // X = A^-1 * X from the factors of factor_lu
+void    factor_lu_solve_vector(const matrix_t *LU, const size_t *piv, TYPE *x, int trans);  // x = A^-1 * x, or A^-T * x if trans
+void    factor_cholesky_solve(const matrix_t *L, matrix_t *X);                          // X = A^-1 * X from the factor of factor_cholesky
+void    factor_cholesky_solve_vector(const matrix_t *L, TYPE *x);                       // x = A^-1 * x
+void    factor_reflect(TYPE **v, size_t m, size_t k, const TYPE *tau, TYPE **b, size_t columns, int trans); // b = Q*b, or QT*b if trans, Q = H_0*...*H_k-1 stored as in LAPACK below the diagonal of the m rows of v
+#endif
@@ -0,0 +1,26 @@
+#ifndef KERNELS
+#define KERNELS
+// Serial inner kernels, compiled once per instruction set from kernels.c and selected from cpuid by libmatrix_init
+// Operations of the elementwise kernel
+enum {
+    ELEMENTWISE_ADD,                                                                        // z = x + y
+    ELEMENTWISE_SUB,                                                                        // z = x - y
+    ELEMENTWISE_MUL,                                                                        // z = x * y
+    ELEMENTWISE_SCALE,                                                                      // z = α * x, y unused
+    ELEMENTWISE_AXPY                                                                        // z = α * x + y
+};
+typedef struct {
+    const char *isa;
+    void (*gemm)(size_t m, size_t k, size_t n, const TYPE *A, size_t lda, const TYPE *B, size_t ldb, TYPE *C, size_t ldc); // C += A * B on row-major strided blocks
+    TYPE (*dot)(size_t n, const TYPE *x, const TYPE *y);                                    // Return x.y
+    void (*axpy)(size_t n, TYPE alpha, const TYPE *x, TYPE *y);                             // y = α * x + y
+    void (*axpby)(size_t n, TYPE alpha, const TYPE *x, TYPE beta, TYPE *y);                 // y = α * x + β * y
+    void (*elementwise)(int op, size_t n, TYPE alpha, const TYPE *x, const TYPE *y, TYPE *z); // z = op(x, y), z may be x or y
+    void (*stream)(size_t n, const TYPE *x, TYPE *z);                                       // z = x with non-temporal stores, bypassing the caches
+    void (*scal)(size_t n, TYPE alpha, const TYPE *x, TYPE *y);                             // y = α * x, x and y may be the same
+    void (*gather)(size_t n, TYPE *const *rows, size_t column, TYPE *y);                    // y[i] = rows[i][column], a transposed row
+} kernels_t;
+
+extern const kernels_t *kernels;                                                            // Kernels in use
+extern const kernels_t kernels_sse2, kernels_avx2, kernels_avx512;
+#endif
@@ -3,23 +3,66 @@
 #define ALIGN 32
 // #define TYPE double
 // typedef float __attribute__((aligned (64))) TYPE;
-typedef double __attribute__((aligned (ALIGN))) TYPE;
+// Rows are ALIGN-aligned at allocation. The element type keeps its natural alignment,
+// otherwise loops starting in the middle of a row may be vectorized with aligned loads.
+// typedef double __attribute__((aligned (ALIGN))) TYPE;
+typedef double TYPE;
 // typedef _Complex double __attribute__((aligned (ALIGN))) COMPLEX_TYPE;
 typedef _Complex double COMPLEX_TYPE;
+// Structure properties cached in matrix_t.flags. They describe the coefficients: clear them
+// when writing directly into coeff.
+enum {
+    MATRIX_SYMETRIC = 1,                                                                    // coeff[i][j] == coeff[j][i]
+    MATRIX_LOWER = 2,                                                                       // Lower triangle (packed storage, triangular matrix)
+    MATRIX_UPPER = 4                                                                        // Upper triangle (packed storage, triangular matrix)
+};
 typedef struct {
     size_t rows;
     size_t columns;
     TYPE **coeff;
+    int flags;
 } matrix_t;
+// Packed triangle of a square matrix: n*(n+1)/2 coefficients stored row after row
+typedef struct {
+    size_t n;
+    int flags;                                                                              // MATRIX_LOWER or MATRIX_UPPER, with MATRIX_SYMETRIC if the other half mirrors it
+    TYPE *data;
+} matrix_packed_t;
+
+enum {
+    MULT_CLASSIC,
+    MULT_STRASSEN
+};
 
 // Library initialisation
 int         libmatrix_init(void);
 int         libmatrix_end(void);
+int         matrix_isa_select(const char *isa);                                             // Use the "sse2", "avx2" or "avx512" kernels, NULL for the best of the cpu. Return 0 if unsupported
+const char *matrix_isa(void);                                                               // Instruction set of the kernels in use
+// Block parameters, derived from the host by default and overridden by the profile libmatrix_init loads
+typedef struct {
+    size_t threads;                                                                         // Threads of the single pool every kernel shares, applied at libmatrix_init
+    size_t mult_step;                                                                       // Tile and rows per task of matrix_mult_f
+    size_t plu_step;                                                                        // Tile of matrix_plu_f and of its triangular solvers
+    size_t gemm_tile;                                                                       // Cache tile of the gemm kernel
+    size_t factor_block;                                                                    // Panel width of the blocked LU and Cholesky factorisations
+    size_t factor_rows;                                                                     // Rows of one trailing update task
+    size_t strassen_cutoff;                                                                 // Dimension under which Strassen recursion stops
+    size_t pool_spin;                                                                       // Pauses an idle thread polls the queue before parking, 0 parks at once
+    size_t stream_size;                                                                     // Bytes of elementwise results above which they bypass the caches, the last level cache by default
+} matrix_tuning_t;
+void        matrix_tuning_defaults(matrix_tuning_t *t);                                     // Fills t with the values derived from the host
+void        matrix_tuning_get(matrix_tuning_t *t);                                          // Fills t with the values in use
+int         matrix_tuning_set(const matrix_tuning_t *t);                                    // Use t. Return 0 if a value is out of range
+int         matrix_tuning_load(const char *filename);                                       // Use a profile, NULL for $MATRIX_TUNING or ~/.libmatrix_tuning. Return 0 if not read
+int         matrix_tuning_save(const char *filename);                                       // Write the values in use to a profile, NULL as above
+int         matrix_autotune(const char *filename, size_t n);                                // Search the fastest values on n*n problems (0 for 512), use and save them
 // Matrix creation functions
 matrix_t *  matrix_create(size_t rows, size_t columns);                         // Creates a 0-filled rows*columns matrix
 matrix_t *  matrix_identity(size_t n);                                                // Creates Identity matrix of rank n
 matrix_t *  matrix_permutation(size_t line1, size_t line2, size_t n);     // Creates a permutation matrix of rank n for two lines
 matrix_t *  matrix_copy(const matrix_t *matrix);                                            // Copies a matrix
+int         matrix_set_symetric(matrix_t *matrix, int symetric);                            // Caller asserts (1) or withdraws (0) MATRIX_SYMETRIC, then trusted without a check. Return 0 if not square
 
 // Matrix destruction functions
 void        matrix_free(matrix_t *matrix);                                                  // Destroys a matrix
@@ -30,16 +73,34 @@ void        matrix_free(matrix_t *matrix);
 matrix_t *  matrix_transp_f(const matrix_t *matrix);                                        // Return transposed matrix
 matrix_t *  matrix_add_f(const matrix_t *matrix1, const matrix_t *matrix2);                 // Return matrix1 + matrix2
 matrix_t *  matrix_mult_scalar_f(const matrix_t *matrix, TYPE lambda);                      // Return λ * matrix
+matrix_t *  matrix_sub_f(const matrix_t *matrix1, const matrix_t *matrix2);                 // Return matrix1 - matrix2
+matrix_t *  matrix_axpy_f(TYPE alpha, const matrix_t *X, const matrix_t *Y);                // Return α * X + Y
+matrix_t *  matrix_hadamard_f(const matrix_t *matrix1, const matrix_t *matrix2);            // Return the elementwise product of matrix1 and matrix2
+matrix_t *  matrix_map_f(const matrix_t *matrix, TYPE (*f)(TYPE));                          // Return f applied to every coefficient
 matrix_t *  matrix_mult_f(const matrix_t *matrix1, const matrix_t *matrix2);                // Return matrix1 * matrix2
 matrix_t *  OMPmatrix_mult_f(const matrix_t *matrix1, const matrix_t *matrix2);                // Return matrix1 * matrix2
 matrix_t *  MONOmatrix_mult_f(const matrix_t *matrix1, const matrix_t *matrix2);                // Return matrix1 * matrix2
 matrix_t *  matrix_pow_f(const matrix_t *matrix, int pow);                                  // Return matrix^pow
+matrix_t *  matrix_mult_strassen_f(const matrix_t *matrix1, const matrix_t *matrix2);       // Return matrix1 * matrix2 with Strassen-Winograd recursion, normwise accurate only
+void        matrix_mult_algorithm(int algorithm);                                           // Selects MULT_CLASSIC (default) or MULT_STRASSEN for matrix_mult_f
+void        matrix_strassen_cutoff(size_t cutoff);                                          // Dimension under which Strassen recursion stops (default 512, min 16), see matrix_tuning_t
+int         matrix_gemv_f(TYPE alpha, const matrix_t *A, const matrix_t *x, TYPE beta, matrix_t *y);    // y = α*A*x + β*y for column vectors x and y
+int         matrix_gevm_f(TYPE alpha, const matrix_t *x, const matrix_t *A, TYPE beta, matrix_t *y);    // y = α*x*A + β*y for row vectors x and y
+
+// Symmetric and triangular operations computing and storing one half only
+matrix_packed_t * matrix_pack(const matrix_t *matrix, int flags);                           // Packs the triangle given by flags (MATRIX_LOWER or MATRIX_UPPER, optionally | MATRIX_SYMETRIC)
+matrix_t *  matrix_unpack(const matrix_packed_t *packed);                                   // Return full matrix, mirrored if symetric, zero-filled otherwise
+void        matrix_packed_free(matrix_packed_t *packed);                                    // Destroys a packed matrix
+TYPE        matrix_packed_get(const matrix_packed_t *packed, size_t i, size_t j);           // Return coefficient (i, j) of a packed matrix, NAN out of it
+matrix_t *  matrix_syrk_f(const matrix_t *matrix);                                          // Return matrix * matrixT, flagged symetric
+matrix_packed_t * matrix_syrk_packed_f(const matrix_t *matrix);                             // Return lower packed matrix * matrixT
+matrix_t *  matrix_symm_f(const matrix_packed_t *S, const matrix_t *B);                     // Return S * B for a packed symetric S
 
-// Raw methods. For fun only. Do never use them, cuz you've NO reason to use them. Really.
-TYPE        matrix_det_raw_f(const matrix_t *matrix);                                       // Return |matrix| with brute force method
-matrix_t *  matrix_inverse_raw_f(const matrix_t *matrix);                                   // Return matrix^-1 computed with brute force method
-matrix_t *  matrix_solve_raw_f(const matrix_t *A, const matrix_t *B);                       // Resolve AX=B with brute force method. Return X
-matrix_t *  matrix_com_f(const matrix_t *matrix);                                           // Return comatrix
+// Cofactor methods, O(n^3) through one complete pivoting LU. Prefer the PLU methods to solve or inverse.
+TYPE        matrix_det_raw_f(const matrix_t *matrix);                                       // Return |matrix| with complete pivoting LU
+matrix_t *  matrix_inverse_raw_f(const matrix_t *matrix);                                   // Return matrix^-1 by substitution on the complete pivoting LU
+matrix_t *  matrix_solve_raw_f(const matrix_t *A, const matrix_t *B);                       // Resolve AX=B with matrix_inverse_raw_f. Return X
+matrix_t *  matrix_com_f(const matrix_t *matrix);                                           // Return comatrix, also for singular matrix
 matrix_t *  matrix_comp_f(const matrix_t *matrix);                                          // Return complementary matrix
 
 // Highly optimized fast methods based upon PLU decomposition for square matrix.
@@ -51,4 +112,78 @@ matrix_t *  matrix_inverse_plu_f(const matrix_t *matrix);
 TYPE matrix_det_cholesky_f(const matrix_t *matrix);
 matrix_t * matrix_solve_cholesky_f(const matrix_t *A, const matrix_t *B);                   // Resolve AX = B with Cholesky method. Return X
 matrix_t * matrix_inverse_cholesky_f(const matrix_t *matrix);                               // Return matrix^-1 computed with Cholesky method
+
+// Overflow safe determinant from one blocked factorisation: Cholesky for symetric positive definite matrix, PLU otherwise
+TYPE        matrix_slogdet(const matrix_t *matrix, TYPE *sign);                              // Return log(abs(|matrix|)), sign receives -1, 0 or 1. -inf if singular
+TYPE        matrix_logdet(const matrix_t *matrix);                                          // Return log(|matrix|), NaN if |matrix| < 0
+
+// Solvers reporting the quality of their result, from the factors they compute anyway
+typedef struct {
+    int compute_residual;                                                                   // In: also compute residual and backward_error, one more O(n^2) pass per column
+    TYPE rcond;                                                                             // Out: estimate of 1 / (||A||1 * ||A^-1||1), 0 if singular
+    TYPE residual;                                                                          // Out: max over columns of ||B - A*X||1
+    TYPE backward_error;                                                                    // Out: max over columns of ||B - A*X||1 / (||A||1 * ||X||1 + ||B||1)
+} solve_info_t;
+matrix_t *  matrix_solve_plu_x_f(const matrix_t *A, const matrix_t *B, solve_info_t *info);     // Resolve AX=B with partial pivoting PLU. Return X, info may be NULL
+matrix_t *  matrix_solve_cholesky_x_f(const matrix_t *A, const matrix_t *B, solve_info_t *info);// Resolve AX=B with real Cholesky for positive definite A. Return X, info may be NULL
+TYPE        matrix_rcond_f(const matrix_t *matrix);                                         // Return estimate of the reciprocal 1-norm condition number
+
+// Householder QR for any shape, TSQR with parallel row blocks for tall and skinny matrix
+int         matrix_qr_f(const matrix_t *A, matrix_t **Q, matrix_t **R);                     // A = Q*R with k = min(rows, columns), Q rows*k orthonormal, R k*columns. Q or R may be NULL
+matrix_t *  matrix_solve_lstsq_f(const matrix_t *A, const matrix_t *B);                     // Return X minimizing ||AX-B||2, minimum norm one if A is wide. A must be of full rank
+
+// Spectral decompositions. Eigenvalues and singular values are returned as column matrix.
+int         matrix_eigen_sym_f(const matrix_t *A, matrix_t **values, matrix_t **vectors);   // A = V*diag(values)*VT, values ascending. vectors may be NULL to get values only
+int         matrix_eigen_sym_topk_f(const matrix_t *A, size_t k, matrix_t **values, matrix_t **vectors); // k largest eigenpairs, values descending, vectors rows*k or NULL
+int         matrix_svd_f(const matrix_t *A, matrix_t **U, matrix_t **S, matrix_t **V);      // Thin A = U*diag(S)*VT, S descending. Any output may be NULL
+
+// Matrix functions from a dozen products and LU solves instead of truncated series
+matrix_t *  matrix_expm_f(const matrix_t *A);                                               // Return exp(A), Padé scaling and squaring
+matrix_t *  matrix_sqrtm_f(const matrix_t *A);                                              // Return principal square root, NULL if A has eigenvalues on ]-inf, 0]
+matrix_t *  matrix_logm_f(const matrix_t *A);                                               // Return principal logarithm, inverse scaling and squaring
+
+// Iterative Krylov solvers. Each column of B is solved independently, starting from X = 0.
+enum {
+    PRECOND_NONE,                                                                           // No preconditioning
+    PRECOND_JACOBI,                                                                         // Inverse of the diagonal
+    PRECOND_ILU0,                                                                           // Incomplete LU restricted to the non-zero pattern of A
+    PRECOND_ICHOL0                                                                          // Incomplete Cholesky restricted to the non-zero pattern of A (SPD only)
+};
+typedef void (*matrix_operator_t)(void *args, const TYPE *x, TYPE *y);                      // Computes y = Op(x)
+typedef struct {
+    TYPE    tol;                                                                            // Relative residual ||b-Ax||/||b|| to reach (default 1e-10)
+    size_t  max_iter;                                                                       // Maximum number of operator applications per right-hand side (default 10*n)
+    size_t  restart;                                                                        // GMRES restart length (default 30)
+    int     precond;                                                                        // PRECOND_* used by the matrix_t solvers (default PRECOND_NONE)
+    size_t  iter;                                                                           // Out: highest number of iterations over all right-hand sides
+    TYPE    residual;                                                                       // Out: highest final relative residual over all right-hand sides
+} solver_opts_t;
+void        solver_opts_default(solver_opts_t *opts);                                       // Fills opts with default values
+matrix_t *  matrix_solve_cg_f(const matrix_t *A, const matrix_t *B, solver_opts_t *opts);   // Resolve AX=B with preconditioned conjugate gradient (A SPD). Return X
+matrix_t *  matrix_solve_gmres_f(const matrix_t *A, const matrix_t *B, solver_opts_t *opts);// Resolve AX=B with restarted GMRES(m). Return X
+matrix_t *  matrix_solve_bicgstab_f(const matrix_t *A, const matrix_t *B, solver_opts_t *opts); // Resolve AX=B with BiCGSTAB. Return X
+// Same solvers for a user supplied operator of rank n and an optional preconditioner (NULL for none).
+// x holds the initial guess and receives the solution. Return 1 if converged, 0 otherwise.
+int         operator_solve_cg(size_t n, matrix_operator_t op, void *op_args, matrix_operator_t precond, void *precond_args, const TYPE *b, TYPE *x, solver_opts_t *opts);
+int         operator_solve_gmres(size_t n, matrix_operator_t op, void *op_args, matrix_operator_t precond, void *precond_args, const TYPE *b, TYPE *x, solver_opts_t *opts);
+int         operator_solve_bicgstab(size_t n, matrix_operator_t op, void *op_args, matrix_operator_t precond, void *precond_args, const TYPE *b, TYPE *x, solver_opts_t *opts);
+
+// Batched operations on arrays of same-size small matrices, parallelised across the batch.
+// Sizes 2, 3, 4, 8, 16 and 32 use size-specialised kernels. Return 1 on success, 0 on error or if a matrix is singular.
+typedef struct {
+    size_t count;                                                                           // Number of matrices
+    size_t rows;
+    size_t columns;
+    size_t stride;                                                                          // Distance in coefficients between two consecutive matrices
+    TYPE *data;                                                                             // Row-major matrices, matrix i starts at data + i*stride
+} matrix_batch_t;
+matrix_batch_t * matrix_batch_create(size_t count, size_t rows, size_t columns);           // Creates a batch of count 0-filled rows*columns matrices
+void        matrix_batch_free(matrix_batch_t *batch);                                       // Destroys a batch
+TYPE *      matrix_batch_get(const matrix_batch_t *batch, size_t i);                        // Return the coefficients of matrix i
+int         matrix_batch_mult(const matrix_batch_t *A, const matrix_batch_t *B, matrix_batch_t *C); // C[i] = A[i] * B[i]
+int         matrix_batch_lu(matrix_batch_t *A, int *piv);                                   // In place PLU of each A[i], piv receives count*rows pivot rows
+int         matrix_batch_cholesky(matrix_batch_t *A);                                       // In place lower Cholesky factor of each A[i]
+int         matrix_batch_solve(const matrix_batch_t *A, matrix_batch_t *B);                 // B[i] = A[i]^-1 * B[i]
+int         matrix_batch_inverse(const matrix_batch_t *A, matrix_batch_t *inv);             // inv[i] = A[i]^-1
+int         matrix_batch_det(const matrix_batch_t *A, TYPE *det);                           // det[i] = |A[i]|
 #endif
\ No newline at end of file
@@ -0,0 +1,18 @@
+#ifndef OOC
+#define OOC
+// Out of core matrices: square tiles stored one after the other in a file, read through a tile cache bounded
+// by a memory budget shared by all the open files. The next tiles are read by an I/O thread while the current
+// ones are computed on the library thread pool. The operations work by column strips of tiles, each pinned
+// whole: they need a budget of about three strips (a row strip and two tiles for the product).
+typedef struct matrix_ooc matrix_ooc_t;
+matrix_ooc_t *  matrix_ooc_create(const char *path, size_t rows, size_t columns, size_t tile);  // Creates a 0-filled rows*columns file of tile*tile tiles (0 for 256)
+matrix_ooc_t *  matrix_ooc_open(const char *path);                                          // Opens a file of matrix_ooc_create
+int             matrix_ooc_close(matrix_ooc_t *A);                                          // Writes back the cached tiles and closes. Return 0 on I/O error
+void            matrix_ooc_size(const matrix_ooc_t *A, size_t *rows, size_t *columns, size_t *tile);
+int             matrix_ooc_write(matrix_ooc_t *A, const matrix_t *M, size_t row, size_t column); // Copies M to the block of A at (row, column). Return 0 on error
+matrix_t *      matrix_ooc_read(matrix_ooc_t *A, size_t row, size_t column, size_t rows, size_t columns); // Return a copy of a rows*columns block of A
+int             matrix_ooc_gemm(matrix_ooc_t *C, matrix_ooc_t *A, matrix_ooc_t *B);         // C = A * B, same tiles. Return 0 on error
+int             matrix_ooc_cholesky(matrix_ooc_t *A);                                       // A = L*LT in the lower triangle of A. Return 0 if not positive definite or on error
+int             matrix_ooc_lu(matrix_ooc_t *A, size_t *piv);                                // P*A = L*U in A as factor_lu, piv of A rows entries. Return 0 if singular or on error
+int             matrix_ooc_budget(size_t bytes);                                            // Bytes of resident tiles of all the files (default 1 GiB). Return 0 for 0
+#endif
@@ -1,7 +1,14 @@
 #ifndef MATRIX_TOOLS
 #define MATRIX_TOOLS
-matrix_t *  matrix_random(int rows, int columns);                                           // Creates a random-filled rows*columns matrix (-10<Aij<10)
-matrix_t *  matrix_symetric_random(int rows, int columns);                                  // Creates a 0-filled rows*columns symetric matrix
+#include <stdint.h>
+// Random matrices, filled in parallel from counter based streams: a given seed reproduces the same sequence of matrices
+void        matrix_random_seed(uint64_t seed);                                              // Restart the sequence of random matrices from seed (seeded with time at libmatrix_init)
+matrix_t *  matrix_random(int rows, int columns);                                           // Creates a random-filled rows*columns matrix of integers (-10<Aij<10)
+matrix_t *  matrix_symetric_random(int rows, int columns);                                  // Creates a random-filled rows*columns symetric matrix of integers
+matrix_t *  matrix_random_uniform(size_t rows, size_t columns, TYPE a, TYPE b);             // Uniform coefficients in [a, b[
+matrix_t *  matrix_random_normal(size_t rows, size_t columns, TYPE mean, TYPE stddev);      // Normal coefficients
+matrix_t *  matrix_random_orthogonal(size_t n);                                             // Haar distributed orthogonal matrix
+matrix_t *  matrix_random_spd(size_t n, TYPE cond);                                         // Symetric positive definite matrix with eigenvalues from 1 down to 1/cond
 matrix_t *  str2matrix(int argc, char **argv, char separator);                              // Creates a matrix from 'separator' separated numbers from 'argc' strings
 matrix_t *  file2matrix(char *filename);                                                    // Creates a matrix from a file. Lines separated by line-feed, numbers separated by spaces
 
@@ -12,6 +19,32 @@ int         matrix2file(matrix_t *matrix, int precision, char * filename);
 
 char * format_time(const long long input_time, char* format);
 long long mstime(void);
-int test_matrix_equality(const matrix_t *matrix1, const matrix_t *matrix2, int precision);
-int matrix_diff(const matrix_t *matrix1, const matrix_t *matrix2, int precision, FILE *stream);
+
+// Parallel comparison kernels, usable as validation gates on large results. A NaN or an infinity is a mismatch in every mode
+enum {
+    COMPARE_ABS,                                                                            // |a-b| <= tol
+    COMPARE_REL,                                                                            // |a-b| <= tol * max(|a|, |b|)
+    COMPARE_ULP                                                                             // a and b at most tol representable doubles apart
+};
+typedef struct {
+    int mode;                                                                               // In: one of COMPARE_ABS, COMPARE_REL, COMPARE_ULP
+    TYPE tol;                                                                               // In: tolerance of the mode
+    int early_exit;                                                                         // In: stop at the first mismatch, statistics are then partial
+    size_t mismatches;                                                                      // Out: number of mismatching coefficients
+    TYPE max_abs, max_rel;                                                                  // Out: max absolute and relative errors
+    uint64_t max_ulp;                                                                       // Out: max distance in ULP
+    size_t row, column;                                                                     // Out: first mismatch in row major order, (rows, columns) if none
+} matrix_compare_t;
+int matrix_compare(const matrix_t *matrix1, const matrix_t *matrix2, matrix_compare_t *cmp); // Return 1 if all coefficients are within tolerance
+int test_matrix_equality(const matrix_t *matrix1, const matrix_t *matrix2, int precision);  // Return 1 if |a-b| <= 10^-precision everywhere, exits at the first mismatch
+int matrix_diff(const matrix_t *matrix1, const matrix_t *matrix2, int precision, FILE *stream); // Print mismatching rows only, then error statistics. Return 1 if equal
+// Thread pool priority and introspection
+enum {
+    MATRIX_PRIORITY_HIGH,                                                                   // Ahead of the other work, which yields between two chunks
+    MATRIX_PRIORITY_NORMAL,
+    MATRIX_PRIORITY_LOW                                                                     // Still served now and then under load
+};
+int matrix_priority(int priority);                                                          // Priority of the operations of the calling thread. Return the previous one, -1 if invalid
+int matrix_pool_report(FILE *stream, int reset);                                           // Print the pool counters, one line per thread, then restart them if reset
+int matrix_pool_sample(unsigned int period_ms);                                             // Print the counters of each period to stderr, 0 stops ($MATRIX_POOL_SAMPLE at libmatrix_init)
 #endif
@@ -0,0 +1,516 @@
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "matrix.h"
+#include "tools.h"
+#include "check.h"
+#include "blas.h"
+
+typedef struct {
+    int type;
+    size_t n;
+    TYPE *inv_diag;     // PRECOND_JACOBI
+    matrix_t *F;        // PRECOND_ILU0: unit L below the diagonal and U above. PRECOND_ICHOL0: lower factor L
+    TYPE *tmp;
+} precond_t;
+
+typedef int (*operator_solver_t)(size_t, matrix_operator_t, void *, matrix_operator_t, void *, const TYPE *, TYPE *, solver_opts_t *);
+
+void solver_opts_default(solver_opts_t *opts)
+{
+    if(!sanity_check((void *)opts, __func__))return;
+    opts->tol = 1e-10;
+    opts->max_iter = 0;
+    opts->restart = 30;
+    opts->precond = PRECOND_NONE;
+    opts->iter = 0;
+    opts->residual = 0;
+}
+
+static TYPE ** _vectors_create(size_t n, size_t count)
+{
+    TYPE **v = calloc(count, sizeof(TYPE *));
+    if(!v){
+        perror(__func__);
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++){
+        v[i] = blas_vector_create(n);
+        if(!v[i]){
+            for (size_t j = 0; j < i; j++)
+                blas_vector_free(v[j]);
+            free(v);
+            return NULL;
+        }
+    }
+    return v;
+}
+
+static void _vectors_free(TYPE **v, size_t count)
+{
+    if(!v)return;
+    for (size_t i = 0; i < count; i++)
+        blas_vector_free(v[i]);
+    free(v);
+}
+
+static inline void _precond_apply(matrix_operator_t precond, void *args, size_t n, const TYPE *x, TYPE *y)
+{
+    if(precond)
+        precond(args, x, y);
+    else
+        blas_copy(n, x, y);
+}
+
+// Return ||b - Ax|| / ||b||, tmp receives b - Ax
+static TYPE _residual(size_t n, matrix_operator_t op, void *op_args, const TYPE *b, const TYPE *x, TYPE *tmp, TYPE bnorm)
+{
+    op(op_args, x, tmp);
+    blas_axpby(n, 1, b, -1, tmp);
+    return blas_nrm2(n, tmp) / bnorm;
+}
+
+// Dense operator and preconditioners
+
+static void _dense_operator(void *args, const TYPE *x, TYPE *y)
+{
+    blas_gemv(1, (const matrix_t *)args, x, 0, y);
+}
+
+static void _jacobi_apply(void *args, const TYPE *x, TYPE *y)
+{
+    precond_t *p = args;
+    #pragma GCC ivdep
+    for (size_t i = 0; i < p->n; i++)
+        y[i] = p->inv_diag[i] * x[i];
+}
+
+static void _ilu0_apply(void *args, const TYPE *x, TYPE *y)
+{
+    precond_t *p = args;
+    TYPE **F = p->F->coeff;
+    size_t n = p->n;
+    for (size_t i = 0; i < n; i++){
+        TYPE sum = x[i];
+        for (size_t k = 0; k < i; k++)
+            sum -= F[i][k] * y[k];
+        y[i] = sum;
+    }
+    for (size_t i = n; i-- > 0;){
+        TYPE sum = y[i];
+        for (size_t k = i+1; k < n; k++)
+            sum -= F[i][k] * y[k];
+        y[i] = sum / F[i][i];
+    }
+}
+
+static void _ichol0_apply(void *args, const TYPE *x, TYPE *y)
+{
+    precond_t *p = args;
+    TYPE **L = p->F->coeff;
+    TYPE *z = p->tmp;
+    size_t n = p->n;
+    for (size_t i = 0; i < n; i++){
+        TYPE sum = x[i];
+        for (size_t k = 0; k < i; k++)
+            sum -= L[i][k] * z[k];
+        z[i] = sum / L[i][i];
+    }
+    // L^T is walked by rows of L so that memory is read contiguously
+    for (size_t i = n; i-- > 0;){
+        y[i] = z[i] / L[i][i];
+        for (size_t k = 0; k < i; k++)
+            z[k] -= L[i][k] * y[i];
+    }
+}
+
+static int _ilu0_factor(const matrix_t *A, matrix_t *F)
+{
+    size_t n = A->rows;
+    TYPE **a = A->coeff, **f = F->coeff;
+    for (size_t i = 1; i < n; i++){
+        for (size_t k = 0; k < i; k++){
+            if(a[i][k] == 0)continue;
+            if(f[k][k] == 0)return 0;
+            f[i][k] /= f[k][k];
+            for (size_t j = k+1; j < n; j++)
+                if(a[i][j] != 0)
+                    f[i][j] -= f[i][k] * f[k][j];
+        }
+    }
+    // A pivot with nothing to eliminate below it is never tested above, and the triangular solves divide by all of them
+    for (size_t k = 0; k < n; k++)
+        if(f[k][k] == 0)return 0;
+    return 1;
+}
+
+static int _ichol0_factor(const matrix_t *A, matrix_t *F)
+{
+    size_t n = A->rows;
+    TYPE **a = A->coeff, **f = F->coeff;
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = i+1; j < n; j++)
+            f[i][j] = 0;
+    for (size_t k = 0; k < n; k++){
+        if(f[k][k] <= 0)return 0;
+        f[k][k] = sqrt(f[k][k]);
+        for (size_t i = k+1; i < n; i++)
+            if(a[i][k] != 0)
+                f[i][k] /= f[k][k];
+        for (size_t i = k+1; i < n; i++){
+            if(f[i][k] == 0)continue;
+            for (size_t j = k+1; j <= i; j++)
+                if(a[i][j] != 0)
+                    f[i][j] -= f[i][k] * f[j][k];
+        }
+    }
+    return 1;
+}
+
+static void _precond_free(precond_t *p)
+{
+    if(!p)return;
+    if(p->F)
+        matrix_free(p->F);
+    blas_vector_free(p->inv_diag);
+    blas_vector_free(p->tmp);
+    free(p);
+}
+
+static int _jacobi_init(precond_t *p, const matrix_t *A)
+{
+    p->type = PRECOND_JACOBI;
+    p->inv_diag = blas_vector_create(p->n);
+    if(!p->inv_diag)return 0;
+    for (size_t i = 0; i < p->n; i++)
+        p->inv_diag[i] = A->coeff[i][i] != 0 ? 1 / A->coeff[i][i] : 1;
+    return 1;
+}
+
+static precond_t * _precond_create(const matrix_t *A, int type, const char *function_name)
+{
+    precond_t *p = calloc(1, sizeof(precond_t));
+    if(!p){
+        perror(__func__);
+        return NULL;
+    }
+    p->type = type;
+    p->n = A->rows;
+    switch(type){
+    case PRECOND_NONE:
+        break;
+    case PRECOND_JACOBI:
+        if(!_jacobi_init(p, A))goto failed;
+        break;
+    case PRECOND_ILU0:
+    case PRECOND_ICHOL0:
+        if(type == PRECOND_ICHOL0 && !symetry_check(A, function_name))goto failed;
+        p->F = matrix_copy(A);
+        p->tmp = blas_vector_create(p->n);
+        if(!p->F || !p->tmp)goto failed;
+        if(!(type == PRECOND_ILU0 ? _ilu0_factor(A, p->F) : _ichol0_factor(A, p->F))){
+            fprintf(stderr, "%s: incomplete factorisation breakdown, falling back to Jacobi\n", function_name);
+            matrix_free(p->F);
+            p->F = NULL;
+            if(!_jacobi_init(p, A))goto failed;
+        }
+        break;
+    default:
+        fprintf(stderr, "%s: unknown preconditioner %d\n", function_name, type);
+        goto failed;
+    }
+    return p;
+failed:
+    _precond_free(p);
+    return NULL;
+}
+
+static matrix_operator_t _precond_func(const precond_t *p)
+{
+    switch(p->type){
+    case PRECOND_JACOBI:
+        return _jacobi_apply;
+    case PRECOND_ILU0:
+        return _ilu0_apply;
+    case PRECOND_ICHOL0:
+        return _ichol0_apply;
+    default:
+        return NULL;
+    }
+}
+
+// Operator solvers
+
+static void _opts_resolve(solver_opts_t *opts, size_t n, TYPE *tol, size_t *max_iter)
+{
+    *tol = opts->tol > 0 ? opts->tol : 1e-10;
+    *max_iter = opts->max_iter > 0 ? opts->max_iter : 10*n;
+    opts->iter = 0;
+    opts->residual = 0;
+}
+
+int operator_solve_cg(size_t n, matrix_operator_t op, void *op_args, matrix_operator_t precond, void *precond_args, const TYPE *b, TYPE *x, solver_opts_t *opts)
+{
+    if(!sanity_check((void *)op, __func__))return 0;
+    if(!sanity_check((void *)b, __func__))return 0;
+    if(!sanity_check((void *)x, __func__))return 0;
+    solver_opts_t defaults;
+    if(!opts){
+        solver_opts_default(&defaults);
+        opts = &defaults;
+    }
+    TYPE tol;
+    size_t max_iter;
+    _opts_resolve(opts, n, &tol, &max_iter);
+    TYPE bnorm = blas_nrm2(n, b);
+    if(bnorm == 0){
+        memset(x, 0, n*sizeof(TYPE));
+        return 1;
+    }
+    TYPE **v = _vectors_create(n, 4);
+    if(!v)return 0;
+    TYPE *r = v[0], *z = v[1], *p = v[2], *q = v[3];
+    TYPE rel = _residual(n, op, op_args, b, x, r, bnorm);
+    _precond_apply(precond, precond_args, n, r, z);
+    blas_copy(n, z, p);
+    TYPE rz = blas_dot(n, r, z);
+    size_t iter = 0;
+    while(rel >= tol && iter < max_iter){
+        op(op_args, p, q);
+        TYPE pq = blas_dot(n, p, q);
+        if(pq == 0)break;
+        TYPE alpha = rz / pq;
+        blas_axpy(n, alpha, p, x);
+        blas_axpy(n, -alpha, q, r);
+        iter++;
+        rel = blas_nrm2(n, r) / bnorm;
+        if(rel < tol)break;
+        _precond_apply(precond, precond_args, n, r, z);
+        TYPE rz_new = blas_dot(n, r, z);
+        blas_axpby(n, 1, z, rz_new / rz, p);
+        rz = rz_new;
+    }
+    opts->iter = iter;
+    opts->residual = _residual(n, op, op_args, b, x, r, bnorm);
+    _vectors_free(v, 4);
+    return opts->residual < tol;
+}
+
+int operator_solve_bicgstab(size_t n, matrix_operator_t op, void *op_args, matrix_operator_t precond, void *precond_args, const TYPE *b, TYPE *x, solver_opts_t *opts)
+{
+    if(!sanity_check((void *)op, __func__))return 0;
+    if(!sanity_check((void *)b, __func__))return 0;
+    if(!sanity_check((void *)x, __func__))return 0;
+    solver_opts_t defaults;
+    if(!opts){
+        solver_opts_default(&defaults);
+        opts = &defaults;
+    }
+    TYPE tol;
+    size_t max_iter;
+    _opts_resolve(opts, n, &tol, &max_iter);
+    TYPE bnorm = blas_nrm2(n, b);
+    if(bnorm == 0){
+        memset(x, 0, n*sizeof(TYPE));
+        return 1;
+    }
+    TYPE **w = _vectors_create(n, 7);
+    if(!w)return 0;
+    TYPE *r = w[0], *r0 = w[1], *p = w[2], *v = w[3], *s = w[4], *t = w[5], *z = w[6];
+    TYPE rel = _residual(n, op, op_args, b, x, r, bnorm);
+    blas_copy(n, r, r0);
+    TYPE rho = 1, alpha = 1, omega = 1;
+    size_t iter = 0;
+    while(rel >= tol && iter < max_iter){
+        TYPE rho_new = blas_dot(n, r0, r);
+        if(rho_new == 0 || omega == 0)break;
+        TYPE beta = (rho_new / rho) * (alpha / omega);
+        rho = rho_new;
+        // p = r + β(p - ωv)
+        blas_axpy(n, -omega, v, p);
+        blas_axpby(n, 1, r, beta, p);
+        _precond_apply(precond, precond_args, n, p, z);
+        op(op_args, z, v);
+        TYPE r0v = blas_dot(n, r0, v);
+        if(r0v == 0)break;
+        alpha = rho / r0v;
+        blas_axpy(n, alpha, z, x);
+        blas_copy(n, r, s);
+        blas_axpy(n, -alpha, v, s);
+        iter++;
+        rel = blas_nrm2(n, s) / bnorm;
+        if(rel < tol)break;
+        _precond_apply(precond, precond_args, n, s, z);
+        op(op_args, z, t);
+        TYPE tt = blas_dot(n, t, t);
+        omega = tt != 0 ? blas_dot(n, t, s) / tt : 0;
+        blas_axpy(n, omega, z, x);
+        blas_copy(n, s, r);
+        blas_axpy(n, -omega, t, r);
+        rel = blas_nrm2(n, r) / bnorm;
+    }
+    opts->iter = iter;
+    opts->residual = _residual(n, op, op_args, b, x, r, bnorm);
+    _vectors_free(w, 7);
+    return opts->residual < tol;
+}
+
+int operator_solve_gmres(size_t n, matrix_operator_t op, void *op_args, matrix_operator_t precond, void *precond_args, const TYPE *b, TYPE *x, solver_opts_t *opts)
+{
+    if(!sanity_check((void *)op, __func__))return 0;
+    if(!sanity_check((void *)b, __func__))return 0;
+    if(!sanity_check((void *)x, __func__))return 0;
+    solver_opts_t defaults;
+    if(!opts){
+        solver_opts_default(&defaults);
+        opts = &defaults;
+    }
+    TYPE tol;
+    size_t max_iter;
+    _opts_resolve(opts, n, &tol, &max_iter);
+    size_t m = opts->restart > 0 ? opts->restart : 30;
+    if(m > n)m = n;
+    TYPE bnorm = blas_nrm2(n, b);
+    if(bnorm == 0){
+        memset(x, 0, n*sizeof(TYPE));
+        return 1;
+    }
+    TYPE **V = _vectors_create(n, m+3);
+    TYPE *H = calloc((m+1)*m + 3*(m+1), sizeof(TYPE));
+    if(!V || !H){
+        perror(__func__);
+        _vectors_free(V, m+3);
+        free(H);
+        return 0;
+    }
+    TYPE *w = V[m+1], *z = V[m+2];
+    TYPE *cs = H + (m+1)*m, *sn = cs + m+1, *g = sn + m+1;
+    size_t iter = 0;
+    TYPE rel = _residual(n, op, op_args, b, x, w, bnorm);
+    int breakdown = 0;
+    while(rel >= tol && iter < max_iter && !breakdown){
+        TYPE beta = rel * bnorm;
+        blas_copy(n, w, V[0]);
+        blas_scal(n, 1 / beta, V[0]);
+        memset(g, 0, (m+1)*sizeof(TYPE));
+        g[0] = beta;
+        size_t k = 0;
+        while(k < m && iter < max_iter){
+            _precond_apply(precond, precond_args, n, V[k], z);
+            op(op_args, z, w);
+            // Modified Gram-Schmidt against the current Krylov basis
+            for (size_t i = 0; i <= k; i++){
+                H[i*m+k] = blas_dot(n, w, V[i]);
+                blas_axpy(n, -H[i*m+k], V[i], w);
+            }
+            TYPE hn = blas_nrm2(n, w);
+            H[(k+1)*m+k] = hn;
+            if(hn != 0){
+                blas_copy(n, w, V[k+1]);
+                blas_scal(n, 1 / hn, V[k+1]);
+            }
+            for (size_t i = 0; i < k; i++){
+                TYPE tmp = cs[i]*H[i*m+k] + sn[i]*H[(i+1)*m+k];
+                H[(i+1)*m+k] = -sn[i]*H[i*m+k] + cs[i]*H[(i+1)*m+k];
+                H[i*m+k] = tmp;
+            }
+            TYPE denom = hypot(H[k*m+k], hn);
+            if(denom == 0){
+                breakdown = 1;
+                break;
+            }
+            cs[k] = H[k*m+k] / denom;
+            sn[k] = hn / denom;
+            H[k*m+k] = denom;
+            H[(k+1)*m+k] = 0;
+            g[k+1] = -sn[k] * g[k];
+            g[k] = cs[k] * g[k];
+            k++;
+            iter++;
+            if(fabs(g[k]) / bnorm < tol || hn == 0)break;
+        }
+        // Solve the k*k upper triangular least-squares system in place in g
+        for (size_t i = k; i-- > 0;){
+            TYPE sum = g[i];
+            for (size_t j = i+1; j < k; j++)
+                sum -= H[i*m+j] * g[j];
+            g[i] = sum / H[i*m+i];
+        }
+        memset(w, 0, n*sizeof(TYPE));
+        for (size_t i = 0; i < k; i++)
+            blas_axpy(n, g[i], V[i], w);
+        _precond_apply(precond, precond_args, n, w, z);
+        blas_axpy(n, 1, z, x);
+        rel = _residual(n, op, op_args, b, x, w, bnorm);
+    }
+    opts->iter = iter;
+    opts->residual = rel;
+    _vectors_free(V, m+3);
+    free(H);
+    return rel < tol;
+}
+
+// Dense matrix solvers
+
+static matrix_t * _matrix_solve_krylov(operator_solver_t solver, const matrix_t *A, const matrix_t *B, solver_opts_t *opts, const char *function_name)
+{
+    if(!sanity_check((void *)A, function_name))return NULL;
+    if(!sanity_check((void *)B, function_name))return NULL;
+    if(!square_check(A, function_name))return NULL;
+    if(A->rows != B->rows){
+        fprintf(stderr, "%s: not solvable system (A->rows != B->rows)\n", function_name);
+        return NULL;
+    }
+    solver_opts_t defaults;
+    if(!opts){
+        solver_opts_default(&defaults);
+        opts = &defaults;
+    }
+    size_t n = A->rows, m = B->columns;
+    matrix_t *X = NULL;
+    TYPE **v = NULL;
+    precond_t *p = _precond_create(A, opts->precond, function_name);
+    if(!p)return NULL;
+    v = _vectors_create(n, 2);
+    if(!v)goto finally;
+    X = matrix_create(n, m);
+    if(!X)goto finally;
+    TYPE *b = v[0], *x = v[1];
+    solver_opts_t col_opts = *opts;
+    opts->iter = 0;
+    opts->residual = 0;
+    int converged = 1;
+    for (size_t j = 0; j < m; j++){
+        for (size_t i = 0; i < n; i++){
+            b[i] = B->coeff[i][j];
+            x[i] = 0;
+        }
+        converged &= solver(n, _dense_operator, (void *)A, _precond_func(p), p, b, x, &col_opts);
+        for (size_t i = 0; i < n; i++)
+            X->coeff[i][j] = x[i];
+        if(col_opts.iter > opts->iter)opts->iter = col_opts.iter;
+        if(col_opts.residual > opts->residual)opts->residual = col_opts.residual;
+    }
+    if(!converged)
+        fprintf(stderr, "%s: no convergence (%zu iterations, residual %g)\n", function_name, opts->iter, opts->residual);
+finally:
+    _vectors_free(v, 2);
+    _precond_free(p);
+    return X;
+}
+
+matrix_t * matrix_solve_cg_f(const matrix_t *A, const matrix_t *B, solver_opts_t *opts)
+{
+    return _matrix_solve_krylov(operator_solve_cg, A, B, opts, __func__);
+}
+
+matrix_t * matrix_solve_gmres_f(const matrix_t *A, const matrix_t *B, solver_opts_t *opts)
+{
+    return _matrix_solve_krylov(operator_solve_gmres, A, B, opts, __func__);
+}
+
+matrix_t * matrix_solve_bicgstab_f(const matrix_t *A, const matrix_t *B, solver_opts_t *opts)
+{
+    return _matrix_solve_krylov(operator_solve_bicgstab, A, B, opts, __func__);
+}
@@ -0,0 +1,132 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <immintrin.h>
+#include "matrix.h"
+#include "kernels.h"
+
+// Built once per KERNEL_ISA by the makefile with the matching -m flags: the loops below are written
+// for the auto-vectoriser, which widens them to the registers of each instruction set.
+#ifndef KERNEL_ISA
+#define KERNEL_ISA sse2
+#endif
+#define _CONCAT(a, b) a ## b
+#define CONCAT(a, b) _CONCAT(a, b)
+#define _STRING(a) #a
+#define STRING(a) _STRING(a)
+
+// Widest non-temporal store of the instruction set
+#if defined(__AVX512F__)
+#define STREAM_BYTES 64
+#define STREAM(z, x) _mm512_stream_pd(z, _mm512_loadu_pd(x))
+#elif defined(__AVX__)
+#define STREAM_BYTES 32
+#define STREAM(z, x) _mm256_stream_pd(z, _mm256_loadu_pd(x))
+#else
+#define STREAM_BYTES 16
+#define STREAM(z, x) _mm_stream_pd(z, _mm_loadu_pd(x))
+#endif
+
+// Cache tile of the gemm kernel
+#define GEMM_TILE tuning.gemm_tile
+
+extern matrix_tuning_t tuning;
+
+static void _gemm(size_t m, size_t k, size_t n, const TYPE *A, size_t lda, const TYPE *B, size_t ldb, TYPE *C, size_t ldc)
+{
+    // Tiles of B are reused across all the rows of the corresponding tile of A
+    for (size_t kk = 0; kk < k; kk += GEMM_TILE){
+        size_t ke = k < kk+GEMM_TILE ? k : kk+GEMM_TILE;
+        for (size_t jj = 0; jj < n; jj += GEMM_TILE){
+            size_t je = n < jj+GEMM_TILE ? n : jj+GEMM_TILE;
+            for (size_t i = 0; i < m; i++){
+                TYPE *c = C + i*ldc;
+                const TYPE *a = A + i*lda;
+                for (size_t p = kk; p < ke; p++){
+                    TYPE aip = a[p];
+                    const TYPE *b = B + p*ldb;
+                    #pragma GCC ivdep
+                    for (size_t j = jj; j < je; j++)
+                        c[j] += aip * b[j];
+                }
+            }
+        }
+    }
+}
+
+static TYPE _dot(size_t n, const TYPE *x, const TYPE *y)
+{
+    TYPE sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += x[i] * y[i];
+    return sum;
+}
+
+static void _axpy(size_t n, TYPE alpha, const TYPE *x, TYPE *y)
+{
+    #pragma GCC ivdep
+    for (size_t i = 0; i < n; i++)
+        y[i] += alpha * x[i];
+}
+
+static void _axpby(size_t n, TYPE alpha, const TYPE *x, TYPE beta, TYPE *y)
+{
+    #pragma GCC ivdep
+    for (size_t i = 0; i < n; i++)
+        y[i] = alpha * x[i] + beta * y[i];
+}
+
+// One loop per operation, so that each of them is vectorised on its own
+static void _elementwise(int op, size_t n, TYPE alpha, const TYPE *x, const TYPE *y, TYPE *z)
+{
+    switch(op){
+    case ELEMENTWISE_ADD:
+        for (size_t i = 0; i < n; i++)
+            z[i] = x[i] + y[i];
+        break;
+    case ELEMENTWISE_SUB:
+        for (size_t i = 0; i < n; i++)
+            z[i] = x[i] - y[i];
+        break;
+    case ELEMENTWISE_MUL:
+        for (size_t i = 0; i < n; i++)
+            z[i] = x[i] * y[i];
+        break;
+    case ELEMENTWISE_SCALE:
+        for (size_t i = 0; i < n; i++)
+            z[i] = alpha * x[i];
+        break;
+    case ELEMENTWISE_AXPY:
+        for (size_t i = 0; i < n; i++)
+            z[i] = alpha * x[i] + y[i];
+        break;
+    }
+}
+
+static void _stream(size_t n, const TYPE *x, TYPE *z)
+{
+    const size_t width = STREAM_BYTES / sizeof(TYPE);
+    size_t i = 0;
+    // Plain stores up to the first aligned vector and after the last one
+    for (; i < n && (uintptr_t)(z + i) % STREAM_BYTES; i++)
+        z[i] = x[i];
+    for (; i + width <= n; i += width)
+        STREAM(z + i, x + i);
+    for (; i < n; i++)
+        z[i] = x[i];
+    // Streamed lines are weakly ordered: publish them before the caller signals completion
+    _mm_sfence();
+}
+
+static void _scal(size_t n, TYPE alpha, const TYPE *x, TYPE *y)
+{
+    for (size_t i = 0; i < n; i++)
+        y[i] = alpha * x[i];
+}
+
+static void _gather(size_t n, TYPE *const *rows, size_t column, TYPE *y)
+{
+    for (size_t i = 0; i < n; i++)
+        y[i] = rows[i][column];
+}
+
+const kernels_t CONCAT(kernels_, KERNEL_ISA) = {STRING(KERNEL_ISA), _gemm, _dot, _axpy, _axpby, _elementwise, _stream, _scal, _gather};
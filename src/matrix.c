@@ -8,20 +8,69 @@
 #include "matrix.h"
 #include "tools.h"
 #include "check.h"
+#include "blas.h"
+#include "kernels.h"
 #include "thread_pool.h"
 
+// Side of the tiles of the parallel transposition
+#define TRANSPOSE_TILE 64
+
 // Matrix creation functions
 thread_pool_t thread_pool;
+int mult_algorithm = MULT_CLASSIC;
+extern matrix_tuning_t tuning;
+const kernels_t *kernels = &kernels_sse2;
+
+int matrix_isa_select(const char *isa)
+{
+    __builtin_cpu_init();
+    int avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    int avx512 = avx2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")
+                      && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512bw");
+    const kernels_t *table[] = {&kernels_sse2, &kernels_avx2, &kernels_avx512};
+    int supported[] = {1, avx2, avx512};
+    if(!isa){
+        kernels = avx512 ? &kernels_avx512 : avx2 ? &kernels_avx2 : &kernels_sse2;
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(table)/sizeof(table[0]); i++){
+        if(strcmp(isa, table[i]->isa))continue;
+        if(!supported[i]){
+            fprintf(stderr, "%s: %s not supported by this cpu\n", __func__, isa);
+            return 0;
+        }
+        kernels = table[i];
+        return 1;
+    }
+    fprintf(stderr, "%s: unknown instruction set %s\n", __func__, isa);
+    return 0;
+}
+
+const char * matrix_isa(void)
+{
+    return kernels->isa;
+}
+
 int libmatrix_init(void)
 {
+    // Kernels of the best instruction set of this cpu, unless MATRIX_ISA forces one
+    if(!matrix_isa_select(getenv("MATRIX_ISA")))
+        matrix_isa_select(NULL);
+    // Host derived block parameters, then the tuning profile if there is one
+    matrix_tuning_defaults(&tuning);
+    matrix_tuning_load(NULL);
     //Creating thread pool
-    int nthreads = 3*get_nprocs()/2;
-    // int nthreads = 2;
-    // printf("Création d'un pool de \x1b[36m%d\x1b[0m threads\n", nthreads);
-    if(thread_pool_create(&thread_pool, nthreads, NULL) != THREAD_POOL_OK){
+    // printf("Création d'un pool de \x1b[36m%zu\x1b[0m threads\n", tuning.threads);
+    if(thread_pool_create(&thread_pool, tuning.threads, NULL) != THREAD_POOL_OK){
         printf("\x1b[31mproblem0\x1b[0m\n");
         return 0;
     }
+    thread_pool_set_spin(&thread_pool, tuning.pool_spin);
+    // Load balance and queue saturation of a production run, without rebuilding it
+    const char *sample = getenv("MATRIX_POOL_SAMPLE");
+    if(sample && atoi(sample) > 0)
+        matrix_pool_sample(atoi(sample));
+    matrix_random_seed((uint64_t)time(NULL));
     return 1;
 }
 
@@ -44,6 +93,7 @@ matrix_t * matrix_create(size_t rows, size_t columns)
         goto failed_matrix;
     matrix->rows = rows;
     matrix->columns = columns;
+    matrix->flags = 0;
     matrix->coeff = malloc(rows*sizeof(TYPE *));
     if (!matrix->coeff)
         goto failed_coeff;
@@ -86,6 +136,7 @@ matrix_t * matrix_copy(const matrix_t *matrix)
     if(!sanity_check((void *)matrix, __func__))return NULL; 
     matrix_t *copy = matrix_create(matrix->rows, matrix->columns);
     if(copy){
+        copy->flags = matrix->flags;
         for (size_t i = 0; i < matrix->rows; i++) {
             copy->coeff[i] = __builtin_assume_aligned(copy->coeff[i], ALIGN);
             matrix->coeff[i] = __builtin_assume_aligned(matrix->coeff[i], ALIGN);
@@ -117,15 +168,25 @@ typedef struct {
     const matrix_t *matrix;
 }transpose_arg_t;
 
-static void _transpose_task(void* args, int i)
+// Tiles of TRANSPOSE_TILE*TRANSPOSE_TILE so that both the read columns and the written rows stay in cache
+static void _transpose_task(void* args, size_t ib, size_t ie, size_t jb, size_t je)
 {
     transpose_arg_t *arg = args;
     matrix_t *transpose_matrix = arg->transpose_matrix;
     const matrix_t *matrix = arg->matrix;
-    transpose_matrix->coeff[i] = __builtin_assume_aligned(transpose_matrix->coeff[i], ALIGN);
-    matrix->coeff[i] = __builtin_assume_aligned(matrix->coeff[i], ALIGN);
-    for (size_t j = 0; j < transpose_matrix->columns; j++)
-       transpose_matrix->coeff[i][j] = matrix->coeff[j][i];
+    for (size_t i = ib; i < ie; i++)
+        kernels->gather(je - jb, matrix->coeff + jb, i, transpose_matrix->coeff[i] + jb);
+}
+
+int matrix_set_symetric(matrix_t *matrix, int symetric)
+{
+    if(!sanity_check((void *)matrix, __func__))return 0;
+    if(!square_check(matrix, __func__))return 0;
+    if(symetric)
+        matrix->flags |= MATRIX_SYMETRIC;
+    else
+        matrix->flags &= ~MATRIX_SYMETRIC;
+    return 1;
 }
 
 matrix_t * matrix_transp_f(const matrix_t *matrix)
@@ -133,87 +194,87 @@ matrix_t * matrix_transp_f(const matrix_t *matrix)
     if(!sanity_check((void *)matrix, __func__))return NULL; 
     matrix_t *transpose_matrix = matrix_create(matrix->columns, matrix->rows);
     if(!transpose_matrix)return NULL;
+    transpose_matrix->flags = matrix->flags & MATRIX_SYMETRIC;
     transpose_arg_t arg = {transpose_matrix, matrix};
-    thread_pool_work_t work = {0, NULL, _transpose_task, (void *)&arg};
-    for (size_t i = 0; i < transpose_matrix->rows; i++){
-        thread_pool_queue_work(&thread_pool, &work, i);
-    }
-    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+    if(thread_pool_parallel_for_2d(&thread_pool, 0, transpose_matrix->rows, TRANSPOSE_TILE,
+                                   0, transpose_matrix->columns, TRANSPOSE_TILE, _transpose_task, &arg) != THREAD_POOL_OK){
         printf("\x1b[31mproblem\x1b[0m\n");
     }
     return transpose_matrix;
 }
 
-matrix_t * matrix_add_f(const matrix_t *matrix1, const matrix_t *matrix2)
-{  
-    if(!sanity_check((void *)matrix1, __func__))return NULL; 
-    if(!sanity_check((void *)matrix2, __func__))return NULL; 
-    if((matrix1->rows != matrix2->rows) || (matrix1->columns != matrix2->columns)){
-        fprintf(stderr, "%s: not addable matrix ((matrix1->rows != matrix2->rows) || (matrix1->columns != matrix2->columns))\n", __func__);
-        return NULL;
-    }
-    matrix_t *add_matrix = matrix_create(matrix1->rows, matrix1->columns);
-    if(add_matrix){
-        for (size_t i = 0; i < add_matrix->rows; i++) {
-            add_matrix->coeff[i] = __builtin_assume_aligned(add_matrix->coeff[i], ALIGN);
-            matrix1->coeff[i] = __builtin_assume_aligned(matrix1->coeff[i], ALIGN);
-            matrix2->coeff[i] = __builtin_assume_aligned(matrix2->coeff[i], ALIGN);
-            #pragma GCC ivdep
-            for (size_t j = 0; j < add_matrix->columns; j++) {
-                add_matrix->coeff[i][j] = matrix1->coeff[i][j] + matrix2->coeff[i][j];
-            }
-        }
-    }
-    return add_matrix;
-}
-
-matrix_t * matrix_mult_scalar_f(const matrix_t *matrix, TYPE lambda)
-{
-    if(!sanity_check((void *)matrix, __func__))return NULL;
-    matrix_t *mult_matrix = matrix_create(matrix->rows, matrix->columns);
-    if(mult_matrix){
-        for (size_t i = 0; i < matrix->rows; i++) {
-            mult_matrix->coeff[i] = __builtin_assume_aligned(mult_matrix->coeff[i], ALIGN);
-            matrix->coeff[i] = __builtin_assume_aligned(matrix->coeff[i], ALIGN);
-            #pragma GCC ivdep
-            for (size_t j = 0; j < matrix->columns; j++) {
-                mult_matrix->coeff[i][j]=lambda * matrix->coeff[i][j];
-            }
-        }
-    }
-    return mult_matrix;
-}
-
 typedef struct {
-    size_t n, m, step;
+    size_t n, m, p, step;
     const matrix_t *matrix1;
     matrix_t *mult, *columns;
 }mult_work_t;
 
-static void _mult_task(void* arg, int i)
+// One step*step block of the product
+static void _mult_task(void* arg, size_t ib, size_t ie, size_t jb, size_t je)
 {
     mult_work_t *work = arg;
-    size_t n = work->n;
-    size_t m = work->m;
-    size_t step = work->step;
+    size_t p = work->p;
     TYPE **matrix_coeff = work->matrix1->coeff;
     TYPE **mult_coeff = work->mult->coeff;
     TYPE **columns_coeff = work->columns->coeff;
-    int ie = n < i+step ? n : i+step;
-    for (size_t j = 0; j < m; j+=step) {
-        int je = m < j+step ? m : j+step;
-        for (int ii = i; ii < ie; ii++){
-            matrix_coeff[ii] = __builtin_assume_aligned(matrix_coeff[ii], ALIGN);
-            for (int jj = j; jj < je; jj++){
-                TYPE sum = 0;
-                columns_coeff[jj] = __builtin_assume_aligned(columns_coeff[jj], ALIGN);
-                for (size_t k = 0; k < n; k++)
-                    sum+=matrix_coeff[ii][k]*columns_coeff[jj][k];
-                mult_coeff[ii][jj] += sum;
-            }
-        }
+    for (size_t i = ib; i < ie; i++)
+        for (size_t j = jb; j < je; j++)
+            mult_coeff[i][j] += kernels->dot(p, matrix_coeff[i], columns_coeff[j]);
+}
+
+int matrix_gemv_f(TYPE alpha, const matrix_t *A, const matrix_t *x, TYPE beta, matrix_t *y)
+{
+    if(!sanity_check((void *)A, __func__))return 0;
+    if(!sanity_check((void *)x, __func__))return 0;
+    if(!sanity_check((void *)y, __func__))return 0;
+    if(x->columns != 1 || y->columns != 1 || x->rows != A->columns || y->rows != A->rows){
+        fprintf(stderr, "%s: not multiplicable vector (x must be A->columns*1 and y A->rows*1)\n", __func__);
+        return 0;
+    }
+    // Column vectors hold one coefficient per row: gather them once so the kernel streams contiguous memory
+    TYPE *vx = blas_vector_create(x->rows);
+    TYPE *vy = blas_vector_create(y->rows);
+    if(!vx || !vy){
+        blas_vector_free(vx);
+        blas_vector_free(vy);
+        return 0;
+    }
+    for (size_t i = 0; i < x->rows; i++)
+        vx[i] = x->coeff[i][0];
+    if(beta != 0)
+        for (size_t i = 0; i < y->rows; i++)
+            vy[i] = y->coeff[i][0];
+    blas_gemv(alpha, A, vx, beta, vy);
+    for (size_t i = 0; i < y->rows; i++)
+        y->coeff[i][0] = vy[i];
+    blas_vector_free(vx);
+    blas_vector_free(vy);
+    return 1;
+}
+
+int matrix_gevm_f(TYPE alpha, const matrix_t *x, const matrix_t *A, TYPE beta, matrix_t *y)
+{
+    if(!sanity_check((void *)A, __func__))return 0;
+    if(!sanity_check((void *)x, __func__))return 0;
+    if(!sanity_check((void *)y, __func__))return 0;
+    if(x->rows != 1 || y->rows != 1 || x->columns != A->rows || y->columns != A->columns){
+        fprintf(stderr, "%s: not multiplicable vector (x must be 1*A->rows and y 1*A->columns)\n", __func__);
+        return 0;
     }
+    return blas_gevm(alpha, x->coeff[0], A, beta, y->coeff[0]);
 }
+
+void matrix_mult_algorithm(int algorithm)
+{
+    mult_algorithm = algorithm;
+}
+
+void matrix_strassen_cutoff(size_t cutoff)
+{
+    // The blocked kernel is faster than the additions of one more level well above this size
+    tuning.strassen_cutoff = cutoff > 16 ? cutoff : 16;
+}
+
 matrix_t * matrix_mult_f(const matrix_t *matrix1, const matrix_t *matrix2)
 {
     if(!sanity_check((void *)matrix1, __func__))return NULL; 
@@ -222,17 +283,27 @@ matrix_t * matrix_mult_f(const matrix_t *matrix1, const matrix_t *matrix2)
         fprintf(stderr, "%s: not multiplicable matrix (matrix2->rows != matrix1->columns)\n", __func__);
         return NULL;
     }
-    matrix_t *mult = matrix_create(matrix1->columns, matrix2->columns);
+    if(mult_algorithm == MULT_STRASSEN && matrix1->rows > tuning.strassen_cutoff && matrix1->columns > tuning.strassen_cutoff && matrix2->columns > tuning.strassen_cutoff)
+        return matrix_mult_strassen_f(matrix1, matrix2);
+    matrix_t *mult = matrix_create(matrix1->rows, matrix2->columns);
     if(!sanity_check((void *)mult, __func__))return NULL;
+    // Matrix-vector products are memory bound: skip the transposition and the blocked kernel
+    if(matrix2->columns == 1 || matrix1->rows == 1){
+        int ok = matrix2->columns == 1 ? matrix_gemv_f(1, matrix1, matrix2, 0, mult) : matrix_gevm_f(1, matrix1, matrix2, 0, mult);
+        if(!ok){
+            matrix_free(mult);
+            return NULL;
+        }
+        return mult;
+    }
     matrix_t *columns = matrix_transp_f(matrix2);
-    if(!sanity_check((void *)columns, __func__))return NULL; 
-    size_t default_step = 2*sysconf(_SC_LEVEL1_DCACHE_LINESIZE)/sizeof(TYPE);
-    size_t step = default_step > 0 ? default_step:16;
-    mult_work_t args = {matrix1->rows, matrix2->columns, step, matrix1, mult, columns};
-    thread_pool_work_t work = {0, NULL, _mult_task, (void *)&args};
-    for (size_t i = 0; i < matrix1->rows; i+=step)
-        thread_pool_queue_work(&thread_pool, &work, i);
-    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+    if(!sanity_check((void *)columns, __func__)){
+        matrix_free(mult);
+        return NULL;
+    }
+    size_t step = tuning.mult_step;
+    mult_work_t args = {matrix1->rows, matrix2->columns, matrix1->columns, step, matrix1, mult, columns};
+    if(thread_pool_parallel_for_2d(&thread_pool, 0, matrix1->rows, step, 0, matrix2->columns, step, _mult_task, &args) != THREAD_POOL_OK){
         printf("\x1b[31mproblem\x1b[0m\n");
     }
     matrix_free(columns);
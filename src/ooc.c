@@ -0,0 +1,828 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "matrix.h"
+#include "check.h"
+#include "factor.h"
+#include "kernels.h"
+#include "ooc.h"
+#include "thread_pool.h"
+
+// File: a header of OOC_HEADER bytes, then the tiles in row major order of tiles, each of them tile*tile
+// coefficients, edge tiles padded with zeros.
+#define OOC_MAGIC "LIBMOOC1"
+#define OOC_HEADER 4096
+#define OOC_TILE 256
+#define OOC_BUDGET ((size_t)1 << 30)
+// Reads queued to the I/O thread at most
+#define OOC_REQUESTS 1024
+// Rows of a tile, or of a panel, per task
+#define OOC_ROWS 32
+#define OOC_PANEL_ROWS 1024
+
+extern thread_pool_t thread_pool;
+
+enum {
+    SLOT_EMPTY,
+    SLOT_LOADING,                                                       // Read by the I/O thread or by a _get
+    SLOT_WRITING,                                                       // Written back, the cache lock released meanwhile
+    SLOT_READY
+};
+
+typedef struct {
+    matrix_ooc_t *file;                                                 // NULL when free
+    size_t id;
+    int state;
+    int pins;
+    int dirty;
+    unsigned long long used;                                            // Clock of the last _get, the least recent is evicted
+    size_t bytes;
+    TYPE *data;
+} slot_t;
+
+struct matrix_ooc {
+    int fd;
+    size_t rows, columns, tile;
+    size_t tile_rows, tile_columns;
+    slot_t **slot_of;                                                   // Cached slot of each tile, under the cache lock
+    int error;
+};
+
+// Tile cache of all the open files
+static struct {
+    slot_t **slots;
+    size_t nb_slots, size_slots;
+    size_t resident, budget;
+    unsigned long long clock;
+    int files;                                                          // Open files, the I/O thread runs while there is one
+    pthread_t io;
+    fifo_t requests;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} cache = {.budget = OOC_BUDGET, .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+// Sent to the I/O thread to stop it
+static slot_t stop;
+
+static inline size_t _extent(size_t total, size_t tile, size_t i)
+{
+    return total - i*tile < tile ? total - i*tile : tile;
+}
+
+static inline size_t _tile_bytes(const matrix_ooc_t *A)
+{
+    return A->tile * A->tile * sizeof(TYPE);
+}
+
+static void _io(slot_t *slot, int write)
+{
+    matrix_ooc_t *A = slot->file;
+    off_t offset = OOC_HEADER + (off_t)slot->id * _tile_bytes(A);
+    char *data = (char *)slot->data;
+    size_t done = 0;
+    while(done < slot->bytes){
+        ssize_t n = write ? pwrite(A->fd, data + done, slot->bytes - done, offset + done)
+                          : pread(A->fd, data + done, slot->bytes - done, offset + done);
+        if(n <= 0){
+            perror(write ? "matrix_ooc: pwrite" : "matrix_ooc: pread");
+            if(!write)memset(data + done, 0, slot->bytes - done);
+            A->error = 1;
+            return;
+        }
+        done += n;
+    }
+}
+
+static void * _io_thread(void *args)
+{
+    (void)args;
+    slot_t *slot;
+    while(fifo_pop(&cache.requests, (void **)&slot, FIFO_WAIT) == FIFO_SUCCESS && slot != &stop){
+        // The file and the tile of a loading slot do not change
+        _io(slot, 0);
+        pthread_mutex_lock(&cache.mutex);
+        slot->state = SLOT_READY;
+        pthread_cond_broadcast(&cache.cond);
+        pthread_mutex_unlock(&cache.mutex);
+    }
+    return NULL;
+}
+
+// Cache lock held, released during the write: write back a dirty ready slot. Its tile is waited for
+// until it is ready again, and it is no victim meanwhile.
+static void _write_back(slot_t *slot)
+{
+    slot->state = SLOT_WRITING;
+    pthread_mutex_unlock(&cache.mutex);
+    _io(slot, 1);
+    pthread_mutex_lock(&cache.mutex);
+    slot->dirty = 0;
+    slot->state = SLOT_READY;
+    pthread_cond_broadcast(&cache.cond);
+}
+
+// Cache lock held: forget the tile of a clean slot
+static void _detach(slot_t *slot)
+{
+    if(!slot->file)return;
+    slot->file->slot_of[slot->id] = NULL;
+    slot->file = NULL;
+    slot->state = SLOT_EMPTY;
+}
+
+// Cache lock held, released while a dirty victim is written back: a detached slot of bytes, new while the
+// budget allows it, else the least recently used of the unpinned ones. NULL if all of them are pinned or
+// busy, with *nomem set if memory is missing instead, or if the budget can not hold the slot.
+static slot_t * _victim(size_t bytes, int *nomem)
+{
+    *nomem = 0;
+    while(1){
+        slot_t *slot = NULL;
+        if(cache.resident + bytes <= cache.budget){
+            if(cache.nb_slots == cache.size_slots){
+                size_t size = cache.size_slots ? 2*cache.size_slots : 64;
+                slot_t **slots = realloc(cache.slots, size*sizeof(slot_t *));
+                if(!slots)goto nomem;
+                cache.slots = slots;
+                cache.size_slots = size;
+            }
+            slot = calloc(1, sizeof(slot_t));
+            if(slot && !(slot->data = aligned_alloc(64, bytes))){
+                free(slot);
+                slot = NULL;
+            }
+            if(!slot)goto nomem;
+            slot->bytes = bytes;
+            cache.resident += bytes;
+            cache.slots[cache.nb_slots++] = slot;
+            return slot;
+        }
+        size_t busy = 0;
+        for (size_t i = 0; i < cache.nb_slots; i++){
+            slot_t *s = cache.slots[i];
+            if(s->pins || s->state == SLOT_LOADING || s->state == SLOT_WRITING){
+                busy++;
+                continue;
+            }
+            if(!slot || s->used < slot->used)slot = s;
+        }
+        if(!slot && !busy){
+            // Nothing to wait for: the budget is below the tile
+            fprintf(stderr, "%s: memory budget of %zu bytes below one tile of %zu bytes\n", __func__, cache.budget, bytes);
+            *nomem = 1;
+            return NULL;
+        }
+        if(!slot)return NULL;
+        if(slot->dirty){
+            // The cache may have changed during the write: choose again
+            _write_back(slot);
+            continue;
+        }
+        _detach(slot);
+        if(slot->bytes != bytes){
+            TYPE *data = aligned_alloc(64, bytes);
+            if(!data)goto nomem;
+            free(slot->data);
+            slot->data = data;
+            cache.resident += bytes - slot->bytes;
+            slot->bytes = bytes;
+        }
+        return slot;
+    }
+nomem:
+    perror(__func__);
+    *nomem = 1;
+    return NULL;
+}
+
+// Pin tile id of A, read from the file unless zero (then filled with zeros). NULL, with the error of A set,
+// when memory is missing for it.
+static slot_t * _get(matrix_ooc_t *A, size_t id, int zero)
+{
+    pthread_mutex_lock(&cache.mutex);
+    slot_t *slot;
+    while(1){
+        slot = A->slot_of[id];
+        if(slot && (slot->state == SLOT_LOADING || slot->state == SLOT_WRITING)){
+            pthread_cond_wait(&cache.cond, &cache.mutex);
+            continue;
+        }
+        if(slot)break;
+        int nomem;
+        slot = _victim(_tile_bytes(A), &nomem);
+        if(nomem){
+            A->error = 1;
+            pthread_mutex_unlock(&cache.mutex);
+            return NULL;
+        }
+        // Loaded by another thread while a victim was written back: the free slot stays free
+        if(slot && A->slot_of[id])continue;
+        if(slot){
+            *slot = (slot_t){A, id, SLOT_LOADING, 1, 0, 0, slot->bytes, slot->data};
+            A->slot_of[id] = slot;
+            if(zero){
+                memset(slot->data, 0, slot->bytes);
+            } else {
+                pthread_mutex_unlock(&cache.mutex);
+                _io(slot, 0);
+                pthread_mutex_lock(&cache.mutex);
+            }
+            slot->state = SLOT_READY;
+            pthread_cond_broadcast(&cache.cond);
+            slot->used = ++cache.clock;
+            pthread_mutex_unlock(&cache.mutex);
+            return slot;
+        }
+        // Every slot pinned: wait for a _put
+        pthread_cond_wait(&cache.cond, &cache.mutex);
+    }
+    slot->pins++;
+    slot->used = ++cache.clock;
+    pthread_mutex_unlock(&cache.mutex);
+    if(zero)memset(slot->data, 0, slot->bytes);
+    return slot;
+}
+
+static void _put(slot_t *slot, int dirty)
+{
+    pthread_mutex_lock(&cache.mutex);
+    slot->pins--;
+    slot->dirty |= dirty;
+    pthread_cond_broadcast(&cache.cond);
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+// Queue the read of tile id of A if there is room for it, without waiting
+static void _prefetch(matrix_ooc_t *A, size_t id)
+{
+    pthread_mutex_lock(&cache.mutex);
+    int nomem;
+    slot_t *slot = A->slot_of[id] ? NULL : _victim(_tile_bytes(A), &nomem);
+    if(slot && !A->slot_of[id]){
+        *slot = (slot_t){A, id, SLOT_LOADING, 0, 0, ++cache.clock, slot->bytes, slot->data};
+        A->slot_of[id] = slot;
+        if(fifo_push(&cache.requests, slot, FIFO_NO_WAIT) != FIFO_SUCCESS){
+            A->slot_of[id] = NULL;
+            slot->file = NULL;
+            slot->state = SLOT_EMPTY;
+        }
+    }
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+// Write back the dirty tiles of A
+static void _flush(matrix_ooc_t *A)
+{
+    pthread_mutex_lock(&cache.mutex);
+    // The slots may change while the lock is released for a write: scan again after each of them
+    for (size_t i = 0; i < cache.nb_slots;){
+        slot_t *slot = cache.slots[i];
+        if(slot->file == A && slot->state == SLOT_WRITING){
+            pthread_cond_wait(&cache.cond, &cache.mutex);
+            i = 0;
+        } else if(slot->file == A && slot->dirty && slot->state == SLOT_READY){
+            _write_back(slot);
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+// Strip of count tiles of A pinned together, from tile first by steps of stride
+typedef struct {
+    matrix_ooc_t *A;
+    size_t first, count, stride;
+    slot_t **slots;
+} strip_t;
+
+static void _strip_put(strip_t *s, int dirty)
+{
+    for (size_t i = 0; i < s->count; i++)
+        _put(s->slots[i], dirty);
+    free(s->slots);
+}
+
+static int _strip_get(strip_t *s, matrix_ooc_t *A, size_t first, size_t count, size_t stride, int zero)
+{
+    *s = (strip_t){A, first, count, stride, malloc((count ? count : 1) * sizeof(slot_t *))};
+    if(!s->slots){
+        perror(__func__);
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++){
+        if(!(s->slots[i] = _get(A, first + i*stride, zero))){
+            s->count = i;
+            _strip_put(s, 0);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static void _strip_prefetch(matrix_ooc_t *A, size_t first, size_t count, size_t stride)
+{
+    for (size_t i = 0; i < count; i++)
+        _prefetch(A, first + i*stride);
+}
+
+// Tile i of a strip
+static inline TYPE * _tile(const strip_t *s, size_t i)
+{
+    return s->slots[i]->data;
+}
+
+// Row r, counted from the first row of a column strip
+static inline TYPE * _row(const strip_t *s, size_t r)
+{
+    return s->slots[r / s->A->tile]->data + (r % s->A->tile) * s->A->tile;
+}
+
+static int _budget_check(size_t tiles, size_t bytes, const char *function_name)
+{
+    pthread_mutex_lock(&cache.mutex);
+    size_t budget = cache.budget;
+    pthread_mutex_unlock(&cache.mutex);
+    if(tiles * bytes <= budget)return 1;
+    fprintf(stderr, "%s: memory budget of %zu bytes below the %zu tiles of %zu bytes it works on\n", function_name, budget, tiles, bytes);
+    return 0;
+}
+
+static void _run(size_t begin, size_t end, size_t grain, void (*task)(void *, size_t, size_t), void *arg)
+{
+    if(end - begin <= grain){
+        if(end > begin)task(arg, begin, end);
+        return;
+    }
+    if(thread_pool_parallel_for(&thread_pool, begin, end, grain, task, arg) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+}
+
+static matrix_ooc_t * _alloc(int fd, size_t rows, size_t columns, size_t tile)
+{
+    matrix_ooc_t *A = calloc(1, sizeof(matrix_ooc_t));
+    if(!A)goto err;
+    *A = (matrix_ooc_t){fd, rows, columns, tile, (rows + tile - 1) / tile, (columns + tile - 1) / tile, NULL, 0};
+    A->slot_of = calloc(A->tile_rows * A->tile_columns + 1, sizeof(slot_t *));
+    if(!A->slot_of)goto err;
+    pthread_mutex_lock(&cache.mutex);
+    if(!cache.files){
+        if(fifo_init(&cache.requests, OOC_REQUESTS) != FIFO_SUCCESS || pthread_create(&cache.io, NULL, _io_thread, NULL)){
+            pthread_mutex_unlock(&cache.mutex);
+            fprintf(stderr, "%s: no I/O thread\n", __func__);
+            free(A->slot_of);
+            free(A);
+            return NULL;
+        }
+    }
+    cache.files++;
+    pthread_mutex_unlock(&cache.mutex);
+    return A;
+err:
+    perror(__func__);
+    if(A)free(A->slot_of);
+    free(A);
+    return NULL;
+}
+
+matrix_ooc_t * matrix_ooc_create(const char *path, size_t rows, size_t columns, size_t tile)
+{
+    if(!sanity_check((void *)path, __func__))return NULL;
+    if(!tile)tile = OOC_TILE;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        perror(__func__);
+        return NULL;
+    }
+    char header[OOC_HEADER] = {0};
+    uint64_t size[3] = {rows, columns, tile};
+    memcpy(header, OOC_MAGIC, 8);
+    memcpy(header + 8, size, sizeof(size));
+    size_t tiles = ((rows + tile - 1) / tile) * ((columns + tile - 1) / tile);
+    // Sparse: the tiles read as zeros until written
+    if(pwrite(fd, header, OOC_HEADER, 0) != OOC_HEADER || ftruncate(fd, OOC_HEADER + (off_t)tiles * tile * tile * sizeof(TYPE))){
+        perror(__func__);
+        close(fd);
+        return NULL;
+    }
+    matrix_ooc_t *A = _alloc(fd, rows, columns, tile);
+    if(!A)close(fd);
+    return A;
+}
+
+matrix_ooc_t * matrix_ooc_open(const char *path)
+{
+    if(!sanity_check((void *)path, __func__))return NULL;
+    int fd = open(path, O_RDWR);
+    if(fd < 0){
+        perror(__func__);
+        return NULL;
+    }
+    char header[8 + 3*sizeof(uint64_t)];
+    uint64_t size[3];
+    if(pread(fd, header, sizeof(header), 0) != sizeof(header) || memcmp(header, OOC_MAGIC, 8)){
+        fprintf(stderr, "%s: %s is not a tiled matrix file\n", __func__, path);
+        close(fd);
+        return NULL;
+    }
+    memcpy(size, header + 8, sizeof(size));
+    matrix_ooc_t *A = size[2] ? _alloc(fd, size[0], size[1], size[2]) : NULL;
+    if(!A)close(fd);
+    return A;
+}
+
+int matrix_ooc_close(matrix_ooc_t *A)
+{
+    if(!sanity_check((void *)A, __func__))return 0;
+    _flush(A);
+    pthread_mutex_lock(&cache.mutex);
+    for (size_t i = 0; i < cache.nb_slots; i++){
+        slot_t *slot = cache.slots[i];
+        while(slot->file == A && slot->state == SLOT_LOADING)
+            pthread_cond_wait(&cache.cond, &cache.mutex);
+        if(slot->file == A)_detach(slot);
+    }
+    int last = !--cache.files;
+    pthread_mutex_unlock(&cache.mutex);
+    if(last){
+        fifo_push(&cache.requests, &stop, FIFO_WAIT);
+        pthread_join(cache.io, NULL);
+        fifo_destroy(&cache.requests);
+        pthread_mutex_lock(&cache.mutex);
+        for (size_t i = 0; i < cache.nb_slots; i++){
+            free(cache.slots[i]->data);
+            free(cache.slots[i]);
+        }
+        free(cache.slots);
+        cache.slots = NULL;
+        cache.nb_slots = cache.size_slots = cache.resident = 0;
+        pthread_mutex_unlock(&cache.mutex);
+    }
+    int ok = !A->error && !fsync(A->fd);
+    close(A->fd);
+    free(A->slot_of);
+    free(A);
+    return ok;
+}
+
+void matrix_ooc_size(const matrix_ooc_t *A, size_t *rows, size_t *columns, size_t *tile)
+{
+    if(!sanity_check((void *)A, __func__))return;
+    if(rows)*rows = A->rows;
+    if(columns)*columns = A->columns;
+    if(tile)*tile = A->tile;
+}
+
+int matrix_ooc_budget(size_t bytes)
+{
+    if(!bytes){
+        fprintf(stderr, "%s: empty budget\n", __func__);
+        return 0;
+    }
+    pthread_mutex_lock(&cache.mutex);
+    cache.budget = bytes;
+    // Free unpinned slots down to the new budget
+    for (size_t i = 0; i < cache.nb_slots && cache.resident > cache.budget;){
+        slot_t *slot = cache.slots[i];
+        if(slot->pins || slot->state == SLOT_LOADING || slot->state == SLOT_WRITING){
+            i++;
+            continue;
+        }
+        if(slot->dirty){
+            _write_back(slot);
+            i = 0;
+            continue;
+        }
+        _detach(slot);
+        cache.resident -= slot->bytes;
+        free(slot->data);
+        free(slot);
+        cache.slots[i] = cache.slots[--cache.nb_slots];
+    }
+    pthread_mutex_unlock(&cache.mutex);
+    return 1;
+}
+
+// Copy between M and the block of A at (row, column), tile by tile
+static int _copy(matrix_ooc_t *A, matrix_t *M, size_t row, size_t column, int write, const char *function_name)
+{
+    if(row + M->rows > A->rows || column + M->columns > A->columns){
+        fprintf(stderr, "%s: block out of the matrix\n", function_name);
+        return 0;
+    }
+    size_t t = A->tile;
+    for (size_t ti = row / t; ti * t < row + M->rows; ti++){
+        for (size_t tj = column / t; tj * t < column + M->columns; tj++){
+            slot_t *slot = _get(A, ti*A->tile_columns + tj, 0);
+            if(!slot)return 0;
+            size_t r0 = ti*t > row ? ti*t : row, r1 = (ti+1)*t < row + M->rows ? (ti+1)*t : row + M->rows;
+            size_t c0 = tj*t > column ? tj*t : column, c1 = (tj+1)*t < column + M->columns ? (tj+1)*t : column + M->columns;
+            for (size_t r = r0; r < r1; r++){
+                TYPE *tile = slot->data + (r - ti*t)*t + (c0 - tj*t), *m = M->coeff[r - row] + (c0 - column);
+                memcpy(write ? tile : m, write ? m : tile, (c1 - c0)*sizeof(TYPE));
+            }
+            _put(slot, write);
+        }
+    }
+    if(write)_flush(A);
+    return !A->error;
+}
+
+int matrix_ooc_write(matrix_ooc_t *A, const matrix_t *M, size_t row, size_t column)
+{
+    if(!sanity_check((void *)A, __func__) || !sanity_check((void *)M, __func__))return 0;
+    return _copy(A, (matrix_t *)M, row, column, 1, __func__);
+}
+
+matrix_t * matrix_ooc_read(matrix_ooc_t *A, size_t row, size_t column, size_t rows, size_t columns)
+{
+    if(!sanity_check((void *)A, __func__))return NULL;
+    matrix_t *M = matrix_create(rows, columns);
+    if(M && !_copy(A, M, row, column, 0, __func__)){
+        matrix_free(M);
+        return NULL;
+    }
+    return M;
+}
+
+typedef struct {
+    size_t tile, m, k, n;
+    const TYPE *a, *b;
+    TYPE *c;
+} gemm_arg_t;
+
+// Rows of C += A * B on tiles of leading dimension tile
+static void _gemm_task(void *args, size_t start, size_t end)
+{
+    gemm_arg_t *arg = args;
+    kernels->gemm(end - start, arg->k, arg->n, arg->a + start*arg->tile, arg->tile, arg->b, arg->tile, arg->c + start*arg->tile, arg->tile);
+}
+
+static void _gemm(size_t tile, size_t m, size_t k, size_t n, const TYPE *a, const TYPE *b, TYPE *c)
+{
+    gemm_arg_t arg = {tile, m, k, n, a, b, c};
+    _run(0, m, OOC_ROWS, _gemm_task, &arg);
+}
+
+int matrix_ooc_gemm(matrix_ooc_t *C, matrix_ooc_t *A, matrix_ooc_t *B)
+{
+    if(!sanity_check((void *)A, __func__) || !sanity_check((void *)B, __func__) || !sanity_check((void *)C, __func__))return 0;
+    if(A->columns != B->rows || C->rows != A->rows || C->columns != B->columns){
+        fprintf(stderr, "%s: not multipliable matrix\n", __func__);
+        return 0;
+    }
+    if(A->tile != B->tile || A->tile != C->tile){
+        fprintf(stderr, "%s: different tiles\n", __func__);
+        return 0;
+    }
+    size_t t = A->tile, tk = A->tile_columns;
+    // A row strip, the C tile, the B tile and the next one
+    if(!_budget_check(tk + 3, _tile_bytes(A), __func__))return 0;
+    for (size_t i = 0; i < C->tile_rows; i++){
+        strip_t a;
+        if(!_strip_get(&a, A, i*tk, tk, 1, 0))return 0;
+        size_t m = _extent(C->rows, t, i);
+        for (size_t j = 0; j < C->tile_columns; j++){
+            size_t n = _extent(C->columns, t, j);
+            slot_t *c = _get(C, i*C->tile_columns + j, 1);
+            if(!c){
+                _strip_put(&a, 0);
+                return 0;
+            }
+            for (size_t p = 0; p < tk; p++){
+                // B is read once per row of tiles of C: the next tile is on its way during this product
+                if(p+1 < tk)_prefetch(B, (p+1)*B->tile_columns + j);
+                else if(j+1 < C->tile_columns)_prefetch(B, j+1);
+                slot_t *b = _get(B, p*B->tile_columns + j, 0);
+                if(!b){
+                    _put(c, 1);
+                    _strip_put(&a, 0);
+                    return 0;
+                }
+                _gemm(t, m, _extent(A->columns, t, p), n, _tile(&a, p), b->data, c->data);
+                _put(b, 0);
+            }
+            _put(c, 1);
+        }
+        // The next row strip of A while the last products end
+        if(i+1 < C->tile_rows)_strip_prefetch(A, (i+1)*tk, tk, 1);
+        _strip_put(&a, 0);
+    }
+    _flush(C);
+    return !A->error && !B->error && !C->error;
+}
+
+typedef struct {
+    size_t tile, kb, nb;
+    strip_t *panel, *strip;
+    size_t k, j;                                                        // Tiles of the panel and of the strip
+    TYPE *buffer;                                                       // kb*tile: the negated transposed tile, or the negated U block
+    TYPE pivot;
+    size_t column;
+} ooc_arg_t;
+
+// Tiles i of the panel below the diagonal tile: A_ik = A_ik * L_kk^-T
+static void _cholesky_trsm_task(void *args, size_t start, size_t end)
+{
+    ooc_arg_t *arg = args;
+    size_t t = arg->tile, kb = arg->kb;
+    const TYPE *l = _tile(arg->panel, 0);
+    for (size_t i = start; i < end; i++){
+        TYPE *a = _tile(arg->panel, i);
+        size_t m = _extent(arg->panel->A->rows, t, arg->k + i);
+        for (size_t r = 0; r < m; r++){
+            TYPE *x = a + r*t;
+            for (size_t c = 0; c < kb; c++)
+                x[c] = (x[c] - kernels->dot(c, x, l + c*t)) / l[c*t + c];
+        }
+    }
+}
+
+// Tiles i of the strip j: A_ij -= A_ik * A_jk^T, or -= L_ik * U_kj for the LU
+static void _update_task(void *args, size_t start, size_t end)
+{
+    ooc_arg_t *arg = args;
+    size_t t = arg->tile;
+    for (size_t i = start; i < end; i++){
+        // Tile i of the strip is the tile (j + i) of the matrix, (j + i - k) of the panel
+        size_t row = arg->strip->first / arg->strip->A->tile_columns + i;
+        kernels->gemm(_extent(arg->strip->A->rows, t, row), arg->kb, arg->nb, _tile(arg->panel, row - arg->k), t,
+                      arg->buffer, t, _tile(arg->strip, i), t);
+    }
+}
+
+int matrix_ooc_cholesky(matrix_ooc_t *A)
+{
+    if(!sanity_check((void *)A, __func__))return 0;
+    if(A->rows != A->columns){
+        fprintf(stderr, "%s: not square matrix\n", __func__);
+        return 0;
+    }
+    size_t t = A->tile, T = A->tile_rows;
+    // The panel, the strip updated and the next one
+    if(!_budget_check(3*T, _tile_bytes(A), __func__))return 0;
+    TYPE *buffer = aligned_alloc(64, _tile_bytes(A));
+    TYPE **rows = malloc(t * sizeof(TYPE *));
+    int ok = buffer && rows;
+    if(!ok)perror(__func__);
+    for (size_t k = 0; ok && k < T; k++){
+        strip_t panel;
+        if(!_strip_get(&panel, A, k*T + k, T - k, T, 0)){
+            ok = 0;
+            break;
+        }
+        size_t kb = _extent(A->rows, t, k);
+        if(k+1 < T)_strip_prefetch(A, (k+1)*T + k+1, T - k-1, T);
+        // Diagonal tile in memory, then the tiles below it
+        for (size_t r = 0; r < kb; r++)
+            rows[r] = _tile(&panel, 0) + r*t;
+        matrix_t diagonal = {kb, kb, rows, 0};
+        if(!factor_cholesky(&diagonal)){
+            _strip_put(&panel, 0);
+            ok = 0;
+            break;
+        }
+        ooc_arg_t arg = {t, kb, 0, &panel, NULL, k, 0, buffer, 0, 0};
+        _run(1, T - k, 1, _cholesky_trsm_task, &arg);
+        for (size_t j = k+1; j < T; j++){
+            strip_t strip;
+            if(!_strip_get(&strip, A, j*T + j, T - j, T, 0)){
+                ok = 0;
+                break;
+            }
+            if(j+1 < T)_strip_prefetch(A, (j+1)*T + j+1, T - j-1, T);
+            // buffer = -A_jk^T, kb*nb
+            size_t nb = _extent(A->rows, t, j);
+            const TYPE *l = _tile(&panel, j - k);
+            for (size_t p = 0; p < kb; p++)
+                for (size_t c = 0; c < nb; c++)
+                    buffer[p*t + c] = -l[c*t + p];
+            arg.strip = &strip;
+            arg.nb = nb;
+            _run(0, T - j, 1, _update_task, &arg);
+            _strip_put(&strip, 1);
+        }
+        _strip_put(&panel, 1);
+    }
+    _flush(A);
+    free(buffer);
+    free(rows);
+    return ok && !A->error;
+}
+
+// Rows below the pivot of the panel column: l = a / pivot, then the rest of the row -= l * pivot row
+static void _panel_task(void *args, size_t start, size_t end)
+{
+    ooc_arg_t *arg = args;
+    size_t c = arg->column;
+    const TYPE *pivot_row = _row(arg->panel, c);
+    for (size_t r = start; r < end; r++){
+        TYPE *row = _row(arg->panel, r);
+        row[c] /= arg->pivot;
+        kernels->axpy(arg->kb - c - 1, -row[c], pivot_row + c + 1, row + c + 1);
+    }
+}
+
+static void _swap(TYPE *x, TYPE *y, size_t n)
+{
+    for (size_t i = 0; i < n; i++){
+        TYPE tmp = x[i];
+        x[i] = y[i];
+        y[i] = tmp;
+    }
+}
+
+int matrix_ooc_lu(matrix_ooc_t *A, size_t *piv)
+{
+    if(!sanity_check((void *)A, __func__) || !sanity_check((void *)piv, __func__))return 0;
+    if(A->rows != A->columns){
+        fprintf(stderr, "%s: not square matrix\n", __func__);
+        return 0;
+    }
+    size_t t = A->tile, T = A->tile_rows, n = A->rows;
+    if(!_budget_check(3*T, _tile_bytes(A), __func__))return 0;
+    TYPE *buffer = aligned_alloc(64, _tile_bytes(A));
+    int ok = buffer != NULL;
+    if(!ok)perror(__func__);
+    for (size_t k = 0; ok && k < T; k++){
+        // Panel: column strip k from the diagonal, pivots searched in the whole of it
+        strip_t panel;
+        if(!_strip_get(&panel, A, k*T + k, T - k, T, 0)){
+            ok = 0;
+            break;
+        }
+        if(k+1 < T)_strip_prefetch(A, k*T + k+1, T - k, T);
+        size_t kb = _extent(n, t, k), rows = n - k*t;
+        ooc_arg_t arg = {t, kb, 0, &panel, NULL, k, 0, buffer, 0, 0};
+        for (size_t c = 0; c < kb; c++){
+            size_t p = c;
+            for (size_t r = c+1; r < rows; r++)
+                if(fabs(_row(&panel, r)[c]) > fabs(_row(&panel, p)[c]))p = r;
+            piv[k*t + c] = k*t + p;
+            if(_row(&panel, p)[c] == 0){
+                fprintf(stderr, "%s: singular matrix\n", __func__);
+                ok = 0;
+                break;
+            }
+            if(p != c)_swap(_row(&panel, c), _row(&panel, p), kb);
+            arg.column = c;
+            arg.pivot = _row(&panel, c)[c];
+            _run(c+1, rows, OOC_PANEL_ROWS, _panel_task, &arg);
+        }
+        for (size_t j = k+1; ok && j < T; j++){
+            // Strip j from the row of the panel: swaps, U_kj = L_kk^-1 A_kj, then the trailing update
+            strip_t strip;
+            if(!_strip_get(&strip, A, k*T + j, T - k, T, 0)){
+                ok = 0;
+                break;
+            }
+            if(j+1 < T)_strip_prefetch(A, k*T + j+1, T - k, T);
+            size_t nb = _extent(n, t, j);
+            for (size_t c = 0; c < kb; c++)
+                if(piv[k*t + c] != k*t + c)
+                    _swap(_row(&strip, c), _row(&strip, piv[k*t + c] - k*t), nb);
+            for (size_t r = 1; r < kb; r++)
+                for (size_t p = 0; p < r; p++)
+                    kernels->axpy(nb, -_row(&panel, r)[p], _row(&strip, p), _row(&strip, r));
+            for (size_t p = 0; p < kb; p++)
+                for (size_t c = 0; c < nb; c++)
+                    buffer[p*t + c] = -_row(&strip, p)[c];
+            arg.strip = &strip;
+            arg.nb = nb;
+            // Tiles below the panel row, strip tile i being the matrix tile k + i
+            strip.first += T;
+            strip.slots++;
+            _run(0, T - k - 1, 1, _update_task, &arg);
+            strip.first -= T;
+            strip.slots--;
+            _strip_put(&strip, 1);
+        }
+        _strip_put(&panel, 1);
+    }
+    // Swaps of the later panels on the columns left of them
+    for (size_t j = 0; ok && j + 1 < T; j++){
+        strip_t strip;
+        if(!_strip_get(&strip, A, (j+1)*T + j, T - j-1, T, 0)){
+            ok = 0;
+            break;
+        }
+        if(j+2 < T)_strip_prefetch(A, (j+2)*T + j+1, T - j-2, T);
+        size_t nb = _extent(n, t, j);
+        for (size_t i = (j+1)*t; i < n; i++)
+            if(piv[i] != i)
+                _swap(_row(&strip, i - (j+1)*t), _row(&strip, piv[i] - (j+1)*t), nb);
+        _strip_put(&strip, 1);
+    }
+    _flush(A);
+    free(buffer);
+    return ok && !A->error;
+}
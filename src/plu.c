@@ -5,6 +5,10 @@
 #include "matrix.h"
 #include "tools.h"
 #include "check.h"
+#include "thread_pool.h"
+
+extern thread_pool_t thread_pool;
+extern matrix_tuning_t tuning;
 
 typedef struct {
     size_t nb_perm;
@@ -57,8 +61,7 @@ static plu_t * matrix_plu_f(const matrix_t *matrix)
     if(!sanity_check((void *)M, __func__))return NULL;
     TYPE **A = M->coeff, **L = plu->L->coeff, **U = plu->U->coeff;
     TYPE sum;
-    size_t default_step = 2*sysconf(_SC_LEVEL1_DCACHE_LINESIZE)/sizeof(TYPE);
-    size_t step = default_step > 0 ? default_step:16;
+    size_t step = tuning.plu_step;
     // long long time = mstime();
     for (size_t i = 0; i < n; i++){
         for (size_t j = i; j < n; j+=step){
@@ -98,58 +101,54 @@ static plu_t * matrix_plu_f(const matrix_t *matrix)
     return(plu);  
 }
 
-static matrix_t * matrix_solve_low_trig(const matrix_t *A, const matrix_t *B)
+// Substitutions on the rows [i, ie[ of X = BT, one row per column of B
+static void _solve_low_trig(const matrix_t *A, matrix_t *X, size_t i, size_t ie)
 {
-    // La ruse du B en ligne et chaque element permet de calculer 1 ligne
-    if(!sanity_check((void *)A, __func__))return NULL;
-    if(!square_check(A, __func__))return NULL; 
     size_t n = A->rows;
-    size_t m = B->columns;
-    size_t default_step = 2*sysconf(_SC_LEVEL1_DCACHE_LINESIZE)/sizeof(TYPE);
-    size_t step = default_step > 0 ? default_step:16;
-    matrix_t *X = matrix_transp_f(B);
-    for (size_t i = 0; i < m; i+=step){
-        int ie = m < i+step ? m : i+step;
-        for (size_t j = 0; j < n; j+=step){
-            int je = n < j+step ? n : j+step;
-            for (int ii = i; ii < ie; ii++){
-                for (int jj = j; jj < je; jj++){
-                    TYPE sum = X->coeff[ii][jj];
-                    for (int k = 0; k < jj; k++)
-                        sum -= X->coeff[ii][k] * A->coeff[jj][k];
-                    X->coeff[ii][jj] = sum / A->coeff[jj][jj];
-                }
+    size_t step = tuning.plu_step;
+    for (size_t j = 0; j < n; j+=step){
+        int je = n < j+step ? n : j+step;
+        for (size_t ii = i; ii < ie; ii++){
+            for (int jj = j; jj < je; jj++){
+                TYPE sum = X->coeff[ii][jj];
+                for (int k = 0; k < jj; k++)
+                    sum -= X->coeff[ii][k] * A->coeff[jj][k];
+                X->coeff[ii][jj] = sum / A->coeff[jj][jj];
             }
         }
     }
-    return(matrix_transp_f(X));
 }
 
-static matrix_t * matrix_solve_up_trig(const matrix_t *A, const matrix_t *B)
+static void _solve_up_trig(const matrix_t *A, matrix_t *X, size_t i, size_t ie)
 {
-    if(!sanity_check((void *)A, __func__))return NULL;
-    if(!square_check(A, __func__))return NULL; 
-    size_t n = A->rows;
-    size_t m = B->columns;
-    size_t default_step = 2*sysconf(_SC_LEVEL1_DCACHE_LINESIZE)/sizeof(TYPE);
-    size_t step = default_step > 0 ? default_step:16;
-    matrix_t *X = matrix_transp_f(B);
-    for (size_t i = 0; i < m; i+=step){
-        int ie = m < i+step ? m : i+step;
-        for (int j = n - 1; j >= 0; j-=step){
-            int je = 0 >= j-(int)step ? 0 : j-step;
-            for (int ii = i; ii < ie; ii++){
-                for (int jj = j-1; jj >= je; jj--){
-                    TYPE sum = X->coeff[ii][jj];
-                    for (int k = n - 1; k > jj; k--)
-                        sum -= X->coeff[ii][k] * A->coeff[jj][k];
-                    X->coeff[ii][jj] = sum / A->coeff[jj][jj];
-                }
+    int n = A->rows;
+    size_t step = tuning.plu_step;
+    for (int j = n - 1; j >= 0; j-=step){
+        int je = 0 >= j-(int)step ? 0 : j-step;
+        for (size_t ii = i; ii < ie; ii++){
+            for (int jj = j-1; jj >= je; jj--){
+                TYPE sum = X->coeff[ii][jj];
+                for (int k = n - 1; k > jj; k--)
+                    sum -= X->coeff[ii][k] * A->coeff[jj][k];
+                X->coeff[ii][jj] = sum / A->coeff[jj][jj];
             }
         }
     }
-    return(matrix_transp_f(X));
 }
+
+typedef struct {
+    const plu_t *plu;
+    matrix_t *X;
+} plu_solve_arg_t;
+
+// Both substitutions of a block of columns of B: the upper one of a block overlaps the lower one of the others
+static void _plu_solve_task(void *args, size_t begin, size_t end)
+{
+    plu_solve_arg_t *arg = args;
+    _solve_low_trig(arg->plu->L, arg->X, begin, end);
+    _solve_up_trig(arg->plu->U, arg->X, begin, end);
+}
+
 TYPE matrix_det_plu_f(const matrix_t *matrix)
 {
     if(!sanity_check((void *)matrix, __func__))return 0;
@@ -172,13 +171,15 @@ matrix_t * matrix_solve_plu_f(const matrix_t *A, const matrix_t *B)
     for (size_t i = 0; i < plu->nb_perm; i++)
         matrix_row_permute(permB, plu->perm[i][0], plu->perm[i][1]);
     // printf("perm: %s\n", format_time(mstime()-time, "ms"));
-    // time = mstime();
-    matrix_t *Z = matrix_solve_low_trig(plu->L, permB);
-    // printf("diag inf: %s\n", format_time(mstime()-time, "ms"));
+    matrix_t *Z = matrix_transp_f(permB);
     matrix_free(permB);
     // time = mstime();
-    matrix_t *X = matrix_solve_up_trig(plu->U, Z);
-    // printf("diag sup: %s\n", format_time(mstime()-time, "ms"));
+    plu_solve_arg_t arg = {plu, Z};
+    if(thread_pool_parallel_for(&thread_pool, 0, Z->rows, tuning.plu_step, _plu_solve_task, &arg) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+    // printf("diag: %s\n", format_time(mstime()-time, "ms"));
+    matrix_t *X = matrix_transp_f(Z);
     matrix_free(Z);
     plu_free(plu);
     return(X);
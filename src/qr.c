@@ -0,0 +1,392 @@
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "matrix.h"
+#include "check.h"
+#include "factor.h"
+#include "thread_pool.h"
+
+// Columns of a panel, and columns of the trailing matrix updated by one task
+#define QR_BLOCK 32
+#define QR_COLUMNS 128
+// Tall matrices are split in row blocks of at least max(TSQR_MIN_ROWS, 4*columns) rows
+#define TSQR_MIN_ROWS 2048
+#define TSQR_MAX_BLOCKS 64
+
+extern thread_pool_t thread_pool;
+
+// Householder QR: reflectors H_j = I - tau_j*v_j*v_jT are stored below the diagonal of F with v_j[j] = 1
+// implicit, R on and above it, Q = H_0*H_1*...*H_k-1. TSQR factors each row block independently, then
+// factors the stacked R of the blocks in S: Q = diag(Q_0, ..., Q_nb-1) * Q_S.
+typedef struct {
+    size_t m, n, k;
+    matrix_t *F;
+    TYPE *tau;                                                          // nb*k reflectors of the blocks, then k of S
+    size_t nb;                                                          // Number of row blocks, 1 without TSQR
+    size_t *start;                                                      // nb+1 first rows of the blocks
+    matrix_t *S;                                                        // nb*n x n stacked R factors, NULL without TSQR
+} qr_t;
+
+typedef struct {
+    TYPE **v;
+    size_t m, j0, j1;
+    const TYPE *tau;
+    TYPE **b;
+    size_t c0, c1;
+    int trans;
+} reflect_arg_t;
+
+typedef struct {
+    qr_t *qr;
+    matrix_t *B;
+    int trans;
+} tsqr_arg_t;
+
+// Applies reflectors j0..j1 to the columns c0..c1 (at most QR_COLUMNS) of b: H_j0 first if trans (QT), last otherwise (Q)
+static void _reflect(TYPE **v, size_t m, size_t j0, size_t j1, const TYPE *tau, TYPE **b, size_t c0, size_t c1, int trans)
+{
+    TYPE w[QR_COLUMNS];
+    size_t width = c1 - c0;
+    for (size_t t = 0; t < j1 - j0; t++){
+        size_t j = trans ? j0 + t : j1 - 1 - t;
+        if(tau[j] == 0)continue;
+        memcpy(w, b[j] + c0, width*sizeof(TYPE));
+        for (size_t i = j+1; i < m; i++){
+            TYPE vi = v[i][j];
+            const TYPE *bi = b[i] + c0;
+            #pragma GCC ivdep
+            for (size_t c = 0; c < width; c++)
+                w[c] += vi * bi[c];
+        }
+        for (size_t c = 0; c < width; c++)
+            w[c] *= tau[j];
+        #pragma GCC ivdep
+        for (size_t c = 0; c < width; c++)
+            b[j][c0+c] -= w[c];
+        for (size_t i = j+1; i < m; i++){
+            TYPE vi = v[i][j];
+            TYPE *bi = b[i] + c0;
+            #pragma GCC ivdep
+            for (size_t c = 0; c < width; c++)
+                bi[c] -= vi * w[c];
+        }
+    }
+}
+
+static void _reflect_task(void *args, int index)
+{
+    reflect_arg_t *arg = args;
+    size_t c = index;
+    size_t c1 = c + QR_COLUMNS < arg->c1 ? c + QR_COLUMNS : arg->c1;
+    _reflect(arg->v, arg->m, arg->j0, arg->j1, arg->tau, arg->b, c, c1, arg->trans);
+}
+
+static void _reflect_columns(reflect_arg_t *arg, int parallel)
+{
+    if(!parallel || arg->c1 - arg->c0 <= QR_COLUMNS){
+        for (size_t c = arg->c0; c < arg->c1; c += QR_COLUMNS)
+            _reflect_task(arg, c);
+        return;
+    }
+    thread_pool_work_t work = {0, NULL, _reflect_task, (void *)arg};
+    for (size_t c = arg->c0; c < arg->c1; c += QR_COLUMNS)
+        thread_pool_queue_work(&thread_pool, &work, c);
+    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+}
+
+void factor_reflect(TYPE **v, size_t m, size_t k, const TYPE *tau, TYPE **b, size_t columns, int trans)
+{
+    reflect_arg_t arg = {v, m, 0, k, tau, b, 0, columns, trans};
+    _reflect_columns(&arg, 1);
+}
+
+// In place Householder QR of the m x n matrix of rows a, tau receives min(m, n) coefficients.
+// Panels of QR_BLOCK columns are factored serially, their reflectors are then applied to the trailing
+// columns one slab of QR_COLUMNS at a time, in parallel if asked.
+static void _householder(TYPE **a, size_t m, size_t n, TYPE *tau, int parallel)
+{
+    size_t k = m < n ? m : n;
+    for (size_t k0 = 0; k0 < k; k0 += QR_BLOCK){
+        size_t k1 = k0 + QR_BLOCK < k ? k0 + QR_BLOCK : k;
+        size_t panel_end = k0 + QR_BLOCK < n ? k0 + QR_BLOCK : n;
+        for (size_t j = k0; j < k1; j++){
+            TYPE alpha = a[j][j], xnorm = 0;
+            for (size_t i = j+1; i < m; i++)
+                xnorm += a[i][j] * a[i][j];
+            if(xnorm == 0){
+                tau[j] = 0;
+                continue;
+            }
+            TYPE beta = -copysign(sqrt(alpha * alpha + xnorm), alpha);
+            tau[j] = (beta - alpha) / beta;
+            TYPE scale = 1 / (alpha - beta);
+            for (size_t i = j+1; i < m; i++)
+                a[i][j] *= scale;
+            a[j][j] = beta;
+            if(j+1 < panel_end)
+                _reflect(a, m, j, j+1, tau, a, j+1, panel_end, 1);
+        }
+        if(panel_end < n){
+            reflect_arg_t arg = {a, m, k0, k1, tau, a, panel_end, n, 1};
+            _reflect_columns(&arg, parallel);
+        }
+    }
+}
+
+static void _qr_free(qr_t *qr)
+{
+    if(qr->F)matrix_free(qr->F);
+    if(qr->S)matrix_free(qr->S);
+    free(qr->tau);
+    free(qr->start);
+    free(qr);
+}
+
+static void _tsqr_block_task(void *args, int p)
+{
+    qr_t *qr = args;
+    size_t rows = qr->start[p+1] - qr->start[p];
+    _householder(qr->F->coeff + qr->start[p], rows, qr->n, qr->tau + p*qr->k, 0);
+}
+
+static qr_t * _qr_factor(const matrix_t *A)
+{
+    qr_t *qr = calloc(1, sizeof(qr_t));
+    if(!qr){
+        perror(__func__);
+        return NULL;
+    }
+    qr->m = A->rows;
+    qr->n = A->columns;
+    qr->k = qr->m < qr->n ? qr->m : qr->n;
+    size_t block_rows = 4*qr->n > TSQR_MIN_ROWS ? 4*qr->n : TSQR_MIN_ROWS;
+    qr->nb = qr->m / block_rows;
+    qr->nb = qr->nb < 2 ? 1 : qr->nb > TSQR_MAX_BLOCKS ? TSQR_MAX_BLOCKS : qr->nb;
+    qr->F = matrix_copy(A);
+    qr->tau = malloc((qr->nb + 1)*(qr->k + 1)*sizeof(TYPE));
+    qr->start = malloc((qr->nb + 1)*sizeof(size_t));
+    if(!qr->F || !qr->tau || !qr->start){
+        perror(__func__);
+        _qr_free(qr);
+        return NULL;
+    }
+    for (size_t p = 0; p <= qr->nb; p++)
+        qr->start[p] = p * qr->m / qr->nb;
+    if(qr->nb == 1){
+        _householder(qr->F->coeff, qr->m, qr->n, qr->tau, 1);
+        return qr;
+    }
+    // TSQR: tall blocks are independent, only the small stacked R factors are reduced afterwards
+    thread_pool_work_t work = {0, NULL, _tsqr_block_task, (void *)qr};
+    for (size_t p = 0; p < qr->nb; p++)
+        thread_pool_queue_work(&thread_pool, &work, p);
+    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+    size_t n = qr->n;
+    qr->S = matrix_create(qr->nb*n, n);
+    if(!qr->S){
+        _qr_free(qr);
+        return NULL;
+    }
+    for (size_t p = 0; p < qr->nb; p++)
+        for (size_t i = 0; i < n; i++)
+            memcpy(qr->S->coeff[p*n+i] + i, qr->F->coeff[qr->start[p]+i] + i, (n-i)*sizeof(TYPE));
+    _householder(qr->S->coeff, qr->nb*n, n, qr->tau + qr->nb*qr->k, 1);
+    return qr;
+}
+
+// Upper triangular factor, k x n
+static matrix_t * _qr_r(const qr_t *qr)
+{
+    matrix_t *R = matrix_create(qr->k, qr->n);
+    if(!R)return NULL;
+    const matrix_t *F = qr->S ? qr->S : qr->F;
+    for (size_t i = 0; i < qr->k; i++)
+        memcpy(R->coeff[i] + i, F->coeff[i] + i, (qr->n-i)*sizeof(TYPE));
+    R->flags = MATRIX_UPPER;
+    return R;
+}
+
+static void _tsqr_apply_task(void *args, int p)
+{
+    tsqr_arg_t *arg = args;
+    qr_t *qr = arg->qr;
+    size_t r0 = qr->start[p], rows = qr->start[p+1] - r0;
+    reflect_arg_t reflect = {qr->F->coeff + r0, rows, 0, qr->k, qr->tau + p*qr->k, arg->B->coeff + r0, 0, arg->B->columns, arg->trans};
+    _reflect_columns(&reflect, 0);
+}
+
+static void _tsqr_apply(qr_t *qr, matrix_t *B, int trans)
+{
+    tsqr_arg_t arg = {qr, B, trans};
+    thread_pool_work_t work = {0, NULL, _tsqr_apply_task, (void *)&arg};
+    for (size_t p = 0; p < qr->nb; p++)
+        thread_pool_queue_work(&thread_pool, &work, p);
+    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+}
+
+// Return the k first rows of QT*B
+static matrix_t * _qr_qt(qr_t *qr, const matrix_t *B)
+{
+    size_t k = qr->k, p = B->columns;
+    matrix_t *W = matrix_copy(B), *Y = NULL;
+    if(!W)return NULL;
+    if(qr->nb == 1){
+        reflect_arg_t arg = {qr->F->coeff, qr->m, 0, k, qr->tau, W->coeff, 0, p, 1};
+        _reflect_columns(&arg, 1);
+        Y = matrix_create(k, p);
+        for (size_t i = 0; Y && i < k; i++)
+            memcpy(Y->coeff[i], W->coeff[i], p*sizeof(TYPE));
+        matrix_free(W);
+        return Y;
+    }
+    _tsqr_apply(qr, W, 1);
+    matrix_t *SB = matrix_create(qr->nb*k, p);
+    if(SB){
+        for (size_t b = 0; b < qr->nb; b++)
+            for (size_t i = 0; i < k; i++)
+                memcpy(SB->coeff[b*k+i], W->coeff[qr->start[b]+i], p*sizeof(TYPE));
+        reflect_arg_t arg = {qr->S->coeff, qr->nb*k, 0, k, qr->tau + qr->nb*k, SB->coeff, 0, p, 1};
+        _reflect_columns(&arg, 1);
+        Y = matrix_create(k, p);
+        for (size_t i = 0; Y && i < k; i++)
+            memcpy(Y->coeff[i], SB->coeff[i], p*sizeof(TYPE));
+        matrix_free(SB);
+    }
+    matrix_free(W);
+    return Y;
+}
+
+// Return Q*[Z; 0] for a k x p matrix Z, m x p
+static matrix_t * _qr_q(qr_t *qr, const matrix_t *Z)
+{
+    size_t k = qr->k, p = Z->columns;
+    matrix_t *Y = matrix_create(qr->m, p);
+    if(!Y)return NULL;
+    if(qr->nb == 1){
+        for (size_t i = 0; i < k; i++)
+            memcpy(Y->coeff[i], Z->coeff[i], p*sizeof(TYPE));
+        reflect_arg_t arg = {qr->F->coeff, qr->m, 0, k, qr->tau, Y->coeff, 0, p, 0};
+        _reflect_columns(&arg, 1);
+        return Y;
+    }
+    matrix_t *SZ = matrix_create(qr->nb*k, p);
+    if(!SZ){
+        matrix_free(Y);
+        return NULL;
+    }
+    for (size_t i = 0; i < k; i++)
+        memcpy(SZ->coeff[i], Z->coeff[i], p*sizeof(TYPE));
+    reflect_arg_t arg = {qr->S->coeff, qr->nb*k, 0, k, qr->tau + qr->nb*k, SZ->coeff, 0, p, 0};
+    _reflect_columns(&arg, 1);
+    for (size_t b = 0; b < qr->nb; b++)
+        for (size_t i = 0; i < k; i++)
+            memcpy(Y->coeff[qr->start[b]+i], SZ->coeff[b*k+i], p*sizeof(TYPE));
+    matrix_free(SZ);
+    _tsqr_apply(qr, Y, 0);
+    return Y;
+}
+
+int matrix_qr_f(const matrix_t *A, matrix_t **Q, matrix_t **R)
+{
+    if(!sanity_check((void *)A, __func__))return 0;
+    qr_t *qr = _qr_factor(A);
+    if(!qr)return 0;
+    int ret = 1;
+    if(R){
+        *R = _qr_r(qr);
+        ret &= *R != NULL;
+    }
+    if(Q){
+        matrix_t *Id = matrix_identity(qr->k);
+        *Q = Id ? _qr_q(qr, Id) : NULL;
+        ret &= *Q != NULL;
+        if(Id)matrix_free(Id);
+    }
+    _qr_free(qr);
+    return ret;
+}
+
+static int _rank_check(const qr_t *qr, const char *function_name)
+{
+    const matrix_t *F = qr->S ? qr->S : qr->F;
+    TYPE max = 0;
+    for (size_t i = 0; i < qr->k; i++)
+        max = fmax(max, fabs(F->coeff[i][i]));
+    size_t dim = qr->m > qr->n ? qr->m : qr->n;
+    for (size_t i = 0; i < qr->k; i++){
+        if(!(fabs(F->coeff[i][i]) > dim * DBL_EPSILON * max)){
+            fprintf(stderr, "%s: rank deficient matrix\n", function_name);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+matrix_t * matrix_solve_lstsq_f(const matrix_t *A, const matrix_t *B)
+{
+    if(!sanity_check((void *)A, __func__))return NULL;
+    if(!sanity_check((void *)B, __func__))return NULL;
+    if(B->rows != A->rows){
+        fprintf(stderr, "%s: not solvable system (B->rows != A->rows)\n", __func__);
+        return NULL;
+    }
+    // Underdetermined systems get the minimum norm solution from the QR factorisation of AT
+    int wide = A->rows < A->columns;
+    matrix_t *At = wide ? matrix_transp_f(A) : NULL;
+    qr_t *qr = _qr_factor(wide ? At : A);
+    if(At)matrix_free(At);
+    if(!qr)return NULL;
+    matrix_t *X = NULL;
+    if(!_rank_check(qr, __func__)){
+        _qr_free(qr);
+        return NULL;
+    }
+    const matrix_t *F = qr->S ? qr->S : qr->F;
+    TYPE **r = F->coeff;
+    size_t k = qr->k, p = B->columns;
+    if(!wide){
+        // X = R^-1 * (QT*B)[0:n]
+        X = _qr_qt(qr, B);
+        for (size_t i = k; X && i-- > 0;){
+            TYPE *x = X->coeff[i];
+            for (size_t j = i+1; j < k; j++){
+                TYPE rij = r[i][j];
+                const TYPE *y = X->coeff[j];
+                #pragma GCC ivdep
+                for (size_t c = 0; c < p; c++)
+                    x[c] -= rij * y[c];
+            }
+            for (size_t c = 0; c < p; c++)
+                x[c] /= r[i][i];
+        }
+    } else {
+        // A = RT*QT: X = Q * R^-T * B
+        matrix_t *Z = matrix_copy(B);
+        for (size_t i = 0; Z && i < k; i++){
+            TYPE *z = Z->coeff[i];
+            for (size_t j = 0; j < i; j++){
+                TYPE rji = r[j][i];
+                const TYPE *y = Z->coeff[j];
+                #pragma GCC ivdep
+                for (size_t c = 0; c < p; c++)
+                    z[c] -= rji * y[c];
+            }
+            for (size_t c = 0; c < p; c++)
+                z[c] /= r[i][i];
+        }
+        if(Z){
+            X = _qr_q(qr, Z);
+            matrix_free(Z);
+        }
+    }
+    _qr_free(qr);
+    return X;
+}
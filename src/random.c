@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "matrix.h"
+#include "tools.h"
+#include "thread_pool.h"
+
+// Counter based generator: coefficient (i, j) of the k-th generated matrix is a pure function of (seed, k, i, j/2),
+// so rows are filled in any order by any thread and a seed reproduces the same matrices whatever the pool size.
+// Philox4x32-10 of Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC11.
+#define RANDOM_ROWS 16
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+extern thread_pool_t thread_pool;
+
+enum {
+    RANDOM_INTEGER,                                                     // Integers in [-9, 9], the historical matrix_random
+    RANDOM_UNIFORM,                                                     // Uniform in [a, b[
+    RANDOM_NORMAL                                                       // Normal of mean a and standard deviation b
+};
+
+typedef struct {
+    matrix_t *matrix;
+    int distribution;
+    TYPE a, b;
+    int lower;                                                          // Only columns 0..i of row i
+    uint64_t key, stream;
+} random_arg_t;
+
+static uint64_t random_key = 0x853C49E6748FEA9BULL;
+static uint64_t random_stream = 0;
+
+void matrix_random_seed(uint64_t seed)
+{
+    __atomic_store_n(&random_key, seed, __ATOMIC_RELAXED);
+    __atomic_store_n(&random_stream, 0, __ATOMIC_RELAXED);
+}
+
+// Two 64 bits random words from the 128 bits counter (column pair, row, stream)
+static inline void _philox(uint64_t key, uint64_t stream, uint32_t row, uint32_t pair, uint64_t out[2])
+{
+    uint32_t c0 = pair, c1 = row, c2 = (uint32_t)stream, c3 = (uint32_t)(stream >> 32);
+    uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+    for (int r = 0; r < 10; r++){
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0, p1 = (uint64_t)PHILOX_M1 * c2;
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = (uint64_t)c0 << 32 | c1;
+    out[1] = (uint64_t)c2 << 32 | c3;
+}
+
+// Uniform in ]0, 1[ from the 53 high bits
+static inline TYPE _unit(uint64_t x)
+{
+    return ((x >> 11) + 0.5) * 0x1.0p-53;
+}
+
+static void _random_task(void *args, int index)
+{
+    random_arg_t *arg = args;
+    matrix_t *M = arg->matrix;
+    size_t start = index, end = start + RANDOM_ROWS < M->rows ? start + RANDOM_ROWS : M->rows;
+    for (size_t i = start; i < end; i++){
+        TYPE *row = M->coeff[i];
+        size_t columns = arg->lower ? i+1 : M->columns;
+        for (size_t j = 0; j < columns; j += 2){
+            uint64_t bits[2];
+            TYPE v[2];
+            _philox(arg->key, arg->stream, i, j/2, bits);
+            TYPE u0 = _unit(bits[0]), u1 = _unit(bits[1]);
+            switch(arg->distribution){
+            case RANDOM_NORMAL:{
+                // Box-Muller, both outputs are used
+                TYPE r = arg->b * sqrt(-2 * log(u0)), t = 6.283185307179586 * u1;
+                v[0] = arg->a + r * cos(t);
+                v[1] = arg->a + r * sin(t);
+                break;
+            }
+            case RANDOM_UNIFORM:
+                v[0] = arg->a + (arg->b - arg->a) * u0;
+                v[1] = arg->a + (arg->b - arg->a) * u1;
+                break;
+            default:
+                v[0] = floor(19 * u0) - 9;
+                v[1] = floor(19 * u1) - 9;
+            }
+            row[j] = v[0];
+            if(j+1 < columns)row[j+1] = v[1];
+        }
+    }
+}
+
+static void _mirror_task(void *args, int index)
+{
+    random_arg_t *arg = args;
+    TYPE **coeff = arg->matrix->coeff;
+    size_t start = index, end = start + RANDOM_ROWS < arg->matrix->rows ? start + RANDOM_ROWS : arg->matrix->rows;
+    for (size_t i = start; i < end; i++)
+        for (size_t j = i+1; j < arg->matrix->columns; j++)
+            coeff[i][j] = coeff[j][i];
+}
+
+static void _run(random_arg_t *arg, void (*task)(void *, int))
+{
+    thread_pool_work_t work = {0, NULL, task, (void *)arg};
+    for (size_t i = 0; i < arg->matrix->rows; i += RANDOM_ROWS)
+        thread_pool_queue_work(&thread_pool, &work, i);
+    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+}
+
+static matrix_t * _random(size_t rows, size_t columns, int distribution, TYPE a, TYPE b, int symetric)
+{
+    matrix_t *matrix = matrix_create(rows, columns);
+    if(!matrix)return NULL;
+    random_arg_t arg = {matrix, distribution, a, b, symetric && rows == columns,
+                        __atomic_load_n(&random_key, __ATOMIC_RELAXED), __atomic_fetch_add(&random_stream, 1, __ATOMIC_RELAXED)};
+    _run(&arg, _random_task);
+    if(arg.lower){
+        _run(&arg, _mirror_task);
+        matrix->flags = MATRIX_SYMETRIC;
+    }
+    return matrix;
+}
+
+matrix_t * matrix_random(int rows, int columns)
+{
+    return _random(rows, columns, RANDOM_INTEGER, 0, 0, 0);
+}
+
+matrix_t * matrix_symetric_random(int rows, int columns)
+{
+    if(rows != columns){
+        // Historical behaviour: the leading square block is symetric
+        matrix_t *matrix = _random(rows, columns, RANDOM_INTEGER, 0, 0, 0);
+        size_t n = rows < columns ? rows : columns;
+        if(matrix)
+            for (size_t i = 0; i < n; i++)
+                for (size_t j = i+1; j < n; j++)
+                    matrix->coeff[i][j] = matrix->coeff[j][i];
+        return matrix;
+    }
+    return _random(rows, columns, RANDOM_INTEGER, 0, 0, 1);
+}
+
+matrix_t * matrix_random_uniform(size_t rows, size_t columns, TYPE a, TYPE b)
+{
+    return _random(rows, columns, RANDOM_UNIFORM, a, b, 0);
+}
+
+matrix_t * matrix_random_normal(size_t rows, size_t columns, TYPE mean, TYPE stddev)
+{
+    return _random(rows, columns, RANDOM_NORMAL, mean, stddev, 0);
+}
+
+matrix_t * matrix_random_orthogonal(size_t n)
+{
+    // Q of the QR of a normal matrix, with the signs of diag(R) moved into Q, is Haar distributed (Mezzadri)
+    matrix_t *G = matrix_random_normal(n, n, 0, 1), *Q = NULL, *R = NULL;
+    if(!G)return NULL;
+    if(matrix_qr_f(G, &Q, &R)){
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < n; j++)
+                if(R->coeff[j][j] < 0)Q->coeff[i][j] = -Q->coeff[i][j];
+    }
+    matrix_free(G);
+    if(R)matrix_free(R);
+    return Q;
+}
+
+matrix_t * matrix_random_spd(size_t n, TYPE cond)
+{
+    if(cond < 1){
+        fprintf(stderr, "%s: condition number must be >= 1\n", __func__);
+        return NULL;
+    }
+    // Q * diag(λ) * QT with λ geometrically spaced from 1 down to 1/cond
+    matrix_t *Q = matrix_random_orthogonal(n), *A = NULL;
+    if(!Q)return NULL;
+    matrix_t *QD = matrix_copy(Q), *Qt = matrix_transp_f(Q);
+    if(QD && Qt){
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < n; j++)
+                QD->coeff[i][j] *= n > 1 ? pow(cond, -(TYPE)j / (n-1)) : 1;
+        A = matrix_mult_f(QD, Qt);
+    }
+    if(A){
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < i; j++)
+                A->coeff[i][j] = A->coeff[j][i] = (A->coeff[i][j] + A->coeff[j][i]) / 2;
+        A->flags = MATRIX_SYMETRIC;
+    }
+    matrix_free(Q);
+    if(QD)matrix_free(QD);
+    if(Qt)matrix_free(Qt);
+    return A;
+}
@@ -4,55 +4,129 @@
 #include "matrix.h"
 #include "tools.h"
 #include "check.h"
-// Methods based upon raw determinant calculation. For fun only. Do never use them, cuz you've NO reason to use them. Really.
-static matrix_t * matrix_shrink_f(const matrix_t *matrix, size_t skipped_row, size_t skipped_column)
+#include "kernels.h"
+// Methods based upon determinant and cofactors. All come from one LU factorisation with complete pivoting,
+// which keeps the last pivot as the only vanishing one on rank n-1 matrices.
+
+// Factorises P*matrix*Q = L*U in a copy of matrix: L unit lower below the diagonal, U upper on and above it.
+// (P*matrix*Q)[i][j] = matrix[p[i]][q[j]], and sign receives det(P)*det(Q).
+static matrix_t * _lu_complete(const matrix_t *matrix, size_t *p, size_t *q, int *sign)
 {
-    if(!sanity_check((void *)matrix, __func__))return NULL;
-    size_t l = 0;
-    matrix_t *shrink_matrix = matrix_create(matrix->rows-1, matrix->columns-1);
-    for (size_t i = 0; i < shrink_matrix->rows; i++) {
-        if (l == skipped_row) l++;
-        size_t k=0;
-        for (size_t j = 0; j < shrink_matrix->columns; j++) {
-            if (k == skipped_column) k++;
-            shrink_matrix->coeff[i][j] = matrix->coeff[l][k++];
+    matrix_t *LU = matrix_copy(matrix);
+    if(!LU)return NULL;
+    size_t n = LU->rows;
+    *sign = 1;
+    for (size_t i = 0; i < n; i++)
+        p[i] = q[i] = i;
+    for (size_t k = 0; k < n; k++){
+        size_t r = k, c = k;
+        TYPE max = 0;
+        for (size_t i = k; i < n; i++)
+            for (size_t j = k; j < n; j++)
+                if(fabs(LU->coeff[i][j]) > max){
+                    max = fabs(LU->coeff[i][j]);
+                    r = i;
+                    c = j;
+                }
+        // The remaining block is null: so are the remaining pivots and the columns of L
+        if(max == 0)break;
+        if(r != k){
+            TYPE *row = LU->coeff[r];
+            LU->coeff[r] = LU->coeff[k];
+            LU->coeff[k] = row;
+            size_t tmp = p[r]; p[r] = p[k]; p[k] = tmp;
+            *sign = -*sign;
+        }
+        if(c != k){
+            for (size_t i = 0; i < n; i++){
+                TYPE tmp = LU->coeff[i][c];
+                LU->coeff[i][c] = LU->coeff[i][k];
+                LU->coeff[i][k] = tmp;
+            }
+            size_t tmp = q[c]; q[c] = q[k]; q[k] = tmp;
+            *sign = -*sign;
+        }
+        TYPE *pivot_row = LU->coeff[k];
+        for (size_t i = k+1; i < n; i++){
+            TYPE *row = LU->coeff[i];
+            TYPE l = row[k] /= pivot_row[k];
+            #pragma GCC ivdep
+            for (size_t j = k+1; j < n; j++)
+                row[j] -= l * pivot_row[j];
         }
-        l++;
     }
-    return shrink_matrix;
+    return LU;
 }
- 
+
 TYPE matrix_det_raw_f(const matrix_t *matrix)
 {
-    TYPE det = 0;
-    TYPE sign = 0;
-    matrix_t *shrinked_matrix = NULL;
     if(!sanity_check((void *)matrix, __func__))return 0;
     if(matrix->columns != matrix->rows) return 0;
-    if(matrix->columns == 1)return matrix->coeff[0][0];
-    for (size_t i = 0; i < matrix->columns; i++) 
-    {
-        shrinked_matrix=matrix_shrink_f(matrix, 0, i);
-        sign = (int)pow(-1.0,(TYPE)i);
-        det += sign * matrix->coeff[0][i] * matrix_det_raw_f(shrinked_matrix);
-        matrix_free(shrinked_matrix);
+    size_t n = matrix->rows;
+    size_t *p = malloc(2*n*sizeof(size_t));
+    if(!p){
+        perror(__func__);
+        return 0;
     }
+    int sign;
+    matrix_t *LU = _lu_complete(matrix, p, p + n, &sign);
+    free(p);
+    if(!LU)return 0;
+    TYPE det = sign;
+    for (size_t i = 0; i < n; i++)
+        det *= LU->coeff[i][i];
+    matrix_free(LU);
     return det;
 }
 
+// A^-1 = Q * U^-1 * L^-1 * P from the same factorisation: no determinant, whose range a few hundred
+// pivots exceed long before the inverse does.
 matrix_t * matrix_inverse_raw_f(const matrix_t *matrix)
 {
     if(!sanity_check((void *)matrix, __func__))return NULL;
-    TYPE det = matrix_det_raw_f(matrix);
-    TYPE one = 1;
-    if(!det){
-        fprintf(stderr, "%s: not inversible matrix (|M| = 0)\n", __func__);
+    if(!square_check(matrix, __func__))return NULL;
+    size_t n = matrix->rows;
+    size_t *p = malloc(2*n*sizeof(size_t));
+    if(!p){
+        perror(__func__);
         return NULL;
     }
-    matrix_t *compl_matrix = matrix_comp_f(matrix);
-    matrix_t *inverse_matrix = matrix_mult_scalar_f(compl_matrix, one / det);
-    matrix_free(compl_matrix);
-    return(inverse_matrix);
+    size_t *q = p + n;
+    int sign;
+    matrix_t *LU = _lu_complete(matrix, p, q, &sign);
+    matrix_t *Y = matrix_identity(n), *inverse_matrix = matrix_create(n, n);
+    if(!LU || !Y || !inverse_matrix)goto failed;
+    TYPE **F = LU->coeff;
+    for (size_t i = 0; i < n; i++)
+        if(F[i][i] == 0){
+            fprintf(stderr, "%s: not inversible matrix (|M| = 0)\n", __func__);
+            goto failed;
+        }
+    // Y = L^-1 by rows, then Y = U^-1 * Y from the last row up
+    for (size_t i = 1; i < n; i++)
+        for (size_t k = 0; k < i; k++)
+            if(F[i][k] != 0)
+                kernels->axpy(k+1, -F[i][k], Y->coeff[k], Y->coeff[i]);
+    for (size_t i = n; i-- > 0;){
+        for (size_t k = i+1; k < n; k++)
+            if(F[i][k] != 0)
+                kernels->axpy(n, -F[i][k], Y->coeff[k], Y->coeff[i]);
+        kernels->scal(n, 1 / F[i][i], Y->coeff[i], Y->coeff[i]);
+    }
+    // (P*A*Q)^-1 = QT * A^-1 * PT: A^-1[q[i]][p[j]] = Y[i][j]
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+            inverse_matrix->coeff[q[i]][p[j]] = Y->coeff[i][j];
+    free(p);
+    matrix_free(LU);
+    matrix_free(Y);
+    return inverse_matrix;
+failed:
+    free(p);
+    if(LU)matrix_free(LU);
+    if(Y)matrix_free(Y);
+    if(inverse_matrix)matrix_free(inverse_matrix);
+    return NULL;
 }
 
 matrix_t * matrix_solve_raw_f(const matrix_t *A, const matrix_t *B)
@@ -67,22 +141,86 @@ matrix_t * matrix_solve_raw_f(const matrix_t *A, const matrix_t *B)
     return(X);
 }
 
+// adj(A) = det(P)*det(Q) * Q * adj(U) * L^-1 * P, where with U = [U11 u; 0 δ]:
+//     adj(U) = det(U11) * [δ*U11^-1  -U11^-1*u; 0  1]
+// which holds for δ = 0 too: no division by the last pivot, so rank n-1 matrices get their exact
+// nonzero comatrix. Below rank n-1 det(U11) vanishes and so does the comatrix.
 matrix_t * matrix_com_f(const matrix_t *matrix)
 {
     if(!sanity_check((void *)matrix, __func__))return NULL;
     if(!square_check(matrix, __func__))return NULL; 
-    TYPE sign = 0;
-    matrix_t *shrinked_matrix = NULL;
-    matrix_t *co_matrix = matrix_create(matrix->rows, matrix->columns);
-    for (size_t i = 0; i < co_matrix->rows; i++){
-        for (size_t j = 0; j < co_matrix->columns; j++){
-            shrinked_matrix=matrix_shrink_f(matrix, i, j);
-            sign = (int)pow(-1.0,(TYPE)(i+j));
-            co_matrix->coeff[i][j] = sign * matrix_det_raw_f(shrinked_matrix);
-            matrix_free(shrinked_matrix);
+    size_t n = matrix->rows;
+    matrix_t *co_matrix = matrix_create(n, n);
+    if(!co_matrix)return NULL;
+    if(n == 1){
+        co_matrix->coeff[0][0] = 1;
+        return co_matrix;
+    }
+    matrix_t *LU = NULL, *adjU = NULL, *Linv = NULL, *adjB = NULL;
+    size_t *p = malloc(2*n*sizeof(size_t));
+    int sign;
+    if(!p){
+        perror(__func__);
+        goto failed;
+    }
+    size_t *q = p + n;
+    LU = _lu_complete(matrix, p, q, &sign);
+    adjU = matrix_create(n, n);
+    Linv = matrix_identity(n);
+    if(!LU || !adjU || !Linv)goto failed;
+    TYPE **U = LU->coeff, **V = adjU->coeff;
+    size_t m = n-1;
+    TYPE det11 = 1, delta = U[m][m];
+    for (size_t i = 0; i < m; i++)
+        det11 *= U[i][i];
+    if(det11 == 0)goto end;
+    // U11^-1 by back substitution, stored in the leading block of adjU
+    for (size_t j = 0; j < m; j++){
+        V[j][j] = 1 / U[j][j];
+        for (size_t i = j; i-- > 0;){
+            TYPE sum = 0;
+            for (size_t k = i+1; k <= j; k++)
+                sum += U[i][k] * V[k][j];
+            V[i][j] = -sum / U[i][i];
         }
     }
+    for (size_t i = 0; i < m; i++){
+        TYPE sum = 0;
+        for (size_t k = i; k < m; k++)
+            sum += V[i][k] * U[k][m];
+        V[i][m] = -det11 * sum;
+        for (size_t j = i; j < m; j++)
+            V[i][j] *= det11 * delta;
+    }
+    V[m][m] = det11;
+    // L^-1 by forward substitution
+    for (size_t i = 1; i < n; i++)
+        for (size_t j = 0; j < i; j++){
+            TYPE sum = 0;
+            for (size_t k = j; k < i; k++)
+                sum += U[i][k] * Linv->coeff[k][j];
+            Linv->coeff[i][j] = -sum;
+        }
+    adjB = matrix_mult_f(adjU, Linv);
+    if(!adjB)goto failed;
+    // com(A) = adj(A)T with adj(A)[q[i]][p[j]] = sign * adj(PAQ)[i][j]
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+            co_matrix->coeff[p[j]][q[i]] = sign * adjB->coeff[i][j];
+end:
+    free(p);
+    matrix_free(LU);
+    matrix_free(adjU);
+    matrix_free(Linv);
+    if(adjB)matrix_free(adjB);
     return co_matrix;
+failed:
+    free(p);
+    if(LU)matrix_free(LU);
+    if(adjU)matrix_free(adjU);
+    if(Linv)matrix_free(Linv);
+    matrix_free(co_matrix);
+    return NULL;
 }
 
 matrix_t * matrix_comp_f(const matrix_t *matrix)
@@ -5,16 +5,17 @@
 #include <math.h>
 #include "matrix.h"
 #include "tools.h"
+#include "ooc.h"
 
 #define DATA_PATH "/home/ubuntu/matrix/src/data"
 // Those test must be run with TYPE defined to double in matrix.h
 #define PRECISION 11
 int precision = PRECISION;
 
-#define IN_1MATRIX_OUT_DOUBLE       matrix_det_plu_f,   matrix_det_cholesky_f,    matrix_det_raw_f
-#define IN_1MATRIX_OUT_DOUBLE_IN    "matrix",           "matrix_sym"    ,         "small_matrix"     
-#define IN_1MATRIX_OUT_DOUBLE_OUT   41528648144648139187061754753110960955112756453546573882130475948738.000000, 11018591242987731278480209809487334669634103274730489724827165526048.0, -18570.0
-#define IN_1MATRIX_OUT_DOUBLE_NAME  "matrix_det_plu_f", "matrix_det_cholesky_f",  "matrix_det_raw_f"
+#define IN_1MATRIX_OUT_DOUBLE       matrix_det_plu_f,   matrix_det_cholesky_f,    matrix_det_raw_f,     matrix_logdet,          matrix_logdet
+#define IN_1MATRIX_OUT_DOUBLE_IN    "matrix",           "matrix_sym"    ,         "small_matrix",       "matrix",               "matrix_sym"
+#define IN_1MATRIX_OUT_DOUBLE_OUT   41528648144648139187061754753110960955112756453546573882130475948738.000000, 11018591242987731278480209809487334669634103274730489724827165526048.0, -18570.0, 155.69699964342317, 154.37020009677053
+#define IN_1MATRIX_OUT_DOUBLE_NAME  "matrix_det_plu_f", "matrix_det_cholesky_f",  "matrix_det_raw_f",   "matrix_logdet",        "matrix_logdet_sym"
 
 #define IN_1MATRIX_OUT_MATRIX       matrix_transp_f,    matrix_inverse_plu_f,   matrix_inverse_cholesky_f,   matrix_inverse_raw_f,  
 #define IN_1MATRIX_OUT_MATRIX_IN    "matrix",           "matrix",               "matrix_sym"  ,              "small_matrix",             
@@ -253,6 +254,1054 @@ static void free_matrixtab(matrix_t** matrixtab, int size)
     matrixtab = NULL;
 }
 
+static matrix_t * diagonally_dominant(const matrix_t *matrix)
+{
+    matrix_t *ret = matrix_copy(matrix);
+    for (size_t i = 0; i < ret->rows; i++){
+        TYPE sum = 0;
+        for (size_t j = 0; j < ret->columns; j++)
+            sum += fabs(ret->coeff[i][j]);
+        ret->coeff[i][i] += sum;
+    }
+    return ret;
+}
+
+static void laplacian_1d(void *args, const TYPE *x, TYPE *y)
+{
+    size_t n = *(size_t *)args;
+    for (size_t i = 0; i < n; i++)
+        y[i] = 4*x[i] - (i > 0 ? x[i-1] : 0) - (i+1 < n ? x[i+1] : 0);
+}
+
+static void test_iterative(char *data_path)
+{
+    char* files[] = {"matrix", "matrix_sym", "B"};
+    matrix_t** inputs = chartab2matrixtab(files, 3, data_path);
+    matrix_t *A = diagonally_dominant(inputs[0]);
+    matrix_t *S = diagonally_dominant(inputs[1]);
+    matrix_t *B = inputs[2];
+    matrix_t *expected_A = matrix_solve_plu_f(A, B);
+    matrix_t *expected_S = matrix_solve_plu_f(S, B);
+    solver_opts_t opts;
+    solver_opts_default(&opts);
+    opts.tol = 1e-13;
+    struct {
+        char *name;
+        matrix_t *(*function)(const matrix_t *, const matrix_t *, solver_opts_t *);
+        int precond;
+        matrix_t *A, *expected;
+    } cases[] = {
+        {"matrix_solve_cg_f",               matrix_solve_cg_f,       PRECOND_NONE,   S, expected_S},
+        {"matrix_solve_cg_f_jacobi",        matrix_solve_cg_f,       PRECOND_JACOBI, S, expected_S},
+        {"matrix_solve_cg_f_ichol0",        matrix_solve_cg_f,       PRECOND_ICHOL0, S, expected_S},
+        {"matrix_solve_gmres_f",            matrix_solve_gmres_f,    PRECOND_NONE,   A, expected_A},
+        {"matrix_solve_gmres_f_ilu0",       matrix_solve_gmres_f,    PRECOND_ILU0,   A, expected_A},
+        {"matrix_solve_bicgstab_f",         matrix_solve_bicgstab_f, PRECOND_NONE,   A, expected_A},
+        {"matrix_solve_bicgstab_f_jacobi",  matrix_solve_bicgstab_f, PRECOND_JACOBI, A, expected_A},
+    };
+    for (size_t i = 0; i < sizeof(cases)/sizeof(cases[0]); i++){
+        opts.precond = cases[i].precond;
+        long long time = mstime();
+        matrix_t *X = cases[i].function(cases[i].A, B, &opts);
+        long long time2 = mstime();
+        process_result((result_t){cases[i].name, test_matrix_equality(cases[i].expected, X, 8), time2 - time});
+        matrix_free(X);
+    }
+    // ILU(0) drops the fill of a[1][2], which zeroes the pivot f[2][2] with nothing below it: Jacobi takes over
+    TYPE values[4][4] = {{1, 0, 1, 0}, {1, 1, 0, 0}, {1, 1, 1, 0}, {0, 0, 0, 1}};
+    matrix_t *Z = matrix_create(4, 4), *ones = matrix_create(4, 1);
+    for (size_t i = 0; i < 4; i++){
+        ones->coeff[i][0] = 1;
+        for (size_t j = 0; j < 4; j++)
+            Z->coeff[i][j] = values[i][j];
+    }
+    matrix_t *expected_Z = matrix_solve_plu_f(Z, ones);
+    opts.precond = PRECOND_ILU0;
+    matrix_t *X = matrix_solve_gmres_f(Z, ones, &opts);
+    process_result((result_t){"matrix_solve_gmres_f_ilu0_zero_pivot", test_matrix_equality(expected_Z, X, 8), 0});
+    matrix_free(X); matrix_free(Z); matrix_free(ones); matrix_free(expected_Z);
+    size_t n = 1000;
+    TYPE *b = malloc(n*sizeof(TYPE));
+    TYPE *x = calloc(n, sizeof(TYPE));
+    for (size_t i = 0; i < n; i++)
+        b[i] = 1;
+    opts.tol = 1e-12;
+    process_result((result_t){"operator_solve_cg", operator_solve_cg(n, laplacian_1d, &n, NULL, NULL, b, x, &opts) && opts.residual < 1e-12, 0});
+    memset(x, 0, n*sizeof(TYPE));
+    process_result((result_t){"operator_solve_gmres", operator_solve_gmres(n, laplacian_1d, &n, NULL, NULL, b, x, &opts) && opts.residual < 1e-12, 0});
+    memset(x, 0, n*sizeof(TYPE));
+    process_result((result_t){"operator_solve_bicgstab", operator_solve_bicgstab(n, laplacian_1d, &n, NULL, NULL, b, x, &opts) && opts.residual < 1e-12, 0});
+    free(b);
+    free(x);
+    matrix_free(A);
+    matrix_free(S);
+    matrix_free(expected_A);
+    matrix_free(expected_S);
+    free_matrixtab(inputs, 3);
+}
+
+static matrix_t * batch2matrix(const matrix_batch_t *batch, size_t i)
+{
+    matrix_t *matrix = matrix_create(batch->rows, batch->columns);
+    TYPE *data = matrix_batch_get(batch, i);
+    for (size_t j = 0; j < batch->rows; j++)
+        for (size_t k = 0; k < batch->columns; k++)
+            matrix->coeff[j][k] = data[j*batch->columns+k];
+    return matrix;
+}
+
+static void test_batch(char *data_path)
+{
+    char* files[] = {"matrix"};
+    matrix_t** inputs = chartab2matrixtab(files, 1, data_path);
+    matrix_t *matrix = inputs[0];
+    size_t sizes[] = {4, 7, 32};
+    size_t count = 40;
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++){
+        size_t n = sizes[s];
+        matrix_batch_t *A = matrix_batch_create(count, n, n);
+        matrix_batch_t *B = matrix_batch_create(count, n, n);
+        matrix_batch_t *C = matrix_batch_create(count, n, n);
+        matrix_batch_t *X = matrix_batch_create(count, n, n);
+        matrix_batch_t *S = matrix_batch_create(count, n, n);
+        matrix_batch_t *I = matrix_batch_create(count, n, n);
+        TYPE *det = malloc(count*sizeof(TYPE));
+        for (size_t i = 0; i < count; i++){
+            TYPE *a = matrix_batch_get(A, i), *b = matrix_batch_get(B, i), *x = matrix_batch_get(X, i), *sym = matrix_batch_get(S, i);
+            for (size_t j = 0; j < n; j++){
+                for (size_t k = 0; k < n; k++){
+                    size_t r = (i+j)%matrix->rows, c = (i+k)%matrix->columns;
+                    // Diagonally dominant blocks keep the unpivoted reference PLU accurate
+                    a[j*n+k] = matrix->coeff[r][c] + (j == k ? 10*n : 0);
+                    b[j*n+k] = matrix->coeff[r][k];
+                    x[j*n+k] = b[j*n+k];
+                    sym[j*n+k] = a[j*n+k] + matrix->coeff[c][r] + (j == k ? 10*n : 0);
+                }
+            }
+        }
+        long long time = mstime();
+        int ok = matrix_batch_mult(A, B, C) && matrix_batch_solve(A, X) && matrix_batch_det(A, det) && matrix_batch_inverse(A, I) && matrix_batch_cholesky(S);
+        long long time2 = mstime();
+        for (size_t i = 0; i < count && ok; i++){
+            matrix_t *a = batch2matrix(A, i), *b = batch2matrix(B, i), *c = batch2matrix(C, i), *x = batch2matrix(X, i), *l = batch2matrix(S, i), *inv = batch2matrix(I, i);
+            matrix_t *expected_inv = matrix_inverse_plu_f(a);
+            matrix_t *expected_c = matrix_mult_f(a, b);
+            matrix_t *expected_x = matrix_solve_plu_f(a, b);
+            matrix_t *lt = matrix_transp_f(l);
+            matrix_t *llt = matrix_mult_f(l, lt);
+            ok &= test_matrix_equality(expected_c, c, precision);
+            ok &= test_matrix_equality(expected_x, x, 6);
+            ok &= test_matrix_equality(expected_inv, inv, 6);
+            ok &= fabs(-1+det[i]/matrix_det_plu_f(a)) < 1e-9;
+            for (size_t j = 0; j < n; j++)
+                for (size_t k = 0; k < n; k++)
+                    ok &= fabs(llt->coeff[j][k] - (a->coeff[j][k] + a->coeff[k][j])) < 1e-9;
+            matrix_free(a); matrix_free(b); matrix_free(c); matrix_free(x); matrix_free(l); matrix_free(inv);
+            matrix_free(expected_c); matrix_free(expected_inv); matrix_free(expected_x); matrix_free(lt); matrix_free(llt);
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "matrix_batch_%zux%zu", n, n);
+        process_result((result_t){name, ok, time2 - time});
+        matrix_batch_free(A);
+        matrix_batch_free(B);
+        matrix_batch_free(C);
+        matrix_batch_free(X);
+        matrix_batch_free(S);
+        matrix_batch_free(I);
+        free(det);
+    }
+    matrix_batch_t *singular = matrix_batch_create(count, 4, 4);
+    matrix_batch_t *inv = matrix_batch_create(count, 4, 4);
+    process_result((result_t){"test_batch_singular_matrix", matrix_batch_inverse(singular, inv) == 0, 0});
+    matrix_batch_free(singular);
+    matrix_batch_free(inv);
+    free_matrixtab(inputs, 1);
+}
+
+static void test_gemv(void)
+{
+    size_t sizes[][2] = {{50, 50}, {300, 700}, {1500, 20}};
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++){
+        size_t n = sizes[s][0], m = sizes[s][1];
+        matrix_t *A = matrix_random(n, m);
+        matrix_t *x = matrix_random(m, 1);
+        matrix_t *xt = matrix_random(1, n);
+        // Two identical columns go through the blocked matrix product, not the vector path
+        matrix_t *x2 = matrix_create(m, 2);
+        matrix_t *xt2 = matrix_create(2, n);
+        for (size_t i = 0; i < m; i++)
+            x2->coeff[i][0] = x2->coeff[i][1] = x->coeff[i][0];
+        for (size_t i = 0; i < n; i++)
+            xt2->coeff[0][i] = xt2->coeff[1][i] = xt->coeff[0][i];
+        long long time = mstime();
+        matrix_t *y = matrix_mult_f(A, x);
+        matrix_t *yt = matrix_mult_f(xt, A);
+        long long time2 = mstime();
+        matrix_t *y2 = matrix_mult_f(A, x2);
+        matrix_t *yt2 = matrix_mult_f(xt2, A);
+        int ok = y && yt && y->rows == n && y->columns == 1 && yt->rows == 1 && yt->columns == m;
+        for (size_t i = 0; ok && i < n; i++)
+            ok &= y->coeff[i][0] == y2->coeff[i][0];
+        for (size_t j = 0; ok && j < m; j++)
+            ok &= yt->coeff[0][j] == yt2->coeff[0][j];
+        // y = 2*A*x - y must give back A*x, and the same for the row vector
+        ok &= matrix_gemv_f(2, A, x, -1, y) && matrix_gevm_f(2, xt, A, -1, yt);
+        for (size_t i = 0; ok && i < n; i++)
+            ok &= y->coeff[i][0] == y2->coeff[i][0];
+        for (size_t j = 0; ok && j < m; j++)
+            ok &= fabs(yt->coeff[0][j] - yt2->coeff[0][j]) <= 1e-9 * (1 + fabs(yt2->coeff[0][j]));
+        char name[64];
+        snprintf(name, sizeof(name), "matrix_gemv_gevm_%zux%zu", n, m);
+        process_result((result_t){name, ok, time2 - time});
+        matrix_free(A); matrix_free(x); matrix_free(xt); matrix_free(x2); matrix_free(xt2);
+        matrix_free(y); matrix_free(yt); matrix_free(y2); matrix_free(yt2);
+    }
+}
+
+static void test_strassen(void)
+{
+    // Odd sizes exercise the padding, the cutoff gives 2 levels of recursion
+    size_t m = 300, k = 257, n = 310;
+    matrix_t *A = matrix_random(m, k);
+    matrix_t *B = matrix_random(k, n);
+    matrix_t *C = matrix_mult_f(A, B);
+    matrix_strassen_cutoff(64);
+    matrix_mult_algorithm(MULT_STRASSEN);
+    long long time = mstime();
+    matrix_t *S = matrix_mult_f(A, B);
+    long long time2 = mstime();
+    matrix_mult_algorithm(MULT_CLASSIC);
+    matrix_strassen_cutoff(512);
+    TYPE normA = 0, normB = 0, err = 0;
+    for (size_t i = 0; i < m; i++)
+        for (size_t j = 0; j < k; j++)
+            normA = fmax(normA, fabs(A->coeff[i][j]));
+    for (size_t i = 0; i < k; i++)
+        for (size_t j = 0; j < n; j++)
+            normB = fmax(normB, fabs(B->coeff[i][j]));
+    int ok = S && S->rows == m && S->columns == n;
+    for (size_t i = 0; ok && i < m; i++)
+        for (size_t j = 0; j < n; j++)
+            err = fmax(err, fabs(S->coeff[i][j] - C->coeff[i][j]));
+    // Normwise bound with a generous constant: Strassen is not componentwise accurate
+    ok &= err <= 1e-12 * k * normA * normB;
+    process_result((result_t){"matrix_mult_strassen_f", ok, time2 - time});
+    matrix_free(A); matrix_free(B); matrix_free(C); matrix_free(S);
+}
+
+static int matrix_equal(const matrix_t *A, const matrix_t *B)
+{
+    if(!A || !B || A->rows != B->rows || A->columns != B->columns)return 0;
+    for (size_t i = 0; i < A->rows; i++)
+        for (size_t j = 0; j < A->columns; j++)
+            if(A->coeff[i][j] != B->coeff[i][j])return 0;
+    return 1;
+}
+
+static void test_symmetric(void)
+{
+    // Integer coefficients: every ordering of the sums is exact
+    matrix_t *A = matrix_random(200, 150);
+    matrix_t *At = matrix_transp_f(A);
+    matrix_t *AAt = matrix_mult_f(A, At);
+    long long time = mstime();
+    matrix_t *C = matrix_syrk_f(A);
+    long long time2 = mstime();
+    process_result((result_t){"matrix_syrk_f", matrix_equal(C, AAt) && (C->flags & MATRIX_SYMETRIC), time2 - time});
+    matrix_packed_t *P = matrix_syrk_packed_f(A);
+    matrix_t *U = matrix_unpack(P);
+    process_result((result_t){"matrix_syrk_packed_f", matrix_equal(U, AAt) && matrix_packed_get(P, 3, 120) == AAt->coeff[3][120], 0});
+    matrix_t *S = matrix_symetric_random(150, 150);
+    matrix_t *B = matrix_random(150, 300);
+    matrix_t *SB = matrix_mult_f(S, B);
+    int ok = 1;
+    int uplo[] = {MATRIX_LOWER, MATRIX_UPPER};
+    for (int i = 0; i < 2; i++){
+        matrix_packed_t *Sp = matrix_pack(S, uplo[i]|MATRIX_SYMETRIC);
+        time = mstime();
+        matrix_t *R = matrix_symm_f(Sp, B);
+        time2 = mstime();
+        matrix_t *S2 = matrix_unpack(Sp);
+        ok &= matrix_equal(R, SB) && matrix_equal(S2, S);
+        matrix_free(R); matrix_free(S2); matrix_packed_free(Sp);
+    }
+    process_result((result_t){"matrix_symm_f", ok, time2 - time});
+    // A triangular pack is not mirrored, a non symetric matrix can not be packed as symetric
+    matrix_packed_t *L = matrix_pack(B, MATRIX_LOWER);
+    matrix_packed_t *T = matrix_pack(AAt, MATRIX_UPPER);
+    matrix_t *Tu = matrix_unpack(T);
+    AAt->coeff[1][0] += 1;
+    AAt->flags = 0;
+    matrix_packed_t *N = matrix_pack(AAt, MATRIX_LOWER|MATRIX_SYMETRIC);
+    process_result((result_t){"matrix_pack_errors", !L && !N && Tu->coeff[1][0] == 0 && Tu->flags == MATRIX_UPPER && matrix_symm_f(T, B) == NULL, 0});
+    // A passed check is not cached in the input: later writes are seen, only the caller asserts the property
+    matrix_t *M = matrix_identity(4);
+    M->coeff[0][1] = M->coeff[1][0] = 0.5;
+    matrix_t *Minv = matrix_inverse_cholesky_f(M);
+    ok = Minv && M->flags == 0;
+    M->coeff[2][1] += 1;
+    ok &= matrix_inverse_cholesky_f(M) == NULL;
+    ok &= matrix_set_symetric(M, 1) && M->flags == MATRIX_SYMETRIC && matrix_set_symetric(M, 0) && M->flags == 0 && !matrix_set_symetric(B, 1);
+    TYPE outside = matrix_packed_get(T, T->n, 0);
+    uint64_t bits;
+    memcpy(&bits, &outside, sizeof(bits));
+    ok &= (bits >> 52 & 0x7ff) == 0x7ff && bits << 12;
+    process_result((result_t){"matrix_symetric_flag", ok, 0});
+    if(Minv)matrix_free(Minv);
+    matrix_free(M);
+    matrix_free(A); matrix_free(At); matrix_free(AAt); matrix_free(C); matrix_free(U); matrix_packed_free(P);
+    matrix_free(S); matrix_free(B); matrix_free(SB); matrix_free(Tu); matrix_packed_free(T);
+}
+
+static void test_comatrix(void)
+{
+    // Rank 1 and rank 2 matrices keep a nonzero comatrix, rank n-2 ones get a null one
+    char *singular[][2][3] = {{{"1 2", "2 4"}, {"4 -2", "-2 1"}},
+                              {{"1 2 3", "4 5 6", "7 8 9"}, {"-3 6 -3", "6 -12 6", "-3 6 -3"}},
+                              {{"1 1 1", "1 1 1", "1 1 1"}, {"0 0 0", "0 0 0", "0 0 0"}},
+                              {{"0 2", "3 0"}, {"0 -3", "-2 0"}}};
+    int rows[] = {2, 3, 3, 2};
+    for (size_t t = 0; t < sizeof(rows)/sizeof(rows[0]); t++){
+        matrix_t *A = str2matrix(rows[t], singular[t][0], ' ');
+        matrix_t *expected = str2matrix(rows[t], singular[t][1], ' ');
+        matrix_t *com = matrix_com_f(A);
+        int ok = com && com->rows == expected->rows;
+        for (size_t i = 0; ok && i < com->rows; i++)
+            for (size_t j = 0; j < com->columns; j++)
+                ok &= fabs(com->coeff[i][j] - expected->coeff[i][j]) < 1e-12;
+        char name[64];
+        snprintf(name, sizeof(name), "matrix_com_f_singular%zu", t);
+        process_result((result_t){name, ok, 0});
+        matrix_free(A); matrix_free(expected);
+        if(com)matrix_free(com);
+    }
+    // Far beyond the reach of a Laplace expansion
+    // Scaled so that |A| and the cofactors stay within double range
+    matrix_t *R = matrix_random(200, 200);
+    matrix_t *D = diagonally_dominant(R);
+    matrix_t *A = matrix_mult_scalar_f(D, 1e-3);
+    matrix_free(R); matrix_free(D);
+    long long time = mstime();
+    TYPE det = matrix_det_raw_f(A);
+    matrix_t *inv = matrix_inverse_raw_f(A);
+    long long time2 = mstime();
+    TYPE ref = matrix_det_plu_f(A);
+    matrix_t *id = matrix_mult_f(A, inv);
+    int ok = fabs(det - ref) <= 1e-10 * fabs(ref);
+    for (size_t i = 0; ok && i < id->rows; i++)
+        for (size_t j = 0; j < id->columns; j++)
+            ok &= fabs(id->coeff[i][j] - (i == j)) < 1e-10;
+    process_result((result_t){"matrix_inverse_raw_f_200", ok, time2 - time});
+    matrix_free(A); matrix_free(inv); matrix_free(id);
+    // Unscaled: |A| overflows, the inverse does not
+    R = matrix_random(300, 300);
+    A = diagonally_dominant(R);
+    matrix_free(R);
+    time = mstime();
+    inv = matrix_inverse_raw_f(A);
+    time2 = mstime();
+    matrix_t *expected = matrix_inverse_plu_f(A);
+    ok = inv && expected;
+    for (size_t i = 0; ok && i < inv->rows; i++)
+        for (size_t j = 0; j < inv->columns; j++)
+            ok &= fabs(inv->coeff[i][j] - expected->coeff[i][j]) <= 1e-12;
+    process_result((result_t){"matrix_inverse_raw_f_300", ok, time2 - time});
+    matrix_free(A);
+    if(inv)matrix_free(inv);
+    if(expected)matrix_free(expected);
+}
+
+static void test_logdet(char *data_path)
+{
+    char *names[] = {"small_matrix"};
+    matrix_t **small = chartab2matrixtab(names, 1, data_path);
+    TYPE sign;
+    TYPE logdet = matrix_slogdet(small[0], &sign);
+    // No isnan/isinf here: the release build is compiled with -ffinite-math-only
+    process_result((result_t){"matrix_slogdet_negative", sign == -1 && fabs(logdet - log(18570.0)) < 1e-9, 0});
+    free_matrixtab(small, 1);
+    matrix_t *singular = matrix_create(3, 3);
+    logdet = matrix_slogdet(singular, &sign);
+    process_result((result_t){"matrix_slogdet_singular", sign == 0 && logdet < -1e300, 0});
+    matrix_free(singular);
+    // |A| and |AAT| overflow a double, log|A/c| + n*log(c) does not
+    size_t n = 600;
+    matrix_t *R = matrix_random(n, n);
+    matrix_t *A = diagonally_dominant(R);
+    matrix_t *AAt = matrix_syrk_f(A);
+    matrix_t *scaled = matrix_mult_scalar_f(A, 1e-3);
+    long long time = mstime();
+    TYPE logdetA = matrix_slogdet(A, &sign);
+    TYPE logdetAAt = matrix_logdet(AAt);
+    long long time2 = mstime();
+    TYPE sign2;
+    TYPE ref = matrix_slogdet(scaled, &sign2) + n * log(1e3);
+    int ok = matrix_det_plu_f(A) > 1e300 && sign == 1 && sign2 == 1;
+    ok &= fabs(logdetA - ref) < 1e-9 * fabs(ref) && fabs(logdetAAt - 2 * logdetA) < 1e-9 * fabs(logdetAAt);
+    process_result((result_t){"matrix_logdet_600", ok, time2 - time});
+    matrix_free(R); matrix_free(A); matrix_free(AAt); matrix_free(scaled);
+}
+
+static TYPE norm1(const matrix_t *A)
+{
+    TYPE norm = 0;
+    for (size_t j = 0; j < A->columns; j++){
+        TYPE sum = 0;
+        for (size_t i = 0; i < A->rows; i++)
+            sum += fabs(A->coeff[i][j]);
+        norm = fmax(norm, sum);
+    }
+    return norm;
+}
+
+static void test_condition(char *data_path)
+{
+    char *names[] = {"matrix", "B", "X"};
+    matrix_t **inputs = chartab2matrixtab(names, 3, data_path);
+    solve_info_t info = {1, 0, 0, 0};
+    long long time = mstime();
+    matrix_t *X = matrix_solve_plu_x_f(inputs[0], inputs[1], &info);
+    long long time2 = mstime();
+    // The estimate is a lower bound of the true condition, rarely off by more than a factor 3
+    matrix_t *inv = matrix_inverse_plu_f(inputs[0]);
+    TYPE rcond = 1 / (norm1(inputs[0]) * norm1(inv));
+    int ok = test_matrix_equality(inputs[2], X, precision) && info.backward_error < 1e-14;
+    ok &= info.rcond >= rcond && info.rcond <= 3 * rcond && matrix_rcond_f(inputs[0]) == info.rcond;
+    process_result((result_t){"matrix_solve_plu_x_f", ok, time2 - time});
+    matrix_free(X); matrix_free(inv);
+    free_matrixtab(inputs, 3);
+    // Positive definite AAT + n*I
+    matrix_t *R = matrix_random(300, 300);
+    matrix_t *A = matrix_syrk_f(R);
+    for (size_t i = 0; i < A->rows; i++)
+        A->coeff[i][i] += A->rows;
+    matrix_t *B = matrix_random(300, 20);
+    time = mstime();
+    X = matrix_solve_cholesky_x_f(A, B, &info);
+    time2 = mstime();
+    inv = matrix_inverse_plu_f(A);
+    rcond = 1 / (norm1(A) * norm1(inv));
+    ok = X && info.backward_error < 1e-14 && info.rcond >= rcond * (1 - 1e-9) && info.rcond <= 3 * rcond;
+    process_result((result_t){"matrix_solve_cholesky_x_f", ok, time2 - time});
+    matrix_free(R); matrix_free(A); matrix_free(B); matrix_free(X); matrix_free(inv);
+    // Hilbert matrix: cond1(H10) ~ 3.5e13
+    A = matrix_create(10, 10);
+    for (size_t i = 0; i < 10; i++)
+        for (size_t j = 0; j < 10; j++)
+            A->coeff[i][j] = 1.0 / (i + j + 1);
+    rcond = matrix_rcond_f(A);
+    matrix_t *singular = matrix_create(3, 3);
+    info.rcond = 1;
+    ok = rcond > 1e-15 && rcond < 1e-12 && matrix_solve_plu_x_f(singular, singular, &info) == NULL && info.rcond == 0;
+    process_result((result_t){"matrix_rcond_f", ok, 0});
+    matrix_free(A); matrix_free(singular);
+}
+
+static TYPE max_abs_diff(const matrix_t *A, const matrix_t *B)
+{
+    TYPE err = 0;
+    for (size_t i = 0; i < A->rows; i++)
+        for (size_t j = 0; j < A->columns; j++)
+            err = fmax(err, fabs(A->coeff[i][j] - B->coeff[i][j]));
+    return err;
+}
+
+static void test_qr(void)
+{
+    // Square enough for the blocked path, tall enough for TSQR, and wide
+    size_t sizes[][2] = {{300, 200}, {10000, 20}, {50, 80}};
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++){
+        size_t m = sizes[s][0], n = sizes[s][1], k = m < n ? m : n;
+        matrix_t *A = matrix_random(m, n), *Q = NULL, *R = NULL;
+        long long time = mstime();
+        int ok = matrix_qr_f(A, &Q, &R);
+        long long time2 = mstime();
+        matrix_t *QR = matrix_mult_f(Q, R);
+        matrix_t *Qt = matrix_transp_f(Q);
+        matrix_t *QtQ = matrix_mult_f(Qt, Q);
+        matrix_t *Id = matrix_identity(k);
+        ok &= Q->rows == m && Q->columns == k && R->rows == k && R->columns == n;
+        ok &= max_abs_diff(QR, A) < 1e-10 && max_abs_diff(QtQ, Id) < 1e-12;
+        for (size_t i = 0; i < k; i++)
+            for (size_t j = 0; j < i; j++)
+                ok &= R->coeff[i][j] == 0;
+        char name[64];
+        snprintf(name, sizeof(name), "matrix_qr_f_%zux%zu", m, n);
+        process_result((result_t){name, ok, time2 - time});
+        // Least squares optimality: the residual is orthogonal to the range of A, or null for wide A
+        matrix_t *B = matrix_random(m, 3);
+        time = mstime();
+        matrix_t *X = matrix_solve_lstsq_f(A, B);
+        time2 = mstime();
+        matrix_t *AX = matrix_mult_f(A, X);
+        matrix_t *res = matrix_mult_scalar_f(AX, -1);
+        matrix_t *r = matrix_add_f(B, res);
+        matrix_t *At = matrix_transp_f(A);
+        matrix_t *Atr = matrix_mult_f(At, r);
+        matrix_t *zero = matrix_create(n, 3);
+        ok = X && X->rows == n && X->columns == 3 && max_abs_diff(Atr, zero) < 1e-8;
+        if(m < n){
+            // Minimum norm: X lies in the span of the rows of A
+            matrix_t *Qr = NULL;
+            matrix_qr_f(At, &Qr, NULL);
+            matrix_t *Qrt = matrix_transp_f(Qr);
+            matrix_t *P = matrix_mult_f(Qrt, X);
+            matrix_t *PX = matrix_mult_f(Qr, P);
+            ok &= max_abs_diff(PX, X) < 1e-10;
+            matrix_free(Qr); matrix_free(Qrt); matrix_free(P); matrix_free(PX);
+        }
+        snprintf(name, sizeof(name), "matrix_solve_lstsq_f_%zux%zu", m, n);
+        process_result((result_t){name, ok, time2 - time});
+        matrix_free(A); matrix_free(Q); matrix_free(R); matrix_free(QR); matrix_free(Qt); matrix_free(QtQ); matrix_free(Id);
+        matrix_free(B); matrix_free(X); matrix_free(AX); matrix_free(res); matrix_free(r); matrix_free(At); matrix_free(Atr); matrix_free(zero);
+    }
+    matrix_t *A = matrix_create(10, 3);
+    matrix_t *B = matrix_create(10, 1);
+    process_result((result_t){"matrix_solve_lstsq_f_rank_deficient", matrix_solve_lstsq_f(A, B) == NULL, 0});
+    matrix_free(A); matrix_free(B);
+}
+
+// max |A*V - V*diag(values)| and max |VT*V - I|
+static void eigen_errors(const matrix_t *A, const matrix_t *values, const matrix_t *V, TYPE *residual, TYPE *orthogonality)
+{
+    matrix_t *AV = matrix_mult_f(A, V);
+    matrix_t *Vt = matrix_transp_f(V);
+    matrix_t *VtV = matrix_mult_f(Vt, V);
+    *residual = *orthogonality = 0;
+    for (size_t i = 0; i < V->rows; i++)
+        for (size_t j = 0; j < V->columns; j++)
+            *residual = fmax(*residual, fabs(AV->coeff[i][j] - V->coeff[i][j] * values->coeff[j][0]));
+    for (size_t i = 0; i < V->columns; i++)
+        for (size_t j = 0; j < V->columns; j++)
+            *orthogonality = fmax(*orthogonality, fabs(VtV->coeff[i][j] - (i == j)));
+    matrix_free(AV); matrix_free(Vt); matrix_free(VtV);
+}
+
+static void test_eigen(void)
+{
+    size_t n = 200, k = 6;
+    matrix_t *A = matrix_symetric_random(n, n), *values = NULL, *V = NULL, *topk = NULL, *Vk = NULL;
+    TYPE residual, orthogonality;
+    long long time = mstime();
+    int ok = matrix_eigen_sym_f(A, &values, &V);
+    long long time2 = mstime();
+    eigen_errors(A, values, V, &residual, &orthogonality);
+    ok &= residual < 1e-10 && orthogonality < 1e-12;
+    for (size_t i = 1; i < n; i++)
+        ok &= values->coeff[i-1][0] <= values->coeff[i][0];
+    process_result((result_t){"matrix_eigen_sym_f", ok, time2 - time});
+    time = mstime();
+    ok = matrix_eigen_sym_topk_f(A, k, &topk, &Vk);
+    time2 = mstime();
+    eigen_errors(A, topk, Vk, &residual, &orthogonality);
+    ok &= residual < 1e-9 && orthogonality < 1e-10 && Vk->rows == n && Vk->columns == k;
+    for (size_t t = 0; t < k; t++)
+        ok &= fabs(topk->coeff[t][0] - values->coeff[n-1-t][0]) < 1e-10 * fabs(values->coeff[n-1][0]);
+    process_result((result_t){"matrix_eigen_sym_topk_f", ok, time2 - time});
+    matrix_free(A); matrix_free(values); matrix_free(V); matrix_free(topk); matrix_free(Vk);
+    // Rank one matrix of ones: n, then a cluster of zeros with distinct orthonormal vectors
+    A = matrix_create(50, 50);
+    for (size_t i = 0; i < 50; i++)
+        for (size_t j = 0; j < 50; j++)
+            A->coeff[i][j] = 1;
+    ok = matrix_eigen_sym_topk_f(A, 4, &topk, &Vk);
+    eigen_errors(A, topk, Vk, &residual, &orthogonality);
+    ok &= fabs(topk->coeff[0][0] - 50) < 1e-12 && fabs(topk->coeff[3][0]) < 1e-12 && residual < 1e-10 && orthogonality < 1e-10;
+    process_result((result_t){"matrix_eigen_sym_topk_f_cluster", ok, 0});
+    ok = !matrix_eigen_sym_f(A, NULL, NULL) && !matrix_eigen_sym_topk_f(A, 4, NULL, &Vk);
+    process_result((result_t){"matrix_eigen_sym errors", ok, 0});
+    matrix_free(A); matrix_free(topk); matrix_free(Vk);
+}
+
+static void test_svd(void)
+{
+    size_t sizes[][2] = {{300, 120}, {80, 150}};
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++){
+        size_t m = sizes[s][0], n = sizes[s][1], k = m < n ? m : n;
+        matrix_t *A = matrix_random(m, n), *U = NULL, *S = NULL, *V = NULL;
+        long long time = mstime();
+        int ok = matrix_svd_f(A, &U, &S, &V);
+        long long time2 = mstime();
+        ok &= U->rows == m && U->columns == k && S->rows == k && V->rows == n && V->columns == k;
+        matrix_t *US = matrix_copy(U);
+        for (size_t i = 0; i < m; i++)
+            for (size_t j = 0; j < k; j++)
+                US->coeff[i][j] *= S->coeff[j][0];
+        matrix_t *Vt = matrix_transp_f(V);
+        matrix_t *USVt = matrix_mult_f(US, Vt);
+        matrix_t *Ut = matrix_transp_f(U);
+        matrix_t *UtU = matrix_mult_f(Ut, U);
+        matrix_t *VtV = matrix_mult_f(Vt, V);
+        matrix_t *Id = matrix_identity(k);
+        ok &= max_abs_diff(USVt, A) < 1e-10 && max_abs_diff(UtU, Id) < 1e-12 && max_abs_diff(VtV, Id) < 1e-12;
+        for (size_t i = 1; i < k; i++)
+            ok &= S->coeff[i-1][0] >= S->coeff[i][0] && S->coeff[i][0] > 0;
+        char name[64];
+        snprintf(name, sizeof(name), "matrix_svd_f_%zux%zu", m, n);
+        process_result((result_t){name, ok, time2 - time});
+        matrix_free(A); matrix_free(U); matrix_free(S); matrix_free(V); matrix_free(US); matrix_free(Vt);
+        matrix_free(USVt); matrix_free(Ut); matrix_free(UtU); matrix_free(VtV); matrix_free(Id);
+    }
+}
+
+static void test_funcm(void)
+{
+    // exp of t times the rotation generator, across the Padé degrees
+    TYPE angles[] = {0.01, 0.2, 1.5, 10, 100};
+    int ok = 1;
+    for (size_t a = 0; a < sizeof(angles)/sizeof(angles[0]); a++){
+        TYPE t = angles[a];
+        matrix_t *G = matrix_create(2, 2);
+        G->coeff[0][1] = -t;
+        G->coeff[1][0] = t;
+        matrix_t *E = matrix_expm_f(G);
+        ok &= fabs(E->coeff[0][0] - cos(t)) < 1e-12 && fabs(E->coeff[1][1] - cos(t)) < 1e-12
+            && fabs(E->coeff[1][0] - sin(t)) < 1e-12 && fabs(E->coeff[0][1] + sin(t)) < 1e-12;
+        matrix_free(G); matrix_free(E);
+    }
+    process_result((result_t){"matrix_expm_f_rotation", ok, 0});
+    size_t n = 150;
+    matrix_t *R = matrix_random(n, n);
+    matrix_t *A = matrix_mult_scalar_f(R, 5.0 / n);
+    matrix_t *mA = matrix_mult_scalar_f(A, -1);
+    long long time = mstime();
+    matrix_t *E = matrix_expm_f(A);
+    long long time2 = mstime();
+    matrix_t *Em = matrix_expm_f(mA);
+    matrix_t *EEm = matrix_mult_f(E, Em);
+    matrix_t *Id = matrix_identity(n);
+    process_result((result_t){"matrix_expm_f", max_abs_diff(EEm, Id) < 1e-10, time2 - time});
+    matrix_free(R); matrix_free(A); matrix_free(mA); matrix_free(E); matrix_free(Em); matrix_free(EEm);
+    // Symetric positive definite matrix with eigenvalues in [1, 2]
+    R = matrix_random(n, n);
+    matrix_t *RRt = matrix_syrk_f(R);
+    matrix_t *S = matrix_mult_scalar_f(RRt, 1.0 / norm1(RRt));
+    A = matrix_add_f(S, Id);
+    time = mstime();
+    matrix_t *Q = matrix_sqrtm_f(A);
+    time2 = mstime();
+    matrix_t *QQ = matrix_mult_f(Q, Q);
+    process_result((result_t){"matrix_sqrtm_f", max_abs_diff(QQ, A) < 1e-12 * norm1(A), time2 - time});
+    time = mstime();
+    matrix_t *L = matrix_logm_f(A);
+    time2 = mstime();
+    matrix_t *EL = matrix_expm_f(L);
+    process_result((result_t){"matrix_logm_f", max_abs_diff(EL, A) < 1e-11 * norm1(A), time2 - time});
+    matrix_free(R); matrix_free(RRt); matrix_free(S); matrix_free(A); matrix_free(Q); matrix_free(QQ); matrix_free(L); matrix_free(EL); matrix_free(Id);
+    // log of a diagonal matrix, and no real square root of a negative eigenvalue
+    A = matrix_create(3, 3);
+    A->coeff[0][0] = 1e-3; A->coeff[1][1] = 1; A->coeff[2][2] = 1e4;
+    L = matrix_logm_f(A);
+    ok = fabs(L->coeff[0][0] - log(1e-3)) < 1e-12 && fabs(L->coeff[1][1]) < 1e-12 && fabs(L->coeff[2][2] - log(1e4)) < 1e-11;
+    A->coeff[0][0] = -1;
+    ok &= matrix_sqrtm_f(A) == NULL;
+    process_result((result_t){"matrix_logm_f_diagonal", ok, 0});
+    matrix_free(A); matrix_free(L);
+}
+
+static void test_compare(void)
+{
+    size_t n = 1000;
+    matrix_t *A = matrix_random(n, n);
+    A->coeff[700][3] = 3;
+    A->coeff[700][8] = -7;
+    matrix_t *B = matrix_copy(A);
+    matrix_compare_t cmp = {.mode = COMPARE_ABS, .tol = 1e-12};
+    long long time = mstime();
+    int ok = matrix_compare(A, B, &cmp);
+    long long time2 = mstime();
+    ok &= cmp.mismatches == 0 && cmp.max_abs == 0 && cmp.row == n && cmp.column == n;
+    process_result((result_t){"matrix_compare_equal", ok, time2 - time});
+    B->coeff[900][5] += 1;
+    B->coeff[700][3] += 1e-9;
+    B->coeff[700][8] = nextafter(A->coeff[700][8], 100);
+    ok = !matrix_compare(A, B, &cmp) && cmp.mismatches == 2 && cmp.row == 700 && cmp.column == 3 && fabs(cmp.max_abs - 1) < 1e-12;
+    cmp.early_exit = 1;
+    // Rows 700 and 900 are in different tasks: how many mismatches an early exit counts depends on the schedule
+    ok &= !matrix_compare(A, B, &cmp) && cmp.mismatches >= 1 && cmp.row == 700 && cmp.column == 3;
+    process_result((result_t){"matrix_compare_abs", ok, 0});
+    B->coeff[900][5] = A->coeff[900][5];
+    B->coeff[700][3] = A->coeff[700][3] * (1 + 1e-10);
+    cmp = (matrix_compare_t){.mode = COMPARE_REL, .tol = 1e-9};
+    ok = matrix_compare(A, B, &cmp) && cmp.max_rel > 0;
+    cmp.tol = 1e-11;
+    ok &= !matrix_compare(A, B, &cmp) && cmp.row == 700 && cmp.column == 3;
+    process_result((result_t){"matrix_compare_rel", ok, 0});
+    B->coeff[700][3] = A->coeff[700][3];
+    cmp = (matrix_compare_t){.mode = COMPARE_ULP, .tol = 1};
+    ok = matrix_compare(A, B, &cmp) && cmp.max_ulp == 1;
+    cmp.tol = 0;
+    ok &= !matrix_compare(A, B, &cmp) && cmp.mismatches == 1 && cmp.row == 700 && cmp.column == 8;
+    FILE *file = fopen("/dev/null", "w");
+    ok &= matrix_diff(A, B, 20, file) == 0 && matrix_diff(A, B, 10, file) == 1;
+    fclose(file);
+    process_result((result_t){"matrix_compare_ulp", ok, 0});
+    matrix_free(A); matrix_free(B);
+    // NaN and infinities built from their bits, -Ofast folding the float ones: never equal, whatever the mode
+    uint64_t bits[] = {0x7ff8000000000000ULL, 0x7ff0000000000000ULL, 0xfff0000000000000ULL};
+    TYPE special[3];
+    memcpy(special, bits, sizeof(special));
+    A = matrix_random(3, 4);
+    B = matrix_copy(A);
+    ok = 1;
+    for (int mode = COMPARE_ABS; mode <= COMPARE_ULP; mode++){
+        for (size_t k = 0; k < 3; k++){
+            for (int both = 0; both < 2; both++){
+                TYPE a = A->coeff[1][2];
+                B->coeff[1][2] = special[k];
+                if(both)A->coeff[1][2] = special[k];
+                cmp = (matrix_compare_t){.mode = mode, .tol = mode == COMPARE_ULP ? 4 : 1e-9};
+                ok &= !matrix_compare(A, B, &cmp) && cmp.mismatches == 1 && cmp.row == 1 && cmp.column == 2;
+                A->coeff[1][2] = B->coeff[1][2] = a;
+            }
+        }
+    }
+    process_result((result_t){"matrix_compare_nonfinite", ok, 0});
+    matrix_free(A); matrix_free(B);
+}
+
+static void test_random(void)
+{
+    size_t n = 1000;
+    matrix_random_seed(42);
+    long long time = mstime();
+    matrix_t *A = matrix_random_normal(n, n, 0, 1);
+    long long time2 = mstime();
+    matrix_t *B = matrix_random_normal(n, n, 0, 1);
+    matrix_random_seed(42);
+    matrix_t *C = matrix_random_normal(n, n, 0, 1);
+    int ok = test_matrix_equality(A, C, 20) && !test_matrix_equality(A, B, 1);
+    TYPE mean = 0, var = 0;
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++){
+            mean += A->coeff[i][j];
+            var += A->coeff[i][j] * A->coeff[i][j];
+        }
+    mean /= n*n;
+    var = var / (n*n) - mean * mean;
+    ok &= fabs(mean) < 5e-3 && fabs(var - 1) < 1e-2;
+    process_result((result_t){"matrix_random_normal", ok, time2 - time});
+    matrix_free(A); matrix_free(B); matrix_free(C);
+    A = matrix_random_uniform(n, n, -2, 6);
+    mean = 0;
+    ok = 1;
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++){
+            ok &= A->coeff[i][j] >= -2 && A->coeff[i][j] < 6;
+            mean += A->coeff[i][j];
+        }
+    ok &= fabs(mean / (n*n) - 2) < 1e-2;
+    B = matrix_symetric_random(n, n);
+    ok &= (B->flags & MATRIX_SYMETRIC) && B->coeff[3][700] == B->coeff[700][3];
+    process_result((result_t){"matrix_random_uniform", ok, 0});
+    matrix_free(A); matrix_free(B);
+    n = 200;
+    time = mstime();
+    matrix_t *Q = matrix_random_orthogonal(n);
+    time2 = mstime();
+    matrix_t *Qt = matrix_transp_f(Q);
+    matrix_t *QtQ = matrix_mult_f(Qt, Q);
+    matrix_t *Id = matrix_identity(n);
+    process_result((result_t){"matrix_random_orthogonal", max_abs_diff(QtQ, Id) < 1e-12, time2 - time});
+    A = matrix_random_spd(n, 1e6);
+    matrix_t *values = NULL;
+    ok = matrix_eigen_sym_f(A, &values, NULL);
+    ok &= fabs(values->coeff[0][0] - 1e-6) < 1e-12 && fabs(values->coeff[n-1][0] - 1) < 1e-12;
+    process_result((result_t){"matrix_random_spd", ok, 0});
+    matrix_free(Q); matrix_free(Qt); matrix_free(QtQ); matrix_free(Id); matrix_free(A); matrix_free(values);
+}
+
+static void test_isa(void)
+{
+    // Every variant the cpu supports gives the same results as the baseline one
+    const char *isas[] = {"sse2", "avx2", "avx512"};
+    const char *best = matrix_isa();
+    matrix_t *A = matrix_random_normal(300, 200, 0, 1);
+    matrix_t *B = matrix_random_normal(200, 250, 0, 1);
+    matrix_isa_select("sse2");
+    matrix_t *ref = matrix_mult_f(A, B);
+    matrix_t *ref_sum = matrix_add_f(A, A);
+    matrix_t *ref_t = matrix_transp_f(A);
+    for (size_t i = 0; i < sizeof(isas)/sizeof(isas[0]); i++){
+        if(!matrix_isa_select(isas[i]))continue;
+        long long time = mstime();
+        matrix_t *C = matrix_mult_f(A, B);
+        long long time2 = mstime();
+        matrix_t *S = matrix_add_f(A, A);
+        matrix_t *T = matrix_transp_f(A);
+        matrix_compare_t cmp = {.mode = COMPARE_ABS, .tol = 1e-12};
+        int ok = matrix_compare(ref, C, &cmp) && matrix_compare(ref_sum, S, &cmp) && matrix_compare(ref_t, T, &cmp);
+        char name[64];
+        snprintf(name, sizeof(name), "matrix_isa_%s", isas[i]);
+        process_result((result_t){name, ok, time2 - time});
+        matrix_free(C); matrix_free(S); matrix_free(T);
+    }
+    process_result((result_t){"matrix_isa_unknown", matrix_isa_select("neon") == 0, 0});
+    matrix_isa_select(best);
+    matrix_free(A); matrix_free(B); matrix_free(ref); matrix_free(ref_sum); matrix_free(ref_t);
+}
+
+static void test_tuning(void)
+{
+    const char *filename = "/tmp/libmatrix_tuning_regression";
+    matrix_tuning_t saved, t;
+    matrix_tuning_get(&saved);
+    t = saved;
+    t.gemm_tile = 4;
+    int ok = matrix_tuning_set(&t) == 0;
+    ok &= matrix_tuning_save(filename);
+    t = saved;
+    t.mult_step = 3;
+    t.factor_block = 7;
+    ok &= matrix_tuning_set(&t) && matrix_tuning_load(filename);
+    matrix_tuning_get(&t);
+    ok &= t.mult_step == saved.mult_step && t.factor_block == saved.factor_block;
+    // A negative value must not wrap around, a zero one is below the minimum of the field: nothing is applied
+    const char *invalid[] = {"mult_step 5\nthreads -1\n", "mult_step 5\ngemm_tile 0\n", "mult_step 5\nplu_step 12x\n"};
+    for (size_t i = 0; i < sizeof(invalid)/sizeof(invalid[0]); i++){
+        FILE *fp = fopen(filename, "w");
+        ok &= fp && fputs(invalid[i], fp) >= 0;
+        if(fp)fclose(fp);
+        ok &= !matrix_tuning_load(filename);
+        matrix_tuning_get(&t);
+        ok &= t.mult_step == saved.mult_step && t.threads == saved.threads;
+    }
+    process_result((result_t){"matrix_tuning_load", ok, 0});
+    // threads resizes the running pool
+    t = saved;
+    t.threads = 2;
+    ok = matrix_tuning_set(&t);
+    FILE *report = tmpfile();
+    char line[512];
+    size_t threads = 0;
+    ok &= report && matrix_pool_report(report, 0);
+    if(report){
+        rewind(report);
+        while(fgets(line, sizeof(line), report))
+            threads += !strncmp(line, "  thread ", 9);
+        fclose(report);
+    }
+    matrix_t *P = matrix_random(150, 150), *Q = matrix_mult_f(P, P);
+    ok &= threads == 2 && Q && matrix_tuning_set(&saved);
+    matrix_t *Q2 = matrix_mult_f(P, P);
+    ok &= Q2 && max_abs_diff(Q, Q2) == 0;
+    process_result((result_t){"matrix_tuning_set_threads", ok, 0});
+    matrix_free(P);
+    if(Q)matrix_free(Q);
+    if(Q2)matrix_free(Q2);
+    long long time = mstime();
+    ok = matrix_autotune(filename, 128);
+    long long time2 = mstime();
+    matrix_tuning_get(&t);
+    ok &= matrix_tuning_set(&saved) && matrix_tuning_load(filename);
+    matrix_tuning_get(&saved);
+    ok &= saved.threads == t.threads && saved.gemm_tile == t.gemm_tile && saved.strassen_cutoff == t.strassen_cutoff && saved.pool_spin == t.pool_spin;
+    // The tuned values still give the right products
+    matrix_t *A = matrix_random(200, 150), *B = matrix_random(150, 170);
+    matrix_t *C = matrix_mult_f(A, B);
+    matrix_mult_algorithm(MULT_STRASSEN);
+    matrix_t *D = matrix_mult_f(A, B);
+    matrix_mult_algorithm(MULT_CLASSIC);
+    ok &= max_abs_diff(C, D) < 1e-9;
+    process_result((result_t){"matrix_autotune", ok, time2 - time});
+    matrix_free(A); matrix_free(B); matrix_free(C); matrix_free(D);
+    remove(filename);
+}
+
+static void test_graph(void)
+{
+    // Small tiles so that the graphs of the tile Cholesky and of the solves have hundreds of tasks
+    matrix_tuning_t saved, t;
+    matrix_tuning_get(&saved);
+    t = saved;
+    t.factor_block = 24;
+    matrix_tuning_set(&t);
+    size_t n = 301;
+    matrix_t *A = matrix_random_spd(n, 1e3), *B = matrix_random_normal(n, 600, 0, 1);
+    solve_info_t info = {.compute_residual = 1};
+    long long time = mstime();
+    matrix_t *X = matrix_solve_cholesky_x_f(A, B, &info);
+    long long time2 = mstime();
+    process_result((result_t){"tile_cholesky", X && info.backward_error < 1e-14, time2 - time});
+    matrix_t *N = matrix_copy(A);
+    N->coeff[n-1][n-1] = -1;
+    matrix_t *Y = matrix_solve_cholesky_x_f(N, B, NULL);
+    process_result((result_t){"tile_cholesky_not_definite", Y == NULL, 0});
+    time = mstime();
+    matrix_t *Z = matrix_solve_plu_x_f(N, B, &info);
+    time2 = mstime();
+    process_result((result_t){"tile_lu_solve", Z && info.backward_error < 1e-14, time2 - time});
+    matrix_tuning_set(&saved);
+    time = mstime();
+    matrix_t *W = matrix_solve_plu_f(N, B);
+    time2 = mstime();
+    process_result((result_t){"matrix_solve_plu_f_overlap", W && Z && max_abs_diff(W, Z) < 1e-8 * norm1(Z), time2 - time});
+    matrix_free(A); matrix_free(B); matrix_free(N);
+    if(X)matrix_free(X);
+    if(Y)matrix_free(Y);
+    if(Z)matrix_free(Z);
+    if(W)matrix_free(W);
+}
+
+// Tasks counted in the first line of a pool report
+static unsigned long long pool_tasks(int reset)
+{
+    FILE *fp = tmpfile();
+    unsigned long long tasks = -1;
+    char line[512];
+    if(fp && matrix_pool_report(fp, reset)){
+        rewind(fp);
+        if(!fgets(line, sizeof(line), fp) || sscanf(line, "thread_pool: %*fs, %llu tasks", &tasks) != 1)tasks = -1;
+    }
+    if(fp)fclose(fp);
+    return tasks;
+}
+
+static void test_pool_stats(void)
+{
+    matrix_t *A = matrix_random(200, 200), *B = matrix_random(200, 200);
+    int ok = pool_tasks(1) != (unsigned long long)-1;
+    ok &= matrix_pool_sample(5);
+    matrix_t *C = matrix_mult_f(A, B);
+    ok &= matrix_pool_sample(0);
+    unsigned long long tasks = pool_tasks(1);
+    ok &= tasks > 0 && tasks != (unsigned long long)-1;
+    // Nothing ran since the reset
+    ok &= pool_tasks(0) == 0;
+    process_result((result_t){"matrix_pool_report", ok, 0});
+    // Same product from the high priority lane
+    ok = matrix_priority(MATRIX_PRIORITY_HIGH) == MATRIX_PRIORITY_NORMAL && matrix_priority(7) == -1;
+    matrix_t *D = matrix_mult_f(A, B);
+    ok &= matrix_priority(MATRIX_PRIORITY_NORMAL) == MATRIX_PRIORITY_HIGH && max_abs_diff(C, D) == 0;
+    process_result((result_t){"matrix_priority", ok, 0});
+    matrix_free(A); matrix_free(B); matrix_free(C); matrix_free(D);
+}
+
+static TYPE square(TYPE x)
+{
+    return x * x;
+}
+
+static void test_elementwise(void)
+{
+    // Serial, then parallel with odd rows for the stream tails, cached then forced to stream
+    size_t sizes[][2] = {{17, 33}, {301, 701}};
+    matrix_tuning_t saved, t;
+    matrix_tuning_get(&saved);
+    for (int stream = 0; stream < 2; stream++){
+        t = saved;
+        if(stream)t.stream_size = 0;
+        matrix_tuning_set(&t);
+        for (size_t s = 0; s < 2; s++){
+            size_t m = sizes[s][0], n = sizes[s][1];
+            matrix_t *X = matrix_random_normal(m, n, 0, 1), *Y = matrix_random_normal(m, n, 0, 1);
+            long long time = mstime();
+            matrix_t *R[] = {matrix_add_f(X, Y), matrix_sub_f(X, Y), matrix_hadamard_f(X, Y),
+                             matrix_mult_scalar_f(X, 3), matrix_axpy_f(-2, X, Y), matrix_map_f(X, square)};
+            long long time2 = mstime();
+            int ok = 1;
+            for (size_t k = 0; k < 6; k++)ok &= R[k] != NULL;
+            for (size_t i = 0; ok && i < m; i++){
+                for (size_t j = 0; j < n; j++){
+                    TYPE x = X->coeff[i][j], y = Y->coeff[i][j];
+                    ok &= R[0]->coeff[i][j] == x + y && R[1]->coeff[i][j] == x - y && R[2]->coeff[i][j] == x * y
+                       && R[3]->coeff[i][j] == 3 * x && fabs(R[4]->coeff[i][j] - (-2 * x + y)) < 1e-15 && R[5]->coeff[i][j] == x * x;
+                }
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "matrix_elementwise %zux%zu%s", m, n, stream ? " streamed" : "");
+            process_result((result_t){name, ok, time2 - time});
+            for (size_t k = 0; k < 6; k++)if(R[k])matrix_free(R[k]);
+            matrix_free(X); matrix_free(Y);
+        }
+    }
+    matrix_tuning_set(&saved);
+    matrix_t *A = matrix_random(3, 4), *B = matrix_random(4, 3);
+    int ok = !matrix_sub_f(A, B) && !matrix_map_f(A, NULL) && !matrix_axpy_f(1, NULL, A);
+    process_result((result_t){"matrix_elementwise errors", ok, 0});
+    matrix_free(A); matrix_free(B);
+}
+
+static void test_ooc(void)
+{
+    // Tiles of 32 on 150 rows for the padded edge tiles, and a budget of a few strips so that tiles are evicted and prefetched
+    size_t n = 150, tile = 32, piv[150];
+    const char *paths[] = {"/tmp/regression_ooc_a", "/tmp/regression_ooc_b", "/tmp/regression_ooc_c"};
+    matrix_t *X = matrix_random_normal(n, n, 0, 1), *Y = matrix_random_normal(n, 97, 0, 1);
+    matrix_t *XT = matrix_transp_f(X), *S = matrix_mult_f(X, XT), *P = matrix_mult_f(X, Y);
+    for (size_t i = 0; i < n; i++)S->coeff[i][i] += n;
+    matrix_ooc_budget(3 * 5 * tile*tile*sizeof(TYPE));
+    matrix_ooc_t *A = matrix_ooc_create(paths[0], n, n, tile), *B = matrix_ooc_create(paths[1], n, 97, tile), *C = matrix_ooc_create(paths[2], n, 97, tile);
+    int ok = A && B && C && matrix_ooc_write(A, X, 0, 0) && matrix_ooc_write(B, Y, 0, 0);
+    long long time = mstime();
+    ok = ok && matrix_ooc_gemm(C, A, B);
+    long long time2 = mstime();
+    matrix_t *R = ok ? matrix_ooc_read(C, 0, 0, n, 97) : NULL;
+    process_result((result_t){"matrix_ooc_gemm", R && max_abs_diff(R, P) < 1e-10, time2 - time});
+    if(R)matrix_free(R);
+    // Cholesky: L*LT of the lower triangle read back
+    ok = ok && matrix_ooc_write(A, S, 0, 0);
+    time = mstime();
+    ok = ok && matrix_ooc_cholesky(A);
+    time2 = mstime();
+    R = ok ? matrix_ooc_read(A, 0, 0, n, n) : NULL;
+    int ok2 = R != NULL;
+    if(R){
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = i+1; j < n; j++)
+                R->coeff[i][j] = 0;
+        matrix_t *RT = matrix_transp_f(R), *LLT = matrix_mult_f(R, RT);
+        ok2 = max_abs_diff(LLT, S) < 1e-9;
+        matrix_free(RT); matrix_free(LLT); matrix_free(R);
+    }
+    process_result((result_t){"matrix_ooc_cholesky", ok2, time2 - time});
+    // LU: L*U against the rows of X swapped as piv, through a file opened again
+    ok = ok && matrix_ooc_write(A, X, 0, 0) && matrix_ooc_close(A);
+    A = ok ? matrix_ooc_open(paths[0]) : NULL;
+    time = mstime();
+    ok = A && matrix_ooc_lu(A, piv);
+    time2 = mstime();
+    R = ok ? matrix_ooc_read(A, 0, 0, n, n) : NULL;
+    ok2 = R != NULL;
+    if(R){
+        matrix_t *L = matrix_create(n, n), *U = matrix_create(n, n);
+        for (size_t i = 0; i < n; i++){
+            for (size_t j = 0; j < n; j++){
+                L->coeff[i][j] = j < i ? R->coeff[i][j] : j == i;
+                U->coeff[i][j] = j >= i ? R->coeff[i][j] : 0;
+            }
+            TYPE *row = X->coeff[i];
+            X->coeff[i] = X->coeff[piv[i]];
+            X->coeff[piv[i]] = row;
+        }
+        matrix_t *LU = matrix_mult_f(L, U);
+        ok2 = max_abs_diff(LU, X) < 1e-9;
+        matrix_free(L); matrix_free(U); matrix_free(LU); matrix_free(R);
+    }
+    process_result((result_t){"matrix_ooc_lu", ok2, time2 - time});
+    ok = !matrix_ooc_gemm(A, A, B) && !matrix_ooc_cholesky(B) && !matrix_ooc_open("/dev/null");
+    // A budget below one tile, then no memory for a tile of 2^48 coefficients: errors instead of waiting forever for a slot
+    matrix_ooc_budget(tile*tile*sizeof(TYPE) / 2);
+    ok &= C && !matrix_ooc_read(C, 0, 0, 1, 1);
+    matrix_ooc_budget((size_t)1 << 62);
+    matrix_ooc_t *H = matrix_ooc_create("/tmp/regression_ooc_huge", 1, 1, 1);
+    uint64_t huge = (uint64_t)1 << 24;
+    FILE *header = H && matrix_ooc_close(H) ? fopen("/tmp/regression_ooc_huge", "r+") : NULL;
+    ok &= header && !fseek(header, 24, SEEK_SET) && fwrite(&huge, sizeof(huge), 1, header) == 1;
+    if(header)fclose(header);
+    H = matrix_ooc_open("/tmp/regression_ooc_huge");
+    ok &= H && !matrix_ooc_read(H, 0, 0, 1, 1);
+    if(H)matrix_ooc_close(H);
+    remove("/tmp/regression_ooc_huge");
+    process_result((result_t){"matrix_ooc errors", ok, 0});
+    if(A)matrix_ooc_close(A);
+    if(B)matrix_ooc_close(B);
+    if(C)matrix_ooc_close(C);
+    matrix_ooc_budget((size_t)1 << 30);
+    for (size_t i = 0; i < 3; i++)remove(paths[i]);
+    matrix_free(X); matrix_free(Y); matrix_free(XT); matrix_free(S); matrix_free(P);
+}
+
 int main(int argc, char **argv) {
     char *data_path = DATA_PATH;
     if(argc > 1)
@@ -351,6 +1400,26 @@ int main(int argc, char **argv) {
     // }
     test_error_cases();
     test_tools();
+    test_iterative(data_path);
+    test_batch(data_path);
+    test_gemv();
+    test_strassen();
+    test_symmetric();
+    test_comatrix();
+    test_logdet(data_path);
+    test_condition(data_path);
+    test_qr();
+    test_eigen();
+    test_svd();
+    test_funcm();
+    test_compare();
+    test_random();
+    test_isa();
+    test_tuning();
+    test_graph();
+    test_pool_stats();
+    test_elementwise();
+    test_ooc();
     libmatrix_end();
     return 1;
 }
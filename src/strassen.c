@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "matrix.h"
+#include "check.h"
+#include "blas.h"
+#include "thread_pool.h"
+
+// Strassen-Winograd product: 7 half-size products and 15 additions per level instead of 8 products,
+// recursing until the smallest dimension fits under tuning.strassen_cutoff, where the blocked kernel takes over.
+// Operands are zero-padded so that each dimension divides evenly at every level.
+//
+// Error bound (Higham, Accuracy and Stability of Numerical Algorithms, 2nd ed., Theorem 23.3),
+// with n0 the size at which the recursion stops, u the unit roundoff and ||X|| = max|xij|:
+//     ||C - fl(C)|| <= [(n/n0)^log2(18) * (n0^2 + 6*n0) - 6*n] * u * ||A|| * ||B|| + O(u^2)
+// The classic product satisfies |C - fl(C)| <= n * u * |A| * |B| componentwise, i.e. a n^2 normwise
+// factor. The bound only holds normwise: small coefficients of C may lose relative accuracy, so keep
+// the classic product when C has entries of widely varying magnitude.
+
+extern thread_pool_t thread_pool;
+extern matrix_tuning_t tuning;
+
+typedef struct {
+    const TYPE *A;
+    size_t lda;
+    const TYPE *B;
+    size_t ldb;
+    TYPE *C;
+    size_t ldc;
+} product_t;
+
+typedef struct {
+    size_t m, k, n;
+    int depth;
+    size_t work_size;
+    TYPE *work;
+    product_t *products;
+} product_arg_t;
+
+static size_t _workspace_size(size_t m, size_t k, size_t n, int depth)
+{
+    if(depth == 0)return 0;
+    size_t m2 = m/2, k2 = k/2, n2 = n/2;
+    return 4*m2*k2 + 4*k2*n2 + 3*m2*n2 + _workspace_size(m2, k2, n2, depth-1);
+}
+
+static void _add(size_t m, size_t n, const TYPE *A, size_t lda, const TYPE *B, size_t ldb, TYPE *C, size_t ldc)
+{
+    for (size_t i = 0; i < m; i++){
+        #pragma GCC ivdep
+        for (size_t j = 0; j < n; j++)
+            C[i*ldc+j] = A[i*lda+j] + B[i*ldb+j];
+    }
+}
+
+static void _sub(size_t m, size_t n, const TYPE *A, size_t lda, const TYPE *B, size_t ldb, TYPE *C, size_t ldc)
+{
+    for (size_t i = 0; i < m; i++){
+        #pragma GCC ivdep
+        for (size_t j = 0; j < n; j++)
+            C[i*ldc+j] = A[i*lda+j] - B[i*ldb+j];
+    }
+}
+
+static void _winograd(size_t m, size_t k, size_t n, const TYPE *A, size_t lda, const TYPE *B, size_t ldb, TYPE *C, size_t ldc, int depth, TYPE *work);
+
+// Computes the operand sums S1..S4 and T1..T4 in work and fills the 7 products description.
+// P2, P3, P4 and P5 are written directly into the quadrants of C, P1, P6 and P7 into work.
+static TYPE * _winograd_prepare(size_t m, size_t k, size_t n, const TYPE *A, size_t lda, const TYPE *B, size_t ldb, TYPE *C, size_t ldc, TYPE *work, product_t *products)
+{
+    size_t m2 = m/2, k2 = k/2, n2 = n/2;
+    const TYPE *A11 = A, *A12 = A + k2, *A21 = A + m2*lda, *A22 = A21 + k2;
+    const TYPE *B11 = B, *B12 = B + n2, *B21 = B + k2*ldb, *B22 = B21 + n2;
+    TYPE *C11 = C, *C12 = C + n2, *C21 = C + m2*ldc, *C22 = C21 + n2;
+    TYPE *S1 = work, *S2 = S1 + m2*k2, *S3 = S2 + m2*k2, *S4 = S3 + m2*k2;
+    TYPE *T1 = S4 + m2*k2, *T2 = T1 + k2*n2, *T3 = T2 + k2*n2, *T4 = T3 + k2*n2;
+    TYPE *P1 = T4 + k2*n2, *P6 = P1 + m2*n2, *P7 = P6 + m2*n2;
+    _add(m2, k2, A21, lda, A22, lda, S1, k2);
+    _sub(m2, k2, S1, k2, A11, lda, S2, k2);
+    _sub(m2, k2, A11, lda, A21, lda, S3, k2);
+    _sub(m2, k2, A12, lda, S2, k2, S4, k2);
+    _sub(k2, n2, B12, ldb, B11, ldb, T1, n2);
+    _sub(k2, n2, B22, ldb, T1, n2, T2, n2);
+    _sub(k2, n2, B22, ldb, B12, ldb, T3, n2);
+    _sub(k2, n2, T2, n2, B21, ldb, T4, n2);
+    products[0] = (product_t){A11, lda, B11, ldb, P1, n2};
+    products[1] = (product_t){A12, lda, B21, ldb, C11, ldc};
+    products[2] = (product_t){S4, k2, B22, ldb, C12, ldc};
+    products[3] = (product_t){A22, lda, T4, n2, C21, ldc};
+    products[4] = (product_t){S1, k2, T1, n2, C22, ldc};
+    products[5] = (product_t){S2, k2, T2, n2, P6, n2};
+    products[6] = (product_t){S3, k2, T3, n2, P7, n2};
+    return P7 + m2*n2;
+}
+
+static void _winograd_combine(size_t m, size_t n, TYPE *C, size_t ldc, TYPE *work, size_t k)
+{
+    size_t m2 = m/2, k2 = k/2, n2 = n/2;
+    TYPE *C11 = C, *C12 = C + n2, *C21 = C + m2*ldc, *C22 = C21 + n2;
+    TYPE *P1 = work + 4*m2*k2 + 4*k2*n2, *P6 = P1 + m2*n2, *P7 = P6 + m2*n2;
+    _add(m2, n2, C11, ldc, P1, n2, C11, ldc);   // C11 = P1 + P2
+    _add(m2, n2, P6, n2, P1, n2, P6, n2);       // U2 = P1 + P6
+    _add(m2, n2, P7, n2, P6, n2, P7, n2);       // U3 = U2 + P7
+    _add(m2, n2, C12, ldc, P6, n2, C12, ldc);
+    _add(m2, n2, C12, ldc, C22, ldc, C12, ldc); // C12 = U2 + P5 + P3
+    _add(m2, n2, C22, ldc, P7, n2, C22, ldc);   // C22 = U3 + P5
+    _sub(m2, n2, P7, n2, C21, ldc, C21, ldc);   // C21 = U3 - P4
+}
+
+static void _winograd(size_t m, size_t k, size_t n, const TYPE *A, size_t lda, const TYPE *B, size_t ldb, TYPE *C, size_t ldc, int depth, TYPE *work)
+{
+    if(depth == 0){
+        for (size_t i = 0; i < m; i++)
+            memset(C + i*ldc, 0, n*sizeof(TYPE));
+        blas_gemm_kernel(m, k, n, A, lda, B, ldb, C, ldc);
+        return;
+    }
+    product_t products[7];
+    TYPE *sub_work = _winograd_prepare(m, k, n, A, lda, B, ldb, C, ldc, work, products);
+    for (int i = 0; i < 7; i++)
+        _winograd(m/2, k/2, n/2, products[i].A, products[i].lda, products[i].B, products[i].ldb, products[i].C, products[i].ldc, depth-1, sub_work);
+    _winograd_combine(m, n, C, ldc, work, k);
+}
+
+static void _product_task(void *args, int i)
+{
+    product_arg_t *arg = args;
+    product_t *p = &arg->products[i];
+    _winograd(arg->m, arg->k, arg->n, p->A, p->lda, p->B, p->ldb, p->C, p->ldc, arg->depth, arg->work + i*arg->work_size);
+}
+
+matrix_t * matrix_mult_strassen_f(const matrix_t *matrix1, const matrix_t *matrix2)
+{
+    if(!sanity_check((void *)matrix1, __func__))return NULL;
+    if(!sanity_check((void *)matrix2, __func__))return NULL;
+    if((matrix2->rows != matrix1->columns)){
+        fprintf(stderr, "%s: not multiplicable matrix (matrix2->rows != matrix1->columns)\n", __func__);
+        return NULL;
+    }
+    size_t m = matrix1->rows, k = matrix1->columns, n = matrix2->columns;
+    size_t min = m < k ? m : k;
+    min = min < n ? min : n;
+    int depth = 0;
+    while((min >> depth) > tuning.strassen_cutoff)
+        depth++;
+    if(depth == 0)
+        return matrix_mult_f(matrix1, matrix2);
+    size_t pad = (size_t)1 << depth;
+    size_t M = (m + pad-1) / pad * pad, K = (k + pad-1) / pad * pad, N = (n + pad-1) / pad * pad;
+    // Top level products run in parallel, each one with its own workspace for the levels below
+    size_t sub_size = _workspace_size(M/2, K/2, N/2, depth-1);
+    size_t size = M*K + K*N + M*N + 4*(M/2)*(K/2) + 4*(K/2)*(N/2) + 3*(M/2)*(N/2) + 7*sub_size;
+    matrix_t *mult = NULL;
+    TYPE *buffer = aligned_alloc(ALIGN, (size + 4-size%4)*sizeof(TYPE));
+    if(!buffer){
+        perror(__func__);
+        return NULL;
+    }
+    TYPE *A = buffer, *B = A + M*K, *C = B + K*N, *work = C + M*N;
+    memset(A, 0, (M*K + K*N)*sizeof(TYPE));
+    for (size_t i = 0; i < m; i++)
+        memcpy(A + i*K, matrix1->coeff[i], k*sizeof(TYPE));
+    for (size_t i = 0; i < k; i++)
+        memcpy(B + i*N, matrix2->coeff[i], n*sizeof(TYPE));
+    product_t products[7];
+    TYPE *sub_work = _winograd_prepare(M, K, N, A, K, B, N, C, N, work, products);
+    product_arg_t arg = {M/2, K/2, N/2, depth-1, sub_size, sub_work, products};
+    thread_pool_work_t thpool_work = {0, NULL, _product_task, (void *)&arg};
+    for (int i = 0; i < 7; i++)
+        thread_pool_queue_work(&thread_pool, &thpool_work, i);
+    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+    _winograd_combine(M, N, C, N, work, K);
+    mult = matrix_create(m, n);
+    if(mult){
+        for (size_t i = 0; i < m; i++)
+            memcpy(mult->coeff[i], C + i*N, n*sizeof(TYPE));
+    }
+    free(buffer);
+    return mult;
+}
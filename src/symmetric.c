@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "matrix.h"
+#include "check.h"
+#include "thread_pool.h"
+
+// Rows of the result handled by one syrk task, and columns of B handled by one symm task
+#define SYRK_ROWS 16
+#define SYRK_TILE 64
+#define SYMM_COLUMNS 256
+
+extern thread_pool_t thread_pool;
+
+typedef struct {
+    const matrix_t *A;
+    matrix_t *C;
+    TYPE *packed;
+} syrk_arg_t;
+
+typedef struct {
+    const matrix_packed_t *S;
+    const matrix_t *B;
+    matrix_t *C;
+} symm_arg_t;
+
+// Row i of a lower packed matrix holds columns 0..i, row i of an upper one holds columns i..n-1
+static inline size_t _packed_row(size_t n, int flags, size_t i)
+{
+    return flags & MATRIX_LOWER ? i*(i+1)/2 : i*n - i*(i-1)/2;
+}
+
+static int _packed_flags_check(int flags, const char *function_name)
+{
+    if(!(flags & MATRIX_LOWER) == !(flags & MATRIX_UPPER)){
+        fprintf(stderr, "%s: one of MATRIX_LOWER and MATRIX_UPPER is expected\n", function_name);
+        return 0;
+    }
+    return 1;
+}
+
+static matrix_packed_t * _packed_create(size_t n, int flags)
+{
+    matrix_packed_t *packed = malloc(sizeof(matrix_packed_t));
+    if(!packed){
+        perror(__func__);
+        return NULL;
+    }
+    size_t size = n*(n+1)/2;
+    packed->n = n;
+    packed->flags = flags;
+    packed->data = aligned_alloc(ALIGN, (size + 4-size%4)*sizeof(TYPE));
+    if(!packed->data){
+        perror(__func__);
+        free(packed);
+        return NULL;
+    }
+    return packed;
+}
+
+matrix_packed_t * matrix_pack(const matrix_t *matrix, int flags)
+{
+    if(!sanity_check((void *)matrix, __func__))return NULL;
+    if(!square_check(matrix, __func__))return NULL;
+    if(!_packed_flags_check(flags, __func__))return NULL;
+    if((flags & MATRIX_SYMETRIC) && !symetry_check(matrix, __func__))return NULL;
+    size_t n = matrix->rows;
+    matrix_packed_t *packed = _packed_create(n, flags);
+    if(!packed)return NULL;
+    for (size_t i = 0; i < n; i++){
+        TYPE *row = packed->data + _packed_row(n, flags, i);
+        if(flags & MATRIX_LOWER)
+            memcpy(row, matrix->coeff[i], (i+1)*sizeof(TYPE));
+        else
+            memcpy(row, matrix->coeff[i] + i, (n-i)*sizeof(TYPE));
+    }
+    return packed;
+}
+
+matrix_t * matrix_unpack(const matrix_packed_t *packed)
+{
+    if(!sanity_check((void *)packed, __func__))return NULL;
+    size_t n = packed->n;
+    matrix_t *matrix = matrix_create(n, n);
+    if(!matrix)return NULL;
+    for (size_t i = 0; i < n; i++){
+        const TYPE *row = packed->data + _packed_row(n, packed->flags, i);
+        if(packed->flags & MATRIX_LOWER)
+            memcpy(matrix->coeff[i], row, (i+1)*sizeof(TYPE));
+        else
+            memcpy(matrix->coeff[i] + i, row, (n-i)*sizeof(TYPE));
+    }
+    if(packed->flags & MATRIX_SYMETRIC){
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < i; j++){
+                if(packed->flags & MATRIX_LOWER)
+                    matrix->coeff[j][i] = matrix->coeff[i][j];
+                else
+                    matrix->coeff[i][j] = matrix->coeff[j][i];
+            }
+    }
+    matrix->flags = packed->flags & MATRIX_SYMETRIC ? MATRIX_SYMETRIC : packed->flags & (MATRIX_LOWER|MATRIX_UPPER);
+    return matrix;
+}
+
+void matrix_packed_free(matrix_packed_t *packed)
+{
+    if(!sanity_check(packed, __func__))return;
+    free(packed->data);
+    free(packed);
+}
+
+TYPE matrix_packed_get(const matrix_packed_t *packed, size_t i, size_t j)
+{
+    if(!sanity_check((void *)packed, __func__))return NAN;
+    if(i >= packed->n || j >= packed->n){
+        fprintf(stderr, "%s: (%zu, %zu) out of the %zux%zu matrix\n", __func__, i, j, packed->n, packed->n);
+        return NAN;
+    }
+    if((packed->flags & MATRIX_LOWER) ? j > i : j < i){
+        if(!(packed->flags & MATRIX_SYMETRIC))return 0;
+        size_t tmp = i;
+        i = j;
+        j = tmp;
+    }
+    size_t first = packed->flags & MATRIX_LOWER ? 0 : i;
+    return packed->data[_packed_row(packed->n, packed->flags, i) + j - first];
+}
+
+static void _syrk_task(void *args, int index)
+{
+    syrk_arg_t *arg = args;
+    const matrix_t *A = arg->A;
+    size_t start = index, end = start + SYRK_ROWS < A->rows ? start + SYRK_ROWS : A->rows;
+    size_t k = A->columns;
+    // Rows j of A are reused by all the rows of the block while they stay in cache
+    for (size_t jj = 0; jj < end; jj += SYRK_TILE){
+        for (size_t i = start; i < end; i++){
+            const TYPE *a = A->coeff[i];
+            TYPE *c = arg->packed ? arg->packed + i*(i+1)/2 : arg->C->coeff[i];
+            size_t jend = jj + SYRK_TILE < i+1 ? jj + SYRK_TILE : i+1;
+            for (size_t j = jj; j < jend; j++){
+                const TYPE *b = A->coeff[j];
+                TYPE sum = 0;
+                for (size_t p = 0; p < k; p++)
+                    sum += a[p] * b[p];
+                c[j] = sum;
+                if(!arg->packed)
+                    arg->C->coeff[j][i] = sum;
+            }
+        }
+    }
+}
+
+static void _syrk(const matrix_t *A, matrix_t *C, TYPE *packed)
+{
+    syrk_arg_t arg = {A, C, packed};
+    thread_pool_work_t work = {0, NULL, _syrk_task, (void *)&arg};
+    for (size_t i = 0; i < A->rows; i += SYRK_ROWS)
+        thread_pool_queue_work(&thread_pool, &work, i);
+    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+}
+
+matrix_t * matrix_syrk_f(const matrix_t *matrix)
+{
+    if(!sanity_check((void *)matrix, __func__))return NULL;
+    matrix_t *C = matrix_create(matrix->rows, matrix->rows);
+    if(!C)return NULL;
+    _syrk(matrix, C, NULL);
+    C->flags = MATRIX_SYMETRIC;
+    return C;
+}
+
+matrix_packed_t * matrix_syrk_packed_f(const matrix_t *matrix)
+{
+    if(!sanity_check((void *)matrix, __func__))return NULL;
+    matrix_packed_t *C = _packed_create(matrix->rows, MATRIX_LOWER|MATRIX_SYMETRIC);
+    if(!C)return NULL;
+    _syrk(matrix, NULL, C->data);
+    return C;
+}
+
+static void _symm_task(void *args, int index)
+{
+    symm_arg_t *arg = args;
+    const matrix_packed_t *S = arg->S;
+    size_t n = S->n, start = index;
+    size_t end = start + SYMM_COLUMNS < arg->B->columns ? start + SYMM_COLUMNS : arg->B->columns;
+    TYPE **B = arg->B->coeff, **C = arg->C->coeff;
+    // Each stored coefficient s(i,j) contributes to rows i and j of the result
+    for (size_t i = 0; i < n; i++){
+        const TYPE *s = S->data + _packed_row(n, S->flags, i);
+        size_t first = S->flags & MATRIX_LOWER ? 0 : i, last = S->flags & MATRIX_LOWER ? i+1 : n;
+        for (size_t j = first; j < last; j++){
+            TYPE sij = s[j - first];
+            TYPE *ci = C[i], *cj = C[j];
+            const TYPE *bi = B[i], *bj = B[j];
+            if(i == j){
+                for (size_t c = start; c < end; c++)
+                    ci[c] += sij * bi[c];
+                continue;
+            }
+            #pragma GCC ivdep
+            for (size_t c = start; c < end; c++){
+                ci[c] += sij * bj[c];
+                cj[c] += sij * bi[c];
+            }
+        }
+    }
+}
+
+matrix_t * matrix_symm_f(const matrix_packed_t *S, const matrix_t *B)
+{
+    if(!sanity_check((void *)S, __func__))return NULL;
+    if(!sanity_check((void *)B, __func__))return NULL;
+    if(!(S->flags & MATRIX_SYMETRIC)){
+        fprintf(stderr, "%s: not symetric matrix\n", __func__);
+        return NULL;
+    }
+    if(B->rows != S->n){
+        fprintf(stderr, "%s: not multiplicable matrix (B->rows != S->n)\n", __func__);
+        return NULL;
+    }
+    matrix_t *C = matrix_create(S->n, B->columns);
+    if(!C)return NULL;
+    symm_arg_t arg = {S, B, C};
+    thread_pool_work_t work = {0, NULL, _symm_task, (void *)&arg};
+    for (size_t c = 0; c < B->columns; c += SYMM_COLUMNS)
+        thread_pool_queue_work(&thread_pool, &work, c);
+    if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem\x1b[0m\n");
+    }
+    return C;
+}
@@ -3,11 +3,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
 #include <errno.h>
 #include <time.h>
 #include <sys/time.h>
 #include "matrix.h"
 #include "tools.h"
+#include "thread_pool.h"
+
+extern thread_pool_t thread_pool;
 
 static int sanity_check(const void *pointer, const char *function_name)
 {
@@ -77,36 +81,6 @@ static void _matrix_display(const matrix_t *matrix, int precision, FILE *stream)
     }
 }
 
-matrix_t * matrix_random(int rows, int columns)
-{
-    matrix_t *matrix = matrix_create(rows, columns);
-    if(matrix){
-        srand((size_t)time(NULL));
-        for (size_t i = 0; i < matrix->rows; i++) {
-            for (size_t j = 0; j < matrix->columns; j++) {
-                matrix->coeff[i][j] = (TYPE)(pow(-1.0, rand())*(rand()%10));
-            }
-        }
-    }
-    return matrix;
-}
-
-matrix_t * matrix_symetric_random(int rows, int columns)
-{
-    TYPE random;
-    matrix_t *matrix = matrix_create(rows, columns);
-    if(matrix){
-        srand((size_t)time(NULL));
-        for (size_t i = 0; i < matrix->rows; i++) {
-            for (size_t j = 0; j <= i; j++) {
-                random = (TYPE)(pow(-1.0, rand())*(rand()%10));
-                matrix->coeff[i][j] = matrix->coeff[j][i] = random;
-            }
-        }
-    }
-    return matrix;
-}
-
 matrix_t * str2matrix(int argc, char **argv, char separator)
 {
     size_t i, j, columns = 0, len, trigger, flag = 0, count, size;
@@ -232,7 +206,7 @@ char * format_time(const long long input_time, char* format)
     if(input_time<=0){ // Quickly handle case 0
         bufsz = snprintf(NULL, 0, "0%s", format);
         ret = malloc((bufsz+1)*sizeof(*ret));
-        if(!ret){perror(__func__);}
+        if(!ret){perror(__func__); return NULL;}
         snprintf(ret, bufsz, "0%s", format);
         return(ret);
     }
@@ -246,7 +220,7 @@ char * format_time(const long long input_time, char* format)
     bufsz = snprintf(NULL, 0, "%lld%s",timestamp[i],formats[i]);
     for (k=i+1; k < j && (bufsz += snprintf(NULL, 0, "%0*lld%s",width[k],timestamp[k],formats[k])); k++ );
     ret = malloc((bufsz+1)*sizeof(*ret));
-    if(!ret){perror(__func__);}
+    if(!ret){perror(__func__); return NULL;}
     bufsz = sprintf(ret, "%lld%s",timestamp[i],formats[i]);
     for (k=i+1; k < j && (bufsz +=(int)sprintf(ret + bufsz, "%0*lld%s",width[k],timestamp[k],formats[k])); k++ );
     return(ret);
@@ -260,40 +234,194 @@ long long mstime(void)
     // return((long long)(1e3*clock()/CLOCKS_PER_SEC));
 }
 
-int test_matrix_equality(const matrix_t *matrix1, const matrix_t *matrix2, int precision)
+// Rows of the compared matrices handled by one task, and size under which the comparison stays serial
+#define COMPARE_ROWS 64
+#define COMPARE_SERIAL 65536
+
+typedef struct {
+    size_t mismatches;
+    TYPE max_abs, max_rel;
+    uint64_t max_ulp;
+    size_t row, column;
+} compare_stats_t;
+
+typedef struct {
+    const matrix_t *A, *B;
+    const matrix_compare_t *cmp;
+    compare_stats_t *stats;                                             // One per block of rows
+    size_t first_row;                                                   // Earliest mismatching row found so far
+} compare_arg_t;
+
+// Doubles mapped to unsigned integers ordered like them, so that ULP distance is a subtraction
+static inline uint64_t _ordered(TYPE x)
 {
-    if(!sanity_check(matrix1, __func__))return 0; 
-    if(!sanity_check(matrix2, __func__))return 0; 
-    if((matrix1->rows != matrix2->rows) || (matrix1->columns != matrix2->columns))return 0;
-    for (size_t i=0; i<matrix1->rows; i++){
-        for (size_t j=0; j<matrix1->columns; j++){
-            if(matrix1->coeff[i][j] != matrix1->coeff[i][j])return 0;// These checks are necessary 
-            if(matrix2->coeff[i][j] != matrix2->coeff[i][j])return 0;//  in case of nan values
-            if(fabs(matrix1->coeff[i][j] - matrix2->coeff[i][j]) > pow(10, -precision))return 0;
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u >> 63 ? ~u : u | (1ULL << 63);
+}
+
+static inline uint64_t _ulp(TYPE a, TYPE b)
+{
+    uint64_t ua = _ordered(a), ub = _ordered(b);
+    return ua > ub ? ua - ub : ub - ua;
+}
+
+// NaN and infinities from the exponent bits: -Ofast compiles float tests of them out
+static inline int _nonfinite(TYPE x)
+{
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return (u >> 52 & 0x7ff) == 0x7ff;
+}
+
+static inline int _nan(TYPE x)
+{
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return (u >> 52 & 0x7ff) == 0x7ff && u << 12;
+}
+
+// A NaN or an infinity on either side is always a mismatch
+static inline int _mismatch(TYPE a, TYPE b, const matrix_compare_t *cmp)
+{
+    if(_nonfinite(a) | _nonfinite(b))return 1;
+    TYPE diff = fabs(a - b);
+    switch(cmp->mode){
+    case COMPARE_REL:
+        return !(diff <= cmp->tol * fmax(fabs(a), fabs(b)));
+    case COMPARE_ULP:
+        return _ulp(a, b) > (uint64_t)cmp->tol;
+    default:
+        return !(diff <= cmp->tol);
+    }
+}
+
+// Branch free statistics over the row, then a scan for the mismatches only if the row has any
+static size_t _compare_row(const TYPE *a, const TYPE *b, size_t n, const matrix_compare_t *cmp, compare_stats_t *stats)
+{
+    TYPE max_abs = 0, max_rel = 0;
+    uint64_t max_ulp = 0;
+    int nonfinite = 0;
+    for (size_t j = 0; j < n; j++){
+        TYPE diff = fabs(a[j] - b[j]), scale = fmax(fabs(a[j]), fabs(b[j]));
+        uint64_t ulp = _ulp(a[j], b[j]);
+        nonfinite |= _nonfinite(a[j]) | _nonfinite(b[j]);
+        max_abs = diff > max_abs || _nan(diff) ? diff : max_abs;
+        max_rel = scale > 0 && diff > max_rel * scale ? diff / scale : max_rel;
+        max_ulp = ulp > max_ulp ? ulp : max_ulp;
+    }
+    stats->max_abs = max_abs > stats->max_abs || _nan(max_abs) ? max_abs : stats->max_abs;
+    stats->max_rel = fmax(stats->max_rel, max_rel);
+    stats->max_ulp = max_ulp > stats->max_ulp ? max_ulp : stats->max_ulp;
+    // Fails closed: the row is scanned unless all of it is finite and within tolerance
+    TYPE worst = cmp->mode == COMPARE_REL ? max_rel : cmp->mode == COMPARE_ULP ? (TYPE)max_ulp : max_abs;
+    if(!nonfinite && worst <= cmp->tol)return n;
+    size_t first = n;
+    for (size_t j = 0; j < n; j++){
+        if(!_mismatch(a[j], b[j], cmp))continue;
+        if(first == n)first = j;
+        stats->mismatches++;
+        if(cmp->early_exit)break;
+    }
+    return first;
+}
+
+static void _compare_task(void *args, int index)
+{
+    compare_arg_t *arg = args;
+    size_t start = index, end = start + COMPARE_ROWS < arg->A->rows ? start + COMPARE_ROWS : arg->A->rows;
+    compare_stats_t *stats = arg->stats + start / COMPARE_ROWS;
+    for (size_t i = start; i < end; i++){
+        // Rows after a known mismatch cannot change the result of an early exit comparison
+        if(arg->cmp->early_exit && i > __atomic_load_n(&arg->first_row, __ATOMIC_RELAXED))return;
+        size_t j = _compare_row(arg->A->coeff[i], arg->B->coeff[i], arg->A->columns, arg->cmp, stats);
+        if(j == arg->A->columns)continue;
+        if(stats->row == arg->A->rows){
+            stats->row = i;
+            stats->column = j;
         }
+        size_t first = __atomic_load_n(&arg->first_row, __ATOMIC_RELAXED);
+        while(i < first && !__atomic_compare_exchange_n(&arg->first_row, &first, i, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        if(arg->cmp->early_exit)return;
     }
-    return 1;
+}
+
+int matrix_compare(const matrix_t *matrix1, const matrix_t *matrix2, matrix_compare_t *cmp)
+{
+    if(!sanity_check(matrix1, __func__))return 0;
+    if(!sanity_check(matrix2, __func__))return 0;
+    if(!sanity_check(cmp, __func__))return 0;
+    size_t rows = matrix1->rows, blocks = (rows + COMPARE_ROWS-1) / COMPARE_ROWS;
+    cmp->mismatches = 0;
+    cmp->max_abs = cmp->max_rel = 0;
+    cmp->max_ulp = 0;
+    cmp->row = rows;
+    cmp->column = matrix1->columns;
+    if((matrix1->rows != matrix2->rows) || (matrix1->columns != matrix2->columns)){
+        cmp->mismatches = 1;
+        return 0;
+    }
+    compare_stats_t *stats = malloc((blocks+1)*sizeof(compare_stats_t));
+    if(!stats){
+        perror(__func__);
+        return 0;
+    }
+    for (size_t b = 0; b < blocks; b++)
+        stats[b] = (compare_stats_t){0, 0, 0, 0, rows, 0};
+    compare_arg_t arg = {matrix1, matrix2, cmp, stats, rows};
+    if(rows * matrix1->columns < COMPARE_SERIAL){
+        for (size_t i = 0; i < rows; i += COMPARE_ROWS)
+            _compare_task(&arg, i);
+    } else {
+        thread_pool_work_t work = {0, NULL, _compare_task, (void *)&arg};
+        for (size_t i = 0; i < rows; i += COMPARE_ROWS)
+            thread_pool_queue_work(&thread_pool, &work, i);
+        if(thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+            printf("\x1b[31mproblem\x1b[0m\n");
+        }
+    }
+    for (size_t b = 0; b < blocks; b++){
+        cmp->mismatches += stats[b].mismatches;
+        cmp->max_abs = stats[b].max_abs > cmp->max_abs || _nan(stats[b].max_abs) ? stats[b].max_abs : cmp->max_abs;
+        cmp->max_rel = fmax(cmp->max_rel, stats[b].max_rel);
+        cmp->max_ulp = stats[b].max_ulp > cmp->max_ulp ? stats[b].max_ulp : cmp->max_ulp;
+        if(stats[b].row < cmp->row){
+            cmp->row = stats[b].row;
+            cmp->column = stats[b].column;
+        }
+    }
+    free(stats);
+    return cmp->mismatches == 0;
+}
+
+int test_matrix_equality(const matrix_t *matrix1, const matrix_t *matrix2, int precision)
+{
+    matrix_compare_t cmp = {.mode = COMPARE_ABS, .tol = pow(10, -precision), .early_exit = 1};
+    return matrix_compare(matrix1, matrix2, &cmp);
 }
 
 int matrix_diff(const matrix_t *matrix1, const matrix_t *matrix2, int precision, FILE *stream)
 {
     if(!sanity_check(matrix1, __func__))return 0; 
     if(!sanity_check(matrix2, __func__))return 0;
-    int ret = 1;
     if((matrix1->rows != matrix2->rows) || (matrix1->columns != matrix2->columns)){
         fprintf(stream, "\x1b[31mmatrix_diff: matrix have different size\x1b[0m");
         return 0;
     }
-    for (size_t i=0; i<matrix1->rows; i++){
-        for (size_t j=0; j<matrix1->columns; j++){
-            TYPE val1 = matrix1->coeff[i][j];
-            TYPE val2 = matrix2->coeff[i][j];
-            if(fabs(val1 - val2) > pow(10, -precision)){
-                fprintf(stream, "\x1b[31m%.*g|%.*g \x1b[0m", precision, val1, precision, val2);
-                ret = 0;
-            } else fprintf(stream, "%.*g ", precision, val1);
+    matrix_compare_t cmp = {.mode = COMPARE_ABS, .tol = pow(10, -precision)};
+    if(matrix_compare(matrix1, matrix2, &cmp))return 1;
+    // Only the rows holding a mismatch, as column|expected|got, from the first one found
+    for (size_t i = cmp.row; i < matrix1->rows; i++){
+        const TYPE *a = matrix1->coeff[i], *b = matrix2->coeff[i];
+        int header = 0;
+        for (size_t j = 0; j < matrix1->columns; j++){
+            if(!_mismatch(a[j], b[j], &cmp))continue;
+            if(!header)fprintf(stream, "row %zu:", i);
+            header = 1;
+            fprintf(stream, " \x1b[31m[%zu] %.*g|%.*g\x1b[0m", j, precision, a[j], precision, b[j]);
         }
-        fprintf(stream, "\n");
+        if(header)fprintf(stream, "\n");
     }
-    return ret;
-}
\ No newline at end of file
+    fprintf(stream, "%zu mismatch(es), max absolute error %g, max relative error %g\n", cmp.mismatches, cmp.max_abs, cmp.max_rel);
+    return 0;
+}
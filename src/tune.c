@@ -0,0 +1,23 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "matrix.h"
+
+// Usage: tune [profile [size]]. Searches the block parameters of this host and writes them to the
+// profile (default $MATRIX_TUNING or ~/.libmatrix_tuning) that libmatrix_init loads afterwards.
+int main(int argc, char **argv)
+{
+    const char *filename = argc > 1 ? argv[1] : NULL;
+    size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+    libmatrix_init();
+    int ok = matrix_autotune(filename, n);
+    if(ok){
+        matrix_tuning_t t;
+        matrix_tuning_get(&t);
+        printf("threads %zu\nmult_step %zu\nplu_step %zu\ngemm_tile %zu\nfactor_block %zu\nfactor_rows %zu\nstrassen_cutoff %zu\n"
+               "pool_spin %zu\nstream_size %zu\n",
+               t.threads, t.mult_step, t.plu_step, t.gemm_tile, t.factor_block, t.factor_rows, t.strassen_cutoff,
+               t.pool_spin, t.stream_size);
+    }
+    libmatrix_end();
+    return ok ? 0 : 1;
+}
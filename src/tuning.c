@@ -0,0 +1,329 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/sysinfo.h>
+#include "matrix.h"
+#include "tools.h"
+#include "factor.h"
+#include "kernels.h"
+#include "blas.h"
+#include "thread_pool.h"
+
+// Profile file read by libmatrix_init when MATRIX_TUNING is not set, relative to $HOME
+#define TUNING_FILE ".libmatrix_tuning"
+// Default size of the autotuner problems, and timed runs per candidate (the best one is kept)
+#define TUNING_SIZE 512
+#define TUNING_RUNS 3
+
+extern thread_pool_t thread_pool;
+
+matrix_tuning_t tuning = {0};
+// Sampling period of the pool, kept across the restarts of the autotuner
+static unsigned int pool_sample_ms = 0;
+
+static const struct {
+    const char *key;
+    size_t offset, min;
+} fields[] = {
+    {"threads",         offsetof(matrix_tuning_t, threads),         1},
+    {"mult_step",       offsetof(matrix_tuning_t, mult_step),       1},
+    {"plu_step",        offsetof(matrix_tuning_t, plu_step),        1},
+    {"gemm_tile",       offsetof(matrix_tuning_t, gemm_tile),       8},
+    {"factor_block",    offsetof(matrix_tuning_t, factor_block),    1},
+    {"factor_rows",     offsetof(matrix_tuning_t, factor_rows),     1},
+    {"strassen_cutoff", offsetof(matrix_tuning_t, strassen_cutoff), 16},
+    {"pool_spin",       offsetof(matrix_tuning_t, pool_spin),       0},
+    {"stream_size",     offsetof(matrix_tuning_t, stream_size),     0},
+};
+#define NB_FIELDS (sizeof(fields)/sizeof(fields[0]))
+
+static inline size_t * _field(matrix_tuning_t *t, size_t i)
+{
+    return (size_t *)((char *)t + fields[i].offset);
+}
+
+void matrix_tuning_defaults(matrix_tuning_t *t)
+{
+    long line = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+    size_t step = line > 0 ? 2*line/sizeof(TYPE) : 16;
+    long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if(llc <= 0)llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    // Spinning on a single core only delays the thread that queues the work
+    *t = (matrix_tuning_t){3*get_nprocs()/2, step, step, 64, 64, 32, 512, get_nprocs() > 1 ? THREAD_POOL_SPIN : 0,
+                           llc > 0 ? (size_t)llc : 8 << 20};
+}
+
+void matrix_tuning_get(matrix_tuning_t *t)
+{
+    *t = tuning;
+}
+
+// Pool of threads threads in place of the running one, which is rebuilt at its size if that fails:
+// the library is never left without a pool
+static int _pool_restart(size_t threads)
+{
+    unsigned int previous = thread_pool.num_slaves;
+    if(thread_pool_destroy(&thread_pool) != THREAD_POOL_OK)return 0;
+    int ok = thread_pool_create(&thread_pool, threads, NULL) == THREAD_POOL_OK;
+    if(!ok){
+        fprintf(stderr, "%s: no pool of %zu threads, back to %u\n", __func__, threads, previous);
+        if(thread_pool_create(&thread_pool, previous, NULL) != THREAD_POOL_OK){
+            printf("\x1b[31mproblem\x1b[0m\n");
+            return 0;
+        }
+    }
+    if(pool_sample_ms)thread_pool_sample_start(&thread_pool, pool_sample_ms, NULL, NULL);
+    thread_pool_set_spin(&thread_pool, tuning.pool_spin);
+    return ok;
+}
+
+int matrix_tuning_set(const matrix_tuning_t *t)
+{
+    if(!t){
+        fprintf(stderr, "%s: NULL pointer\n", __func__);
+        return 0;
+    }
+    for (size_t i = 0; i < NB_FIELDS; i++){
+        size_t value = *_field((matrix_tuning_t *)t, i);
+        if(value < fields[i].min){
+            fprintf(stderr, "%s: %s must be at least %zu\n", __func__, fields[i].key, fields[i].min);
+            return 0;
+        }
+    }
+    // No pool before libmatrix_init, which creates it with these values
+    if(thread_pool.queue && t->threads != thread_pool.num_slaves && !_pool_restart(t->threads))return 0;
+    tuning = *t;
+    thread_pool_set_spin(&thread_pool, tuning.pool_spin);
+    return 1;
+}
+
+// filename, or $MATRIX_TUNING, or ~/TUNING_FILE
+static const char * _path(const char *filename, char *buffer, size_t size)
+{
+    if(filename)return filename;
+    const char *env = getenv("MATRIX_TUNING");
+    if(env)return env;
+    const char *home = getenv("HOME");
+    if(!home)return NULL;
+    snprintf(buffer, size, "%s/%s", home, TUNING_FILE);
+    return buffer;
+}
+
+int matrix_tuning_load(const char *filename)
+{
+    char buffer[4096];
+    const char *path = _path(filename, buffer, sizeof(buffer));
+    FILE *fp = path ? fopen(path, "r") : NULL;
+    if(!fp){
+        // No profile is the normal case of an untuned host
+        if(filename)perror(__func__);
+        return 0;
+    }
+    matrix_tuning_t t = tuning;
+    char line[256], key[64], number[32];
+    while(fgets(line, sizeof(line), fp)){
+        if(line[0] == '#' || sscanf(line, "%63s %31s", key, number) != 2)continue;
+        for (size_t i = 0; i < NB_FIELDS; i++){
+            if(strcmp(key, fields[i].key))continue;
+            // strtoull would wrap a negative value around to a huge one
+            char *end;
+            errno = 0;
+            unsigned long long value = strtoull(number, &end, 10);
+            if(number[0] < '0' || number[0] > '9' || *end || errno || value > SIZE_MAX){
+                fprintf(stderr, "%s: %s: invalid %s %s\n", __func__, path, key, number);
+                fclose(fp);
+                return 0;
+            }
+            *_field(&t, i) = value;
+        }
+    }
+    fclose(fp);
+    return matrix_tuning_set(&t);
+}
+
+int matrix_tuning_save(const char *filename)
+{
+    char buffer[4096];
+    const char *path = _path(filename, buffer, sizeof(buffer));
+    FILE *fp = path ? fopen(path, "w") : NULL;
+    if(!fp){
+        perror(__func__);
+        return 0;
+    }
+    fprintf(fp, "# libmatrix tuning profile, %d cores, %s kernels\n", get_nprocs(), matrix_isa());
+    for (size_t i = 0; i < NB_FIELDS; i++)
+        fprintf(fp, "%s %zu\n", fields[i].key, *_field(&tuning, i));
+    fclose(fp);
+    return 1;
+}
+
+int matrix_priority(int priority)
+{
+    // MATRIX_PRIORITY_* are in the order of the lanes of the pool
+    int previous = thread_pool_set_priority(priority);
+    if(previous < 0)fprintf(stderr, "%s: unknown priority %d\n", __func__, priority);
+    return previous;
+}
+
+int matrix_pool_report(FILE *stream, int reset)
+{
+    if(!stream){
+        fprintf(stderr, "%s: NULL pointer\n", __func__);
+        return 0;
+    }
+    thread_pool_stats_t stats;
+    thread_pool_slave_stats_t *slaves = malloc((thread_pool.num_slaves + 1) * sizeof(thread_pool_slave_stats_t));
+    if(!slaves){
+        perror(__func__);
+        return 0;
+    }
+    int ok = thread_pool_stats(&thread_pool, &stats, slaves, thread_pool.num_slaves) == THREAD_POOL_OK;
+    if(ok){
+        thread_pool_stats_print(stream, &stats, slaves);
+        for (unsigned int i = 0; i < stats.num_slaves; i++)
+            fprintf(stream, "  thread %u: %llu tasks, %llu steals, busy %.3fms, idle %.3fms\n",
+                    i, slaves[i].tasks, slaves[i].steals, slaves[i].busy_ns / 1e6, slaves[i].idle_ns / 1e6);
+    }
+    free(slaves);
+    if(ok && reset)ok = thread_pool_stats_reset(&thread_pool) == THREAD_POOL_OK;
+    return ok;
+}
+
+int matrix_pool_sample(unsigned int period_ms)
+{
+    pool_sample_ms = period_ms;
+    if(!period_ms)return thread_pool_sample_stop(&thread_pool) == THREAD_POOL_OK;
+    return thread_pool_sample_start(&thread_pool, period_ms, NULL, NULL) == THREAD_POOL_OK;
+}
+
+// Autotuner: coordinate search, one parameter at a time over candidates around the default,
+// each candidate timed on a problem of the kernels it drives
+typedef struct {
+    size_t n;
+    matrix_t *A, *B, *C;
+    TYPE *a, *b, *c;
+} bench_t;
+
+static long long _nstime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void _bench_mult(bench_t *b)
+{
+    matrix_t *C = matrix_mult_f(b->A, b->B);
+    if(C)matrix_free(C);
+}
+
+static void _bench_gemm(bench_t *b)
+{
+    kernels->gemm(b->n, b->n, b->n, b->a, b->n, b->b, b->n, b->c, b->n);
+}
+
+static void _bench_plu(bench_t *b)
+{
+    matrix_t *X = matrix_solve_plu_f(b->A, b->C);
+    if(X)matrix_free(X);
+}
+
+static void _bench_factor(bench_t *b)
+{
+    matrix_t *F = matrix_copy(b->A);
+    size_t *piv = malloc((b->n+1)*sizeof(size_t));
+    int sign;
+    if(F && piv)factor_lu(F, piv, &sign);
+    if(F)matrix_free(F);
+    free(piv);
+}
+
+static void _bench_strassen(bench_t *b)
+{
+    matrix_t *C = matrix_mult_strassen_f(b->A, b->B);
+    if(C)matrix_free(C);
+}
+
+static long long _time(void (*bench)(bench_t *), bench_t *b)
+{
+    long long best = -1;
+    for (int r = 0; r < TUNING_RUNS; r++){
+        long long start = _nstime();
+        bench(b);
+        long long elapsed = _nstime() - start;
+        if(best < 0 || elapsed < best)best = elapsed;
+    }
+    return best;
+}
+
+static int _pool_spin(size_t spin)
+{
+    return thread_pool_set_spin(&thread_pool, spin) == THREAD_POOL_OK;
+}
+
+// Keep in *value the fastest of the candidates, apply (if any) puts a candidate in use
+static void _search(size_t *value, const size_t *candidates, size_t count, void (*bench)(bench_t *), bench_t *b, int (*apply)(size_t))
+{
+    size_t best = *value;
+    long long best_time = -1;
+    for (size_t i = 0; i < count; i++){
+        if(!candidates[i])continue;
+        *value = candidates[i];
+        if(apply && !apply(*value))continue;
+        long long t = _time(bench, b);
+        if(best_time < 0 || t < best_time){
+            best_time = t;
+            best = *value;
+        }
+    }
+    *value = best;
+    if(apply)apply(best);
+}
+
+int matrix_autotune(const char *filename, size_t n)
+{
+    if(!n)n = TUNING_SIZE;
+    size_t cores = get_nprocs();
+    bench_t b = {n, matrix_random_normal(n, n, 0, 1), matrix_random_normal(n, n, 0, 1), matrix_random_normal(n, 16, 0, 1),
+                 blas_vector_create(n*n), blas_vector_create(n*n), blas_vector_create(n*n)};
+    int ok = b.A && b.B && b.C && b.a && b.b && b.c;
+    if(ok){
+        for (size_t i = 0; i < n*n; i++)
+            b.a[i] = b.b[i] = 1.0 / (1 + i % 7);
+        size_t gemm_tile[] = {32, 64, 128, 256};
+        size_t threads[] = {cores, 3*cores/2, 2*cores};
+        size_t steps[] = {8, 16, 32, 64, 128};
+        size_t factor_block[] = {32, 64, 128, 256};
+        size_t factor_rows[] = {8, 16, 32, 64, 128};
+        size_t strassen_cutoff[] = {n/8, n/4, n/2};
+        // 1 rather than 0 for parking at once, 0 being skipped
+        size_t pool_spin[] = {1, THREAD_POOL_SPIN/4, THREAD_POOL_SPIN, 4*THREAD_POOL_SPIN};
+        _search(&tuning.gemm_tile, gemm_tile, 4, _bench_gemm, &b, NULL);
+        _search(&tuning.threads, threads, 3, _bench_mult, &b, _pool_restart);
+        _search(&tuning.pool_spin, pool_spin, 4, _bench_factor, &b, _pool_spin);
+        _search(&tuning.mult_step, steps, 5, _bench_mult, &b, NULL);
+        _search(&tuning.plu_step, steps, 5, _bench_plu, &b, NULL);
+        _search(&tuning.factor_block, factor_block, 4, _bench_factor, &b, NULL);
+        _search(&tuning.factor_rows, factor_rows, 5, _bench_factor, &b, NULL);
+        for (size_t i = 0; i < 3; i++)
+            strassen_cutoff[i] = strassen_cutoff[i] < 16 ? 16 : strassen_cutoff[i];
+        _search(&tuning.strassen_cutoff, strassen_cutoff, 3, _bench_strassen, &b, NULL);
+    }
+    if(b.A)matrix_free(b.A);
+    if(b.B)matrix_free(b.B);
+    if(b.C)matrix_free(b.C);
+    blas_vector_free(b.a);
+    blas_vector_free(b.b);
+    blas_vector_free(b.c);
+    if(!ok){
+        perror(__func__);
+        return 0;
+    }
+    return matrix_tuning_save(filename);
+}
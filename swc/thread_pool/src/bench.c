@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "thread_pool.h"
+#include "fifo.h"
+
+// Microbenchmarks of the pool and of the fifos. One CSV line per measure on stdout:
+//     benchmark,variant,threads,value,unit
+// so that two runs (before and after a scheduler change) can be joined on the first three columns.
+// Usage: bench [threads [scale]], scale multiplying the number of operations of every benchmark.
+#define BENCH_ROUNDS 5                                                  // Repetitions of the throughput measures, the best is kept
+
+static thread_pool_t pool;
+static long scale = 1;
+
+static long long nstime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const char *benchmark, const char *variant, int threads, double value, const char *unit)
+{
+    printf("%s,%s,%d,%.3f,%s\n", benchmark, variant, threads, value, unit);
+    fflush(stdout);
+}
+
+static int compare(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Median and 99th percentile of samples, sorted in place
+static void report_latency(const char *benchmark, const char *variant, int threads, long long *samples, int count)
+{
+    char name[128];
+    qsort(samples, count, sizeof(long long), compare);
+    snprintf(name, sizeof(name), "%s_p50", benchmark);
+    report(name, variant, threads, samples[count / 2], "ns");
+    snprintf(name, sizeof(name), "%s_p99", benchmark);
+    report(name, variant, threads, samples[count * 99 / 100], "ns");
+}
+
+static void empty(void *args, int index)
+{
+    (void)args;
+    (void)index;
+}
+
+static void empty_range(void *args, size_t begin, size_t end)
+{
+    (void)args;
+    (void)begin;
+    (void)end;
+}
+
+static void stamp(void *args, int index)
+{
+    (void)index;
+    __atomic_store_n((long long *)args, nstime(), __ATOMIC_RELEASE);
+}
+
+// Empty works queued one by one then waited for, and empty chunks of one range
+static void _throughput(int threads)
+{
+    long count = 100000 * scale;
+    thread_pool_work_t work = {0, NULL, empty, NULL};
+    long long best = -1;
+    for (int r = 0; r < BENCH_ROUNDS; r++){
+        long long time = nstime();
+        for (long i = 0; i < count; i++)
+            thread_pool_queue_work(&pool, &work, i);
+        thread_pool_wait(&pool);
+        time = nstime() - time;
+        best = best < 0 || time < best ? time : best;
+    }
+    report("empty_task_throughput", "queue_work", threads, 1e3 * count / best, "Mtasks/s");
+    best = -1;
+    for (int r = 0; r < BENCH_ROUNDS; r++){
+        long long time = nstime();
+        thread_pool_parallel_for(&pool, 0, count, 1, empty_range, NULL);
+        time = nstime() - time;
+        best = best < 0 || time < best ? time : best;
+    }
+    report("empty_task_throughput", "parallel_for", threads, 1e3 * count / best, "Mtasks/s");
+}
+
+// Cost of the submission call alone, in batches that leave the queue room
+static void _submit_latency(int threads)
+{
+    int count = 20000 * scale, batch = pool.lanes[0].size / 2, n = 0;
+    long long *samples = malloc(count * sizeof(long long));
+    thread_pool_work_t work = {0, NULL, empty, NULL};
+    if(!samples)return;
+    while(n < count){
+        for (int i = 0; i < batch && n < count; i++){
+            long long time = nstime();
+            thread_pool_queue_work(&pool, &work, i);
+            samples[n++] = nstime() - time;
+        }
+        thread_pool_wait(&pool);
+    }
+    report_latency("submit_latency", "queue_work", threads, samples, count);
+    free(samples);
+}
+
+// Push to start of a work on an idle pool, slaves parked at once or spinning first
+static void _wake_latency(int threads, const char *variant, unsigned int spin)
+{
+    int count = 2000 * scale;
+    long long *samples = malloc(count * sizeof(long long)), start;
+    thread_pool_work_t work = {0, NULL, stamp, &start};
+    if(!samples)return;
+    thread_pool_set_spin(&pool, spin);
+    for (int i = 0; i < count; i++){
+        // Long enough for the slaves to go idle, or to park without spin
+        struct timespec gap = {0, 50000};
+        nanosleep(&gap, NULL);
+        start = 0;
+        long long time = nstime();
+        thread_pool_queue_work(&pool, &work, 0);
+        while(!__atomic_load_n(&start, __ATOMIC_ACQUIRE))sched_yield();
+        samples[i] = start - time;
+        thread_pool_wait(&pool);
+    }
+    thread_pool_set_spin(&pool, sysconf(_SC_NPROCESSORS_ONLN) > 1 ? THREAD_POOL_SPIN : 0);
+    report_latency("wake_latency", variant, threads, samples, count);
+    free(samples);
+}
+
+// Fork and join of one empty chunk per participant, as a range and as a graph source -> slaves -> sink
+static void _barrier(int threads)
+{
+    int count = 5000 * scale;
+    long long *samples = malloc(count * sizeof(long long));
+    if(!samples)return;
+    for (int i = 0; i < count; i++){
+        long long time = nstime();
+        thread_pool_parallel_for(&pool, 0, threads + 1, 1, empty_range, NULL);
+        samples[i] = nstime() - time;
+    }
+    report_latency("fanout_fanin", "parallel_for", threads, samples, count);
+    thread_pool_graph_t *graph = thread_pool_graph_create();
+    int *ids = malloc((threads + 2) * sizeof(int));
+    if(graph && ids){
+        ids[0] = thread_pool_graph_add(graph, empty, NULL, 0, 0, NULL);
+        for (int t = 1; t <= threads; t++)
+            ids[t] = thread_pool_graph_add(graph, empty, NULL, t, 1, ids);
+        thread_pool_graph_add(graph, empty, NULL, threads + 1, threads, ids + 1);
+        for (int i = 0; i < count; i++){
+            long long time = nstime();
+            thread_pool_graph_run(&pool, graph);
+            samples[i] = nstime() - time;
+        }
+        report_latency("fanout_fanin", "graph", threads, samples, count);
+    }
+    free(ids);
+    thread_pool_graph_destroy(graph);
+    free(samples);
+}
+
+typedef struct {
+    fifo_t *fifo;
+    long ops;
+    int batch;
+    long long sum;
+    int *go;
+} contention_t;
+
+static void * producer(void *args)
+{
+    contention_t *c = args;
+    void *elts[64];
+    while(!__atomic_load_n(c->go, __ATOMIC_ACQUIRE));
+    for (long i = 0; i < c->ops; i += c->batch){
+        int n = c->ops - i < c->batch ? c->ops - i : c->batch;
+        for (int k = 0; k < n; k++)
+            elts[k] = (void *)(intptr_t)(i + k + 1);
+        if(n == 1)
+            fifo_push(c->fifo, elts[0], FIFO_WAIT);
+        else
+            fifo_push_batch(c->fifo, elts, NULL, n, NULL, FIFO_WAIT);
+    }
+    return NULL;
+}
+
+static void * consumer(void *args)
+{
+    contention_t *c = args;
+    void *elts[64];
+    while(!__atomic_load_n(c->go, __ATOMIC_ACQUIRE));
+    for (long got = 0; got < c->ops;){
+        size_t n = 0, max = c->ops - got < c->batch ? c->ops - got : c->batch;
+        if(max == 1){
+            if(fifo_pop(c->fifo, elts, FIFO_WAIT) == FIFO_SUCCESS)n = 1;
+        } else {
+            fifo_pop_batch(c->fifo, elts, NULL, max, &n, FIFO_WAIT);
+        }
+        for (size_t k = 0; k < n; k++)
+            c->sum += (intptr_t)elts[k];
+        got += n;
+    }
+    return NULL;
+}
+
+// producers producers and as many consumers on a 1024 elements fifo, one op being one push or one pop
+static void _contention(const char *variant, int mode, int batch, int producers)
+{
+    long ops = 100000 * scale;
+    fifo_t fifo;
+    if(fifo_init_mode(&fifo, 1024, mode) != FIFO_SUCCESS)return;
+    fifo_set_spin(&fifo, sysconf(_SC_NPROCESSORS_ONLN) > 1 ? THREAD_POOL_SPIN : 0);
+    pthread_t ids[2*producers];
+    contention_t c[2*producers];
+    int go = 0;
+    long long sum = 0;
+    for (int i = 0; i < 2*producers; i++){
+        c[i] = (contention_t){&fifo, ops, batch, 0, &go};
+        pthread_create(&ids[i], NULL, i < producers ? producer : consumer, &c[i]);
+    }
+    long long time = nstime();
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < 2*producers; i++){
+        pthread_join(ids[i], NULL);
+        sum += c[i].sum;
+    }
+    time = nstime() - time;
+    if(sum != producers * (ops * (ops + 1) / 2))
+        fprintf(stderr, "\x1b[31m%s: %s with %d producers lost elements\x1b[0m\n", __func__, variant, producers);
+    report("queue_contention", variant, producers, 2e3 * producers * ops / time, "Mops/s");
+    fifo_destroy(&fifo);
+}
+
+int main(int argc, char **argv)
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(argc > 1)threads = atoi(argv[1]);
+    if(argc > 2)scale = atol(argv[2]);
+    if(threads < 1 || scale < 1){
+        fprintf(stderr, "usage: %s [threads [scale]]\n", argv[0]);
+        return 1;
+    }
+    if(thread_pool_create(&pool, threads, NULL) != THREAD_POOL_OK){
+        fprintf(stderr, "\x1b[31mproblem0\x1b[0m\n");
+        return 1;
+    }
+    printf("benchmark,variant,threads,value,unit\n");
+    _throughput(threads);
+    _submit_latency(threads);
+    _wake_latency(threads, "park", 0);
+    _wake_latency(threads, "spin", THREAD_POOL_SPIN);
+    _barrier(threads);
+    for (int producers = 1; producers <= 2*threads && producers <= 16; producers *= 2){
+        _contention("locked", FIFO_LOCKED, 1, producers);
+        _contention("lockfree", FIFO_LOCKFREE, 1, producers);
+        _contention("lockfree_batch32", FIFO_LOCKFREE, 32, producers);
+    }
+    if(thread_pool_destroy(&pool) != THREAD_POOL_OK){
+        fprintf(stderr, "\x1b[31mproblem1\x1b[0m\n");
+        return 1;
+    }
+    return 0;
+}
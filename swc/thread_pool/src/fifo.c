@@ -1,44 +1,275 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "fifo.h"
 
+// Longest pause burst of the spin backoff, beyond it the spinner also yields its cpu
+#define FIFO_PAUSE_MAX 64
+// The adaptive spin never drops under spin/FIFO_SPIN_MIN_RATIO
+#define FIFO_SPIN_MIN_RATIO 16
+
+static inline void _pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield" ::: "memory");
+#else
+    __asm__ volatile("" ::: "memory");
+#endif
+}
+
+static long long _nstime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline void _high_water(fifo_t *fifo, unsigned int count)
+{
+    unsigned int high = __atomic_load_n(&fifo->high_water, __ATOMIC_RELAXED);
+    while(count > high && !__atomic_compare_exchange_n(&fifo->high_water, &high, count, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline long _futex(int *addr, int op, int val)
+{
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+// Spins that end with an element double the budget of the next ones, spins that end parked halve it
+static void _adapt(fifo_t *fifo, int success)
+{
+    unsigned int spin = __atomic_load_n(&fifo->spin, __ATOMIC_RELAXED);
+    unsigned int current = __atomic_load_n(&fifo->spin_current, __ATOMIC_RELAXED);
+    unsigned int floor = spin / FIFO_SPIN_MIN_RATIO ? spin / FIFO_SPIN_MIN_RATIO : 1;
+    current = success ? (current < spin / 2 ? 2 * current : spin) : (current / 2 > floor ? current / 2 : floor);
+    __atomic_store_n(&fifo->spin_current, current, __ATOMIC_RELAXED);
+}
+
+// Poll an empty fifo with exponential backoff, then park on the futex until a push
+static void _wait_not_empty(fifo_t *fifo)
+{
+    unsigned int spin = __atomic_load_n(&fifo->spin_current, __ATOMIC_RELAXED);
+    unsigned int burst = 1;
+    for (unsigned int i = 0; i < spin; i += burst){
+        if(__atomic_load_n(&fifo->curr_nb_elt, __ATOMIC_ACQUIRE)){
+            _adapt(fifo, 1);
+            return;
+        }
+        for (unsigned int p = 0; p < burst; p++)
+            _pause();
+        if(burst < FIFO_PAUSE_MAX)burst *= 2;
+        else sched_yield();
+    }
+    if(spin && !__atomic_load_n(&fifo->curr_nb_elt, __ATOMIC_ACQUIRE))_adapt(fifo, 0);
+    while(!__atomic_load_n(&fifo->curr_nb_elt, __ATOMIC_SEQ_CST)){
+        // Registered as sleeper before reading the sequence: a push either bumps it first or sees the sleeper
+        __atomic_add_fetch(&fifo->sleepers, 1, __ATOMIC_SEQ_CST);
+        int seq = __atomic_load_n(&fifo->futex, __ATOMIC_SEQ_CST);
+        if(!__atomic_load_n(&fifo->curr_nb_elt, __ATOMIC_SEQ_CST)){
+            __atomic_add_fetch(&fifo->parks, 1, __ATOMIC_RELAXED);
+            _futex(&fifo->futex, FUTEX_WAIT_PRIVATE, seq);
+        }
+        __atomic_sub_fetch(&fifo->sleepers, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void _wake(fifo_t *fifo, int count)
+{
+    __atomic_add_fetch(&fifo->futex, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&fifo->sleepers, __ATOMIC_SEQ_CST)){
+        __atomic_add_fetch(&fifo->wakes, 1, __ATOMIC_RELAXED);
+        _futex(&fifo->futex, FUTEX_WAKE_PRIVATE, count);
+    }
+}
+
+// Take pop_mutex with at least one element in the fifo. Poppers wait outside of it, so that a burst
+// of pushes wakes as many of them at once.
+static int _pop_lock(fifo_t *fifo, int wait)
+{
+    while(1){
+        if(!(wait & FIFO_NO_WAIT))_wait_not_empty(fifo);
+        if(pthread_mutex_lock(&fifo->pop_mutex))return FIFO_FAIL_MUTEX;
+        if(__atomic_load_n(&fifo->curr_nb_elt, __ATOMIC_ACQUIRE))return FIFO_SUCCESS;
+        if(pthread_mutex_unlock(&fifo->pop_mutex))return FIFO_FAIL_MUTEX;
+        if(wait & FIFO_NO_WAIT)return FIFO_EMPTY;
+    }
+}
+
+// Lock-free ring: cell p%capacity is free for the push of position p when its seq is p, holds the element
+// of position p when its seq is p+1, and is released for the next lap with seq p+capacity.
+// Pushes count the element before publishing it, so curr_nb_elt never falls under the real number of elements.
+static int _ring_push(fifo_t *fifo, void *elt, int index)
+{
+    fifo_cell_t *cell;
+    size_t pos = __atomic_load_n(&fifo->enqueue_pos, __ATOMIC_RELAXED);
+    while(1){
+        cell = &fifo->cells[pos & fifo->mask];
+        long diff = (long)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+        if(!diff){
+            if(__atomic_compare_exchange_n(&fifo->enqueue_pos, &pos, pos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))break;
+        } else if(diff < 0){
+            return FIFO_FULL;
+        } else {
+            pos = __atomic_load_n(&fifo->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    _high_water(fifo, __atomic_add_fetch(&fifo->curr_nb_elt, 1, __ATOMIC_SEQ_CST));
+    cell->elt = elt;
+    cell->index = index;
+    __atomic_store_n(&cell->seq, pos+1, __ATOMIC_RELEASE);
+    return FIFO_SUCCESS;
+}
+
+// Claim up to count consecutive free cells at once, return how many were pushed
+static size_t _ring_push_batch(fifo_t *fifo, void **elt, const int *index, size_t count)
+{
+    size_t pos = __atomic_load_n(&fifo->enqueue_pos, __ATOMIC_RELAXED), n;
+    while(1){
+        for (n = 0; n < count && __atomic_load_n(&fifo->cells[(pos+n) & fifo->mask].seq, __ATOMIC_ACQUIRE) == pos+n; n++);
+        if(!n){
+            if((long)(__atomic_load_n(&fifo->cells[pos & fifo->mask].seq, __ATOMIC_ACQUIRE) - pos) < 0)return 0;
+            pos = __atomic_load_n(&fifo->enqueue_pos, __ATOMIC_RELAXED);
+            continue;
+        }
+        if(__atomic_compare_exchange_n(&fifo->enqueue_pos, &pos, pos+n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))break;
+    }
+    _high_water(fifo, __atomic_add_fetch(&fifo->curr_nb_elt, n, __ATOMIC_SEQ_CST));
+    for (size_t i = 0; i < n; i++){
+        fifo_cell_t *cell = &fifo->cells[(pos+i) & fifo->mask];
+        cell->elt = elt[i];
+        cell->index = index ? index[i] : 0;
+        __atomic_store_n(&cell->seq, pos+i+1, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+// Take up to count published elements, return how many. curr_nb_elt is left to the caller.
+static size_t _ring_pop_batch(fifo_t *fifo, void **elt, int *index, size_t count)
+{
+    size_t pos = __atomic_load_n(&fifo->dequeue_pos, __ATOMIC_RELAXED), n;
+    while(1){
+        for (n = 0; n < count && __atomic_load_n(&fifo->cells[(pos+n) & fifo->mask].seq, __ATOMIC_ACQUIRE) == pos+n+1; n++);
+        if(!n){
+            if((long)(__atomic_load_n(&fifo->cells[pos & fifo->mask].seq, __ATOMIC_ACQUIRE) - (pos+1)) < 0)return 0;
+            pos = __atomic_load_n(&fifo->dequeue_pos, __ATOMIC_RELAXED);
+            continue;
+        }
+        if(__atomic_compare_exchange_n(&fifo->dequeue_pos, &pos, pos+n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))break;
+    }
+    for (size_t i = 0; i < n; i++){
+        fifo_cell_t *cell = &fifo->cells[(pos+i) & fifo->mask];
+        elt[i] = cell->elt;
+        if(index)index[i] = cell->index;
+        __atomic_store_n(&cell->seq, pos+i+fifo->mask+1, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+static void _ring_wait_full(void)
+{
+    // Consumers free cells without telling anyone: back off until one does
+    for (int p = 0; p < FIFO_PAUSE_MAX; p++)
+        _pause();
+    sched_yield();
+}
+
+// Account for popped elements, telling fifo_wait_empty when there are none left
+static int _popped(fifo_t *fifo, size_t count)
+{
+    if(__atomic_sub_fetch(&fifo->curr_nb_elt, count, __ATOMIC_SEQ_CST))return FIFO_SUCCESS;
+    if(pthread_mutex_lock(&fifo->empty_cond_mutex))return FIFO_FAIL_MUTEX;
+    if(pthread_cond_signal(&fifo->empty_cond)!=0)return FIFO_FAIL_COND;
+    if(pthread_mutex_unlock(&fifo->empty_cond_mutex))return FIFO_FAIL_MUTEX;
+    return FIFO_SUCCESS;
+}
+
+static int _ring_push_wait(fifo_t *fifo, void *elt, int index, int wait)
+{
+    long long start = 0;
+    while(_ring_push(fifo, elt, index) != FIFO_SUCCESS){
+        if(wait & FIFO_NO_WAIT)return FIFO_FULL;
+        if(!start)start = _nstime();
+        _ring_wait_full();
+    }
+    if(start)__atomic_add_fetch(&fifo->blocked_ns, _nstime() - start, __ATOMIC_RELAXED);
+    if(!(wait & FIFO_NO_WAKE))_wake(fifo, 1);
+    return FIFO_SUCCESS;
+}
+
+static int _ring_pop_wait(fifo_t *fifo, void **elt, int *index, int wait, int *cond, int value)
+{
+    while(!_ring_pop_batch(fifo, elt, index, 1)){
+        if(wait & FIFO_NO_WAIT)return FIFO_EMPTY;
+        _wait_not_empty(fifo);
+    }
+    if(cond)*cond = value;
+    return _popped(fifo, 1);
+}
+
 int fifo_init(fifo_t *fifo, size_t size)
+{
+    return fifo_init_mode(fifo, size, FIFO_LOCKED);
+}
+
+int fifo_init_mode(fifo_t *fifo, size_t size, int mode)
 {
     if(!fifo)return FIFO_FAIL_UNALLOCATED;
     int ret = FIFO_FAIL_MUTEX;
+    fifo->mode = mode;
     fifo->size = size;
-    fifo->buf = calloc(size, sizeof(void *));
-    fifo->index_buf = malloc(size*sizeof(int));
-    if(!fifo->buf){
-        goto fail_alloc;
+    fifo->buf = NULL;
+    fifo->index_buf = NULL;
+    fifo->cells = NULL;
+    if(mode == FIFO_LOCKFREE){
+        size_t capacity = 2;
+        while(capacity < size)capacity *= 2;
+        fifo->cells = malloc(capacity*sizeof(fifo_cell_t));
+        if(!fifo->cells)goto fail_alloc;
+        for (size_t i = 0; i < capacity; i++)
+            fifo->cells[i] = (fifo_cell_t){i, NULL, 0};
+        fifo->size = capacity;
+        fifo->mask = capacity - 1;
+        fifo->enqueue_pos = fifo->dequeue_pos = 0;
+    } else {
+        fifo->buf = calloc(size, sizeof(void *));
+        fifo->index_buf = malloc(size*sizeof(int));
+        if(!fifo->buf || !fifo->index_buf){
+            free(fifo->buf);
+            free(fifo->index_buf);
+            goto fail_alloc;
+        }
     }
     if(pthread_mutex_init(&fifo->curr_nb_mutex, NULL) != 0)goto fail_nb_mutex;
     if(pthread_mutex_init(&fifo->pop_mutex, NULL) != 0)goto fail_pop_mutex;
     if(pthread_mutex_init(&fifo->push_cond_mutex, NULL) != 0)goto fail_push_cond_mutex;
-    if(pthread_mutex_init(&fifo->pop_cond_mutex, NULL) != 0)goto fail_pop_cond_mutex;
     if(pthread_mutex_init(&fifo->empty_cond_mutex, NULL) != 0)goto fail_empty_cond_mutex;
     if(pthread_cond_init(&fifo->push_cond, NULL) != 0)goto fail_push_cond;
-    if(pthread_cond_init(&fifo->pop_cond, NULL) != 0)goto fail_pop_cond;
     if(pthread_cond_init(&fifo->empty_cond, NULL) != 0)goto fail_empty_cond;
     fifo->push_index = 0;
     fifo->pop_index = 0;
     fifo->curr_nb_elt = 0;
+    fifo->spin = fifo->spin_current = 0;
+    fifo->futex = fifo->sleepers = 0;
+    fifo->high_water = 0;
+    fifo->parks = fifo->wakes = fifo->blocked_ns = 0;
     goto success;
 fail_empty_cond:
-    ret = FIFO_FAIL_COND;
-    pthread_cond_destroy(&fifo->pop_cond);
-fail_pop_cond:
     ret = FIFO_FAIL_COND;
     pthread_cond_destroy(&fifo->push_cond);
 fail_push_cond:
     pthread_mutex_destroy(&fifo->empty_cond_mutex);
 fail_empty_cond_mutex:
-    pthread_mutex_destroy(&fifo->pop_cond_mutex);
-fail_pop_cond_mutex:
     pthread_mutex_destroy(&fifo->push_cond_mutex);
 fail_push_cond_mutex:
     pthread_mutex_destroy(&fifo->pop_mutex);
@@ -46,6 +277,8 @@ fail_pop_mutex:
     pthread_mutex_destroy(&fifo->curr_nb_mutex);
 fail_nb_mutex:
     free(fifo->buf);
+    free(fifo->index_buf);
+    free(fifo->cells);
     return ret;
 fail_alloc:
     return FIFO_FAIL_MEM;
@@ -56,73 +289,69 @@ success:
 int fifo_push(fifo_t *fifo, void *elt, int wait)
 {
     if(!fifo)return FIFO_FAIL_UNALLOCATED;
+    if(fifo->mode == FIFO_LOCKFREE)return _ring_push_wait(fifo, elt, 0, wait);
     if(pthread_mutex_lock(&fifo->push_cond_mutex))return FIFO_FAIL_MUTEX;
-    if(fifo->curr_nb_elt == fifo->size && wait == FIFO_NO_WAIT){
+    if(fifo->curr_nb_elt == fifo->size && (wait & FIFO_NO_WAIT)){
         if(pthread_mutex_unlock(&fifo->push_cond_mutex)!=0)return FIFO_FAIL_MUTEX;
         return FIFO_FULL;
     }
-    if(fifo->curr_nb_elt == fifo->size && wait == FIFO_WAIT){
+    while(fifo->curr_nb_elt == fifo->size && !(wait & FIFO_NO_WAIT)){
         // printf("\x1b[31mPUSH WAITING (curr_nb_elt= %d, push_index = %d)\x1b[0m\n", fifo->curr_nb_elt, fifo->push_index);
+        long long start = _nstime();
         pthread_cond_wait(&fifo->push_cond, &fifo->push_cond_mutex);
+        __atomic_add_fetch(&fifo->blocked_ns, _nstime() - start, __ATOMIC_RELAXED);
     }
     fifo->buf[fifo->push_index] = elt;
     fifo->push_index = fifo->push_index+1 < fifo->size ? fifo->push_index+1:0;
-    if(pthread_mutex_unlock(&fifo->push_cond_mutex))return FIFO_FAIL_MUTEX;
-    if(pthread_mutex_lock(&fifo->pop_cond_mutex))return FIFO_FAIL_MUTEX;
+    // Counted before releasing push_cond_mutex, or the next push could see room that is not there
     if(pthread_mutex_lock(&fifo->curr_nb_mutex))return FIFO_FAIL_MUTEX;
-    fifo->curr_nb_elt++;
+    _high_water(fifo, __atomic_add_fetch(&fifo->curr_nb_elt, 1, __ATOMIC_SEQ_CST));
     if(pthread_mutex_unlock(&fifo->curr_nb_mutex))return FIFO_FAIL_MUTEX;
-    if(pthread_cond_signal(&fifo->pop_cond))return FIFO_FAIL_COND;
+    if(pthread_mutex_unlock(&fifo->push_cond_mutex))return FIFO_FAIL_MUTEX;
     // printf("PUSHED work %p at index %d, curr_nb_elt = %d\n", elt, push_index, fifo->curr_nb_elt);
-    if(pthread_mutex_unlock(&fifo->pop_cond_mutex))return FIFO_FAIL_MUTEX;
+    if(!(wait & FIFO_NO_WAKE))_wake(fifo, 1);
     return FIFO_SUCCESS;
 }
 int fifo_push_index(fifo_t *fifo, void *elt, int index, int wait)
 {
     if(!fifo)return FIFO_FAIL_UNALLOCATED;
+    if(fifo->mode == FIFO_LOCKFREE)return _ring_push_wait(fifo, elt, index, wait);
     if(pthread_mutex_lock(&fifo->push_cond_mutex))return FIFO_FAIL_MUTEX;
-    if(fifo->curr_nb_elt == fifo->size && wait == FIFO_NO_WAIT){
+    if(fifo->curr_nb_elt == fifo->size && (wait & FIFO_NO_WAIT)){
         if(pthread_mutex_unlock(&fifo->push_cond_mutex)!=0)return FIFO_FAIL_MUTEX;
         return FIFO_FULL;
     }
-    if(fifo->curr_nb_elt == fifo->size && wait == FIFO_WAIT){
+    while(fifo->curr_nb_elt == fifo->size && !(wait & FIFO_NO_WAIT)){
         // printf("\x1b[31mPUSH WAITING (curr_nb_elt= %d, push_index = %d)\x1b[0m\n", fifo->curr_nb_elt, fifo->push_index);
+        long long start = _nstime();
         pthread_cond_wait(&fifo->push_cond, &fifo->push_cond_mutex);
+        __atomic_add_fetch(&fifo->blocked_ns, _nstime() - start, __ATOMIC_RELAXED);
     }
     fifo->buf[fifo->push_index] = elt;
     fifo->index_buf[fifo->push_index] = index;
     fifo->push_index = fifo->push_index+1 < fifo->size ? fifo->push_index+1:0;
-    if(pthread_mutex_unlock(&fifo->push_cond_mutex))return FIFO_FAIL_MUTEX;
-    if(pthread_mutex_lock(&fifo->pop_cond_mutex))return FIFO_FAIL_MUTEX;
+    // Counted before releasing push_cond_mutex, or the next push could see room that is not there
     if(pthread_mutex_lock(&fifo->curr_nb_mutex))return FIFO_FAIL_MUTEX;
-    fifo->curr_nb_elt++;
+    _high_water(fifo, __atomic_add_fetch(&fifo->curr_nb_elt, 1, __ATOMIC_SEQ_CST));
     if(pthread_mutex_unlock(&fifo->curr_nb_mutex))return FIFO_FAIL_MUTEX;
-    if(pthread_cond_signal(&fifo->pop_cond))return FIFO_FAIL_COND;
+    if(pthread_mutex_unlock(&fifo->push_cond_mutex))return FIFO_FAIL_MUTEX;
     // printf("PUSHED work %p at index %d, curr_nb_elt = %d\n", elt, push_index, fifo->curr_nb_elt);
-    if(pthread_mutex_unlock(&fifo->pop_cond_mutex))return FIFO_FAIL_MUTEX;
+    if(!(wait & FIFO_NO_WAKE))_wake(fifo, 1);
     return FIFO_SUCCESS;
 }
 
 int fifo_pop(fifo_t *fifo, void **elt, int wait)
 {
     if(!fifo)return FIFO_FAIL_UNALLOCATED;
-    if(pthread_mutex_lock(&fifo->pop_mutex)!=0)return FIFO_FAIL_MUTEX;
-    if(wait == FIFO_NO_WAIT && fifo->curr_nb_elt == 0){
-        if(pthread_mutex_unlock(&fifo->pop_mutex)!=0)return FIFO_FAIL_MUTEX;
-        return FIFO_EMPTY;
-    }
-    if(pthread_mutex_lock(&fifo->pop_cond_mutex))return FIFO_FAIL_MUTEX;
-    if(wait == FIFO_WAIT && fifo->curr_nb_elt == 0){
-        // printf("\x1b[31mPOP WAITING\x1b[0m\n");
-        pthread_cond_wait(&fifo->pop_cond, &fifo->pop_cond_mutex);
-    }
-    if(pthread_mutex_unlock(&fifo->pop_cond_mutex))return FIFO_FAIL_MUTEX;
+    if(fifo->mode == FIFO_LOCKFREE)return _ring_pop_wait(fifo, elt, NULL, wait, NULL, 0);
+    int ret = _pop_lock(fifo, wait);
+    if(ret != FIFO_SUCCESS)return ret;
     *elt = fifo->buf[fifo->pop_index];
     fifo->buf[fifo->pop_index] = NULL;
     if(pthread_mutex_lock(&fifo->push_cond_mutex))return FIFO_FAIL_MUTEX;
     if(pthread_cond_signal(&fifo->push_cond))return FIFO_FAIL_COND;
     if(pthread_mutex_lock(&fifo->curr_nb_mutex))return FIFO_FAIL_MUTEX;
-    fifo->curr_nb_elt--;
+    __atomic_sub_fetch(&fifo->curr_nb_elt, 1, __ATOMIC_SEQ_CST);
     if(pthread_mutex_unlock(&fifo->curr_nb_mutex))return FIFO_FAIL_MUTEX;
     // printf("POPPED work %p at index %d\n", *elt, fifo->pop_index);
     if(pthread_mutex_unlock(&fifo->push_cond_mutex))return FIFO_FAIL_MUTEX;
@@ -138,17 +367,9 @@ int fifo_pop(fifo_t *fifo, void **elt, int wait)
 int fifo_pop_index_cond(fifo_t *fifo, void **elt, int *index, int wait, int *cond, int value)
 {
     if(!fifo)return FIFO_FAIL_UNALLOCATED;
-    if(pthread_mutex_lock(&fifo->pop_mutex)!=0)return FIFO_FAIL_MUTEX;
-    if(wait == FIFO_NO_WAIT && fifo->curr_nb_elt == 0){
-        if(pthread_mutex_unlock(&fifo->pop_mutex)!=0)return FIFO_FAIL_MUTEX;
-        return FIFO_EMPTY;
-    }
-    if(pthread_mutex_lock(&fifo->pop_cond_mutex))return FIFO_FAIL_MUTEX;
-    if(wait == FIFO_WAIT && fifo->curr_nb_elt == 0){
-        // printf("\x1b[31mPOP WAITING\x1b[0m\n");
-        pthread_cond_wait(&fifo->pop_cond, &fifo->pop_cond_mutex);
-    }
-    if(pthread_mutex_unlock(&fifo->pop_cond_mutex))return FIFO_FAIL_MUTEX;
+    if(fifo->mode == FIFO_LOCKFREE)return _ring_pop_wait(fifo, elt, index, wait, cond, value);
+    int ret = _pop_lock(fifo, wait);
+    if(ret != FIFO_SUCCESS)return ret;
     *elt = fifo->buf[fifo->pop_index];
     *index = fifo->index_buf[fifo->pop_index];
     fifo->buf[fifo->pop_index] = NULL;
@@ -156,7 +377,7 @@ int fifo_pop_index_cond(fifo_t *fifo, void **elt, int *index, int wait, int *con
     if(pthread_cond_signal(&fifo->push_cond))return FIFO_FAIL_COND;
     *cond = value;
     if(pthread_mutex_lock(&fifo->curr_nb_mutex))return FIFO_FAIL_MUTEX;
-    fifo->curr_nb_elt--;
+    __atomic_sub_fetch(&fifo->curr_nb_elt, 1, __ATOMIC_SEQ_CST);
     if(pthread_mutex_unlock(&fifo->curr_nb_mutex))return FIFO_FAIL_MUTEX;
     // printf("POPPED work %p at index %d\n", *elt, fifo->pop_index);
     if(pthread_mutex_unlock(&fifo->push_cond_mutex))return FIFO_FAIL_MUTEX;
@@ -181,12 +402,100 @@ int fifo_wait_empty(fifo_t *fifo)
     if(pthread_mutex_unlock(&fifo->empty_cond_mutex))return FIFO_FAIL_MUTEX;
     return FIFO_SUCCESS;
 }
+int fifo_push_batch(fifo_t *fifo, void **elt, const int *index, size_t count, size_t *done, int wait)
+{
+    if(!fifo)return FIFO_FAIL_UNALLOCATED;
+    size_t pushed = 0;
+    int ret = FIFO_SUCCESS;
+    while(pushed < count){
+        if(fifo->mode == FIFO_LOCKFREE){
+            size_t n = _ring_push_batch(fifo, elt + pushed, index ? index + pushed : NULL, count - pushed);
+            pushed += n;
+            if(n)continue;
+            if(wait & FIFO_NO_WAIT){
+                ret = FIFO_FULL;
+                break;
+            }
+            long long start = _nstime();
+            _ring_wait_full();
+            __atomic_add_fetch(&fifo->blocked_ns, _nstime() - start, __ATOMIC_RELAXED);
+        } else {
+            ret = fifo_push_index(fifo, elt[pushed], index ? index[pushed] : 0, wait | FIFO_NO_WAKE);
+            if(ret != FIFO_SUCCESS)break;
+            pushed++;
+        }
+    }
+    // One wake-up call for the whole batch
+    if(pushed && !(wait & FIFO_NO_WAKE))_wake(fifo, pushed < INT_MAX ? (int)pushed : INT_MAX);
+    if(done)*done = pushed;
+    return ret;
+}
+
+int fifo_pop_batch(fifo_t *fifo, void **elt, int *index, size_t count, size_t *done, int wait)
+{
+    if(!fifo)return FIFO_FAIL_UNALLOCATED;
+    size_t popped = 0;
+    int ret = FIFO_SUCCESS;
+    if(fifo->mode == FIFO_LOCKFREE){
+        while(count && !(popped = _ring_pop_batch(fifo, elt, index, count))){
+            if(wait & FIFO_NO_WAIT){
+                ret = FIFO_EMPTY;
+                break;
+            }
+            _wait_not_empty(fifo);
+        }
+        if(popped)ret = _popped(fifo, popped);
+    } else {
+        // Only the first pop may wait
+        for (; popped < count; popped++){
+            int dummy;
+            ret = fifo_pop_index_cond(fifo, elt + popped, index ? index + popped : &dummy, popped ? FIFO_NO_WAIT : wait, &dummy, 0);
+            if(ret != FIFO_SUCCESS)break;
+        }
+        if(popped && ret == FIFO_EMPTY)ret = FIFO_SUCCESS;
+    }
+    if(done)*done = popped;
+    return ret;
+}
+
+int fifo_wake_all(fifo_t *fifo)
+{
+    if(!fifo)return FIFO_FAIL_UNALLOCATED;
+    _wake(fifo, INT_MAX);
+    return FIFO_SUCCESS;
+}
+
+int fifo_set_spin(fifo_t *fifo, unsigned int spin)
+{
+    if(!fifo)return FIFO_FAIL_UNALLOCATED;
+    __atomic_store_n(&fifo->spin, spin, __ATOMIC_RELAXED);
+    __atomic_store_n(&fifo->spin_current, spin, __ATOMIC_RELAXED);
+    return FIFO_SUCCESS;
+}
+
 int fifo_current_size(fifo_t *fifo, int* curr_nb_elt)
 {
     if(!fifo)return FIFO_FAIL_UNALLOCATED;
     *curr_nb_elt = fifo->curr_nb_elt;
     return FIFO_SUCCESS;
 }
+int fifo_stats(fifo_t *fifo, fifo_stats_t *stats, int reset)
+{
+    if(!fifo || !stats)return FIFO_FAIL_UNALLOCATED;
+    if(reset){
+        stats->high_water = __atomic_exchange_n(&fifo->high_water, 0, __ATOMIC_RELAXED);
+        stats->parks = __atomic_exchange_n(&fifo->parks, 0, __ATOMIC_RELAXED);
+        stats->wakes = __atomic_exchange_n(&fifo->wakes, 0, __ATOMIC_RELAXED);
+        stats->blocked_ns = __atomic_exchange_n(&fifo->blocked_ns, 0, __ATOMIC_RELAXED);
+    } else {
+        stats->high_water = __atomic_load_n(&fifo->high_water, __ATOMIC_RELAXED);
+        stats->parks = __atomic_load_n(&fifo->parks, __ATOMIC_RELAXED);
+        stats->wakes = __atomic_load_n(&fifo->wakes, __ATOMIC_RELAXED);
+        stats->blocked_ns = __atomic_load_n(&fifo->blocked_ns, __ATOMIC_RELAXED);
+    }
+    return FIFO_SUCCESS;
+}
+
 int fifo_destroy(fifo_t *fifo)
 {
     if(!fifo)return FIFO_FAIL_UNALLOCATED;
@@ -194,13 +503,12 @@ int fifo_destroy(fifo_t *fifo)
     if(pthread_mutex_destroy(&fifo->curr_nb_mutex) != 0)ret = FIFO_FAIL_MUTEX;
     if(pthread_mutex_destroy(&fifo->pop_mutex) != 0)ret = FIFO_FAIL_MUTEX;
     if(pthread_mutex_destroy(&fifo->push_cond_mutex) != 0)ret = FIFO_FAIL_MUTEX;
-    if(pthread_mutex_destroy(&fifo->pop_cond_mutex) != 0)ret = FIFO_FAIL_MUTEX;
     if(pthread_mutex_destroy(&fifo->empty_cond_mutex) != 0)ret = FIFO_FAIL_MUTEX;
     if(pthread_cond_destroy(&fifo->push_cond) != 0)ret = FIFO_FAIL_COND;
-    if(pthread_cond_destroy(&fifo->pop_cond) != 0)ret = FIFO_FAIL_COND;
     if(pthread_cond_destroy(&fifo->empty_cond) != 0)ret = FIFO_FAIL_COND;
     free(fifo->buf);
     free(fifo->index_buf);
+    free(fifo->cells);
     return ret;
 }
 int fifo_show(fifo_t *fifo)
@@ -209,6 +517,11 @@ int fifo_show(fifo_t *fifo)
     char *string = NULL;
     size_t new_size, size = 0;
     printf("\x1b[34mNB OF ELEMENTS: %d\x1b[0m\n", fifo->curr_nb_elt);
+    if(fifo->mode == FIFO_LOCKFREE){
+        printf("\x1b[34mENQUEUE POSITION: %zu\x1b[0m\n", fifo->enqueue_pos);
+        printf("\x1b[34mDEQUEUE POSITION: %zu\x1b[0m\n", fifo->dequeue_pos);
+        return FIFO_SUCCESS;
+    }
     printf("\x1b[34mPUSH INDEX: %d\x1b[0m\n", fifo->push_index);
     printf("\x1b[34mPOP INDEX: %d\x1b[0m\n", fifo->pop_index);
     if(fifo->curr_nb_elt == 0)return FIFO_SUCCESS;
@@ -12,11 +12,28 @@ enum {
     FIFO_SUCCESS
 };
 enum {
-    FIFO_WAIT,
-    FIFO_NO_WAIT
+    FIFO_WAIT = 0,
+    FIFO_NO_WAIT = 1,
+    FIFO_NO_WAKE = 2                                                    // Push flag: leave the sleepers to a later fifo_wake_all
 };
+enum {
+    FIFO_LOCKED,                                                        // Mutexes and condition variables
+    FIFO_LOCKFREE                                                       // Bounded MPMC ring of sequence numbered cells (Vyukov)
+};
+typedef struct
+{
+    size_t seq;                                                         // Position the cell expects next, atomic
+    void *elt;
+    int index;
+} fifo_cell_t;
+typedef struct
+{
+    unsigned int high_water;
+    unsigned long long parks, wakes, blocked_ns;
+} fifo_stats_t;
 typedef struct
 {
+    int mode;
     size_t size;
     void ** buf;
     int * index_buf;
@@ -27,20 +44,39 @@ typedef struct
     pthread_mutex_t push_mutex;
     pthread_mutex_t pop_mutex;
     pthread_mutex_t push_cond_mutex;
-    pthread_mutex_t pop_cond_mutex;
     pthread_mutex_t empty_cond_mutex;
     pthread_cond_t push_cond;
-    pthread_cond_t pop_cond;
     pthread_cond_t empty_cond;
+    unsigned int spin;                                                  // Maximal polls of an empty fifo before parking
+    unsigned int spin_current;                                          // Adapted between spin/FIFO_SPIN_MIN_RATIO and spin
+    int futex;                                                          // Bumped by every push, poppers park on it
+    int sleepers;                                                       // Poppers parked on the futex
+    unsigned int high_water;                                            // Largest curr_nb_elt seen by a push, atomic
+    unsigned long long parks, wakes;                                    // Futex waits of poppers, futex wakes of pushes, atomic
+    unsigned long long blocked_ns;                                      // Time pushes waited for room, atomic
+    fifo_cell_t *cells;                                                 // FIFO_LOCKFREE only, mask+1 cells
+    size_t mask;
+    char pad_push[64];                                                  // Producers and consumers positions on their own cache lines
+    size_t enqueue_pos;
+    char pad_pop[64];
+    size_t dequeue_pos;
+    char pad_end[64];
 } fifo_t;
 
-int fifo_init(fifo_t *fifo, size_t size);
+int fifo_init(fifo_t *fifo, size_t size);                          // FIFO_LOCKED fifo
+int fifo_init_mode(fifo_t *fifo, size_t size, int mode);           // FIFO_LOCKFREE rounds size up to a power of 2
 int fifo_push(fifo_t *fifo, void *elt, int wait);
 int fifo_push_index(fifo_t *fifo, void *elt, int index, int wait);
 int fifo_pop(fifo_t *fifo, void **elt, int wait);
 int fifo_pop_index_cond(fifo_t *fifo, void **elt, int *index, int wait, int *cond, int value);
+// Up to count elements (index may be NULL) in one call, *done of them. A waiting pop returns as soon as it got one.
+int fifo_push_batch(fifo_t *fifo, void **elt, const int *index, size_t count, size_t *done, int wait);
+int fifo_pop_batch(fifo_t *fifo, void **elt, int *index, size_t count, size_t *done, int wait);
 int fifo_wait_empty(fifo_t *fifo);
+int fifo_wake_all(fifo_t *fifo);
+int fifo_set_spin(fifo_t *fifo, unsigned int spin);
 int fifo_current_size(fifo_t *fifo, int* curr_nb_elt);
+int fifo_stats(fifo_t *fifo, fifo_stats_t *stats, int reset);     // Counters since fifo_init or the last reset
 int fifo_destroy(fifo_t *fifo);
 int fifo_show(fifo_t *fifo);
 #endif
@@ -1,19 +1,69 @@
 #ifndef THREAD_POOL
 #define THREAD_POOL
 #include <pthread.h>
+#include <stdio.h>
 #include "fifo.h"
+// Default pause instructions an idle slave spends polling the queue before parking, on multi-core hosts
+#define THREAD_POOL_SPIN 4096
+// Works taken from higher lanes while a lower one waits before the lower one is served once
+#define THREAD_POOL_AGING 16
+// Priority lanes, served highest first, each in submission order. Works carry no deadline: a latency bound
+// is obtained with the lane, which only waits for the chunks in progress and for aging of lower lanes.
+enum thread_pool_lane{
+    THREAD_POOL_HIGH,
+    THREAD_POOL_NORMAL,
+    THREAD_POOL_LOW,
+    THREAD_POOL_LANES
+};
+// Counters of one slave
+typedef struct {
+    unsigned long long tasks;                                           // Works popped from the queue and run
+    unsigned long long steals;                                          // Range chunks and graph tasks claimed from a shared descriptor
+    unsigned long long busy_ns, idle_ns;                                // Time running works, time spinning or parked on the queue
+} thread_pool_slave_stats_t;
+
+// Counters of one lane
+typedef struct {
+    int queued;                                                         // Works waiting at the time of the call
+    unsigned int high_water;                                            // Most works waiting at once
+    unsigned long long executed;                                        // Works taken by the slaves
+    unsigned long long aged;                                            // Of which taken ahead of a higher lane against starvation
+    unsigned long long enqueue_blocked_ns;                              // Time producers waited for room in the lane
+} thread_pool_lane_stats_t;
+
+// Counters of the whole pool
+typedef struct {
+    unsigned int num_slaves;
+    unsigned long long elapsed_ns;                                      // Covered by the counters
+    int queue_size, queue_capacity;                                     // Works queued at the time of the call
+    unsigned int queue_high_water;                                      // Most works queued at once
+    unsigned long long parks, wakes;                                    // Slaves parked on the queue, wake-ups issued to them
+    unsigned long long enqueue_blocked_ns;                              // Time producers waited for room in the queue
+    thread_pool_lane_stats_t lanes[THREAD_POOL_LANES];
+} thread_pool_stats_t;
+
 typedef struct {
+    struct thread_pool *pool;
     pthread_t       id;
     int             state;
     fifo_t          *queue;
     pthread_mutex_t mutex;
     pthread_cond_t  cond;
+    thread_pool_slave_stats_t stats;                                    // Atomic
+    long long       since;                                              // Start of the current busy or idle period, atomic
 } slave_t;
 
-typedef struct {
+// The works wait in their lane, the queue holds one token per work: slaves wait on the queue and,
+// once they have a token, take the work of the highest lane that has one.
+typedef struct thread_pool {
     slave_t        *slaves;
     unsigned int    num_slaves;
     fifo_t          *queue;
+    fifo_t          *lanes;                                             // THREAD_POOL_LANES fifos
+    unsigned int    skips[THREAD_POOL_LANES];                           // Works taken from higher lanes while this one waited, atomic
+    unsigned long long executed[THREAD_POOL_LANES], aged[THREAD_POOL_LANES]; // Atomic
+    long long       stats_start;                                        // Creation or last thread_pool_stats_reset
+    struct thread_pool_sampler *sampler;
 } thread_pool_t;
 
 typedef struct {
@@ -33,6 +83,40 @@ enum thread_pool_ret{
 int thread_pool_create(thread_pool_t *thread_pool, unsigned int num_slaves, pthread_attr_t *attr);
 int thread_pool_queue(thread_pool_t *thread_pool, void (*func)(void *), void *args);
 int thread_pool_queue_work(thread_pool_t *thread_pool, thread_pool_work_t *work, int index);
+int thread_pool_queue_work_priority(thread_pool_t *thread_pool, thread_pool_work_t *work, int index, int lane);
+// Lane of the works the calling thread submits from now on, ranges and graphs included; return the
+// previous one, -1 if lane is not valid. Works submitted from a task inherit the lane of the task.
+// Slaves leave a range or a graph between two chunks when a higher lane has work.
+int thread_pool_set_priority(int lane);
 int thread_pool_wait(thread_pool_t *thread_pool);
+// Whole index ranges as one descriptor: workers and the calling thread claim chunks of grain indices
+// (grain 0 for an automatic size) until none is left, then the call returns. Safe from inside a task.
+int thread_pool_parallel_for(thread_pool_t *thread_pool, size_t begin, size_t end, size_t grain,
+                             void (*func)(void *args, size_t begin, size_t end), void *args);
+int thread_pool_parallel_for_2d(thread_pool_t *thread_pool, size_t row_begin, size_t row_end, size_t row_grain,
+                                size_t column_begin, size_t column_end, size_t column_grain,
+                                void (*func)(void *args, size_t row_begin, size_t row_end, size_t column_begin, size_t column_end), void *args);
+// Task graphs: a task may only depend on tasks added before it, so a graph is acyclic by construction.
+// thread_pool_graph_add returns the id of the task, -1 on error. A run starts each task once all of its
+// dependencies are done, the calling thread takes part, and the graph may be run again afterwards.
+typedef struct thread_pool_graph thread_pool_graph_t;
+thread_pool_graph_t * thread_pool_graph_create(void);
+int thread_pool_graph_add(thread_pool_graph_t *graph, void (*func)(void *args, int index), void *args, int index,
+                          size_t nb_deps, const int *deps);
+int thread_pool_graph_run(thread_pool_t *thread_pool, thread_pool_graph_t *graph);
+void thread_pool_graph_destroy(thread_pool_graph_t *graph);
+// Spin budget of the idle slaves, 0 parks them as soon as the queue is empty
+int thread_pool_set_spin(thread_pool_t *thread_pool, unsigned int spin);
+// Counters since creation or the last reset, slaves (may be NULL) receives those of the first nb_slaves slaves.
+// Busy and idle time include the period in progress, so that a slave stuck in a long task shows.
+int thread_pool_stats(thread_pool_t *thread_pool, thread_pool_stats_t *stats, thread_pool_slave_stats_t *slaves, unsigned int nb_slaves);
+int thread_pool_stats_reset(thread_pool_t *thread_pool);
+// One line of totals and the spread of the slaves utilisation
+void thread_pool_stats_print(FILE *stream, const thread_pool_stats_t *stats, const thread_pool_slave_stats_t *slaves);
+// Periodic sampling: a thread calls func every period_ms with the counters of the last period,
+// func NULL prints them to stderr with thread_pool_stats_print. Stopped by thread_pool_destroy.
+typedef void (*thread_pool_sample_func_t)(const thread_pool_stats_t *stats, const thread_pool_slave_stats_t *slaves, void *args);
+int thread_pool_sample_start(thread_pool_t *thread_pool, unsigned int period_ms, thread_pool_sample_func_t func, void *args);
+int thread_pool_sample_stop(thread_pool_t *thread_pool);
 int thread_pool_destroy(thread_pool_t *thread_pool);
 #endif
\ No newline at end of file
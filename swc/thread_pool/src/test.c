@@ -1,8 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
 #include <unistd.h>
+#include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/time.h>
 #include <sys/sysinfo.h>
 #include "thread_pool.h"
@@ -22,7 +27,7 @@ char * format_time(const long long input_time, char* format)
     if(input_time<=0){ // Quickly handle case 0
         bufsz = snprintf(NULL, 0, "0%s", format);
         ret = malloc((bufsz+1)*sizeof(*ret));
-        if(!ret){perror(__func__);}
+        if(!ret){perror(__func__); return NULL;}
         snprintf(ret, bufsz, "0%s", format);
         return(ret);
     }
@@ -36,7 +41,7 @@ char * format_time(const long long input_time, char* format)
     bufsz = snprintf(NULL, 0, "%lld%s",timestamp[i],formats[i]);
     for (k=i+1; k < j && (bufsz += snprintf(NULL, 0, "%0*lld%s",width[k],timestamp[k],formats[k])); k++ );
     ret = malloc((bufsz+1)*sizeof(*ret));
-    if(!ret){perror(__func__);}
+    if(!ret){perror(__func__); return NULL;}
     bufsz = sprintf(ret, "%lld%s",timestamp[i],formats[i]);
     for (k=i+1; k < j && (bufsz +=(int)sprintf(ret + bufsz, "%0*lld%s",width[k],timestamp[k],formats[k])); k++ );
     return(ret);
@@ -114,15 +119,213 @@ static work_t _thread_pool(int work_nb, int work_len)
     return work;
 }
 
+static void prime_range(void *arg, size_t begin, size_t end)
+{
+    for (size_t n = begin; n < end; n++)
+        prime_calc(arg, n);
+}
+
+static work_t _parallel_for(int work_nb, int work_len)
+{
+    // Working with one range descriptor, the main thread taking part
+    printf("\t* le parallel_for: ");
+    fflush(stdout);
+    work_t work = {work_len, calloc(work_nb*work_len, sizeof(int))};
+    long long time = mstime();
+    if(thread_pool_parallel_for(&thread_pool, 0, work_nb, 1, prime_range, &work) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem4\x1b[0m\n");
+    }
+    char *formatted_time = format_time(mstime() - time, "ms");
+    printf("%s\n", formatted_time);
+    free(formatted_time);
+    return work;
+}
+
+typedef struct{
+    work_t *work;
+    int *order;
+    int counter;
+}graph_work_t;
+
+static void prime_node(void *arg, int n)
+{
+    graph_work_t *graph_work = arg;
+    prime_calc(graph_work->work, n);
+    graph_work->order[n] = __atomic_fetch_add(&graph_work->counter, 1, __ATOMIC_RELAXED);
+}
+
+static work_t _graph(int work_nb, int work_len)
+{
+    // Working with a dependency tree, sack n waiting for sacks n/2 and n-1 when odd
+    printf("\t* le graphe de tâches: ");
+    fflush(stdout);
+    work_t work = {work_len, calloc(work_nb*work_len, sizeof(int))};
+    graph_work_t graph_work = {&work, calloc(work_nb, sizeof(int)), 0};
+    thread_pool_graph_t *graph = thread_pool_graph_create();
+    int *ids = malloc(work_nb*sizeof(int));
+    long long time = mstime();
+    for (int i=0;i<work_nb;i++){
+        int deps[2] = {i ? ids[i/2] : 0, i%2 ? ids[i-1] : 0};
+        ids[i] = thread_pool_graph_add(graph, prime_node, &graph_work, i, i ? 1 + i%2 : 0, deps);
+    }
+    if(thread_pool_graph_run(&thread_pool, graph) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem6\x1b[0m\n");
+    }
+    char *formatted_time = format_time(mstime() - time, "ms");
+    printf("%s\n", formatted_time);
+    free(formatted_time);
+    for (int i=1;i<work_nb;i++){
+        if(graph_work.order[i] < graph_work.order[i/2] || (i%2 && graph_work.order[i] < graph_work.order[i-1])){
+            printf("\x1b[31mdependency of %d not respected\x1b[0m\n", i);
+            break;
+        }
+    }
+    thread_pool_graph_destroy(graph);
+    free(graph_work.order);
+    free(ids);
+    return work;
+}
+
+static long long nstime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+typedef struct{
+    fifo_t *fifo;
+    long ops;
+    int batch;
+    long long sum;
+}fifo_bench_t;
+
+static void * producer(void *arg)
+{
+    fifo_bench_t *bench = arg;
+    void *elts[64];
+    for (long i = 0; i < bench->ops; i += bench->batch){
+        int n = bench->ops - i < bench->batch ? bench->ops - i : bench->batch;
+        for (int k = 0; k < n; k++)
+            elts[k] = (void *)(intptr_t)(i + k + 1);
+        fifo_push_batch(bench->fifo, elts, NULL, n, NULL, FIFO_WAIT);
+    }
+    return NULL;
+}
+
+static void * consumer(void *arg)
+{
+    fifo_bench_t *bench = arg;
+    void *elts[64];
+    for (long got = 0; got < bench->ops;){
+        size_t n = 0;
+        size_t max = bench->ops - got < bench->batch ? bench->ops - got : bench->batch;
+        fifo_pop_batch(bench->fifo, elts, NULL, max, &n, FIFO_WAIT);
+        for (size_t k = 0; k < n; k++)
+            bench->sum += (intptr_t)elts[k];
+        got += n;
+    }
+    return NULL;
+}
+
+static void _fifo_throughput(const char *name, int mode, int batch, int threads, long ops)
+{
+    // threads producers and as many consumers on a 1024 elements fifo
+    fifo_t fifo;
+    fifo_init_mode(&fifo, 1024, mode);
+    fifo_set_spin(&fifo, THREAD_POOL_SPIN);
+    pthread_t ids[2*threads];
+    fifo_bench_t benches[2*threads];
+    long long time = nstime(), sum = 0;
+    for (int i = 0; i < 2*threads; i++){
+        benches[i] = (fifo_bench_t){&fifo, ops, batch, 0};
+        pthread_create(&ids[i], NULL, i < threads ? producer : consumer, &benches[i]);
+    }
+    for (int i = 0; i < 2*threads; i++){
+        pthread_join(ids[i], NULL);
+        sum += benches[i].sum;
+    }
+    time = nstime() - time;
+    int ok = sum == threads * (ops * (ops + 1) / 2);
+    printf("\t* %s: %.1f Mops/s %s\n", name, 2e3 * threads * ops / time, ok ? "\x1b[32mOK\x1b[0m" : "\x1b[31mNOK\x1b[0m");
+    fifo_destroy(&fifo);
+}
+
+static void stamp(void *arg, int n)
+{
+    (void)n;
+    long long *start = arg;
+    __atomic_store_n(start, nstime(), __ATOMIC_RELAXED);
+}
+
+static void _first_task(unsigned int spin, int rounds)
+{
+    // Time from the push of a task to its start on an idle pool, the slaves having had 50µs to go idle
+    long long start, total = 0, worst = 0;
+    thread_pool_work_t work = {0, NULL, stamp, &start};
+    thread_pool_set_spin(&thread_pool, spin);
+    for (int i = 0; i < rounds; i++){
+        struct timespec gap = {0, 50000};
+        nanosleep(&gap, NULL);
+        long long time = nstime();
+        if(thread_pool_queue_work(&thread_pool, &work, 0) != THREAD_POOL_OK || thread_pool_wait(&thread_pool) != THREAD_POOL_OK){
+            printf("\x1b[31mproblem5\x1b[0m\n");
+            return;
+        }
+        long long latency = start - time;
+        total += latency;
+        worst = latency > worst ? latency : worst;
+    }
+    printf("\t* spin %u: moyenne %lldns, pire %lldns\n", spin, total / rounds, worst);
+}
+
+static void spin_range(void *arg, size_t begin, size_t end)
+{
+    // 100µs of cpu per index
+    (void)arg;
+    long long time = nstime();
+    while(nstime() - time < 100000LL * (long long)(end - begin));
+}
+
+static void * low_range(void *arg)
+{
+    (void)arg;
+    thread_pool_set_priority(THREAD_POOL_LOW);
+    thread_pool_parallel_for(&thread_pool, 0, 2000, 1, spin_range, NULL);
+    return NULL;
+}
+
+static void _priority(const char *name, int lane)
+{
+    // Time from the push of a task to its start while a 200ms low priority range keeps the slaves busy
+    long long start = 0;
+    thread_pool_work_t work = {0, NULL, stamp, &start};
+    pthread_t id;
+    pthread_create(&id, NULL, low_range, NULL);
+    struct timespec gap = {0, 10000000};
+    nanosleep(&gap, NULL);
+    long long time = nstime();
+    if(thread_pool_queue_work_priority(&thread_pool, &work, 0, lane) != THREAD_POOL_OK){
+        printf("\x1b[31mproblem6\x1b[0m\n");
+        return;
+    }
+    while(!__atomic_load_n(&start, __ATOMIC_RELAXED))sched_yield();
+    pthread_join(id, NULL);
+    thread_pool_wait(&thread_pool);
+    printf("\t* voie %s: %.3fms\n", name, (start - time) / 1e6);
+}
+
 int main(int argc, char ** argv)
 {
     // "Traitement de 10 sacs de 2kg de données par 8 thread"
     int work_nb = 10;
     int work_len = 2000;
     int threads = 8;
+    int sample_ms = 0;
     if (argc > 1)work_nb = atoi(argv[1]);
     if (argc > 2)work_len = atoi(argv[2]);
     if (argc > 3)threads = atoi(argv[3]);
+    if (argc > 4)sample_ms = atoi(argv[4]);
     printf("This system has %d processors configured and %d processors available.\n", get_nprocs_conf(), get_nprocs());
         
     //Creating thread pool
@@ -131,10 +334,12 @@ int main(int argc, char ** argv)
         printf("\x1b[31mproblem0\x1b[0m\n");
         return 1;
     }
+    // Counters of each period on stderr
+    if(sample_ms > 0)thread_pool_sample_start(&thread_pool, sample_ms, NULL, NULL);
     
     //Preparing test functions
-    int num_func = 2;
-    work_t (*func_tab[2])(int work_nb, int work_len) = {_main_thread, _thread_pool};
+    int num_func = 4;
+    work_t (*func_tab[4])(int work_nb, int work_len) = {_main_thread, _thread_pool, _parallel_for, _graph};
     work_t res[num_func];
     //Executing test functions
     printf("Traitement de \x1b[34m%d\x1b[0m sacs de \x1b[34m%dg\x1b[0m de données par :\n", work_nb, work_len);
@@ -156,6 +361,29 @@ int main(int argc, char ** argv)
         }
     }     
     if(ok)printf("\x1b[32mOK\x1b[0m\n");
+    // Wake-up latency of the idle slaves, parked at once then spinning first
+    printf("Temps jusqu'à la première tâche sur \x1b[34m%d\x1b[0m essais :\n", 1000);
+    _first_task(0, 1000);
+    _first_task(THREAD_POOL_SPIN, 1000);
+    // A slave leaves the low priority range at the end of its chunk for the high priority task
+    printf("Temps jusqu'à la première tâche derrière un calcul de basse priorité :\n");
+    _priority("basse", THREAD_POOL_LOW);
+    _priority("haute", THREAD_POOL_HIGH);
+    // Load balance of everything above
+    thread_pool_stats_t stats;
+    thread_pool_slave_stats_t slaves[threads];
+    if(thread_pool_stats(&thread_pool, &stats, slaves, threads) == THREAD_POOL_OK){
+        printf("Statistiques du pool :\n");
+        thread_pool_stats_print(stdout, &stats, slaves);
+        for (int i=0; i<threads; i++)
+            printf("    thread %2d : \x1b[34m%6llu\x1b[0m tâches, \x1b[34m%6llu\x1b[0m morceaux volés, occupé \x1b[34m%8.3fms\x1b[0m, inactif \x1b[34m%8.3fms\x1b[0m\n",
+                   i, slaves[i].tasks, slaves[i].steals, slaves[i].busy_ns / 1e6, slaves[i].idle_ns / 1e6);
+    }
+    // Raw fifo throughput, one op being one push or one pop
+    printf("Débit des fifos, \x1b[34m2\x1b[0m producteurs et \x1b[34m2\x1b[0m consommateurs :\n");
+    _fifo_throughput("verrous", FIFO_LOCKED, 1, 2, 200000);
+    _fifo_throughput("sans verrou", FIFO_LOCKFREE, 1, 2, 200000);
+    _fifo_throughput("sans verrou, lots de 32", FIFO_LOCKFREE, 32, 2, 200000);
     // Freeing results
     for (int i=0; i<num_func; i++)
         free(res[i].ret);
@@ -1,12 +1,32 @@
+#define _GNU_SOURCE
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include "thread_pool.h"
 #include "fifo.h"
 
 static void * _slave_func(void *args);
 
+// Slave running on this thread, NULL on the threads of the callers
+static _Thread_local slave_t *current_slave;
+// Lane of the works this thread submits, that of the running work on a slave
+static _Thread_local int current_lane = THREAD_POOL_NORMAL;
+
+struct thread_pool_sampler {
+    pthread_t id;
+    thread_pool_t *thread_pool;
+    unsigned int period_ms;
+    thread_pool_sample_func_t func;
+    void *args;
+    int stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
 enum thread_state{
     THREAD_STARTING=0,
     THREAD_READY,
@@ -21,23 +41,93 @@ enum work_flag{
 };
 
 
+static long long _nstime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Close the current period of self into *counter and start the next one
+static inline void _account(slave_t *self, unsigned long long *counter)
+{
+    long long now = _nstime();
+    __atomic_add_fetch(counter, now - __atomic_exchange_n(&self->since, now, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+// Queue a work in its lane then its token, the token wakes a slave unless wait has FIFO_NO_WAKE
+static int _lane_push(thread_pool_t *thread_pool, int lane, thread_pool_work_t *work, int index, int wait)
+{
+    int ret = fifo_push_index(&thread_pool->lanes[lane], (void *)work, index, wait | FIFO_NO_WAKE);
+    if(ret != FIFO_SUCCESS)return ret;
+    // Never full: the tokens queued never outnumber the works in the lanes
+    return fifo_push_index(thread_pool->queue, (void *)&thread_pool->lanes[lane], lane, FIFO_WAIT | (wait & FIFO_NO_WAKE));
+}
+
+static inline int _lane_size(thread_pool_t *thread_pool, int lane)
+{
+    return __atomic_load_n(&thread_pool->lanes[lane].curr_nb_elt, __ATOMIC_RELAXED);
+}
+
+// A work waits in a lane above lane
+static inline int _higher_pending(thread_pool_t *thread_pool, int lane)
+{
+    for (int l = 0; l < lane; l++)
+        if(_lane_size(thread_pool, l))return 1;
+    return 0;
+}
+
+// Take the work of a popped token: the highest lane that has one, or a lower lane passed over
+// THREAD_POOL_AGING times. The work exists since works are queued before their token.
+static thread_pool_work_t * _lane_pop(thread_pool_t *thread_pool, int *index, int *lane)
+{
+    thread_pool_work_t *work;
+    while(1){
+        int first = 0;
+        while(first < THREAD_POOL_LANES && !_lane_size(thread_pool, first))first++;
+        int aged = -1;
+        for (int l = THREAD_POOL_LANES - 1; l > first; l--){
+            if(_lane_size(thread_pool, l) && __atomic_add_fetch(&thread_pool->skips[l], 1, __ATOMIC_RELAXED) >= THREAD_POOL_AGING){
+                __atomic_store_n(&thread_pool->skips[l], 0, __ATOMIC_RELAXED);
+                aged = l;
+                break;
+            }
+        }
+        if(aged >= 0 && fifo_pop_index_cond(&thread_pool->lanes[aged], (void **)&work, index, FIFO_NO_WAIT, lane, aged) == FIFO_SUCCESS){
+            __atomic_add_fetch(&thread_pool->aged[aged], 1, __ATOMIC_RELAXED);
+            break;
+        }
+        for (int l = first; l < THREAD_POOL_LANES; l++)
+            if(fifo_pop_index_cond(&thread_pool->lanes[l], (void **)&work, index, FIFO_NO_WAIT, lane, l) == FIFO_SUCCESS)
+                goto found;
+        // Counted but not published yet
+        sched_yield();
+    }
+found:
+    __atomic_add_fetch(&thread_pool->executed[*lane], 1, __ATOMIC_RELAXED);
+    return work;
+}
+
 static void * _slave_func(void *args)
 {
     slave_t *self = args;
     thread_pool_work_t *work;
+    fifo_t *token;
     int ret;
     int index;
+    current_slave = self;
     while(1){
         pthread_mutex_lock(&self->mutex);
         self->state = THREAD_READY;
         pthread_cond_signal(&self->cond);
         pthread_mutex_unlock(&self->mutex);
-        work = NULL;
-        ret = fifo_pop_index_cond(self->queue, (void **)&work, &index, FIFO_WAIT, &self->state, THREAD_BUSY);
+        ret = fifo_pop_index_cond(self->queue, (void **)&token, &index, FIFO_WAIT, &self->state, THREAD_BUSY);
         if(ret != FIFO_SUCCESS){
             fprintf(stderr, "\x1b[31m%s:%s:%d: fifo_pop: error %d\x1b[0m", __FILE__, __func__, __LINE__, ret);
             continue;
         }
+        _account(self, &self->stats.idle_ns);
+        work = _lane_pop(self->pool, &index, &current_lane);
         if(!work){
             fprintf(stderr, "\x1b[31m%s:%s:%d: received NULL work\x1b[0m\n", __FILE__, __func__, __LINE__);
             continue;
@@ -54,6 +144,8 @@ static void * _slave_func(void *args)
             fprintf(stderr, "\x1b[31m%s:%s:%d: fifo_pop: inconsistency (work->flag= %d)\x1b[0m\n", __FILE__, __func__, __LINE__, work->flag);
             continue;
         }
+        __atomic_add_fetch(&self->stats.tasks, 1, __ATOMIC_RELAXED);
+        _account(self, &self->stats.busy_ns);
     }
     self->state = THREAD_STOPPED;
     return NULL;
@@ -64,13 +156,34 @@ int thread_pool_create(thread_pool_t *thread_pool, unsigned int num_slaves, pthr
     int ret;
     if(!thread_pool)return THREAD_POOL_UNALLOCATED;
     thread_pool->queue = malloc(sizeof(fifo_t));
-    ret = fifo_init(thread_pool->queue, 10*num_slaves);
+    thread_pool->lanes = malloc(THREAD_POOL_LANES * sizeof(fifo_t));
+    if(!thread_pool->queue || !thread_pool->lanes){
+        fprintf(stderr, "%s:%s:%d: ", __FILE__, __func__, __LINE__);
+        perror(NULL);
+        goto err_alloc;
+    }
+    int lanes = 0;
+    for (; lanes < THREAD_POOL_LANES; lanes++){
+        ret = fifo_init_mode(&thread_pool->lanes[lanes], 10*num_slaves, FIFO_LOCKFREE);
+        if(ret != FIFO_SUCCESS){
+            fprintf(stderr, "%s:%s:%d: error %d\n", __FILE__, __func__, __LINE__, ret);
+            goto err_lanes;
+        }
+        thread_pool->skips[lanes] = 0;
+        thread_pool->executed[lanes] = thread_pool->aged[lanes] = 0;
+    }
+    // Room for a token per work the lanes can hold
+    ret = fifo_init_mode(thread_pool->queue, THREAD_POOL_LANES * thread_pool->lanes[0].size, FIFO_LOCKFREE);
     if(ret != FIFO_SUCCESS){
         fprintf(stderr, "%s:%s:%d: error %d\n", __FILE__, __func__, __LINE__, ret);
-        goto err_queue_open;
+        goto err_lanes;
     }
+    // Spinning on a single core only delays the thread that would push the work
+    fifo_set_spin(thread_pool->queue, sysconf(_SC_NPROCESSORS_ONLN) > 1 ? THREAD_POOL_SPIN : 0);
     thread_pool->num_slaves = 0;
-    thread_pool->slaves = malloc(num_slaves * sizeof(slave_t));
+    thread_pool->sampler = NULL;
+    thread_pool->stats_start = _nstime();
+    thread_pool->slaves = calloc(num_slaves, sizeof(slave_t));
     if(thread_pool->slaves == NULL){
         fprintf(stderr, "%s:%s:%d: ", __FILE__, __func__, __LINE__);
         perror(NULL);
@@ -78,7 +191,9 @@ int thread_pool_create(thread_pool_t *thread_pool, unsigned int num_slaves, pthr
     }
     for (unsigned int i = 0; i < num_slaves; i++){
         thread_pool->slaves[i].state = THREAD_STARTING;
+        thread_pool->slaves[i].pool = thread_pool;
         thread_pool->slaves[i].queue = thread_pool->queue;
+        thread_pool->slaves[i].since = thread_pool->stats_start;
         pthread_mutex_init(&thread_pool->slaves[i].mutex, NULL);
         pthread_cond_init(&thread_pool->slaves[i].cond, NULL);
         ret = pthread_create(&thread_pool->slaves[i].id, attr, _slave_func, &thread_pool->slaves[i]);
@@ -105,8 +220,13 @@ err_slaves:
     ret = fifo_destroy(thread_pool->queue);
     if(ret != FIFO_SUCCESS)
         fprintf(stderr, "\x1b[31m%s:%s:%d: %d\x1b[0m\n", __FILE__, __func__, __LINE__, ret);
+err_lanes:
+    while(lanes-- > 0)
+        fifo_destroy(&thread_pool->lanes[lanes]);
+err_alloc:
+    free(thread_pool->lanes);
     free(thread_pool->queue);
-err_queue_open:
+    thread_pool->queue = NULL;
     return THREAD_POOL_KO;
 success:
     return THREAD_POOL_OK;
@@ -121,7 +241,7 @@ int thread_pool_queue(thread_pool_t *thread_pool, void (*func)(void *), void *ar
     work->flag = WORK_WORK;
     work->func = func;
     work->args = args;
-    ret = fifo_push(thread_pool->queue, (void *)work, FIFO_WAIT);
+    ret = _lane_push(thread_pool, current_lane, work, 0, FIFO_WAIT);
     if(ret != FIFO_SUCCESS){
         fprintf(stderr, "\x1b[31m%s:%s:%d: %d\x1b[0m\n", __FILE__, __func__, __LINE__, ret);
         return THREAD_POOL_KO;
@@ -130,11 +250,25 @@ int thread_pool_queue(thread_pool_t *thread_pool, void (*func)(void *), void *ar
 }
 
 int thread_pool_queue_work(thread_pool_t *thread_pool, thread_pool_work_t *work, int index)
+{
+    return thread_pool_queue_work_priority(thread_pool, work, index, current_lane);
+}
+
+int thread_pool_set_priority(int lane)
+{
+    if(lane < 0 || lane >= THREAD_POOL_LANES)return -1;
+    int previous = current_lane;
+    current_lane = lane;
+    return previous;
+}
+
+int thread_pool_queue_work_priority(thread_pool_t *thread_pool, thread_pool_work_t *work, int index, int lane)
 {
     int ret;
     if(!thread_pool)return THREAD_POOL_UNALLOCATED;
+    if(!work || lane < 0 || lane >= THREAD_POOL_LANES)return THREAD_POOL_NULLPTR;
     work->flag = WORK_INDEX;
-    ret = fifo_push_index(thread_pool->queue, (void *)work, index, FIFO_WAIT);
+    ret = _lane_push(thread_pool, lane, work, index, FIFO_WAIT);
     if(ret != FIFO_SUCCESS){
         fprintf(stderr, "\x1b[31m%s:%s:%d: %d\x1b[0m\n", __FILE__, __func__, __LINE__, ret);
         return THREAD_POOL_KO;
@@ -158,15 +292,565 @@ int thread_pool_wait(thread_pool_t *thread_pool)
     return THREAD_POOL_OK;
 }
 
+// Range descriptor shared by the caller and the helpers pushed to the queue. It is freed by the last
+// of them to leave, so that a helper popped after the range is complete never reads freed memory.
+typedef struct {
+    thread_pool_work_t work;
+    size_t begin, end, grain;
+    size_t column_begin, column_end, column_grain, columns;            // 2D ranges only, columns = chunks per row
+    size_t chunks;
+    size_t next;                                                        // Next chunk to claim, atomic
+    size_t done;                                                        // Chunks completed, atomic
+    int refs;                                                           // Caller + pushed helpers, atomic
+    thread_pool_t *thread_pool;
+    int lane;
+    void (*func)(void *, size_t, size_t);
+    void (*func_2d)(void *, size_t, size_t, size_t, size_t);
+    void *args;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} range_t;
+
+static void _range_release(range_t *range)
+{
+    if(__atomic_sub_fetch(&range->refs, 1, __ATOMIC_ACQ_REL))return;
+    pthread_cond_destroy(&range->cond);
+    pthread_mutex_destroy(&range->mutex);
+    free(range);
+}
+
+// index is 1 for the caller, 0 for the helpers
+static void _range_run(void *args, int index)
+{
+    range_t *range = args;
+    size_t chunk, completed = 0;
+    while((chunk = __atomic_fetch_add(&range->next, 1, __ATOMIC_RELAXED)) < range->chunks){
+        if(range->func){
+            size_t begin = range->begin + chunk*range->grain;
+            size_t end = range->end - begin < range->grain ? range->end : begin + range->grain;
+            range->func(range->args, begin, end);
+        } else {
+            size_t row = range->begin + chunk / range->columns * range->grain;
+            size_t column = range->column_begin + chunk % range->columns * range->column_grain;
+            size_t row_end = range->end - row < range->grain ? range->end : row + range->grain;
+            size_t column_end = range->column_end - column < range->column_grain ? range->column_end : column + range->column_grain;
+            range->func_2d(range->args, row, row_end, column, column_end);
+        }
+        completed++;
+        // A slave leaves the rest to the others for more urgent work, the caller always finishes
+        if(!index && current_slave && _higher_pending(range->thread_pool, range->lane))break;
+    }
+    if(completed && current_slave)
+        __atomic_add_fetch(&current_slave->stats.steals, completed, __ATOMIC_RELAXED);
+    if(completed && __atomic_add_fetch(&range->done, completed, __ATOMIC_ACQ_REL) == range->chunks){
+        pthread_mutex_lock(&range->mutex);
+        pthread_cond_signal(&range->cond);
+        pthread_mutex_unlock(&range->mutex);
+    }
+    _range_release(range);
+}
+
+static int _range_submit(thread_pool_t *thread_pool, range_t *range)
+{
+    range->work = (thread_pool_work_t){WORK_INDEX, NULL, _range_run, range};
+    range->next = range->done = 0;
+    range->thread_pool = thread_pool;
+    range->lane = current_lane;
+    pthread_mutex_init(&range->mutex, NULL);
+    pthread_cond_init(&range->cond, NULL);
+    // One helper per slave at most, none if the caller can do it alone
+    unsigned int helpers = range->chunks - 1 < thread_pool->num_slaves ? range->chunks - 1 : thread_pool->num_slaves;
+    // The caller holds two references: one released by its own _range_run, one once the range is complete
+    range->refs = 2 + helpers;
+    for (unsigned int i = 0; i < helpers; i++){
+        // A full queue means busy slaves: the caller does their share
+        if(_lane_push(thread_pool, range->lane, &range->work, 0, FIFO_NO_WAIT | FIFO_NO_WAKE) != FIFO_SUCCESS)
+            __atomic_sub_fetch(&range->refs, 1, __ATOMIC_ACQ_REL);
+    }
+    // One broadcast for the whole range rather than one wake-up per helper
+    if(helpers)fifo_wake_all(thread_pool->queue);
+    _range_run(range, 1);
+    pthread_mutex_lock(&range->mutex);
+    while(__atomic_load_n(&range->done, __ATOMIC_ACQUIRE) < range->chunks)
+        pthread_cond_wait(&range->cond, &range->mutex);
+    pthread_mutex_unlock(&range->mutex);
+    _range_release(range);
+    return THREAD_POOL_OK;
+}
+
+static size_t _grain(thread_pool_t *thread_pool, size_t n, size_t grain)
+{
+    // About 4 chunks per participant balances uneven chunks without contending on the counter
+    if(grain)return grain;
+    grain = n / (4 * (thread_pool->num_slaves + 1));
+    return grain ? grain : 1;
+}
+
+int thread_pool_parallel_for(thread_pool_t *thread_pool, size_t begin, size_t end, size_t grain,
+                             void (*func)(void *args, size_t begin, size_t end), void *args)
+{
+    if(!thread_pool)return THREAD_POOL_UNALLOCATED;
+    if(!func)return THREAD_POOL_NULLPTR;
+    if(end <= begin)return THREAD_POOL_OK;
+    range_t *range = calloc(1, sizeof(range_t));
+    if(!range){
+        fprintf(stderr, "%s:%s:%d: ", __FILE__, __func__, __LINE__);
+        perror(NULL);
+        return THREAD_POOL_KO;
+    }
+    range->begin = begin;
+    range->end = end;
+    range->grain = _grain(thread_pool, end - begin, grain);
+    range->chunks = (end - begin + range->grain - 1) / range->grain;
+    range->func = func;
+    range->args = args;
+    return _range_submit(thread_pool, range);
+}
+
+int thread_pool_parallel_for_2d(thread_pool_t *thread_pool, size_t row_begin, size_t row_end, size_t row_grain,
+                                size_t column_begin, size_t column_end, size_t column_grain,
+                                void (*func)(void *args, size_t row_begin, size_t row_end, size_t column_begin, size_t column_end), void *args)
+{
+    if(!thread_pool)return THREAD_POOL_UNALLOCATED;
+    if(!func)return THREAD_POOL_NULLPTR;
+    if(row_end <= row_begin || column_end <= column_begin)return THREAD_POOL_OK;
+    range_t *range = calloc(1, sizeof(range_t));
+    if(!range){
+        fprintf(stderr, "%s:%s:%d: ", __FILE__, __func__, __LINE__);
+        perror(NULL);
+        return THREAD_POOL_KO;
+    }
+    range->begin = row_begin;
+    range->end = row_end;
+    range->grain = _grain(thread_pool, row_end - row_begin, row_grain);
+    range->column_begin = column_begin;
+    range->column_end = column_end;
+    range->column_grain = column_grain ? column_grain : column_end - column_begin;
+    range->columns = (column_end - column_begin + range->column_grain - 1) / range->column_grain;
+    range->chunks = (row_end - row_begin + range->grain - 1) / range->grain * range->columns;
+    range->func_2d = func;
+    range->args = args;
+    return _range_submit(thread_pool, range);
+}
+
+typedef struct {
+    void (*func)(void *, int);
+    void *args;
+    int index;
+    int nb_deps;
+    int pending;                                                        // Dependencies not done yet during a run, under the run mutex
+    int *successors;
+    size_t nb_successors, size_successors;
+} graph_task_t;
+
+struct thread_pool_graph {
+    graph_task_t *tasks;
+    size_t nb_tasks, size_tasks;
+};
+
+// State of one run, shared like a range descriptor: helpers popped after the end only read the empty
+// ready stack before releasing it.
+typedef struct {
+    thread_pool_work_t work;
+    thread_pool_t *thread_pool;
+    graph_task_t *tasks;
+    size_t nb_tasks;
+    int *ready;                                                         // Stack of the tasks whose dependencies are done
+    size_t nb_ready;
+    size_t done;
+    int refs;                                                           // Caller + helpers in the queue or running, atomic
+    int lane;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} graph_run_t;
+
+thread_pool_graph_t * thread_pool_graph_create(void)
+{
+    thread_pool_graph_t *graph = calloc(1, sizeof(thread_pool_graph_t));
+    if(!graph){
+        fprintf(stderr, "%s:%s:%d: ", __FILE__, __func__, __LINE__);
+        perror(NULL);
+    }
+    return graph;
+}
+
+int thread_pool_graph_add(thread_pool_graph_t *graph, void (*func)(void *args, int index), void *args, int index,
+                          size_t nb_deps, const int *deps)
+{
+    if(!graph || !func || (nb_deps && !deps))return -1;
+    for (size_t i = 0; i < nb_deps; i++){
+        if(deps[i] < 0 || (size_t)deps[i] >= graph->nb_tasks){
+            fprintf(stderr, "\x1b[31m%s:%s:%d: unknown dependency %d\x1b[0m\n", __FILE__, __func__, __LINE__, deps[i]);
+            return -1;
+        }
+    }
+    if(graph->nb_tasks == graph->size_tasks){
+        size_t size = graph->size_tasks ? 2*graph->size_tasks : 64;
+        graph_task_t *tasks = realloc(graph->tasks, size*sizeof(graph_task_t));
+        if(!tasks)goto err_alloc;
+        graph->tasks = tasks;
+        graph->size_tasks = size;
+    }
+    int id = graph->nb_tasks;
+    for (size_t i = 0; i < nb_deps; i++){
+        graph_task_t *dep = &graph->tasks[deps[i]];
+        if(dep->nb_successors == dep->size_successors){
+            size_t size = dep->size_successors ? 2*dep->size_successors : 4;
+            int *successors = realloc(dep->successors, size*sizeof(int));
+            if(!successors){
+                // Undo the edges already added
+                while(i-- > 0)graph->tasks[deps[i]].nb_successors--;
+                goto err_alloc;
+            }
+            dep->successors = successors;
+            dep->size_successors = size;
+        }
+        dep->successors[dep->nb_successors++] = id;
+    }
+    graph->tasks[id] = (graph_task_t){func, args, index, nb_deps, 0, NULL, 0, 0};
+    graph->nb_tasks++;
+    return id;
+err_alloc:
+    fprintf(stderr, "%s:%s:%d: ", __FILE__, __func__, __LINE__);
+    perror(NULL);
+    return -1;
+}
+
+void thread_pool_graph_destroy(thread_pool_graph_t *graph)
+{
+    if(!graph)return;
+    for (size_t i = 0; i < graph->nb_tasks; i++)
+        free(graph->tasks[i].successors);
+    free(graph->tasks);
+    free(graph);
+}
+
+static void _graph_release(graph_run_t *run)
+{
+    if(__atomic_sub_fetch(&run->refs, 1, __ATOMIC_ACQ_REL))return;
+    pthread_cond_destroy(&run->cond);
+    pthread_mutex_destroy(&run->mutex);
+    free(run->ready);
+    free(run);
+}
+
+static void _graph_worker(void *args, int index);
+
+// Queue helpers for the tasks made ready beyond the one the current thread goes on with,
+// no more than one per slave
+static void _graph_help(graph_run_t *run, size_t count)
+{
+    size_t pushed = 0;
+    for (size_t i = 0; i < count; i++){
+        if((unsigned int)__atomic_load_n(&run->refs, __ATOMIC_RELAXED) > run->thread_pool->num_slaves)break;
+        __atomic_add_fetch(&run->refs, 1, __ATOMIC_ACQ_REL);
+        if(_lane_push(run->thread_pool, run->lane, &run->work, 0, FIFO_NO_WAIT | FIFO_NO_WAKE) != FIFO_SUCCESS){
+            __atomic_sub_fetch(&run->refs, 1, __ATOMIC_ACQ_REL);
+            break;
+        }
+        pushed++;
+    }
+    if(pushed)fifo_wake_all(run->thread_pool->queue);
+}
+
+// Run the ready tasks until there is none left, or until a higher lane has work for a helper,
+// return 1 if the whole graph is done
+static int _graph_drain(graph_run_t *run, int helper)
+{
+    pthread_mutex_lock(&run->mutex);
+    while(run->nb_ready){
+        graph_task_t *task = &run->tasks[run->ready[--run->nb_ready]];
+        pthread_mutex_unlock(&run->mutex);
+        task->func(task->args, task->index);
+        if(current_slave)
+            __atomic_add_fetch(&current_slave->stats.steals, 1, __ATOMIC_RELAXED);
+        size_t released = 0;
+        pthread_mutex_lock(&run->mutex);
+        for (size_t i = 0; i < task->nb_successors; i++){
+            int successor = task->successors[i];
+            if(!--run->tasks[successor].pending){
+                run->ready[run->nb_ready++] = successor;
+                released++;
+            }
+        }
+        // The caller sleeps when nothing is ready: tell it about new work and about the end
+        if(++run->done == run->nb_tasks || released)
+            pthread_cond_signal(&run->cond);
+        if(released > 1){
+            pthread_mutex_unlock(&run->mutex);
+            _graph_help(run, released - 1);
+            pthread_mutex_lock(&run->mutex);
+        }
+        // Tasks left ready were signaled, the caller takes them
+        if(helper && current_slave && _higher_pending(run->thread_pool, run->lane))break;
+    }
+    int finished = run->done == run->nb_tasks;
+    pthread_mutex_unlock(&run->mutex);
+    return finished;
+}
+
+static void _graph_worker(void *args, int index)
+{
+    (void)index;
+    graph_run_t *run = args;
+    _graph_drain(run, 1);
+    _graph_release(run);
+}
+
+int thread_pool_graph_run(thread_pool_t *thread_pool, thread_pool_graph_t *graph)
+{
+    if(!thread_pool)return THREAD_POOL_UNALLOCATED;
+    if(!graph)return THREAD_POOL_NULLPTR;
+    if(!graph->nb_tasks)return THREAD_POOL_OK;
+    graph_run_t *run = calloc(1, sizeof(graph_run_t));
+    int *ready = malloc(graph->nb_tasks*sizeof(int));
+    if(!run || !ready){
+        fprintf(stderr, "%s:%s:%d: ", __FILE__, __func__, __LINE__);
+        perror(NULL);
+        free(run);
+        free(ready);
+        return THREAD_POOL_KO;
+    }
+    run->work = (thread_pool_work_t){WORK_INDEX, NULL, _graph_worker, run};
+    run->thread_pool = thread_pool;
+    run->tasks = graph->tasks;
+    run->nb_tasks = graph->nb_tasks;
+    run->ready = ready;
+    run->refs = 1;
+    run->lane = current_lane;
+    pthread_mutex_init(&run->mutex, NULL);
+    pthread_cond_init(&run->cond, NULL);
+    // Sources pushed in reverse so that the stack starts with the first added task
+    for (size_t i = graph->nb_tasks; i-- > 0;){
+        graph->tasks[i].pending = graph->tasks[i].nb_deps;
+        if(!graph->tasks[i].nb_deps)
+            run->ready[run->nb_ready++] = i;
+    }
+    if(run->nb_ready > 1)_graph_help(run, run->nb_ready - 1);
+    while(!_graph_drain(run, 0)){
+        pthread_mutex_lock(&run->mutex);
+        while(!run->nb_ready && run->done < run->nb_tasks)
+            pthread_cond_wait(&run->cond, &run->mutex);
+        pthread_mutex_unlock(&run->mutex);
+    }
+    _graph_release(run);
+    return THREAD_POOL_OK;
+}
+
+int thread_pool_set_spin(thread_pool_t *thread_pool, unsigned int spin)
+{
+    if(!thread_pool)return THREAD_POOL_UNALLOCATED;
+    if(!thread_pool->queue)return THREAD_POOL_NULLPTR;
+    return fifo_set_spin(thread_pool->queue, spin) == FIFO_SUCCESS ? THREAD_POOL_OK : THREAD_POOL_KO;
+}
+
+int thread_pool_stats(thread_pool_t *thread_pool, thread_pool_stats_t *stats, thread_pool_slave_stats_t *slaves, unsigned int nb_slaves)
+{
+    if(!thread_pool)return THREAD_POOL_UNALLOCATED;
+    if(!thread_pool->queue || !stats)return THREAD_POOL_NULLPTR;
+    fifo_stats_t queue;
+    if(fifo_stats(thread_pool->queue, &queue, 0) != FIFO_SUCCESS)return THREAD_POOL_KO;
+    long long now = _nstime();
+    *stats = (thread_pool_stats_t){
+        .num_slaves = thread_pool->num_slaves,
+        .elapsed_ns = now - __atomic_load_n(&thread_pool->stats_start, __ATOMIC_RELAXED),
+        .queue_capacity = thread_pool->queue->size,
+        .queue_high_water = queue.high_water,
+        .parks = queue.parks,
+        .wakes = queue.wakes,
+    };
+    // Producers block on the lanes, the tokens always have room
+    for (int l = 0; l < THREAD_POOL_LANES; l++){
+        fifo_stats_t lane;
+        fifo_stats(&thread_pool->lanes[l], &lane, 0);
+        stats->lanes[l] = (thread_pool_lane_stats_t){_lane_size(thread_pool, l), lane.high_water,
+                                                     __atomic_load_n(&thread_pool->executed[l], __ATOMIC_RELAXED),
+                                                     __atomic_load_n(&thread_pool->aged[l], __ATOMIC_RELAXED), lane.blocked_ns};
+        stats->enqueue_blocked_ns += lane.blocked_ns;
+    }
+    fifo_current_size(thread_pool->queue, &stats->queue_size);
+    for (unsigned int i = 0; slaves && i < nb_slaves && i < thread_pool->num_slaves; i++){
+        slave_t *slave = &thread_pool->slaves[i];
+        thread_pool_slave_stats_t *s = &slaves[i];
+        s->tasks = __atomic_load_n(&slave->stats.tasks, __ATOMIC_RELAXED);
+        s->steals = __atomic_load_n(&slave->stats.steals, __ATOMIC_RELAXED);
+        s->busy_ns = __atomic_load_n(&slave->stats.busy_ns, __ATOMIC_RELAXED);
+        s->idle_ns = __atomic_load_n(&slave->stats.idle_ns, __ATOMIC_RELAXED);
+        // The period in progress, busy once the slave has taken a work
+        long long since = __atomic_load_n(&slave->since, __ATOMIC_RELAXED);
+        if(now > since){
+            if(__atomic_load_n(&slave->state, __ATOMIC_RELAXED) == THREAD_BUSY)
+                s->busy_ns += now - since;
+            else
+                s->idle_ns += now - since;
+        }
+    }
+    return THREAD_POOL_OK;
+}
+
+int thread_pool_stats_reset(thread_pool_t *thread_pool)
+{
+    if(!thread_pool)return THREAD_POOL_UNALLOCATED;
+    if(!thread_pool->queue)return THREAD_POOL_NULLPTR;
+    fifo_stats_t queue;
+    fifo_stats(thread_pool->queue, &queue, 1);
+    for (int l = 0; l < THREAD_POOL_LANES; l++){
+        fifo_stats(&thread_pool->lanes[l], &queue, 1);
+        __atomic_store_n(&thread_pool->executed[l], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&thread_pool->aged[l], 0, __ATOMIC_RELAXED);
+    }
+    long long now = _nstime();
+    __atomic_store_n(&thread_pool->stats_start, now, __ATOMIC_RELAXED);
+    for (unsigned int i = 0; i < thread_pool->num_slaves; i++){
+        slave_t *slave = &thread_pool->slaves[i];
+        __atomic_store_n(&slave->stats.tasks, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slave->stats.steals, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slave->stats.busy_ns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slave->stats.idle_ns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slave->since, now, __ATOMIC_RELAXED);
+    }
+    return THREAD_POOL_OK;
+}
+
+void thread_pool_stats_print(FILE *stream, const thread_pool_stats_t *stats, const thread_pool_slave_stats_t *slaves)
+{
+    unsigned long long tasks = 0, steals = 0;
+    double total = 0, low = 1, high = 0;
+    for (unsigned int i = 0; slaves && i < stats->num_slaves; i++){
+        unsigned long long time = slaves[i].busy_ns + slaves[i].idle_ns;
+        double busy = time ? (double)slaves[i].busy_ns / time : 0;
+        tasks += slaves[i].tasks;
+        steals += slaves[i].steals;
+        total += busy;
+        low = busy < low ? busy : low;
+        high = busy > high ? busy : high;
+    }
+    if(!slaves || !stats->num_slaves)low = 0;
+    fprintf(stream, "thread_pool: %.3fs, %llu tasks, %llu steals, busy %.0f%% (min %.0f%%, max %.0f%%), "
+            "queue %d/%d (max %u, blocked %.3fms), %llu parks, %llu wakes, lanes %llu/%llu/%llu works (%llu/%llu aged)\n",
+            stats->elapsed_ns / 1e9, tasks, steals, stats->num_slaves ? 100 * total / stats->num_slaves : 0, 100 * low, 100 * high,
+            stats->queue_size, stats->queue_capacity, stats->queue_high_water, stats->enqueue_blocked_ns / 1e6,
+            stats->parks, stats->wakes, stats->lanes[THREAD_POOL_HIGH].executed, stats->lanes[THREAD_POOL_NORMAL].executed,
+            stats->lanes[THREAD_POOL_LOW].executed, stats->lanes[THREAD_POOL_NORMAL].aged, stats->lanes[THREAD_POOL_LOW].aged);
+}
+
+static void * _sampler_func(void *args)
+{
+    struct thread_pool_sampler *sampler = args;
+    thread_pool_t *thread_pool = sampler->thread_pool;
+    unsigned int n = thread_pool->num_slaves;
+    thread_pool_slave_stats_t *previous = calloc(n ? 2*n : 1, sizeof(thread_pool_slave_stats_t)), *current = previous + n;
+    thread_pool_stats_t before, now;
+    if(!previous){
+        fprintf(stderr, "%s:%s:%d: ", __FILE__, __func__, __LINE__);
+        perror(NULL);
+        return NULL;
+    }
+    thread_pool_stats(thread_pool, &before, previous, n);
+    pthread_mutex_lock(&sampler->mutex);
+    while(!sampler->stop){
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += sampler->period_ms / 1000;
+        deadline.tv_nsec += (sampler->period_ms % 1000) * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while(!sampler->stop && pthread_cond_timedwait(&sampler->cond, &sampler->mutex, &deadline) == 0);
+        if(sampler->stop)break;
+        pthread_mutex_unlock(&sampler->mutex);
+        thread_pool_stats(thread_pool, &now, current, n);
+        // Counters of the period: a reset in between only makes it look shorter
+        thread_pool_stats_t period = now;
+        #define DELTA(a, b) ((a) > (b) ? (a) - (b) : (a))
+        if(now.elapsed_ns > before.elapsed_ns){
+            period.elapsed_ns -= before.elapsed_ns;
+            period.parks = DELTA(now.parks, before.parks);
+            period.wakes = DELTA(now.wakes, before.wakes);
+            period.enqueue_blocked_ns = DELTA(now.enqueue_blocked_ns, before.enqueue_blocked_ns);
+            for (int l = 0; l < THREAD_POOL_LANES; l++){
+                period.lanes[l].executed = DELTA(now.lanes[l].executed, before.lanes[l].executed);
+                period.lanes[l].aged = DELTA(now.lanes[l].aged, before.lanes[l].aged);
+                period.lanes[l].enqueue_blocked_ns = DELTA(now.lanes[l].enqueue_blocked_ns, before.lanes[l].enqueue_blocked_ns);
+            }
+        }
+        before = now;
+        for (unsigned int i = 0; i < n; i++){
+            thread_pool_slave_stats_t delta = {
+                DELTA(current[i].tasks, previous[i].tasks), DELTA(current[i].steals, previous[i].steals),
+                DELTA(current[i].busy_ns, previous[i].busy_ns), DELTA(current[i].idle_ns, previous[i].idle_ns)
+            };
+            previous[i] = current[i];
+            current[i] = delta;
+        }
+        #undef DELTA
+        if(sampler->func)
+            sampler->func(&period, current, sampler->args);
+        else
+            thread_pool_stats_print(stderr, &period, current);
+        pthread_mutex_lock(&sampler->mutex);
+    }
+    pthread_mutex_unlock(&sampler->mutex);
+    free(previous);
+    return NULL;
+}
+
+int thread_pool_sample_start(thread_pool_t *thread_pool, unsigned int period_ms, thread_pool_sample_func_t func, void *args)
+{
+    if(!thread_pool)return THREAD_POOL_UNALLOCATED;
+    if(!thread_pool->queue || !period_ms)return THREAD_POOL_NULLPTR;
+    if(thread_pool->sampler)thread_pool_sample_stop(thread_pool);
+    struct thread_pool_sampler *sampler = malloc(sizeof(*sampler));
+    if(!sampler){
+        fprintf(stderr, "%s:%s:%d: ", __FILE__, __func__, __LINE__);
+        perror(NULL);
+        return THREAD_POOL_KO;
+    }
+    *sampler = (struct thread_pool_sampler){.thread_pool = thread_pool, .period_ms = period_ms, .func = func, .args = args};
+    pthread_mutex_init(&sampler->mutex, NULL);
+    pthread_cond_init(&sampler->cond, NULL);
+    int ret = pthread_create(&sampler->id, NULL, _sampler_func, sampler);
+    if(ret != 0){
+        fprintf(stderr, "%s:%s:%d: error %d\n", __FILE__, __func__, __LINE__, ret);
+        pthread_cond_destroy(&sampler->cond);
+        pthread_mutex_destroy(&sampler->mutex);
+        free(sampler);
+        return THREAD_POOL_KO;
+    }
+    thread_pool->sampler = sampler;
+    return THREAD_POOL_OK;
+}
+
+int thread_pool_sample_stop(thread_pool_t *thread_pool)
+{
+    if(!thread_pool)return THREAD_POOL_UNALLOCATED;
+    struct thread_pool_sampler *sampler = thread_pool->sampler;
+    if(!sampler)return THREAD_POOL_OK;
+    pthread_mutex_lock(&sampler->mutex);
+    sampler->stop = 1;
+    pthread_cond_signal(&sampler->cond);
+    pthread_mutex_unlock(&sampler->mutex);
+    pthread_join(sampler->id, NULL);
+    pthread_cond_destroy(&sampler->cond);
+    pthread_mutex_destroy(&sampler->mutex);
+    free(sampler);
+    thread_pool->sampler = NULL;
+    return THREAD_POOL_OK;
+}
+
 int thread_pool_destroy(thread_pool_t *thread_pool)
 {
     int ret;
     thread_pool_work_t *work;
     int current_size = 0;
+    thread_pool_sample_stop(thread_pool);
+    // Aging could serve the stops before the works queued in higher lanes
+    if(thread_pool->num_slaves)thread_pool_wait(thread_pool);
     for (unsigned int i = 0; i<thread_pool->num_slaves; i++){
         work = malloc(sizeof(thread_pool_work_t));
         work->flag = WORK_STOP;
-        ret = fifo_push(thread_pool->queue, (void *)work, FIFO_WAIT);
+        ret = _lane_push(thread_pool, THREAD_POOL_LOW, work, 0, FIFO_WAIT);
         if(ret != FIFO_SUCCESS){
             fprintf(stderr, "\x1b[31m%s:%s:%d: %d\x1b[0m\n", __FILE__, __func__, __LINE__, ret);
             return THREAD_POOL_KO;
@@ -189,13 +873,21 @@ int thread_pool_destroy(thread_pool_t *thread_pool)
     }
     if(current_size > 0)
         fprintf(stderr, "WARNING: Some work will be deleted\n");
-    while (fifo_pop(thread_pool->queue, (void **)&work, FIFO_NO_WAIT) != FIFO_EMPTY)
-        free(work);
+    fifo_t *token;
+    while (fifo_pop(thread_pool->queue, (void **)&token, FIFO_NO_WAIT) != FIFO_EMPTY);
+    for (int l = 0; l < THREAD_POOL_LANES; l++){
+        // Indexed works belong to their submitter
+        while (fifo_pop(&thread_pool->lanes[l], (void **)&work, FIFO_NO_WAIT) != FIFO_EMPTY)
+            if(work->flag != WORK_INDEX)free(work);
+        fifo_destroy(&thread_pool->lanes[l]);
+    }
     if(fifo_destroy(thread_pool->queue) != FIFO_SUCCESS){
         fprintf(stderr, "%s:%s:%d: ", __FILE__, __func__, __LINE__);
         return THREAD_POOL_KO;
     }
     free(thread_pool->slaves);
+    free(thread_pool->lanes);
     free(thread_pool->queue);
+    thread_pool->queue = NULL;
     return THREAD_POOL_OK;
 }